@@ -25,14 +25,75 @@
 #endif
 
 #include "plc_i2c.h"
+#include "plc_profile.h"
+#include "plc_dispatch.h"
+#include "plc_schema.h"
+#include "plc_sniffer.h"
+#include "plc_bridge.h"
+#include "plc_link.h"
+#include "plc_dedup.h"
+#include "plc_tdma.h"
+#include "pin_io.h"
+#include "heartbeat.h"
+#include "task_scheduler.h"
+#include "plc_aggregate.h"
+
+#define REPORT_SAMPLE_CYCLES 0  /* When 1, print the measured cycles per input sample on Serial at boot */
+#define INPUT_PIN_CHANGE PIN_IO_PORT_MAP  /* When 1, the transmitter samples on pin-change interrupts and sleeps in between instead of polling every 1ms */
+#define PROFILE_SERIAL_CONFIG 0  /* When 1, a digit 0-3 received on Serial stores that modem profile in EEPROM and applies it */
+#define REPORT_BOOT_TIME 0  /* When 1, print the time from power up to the first frame sent or received on Serial */
+#define DEDUP_SEQUENCE 0  /* When 1, CMD_SENDMSG carries a sequence tag and the receiver drops the repeats a lost ACK causes, see plc_dedup.h. Both ends must agree: the tag is a payload byte */
+#define LINK_SERIAL_REPORT 0  /* When 1, an 'l' received on Serial prints the link quality table */
+#define TASK_SERIAL_REPORT 0  /* When 1, a 't' received on Serial prints the runtime and overruns of each task */
+#define SAMPLE_PERIOD_MS 1  /* Input sampling period when not sampling on pin-change interrupts */
+#define SERIAL_PERIOD_MS 50  /* Period of the Serial command checks */
+#define SNIFFER_MODE 0  /* When 1, capture every frame on the line and stream it on Serial, see plc_sniffer.h */
+#define SNIFFER_BAUD 115200
+#define BRIDGE_MODE 0  /* When 1, act as a PLC network interface for a PC on Serial, see plc_bridge.h */
+#define BRIDGE_BAUD 115200
+#define TDMA_MODE 0  /* When 1, the receiver sends beacons and the transmitter only sends in its time slot, see plc_tdma.h */
+#define TDMA_SLOT_MS 250
+#define TDMA_GUARD_MS 10
+#define TDMA_FRAME_MS 100  /* One CMD_SENDMSG with its ACK at the default profile's 2400 bps */
+#define AGGREGATE_MS 0  /* When not 0, every input change is sent as a message of its own, several to a CMD_AGGREGATE frame, after waiting up to this long for others, see plc_aggregate.h. Not with TDMA_MODE. */
 
 PLC_I2C plc;
+#if SNIFFER_MODE
+PLC_Sniffer sniffer;
+#endif
+#if BRIDGE_MODE
+PLC_Bridge bridge;
+#endif
+#if !BRIDGE_MODE && !SNIFFER_MODE
+PLC_Dispatcher dispatcher;
+PLC_DedupCache dedup;
+PLC_LinkTable links;             /* Retry count and service type per destination, see plc_link.h */
+#if TDMA_MODE
+PLC_Tdma tdma;
+bool txPending = false;          /* data holds a frame waiting for the transmitter's slot */
+#endif
+#if AGGREGATE_MS
+PLC_AggregateSender aggregator;
+PLC_AggregateReceiver unpacker;
+byte frame[MAX_PLC_PACKET_LENGTH];
+byte frameAddress;
+byte frameCommand;
+byte frameLength;
+#endif
+Heartbeat heartbeat;
+TaskScheduler tasks;             /* The loop's work as cooperative tasks, see task_scheduler.h */
+Task *sendTask;
+Task *outputTask;
+#endif
 byte destinationAddress;
 byte localAddress;
 byte data[32];
 
-uint32_t* dataVal = (uint32_t*) data;
-uint32_t oldData = 0, timeoutCount = 0;
+uint32_t pinState = 0;           /* Bitmap of the bridged pins, one bit each in PIN_MAP order */
+uint32_t oldData = 0;
+unsigned long edgeTime = 0;      /* micros() of the input edge behind the current sample */
+unsigned long edgeLatency = 0;   /* Input edge to frame submit of the last state change, in us */
+unsigned long edgeLatencyMax = 0;
 
 bool transmitter = true;
 bool receiver = !transmitter;
@@ -46,19 +107,32 @@ int wSuccessCount = 0;   /* Number of packets successfully acknowledged by the r
 int bPLC_Success = 0;
 int i=0; //itterator
 
-uint8_t pinArray[] = {
-        // 1 VDD
-        // 2 RX (0)
-        // 3 TX (1)
-     9, // 4 - PWM
-    10, // 5 - PWM
+#define PIN_MAP \
+        /* 1 VDD    */ \
+        /* 2 RX (0) */ \
+        /* 3 TX (1) */ \
+     9, /* 4 - PWM  */ \
+    10, /* 5 - PWM  */ \
+        /* 6 GND    */ \
+    14, /* 7 - A0   */ \
+    15, /* 8 - A1   */ \
+    16, /* 9 - A2   */ \
+     8  /* 10       */
 
-        // 6 GND
-    14, // 7 - A0
-    15, // 8 - A1
-    16, // 9 - A2
-     8, // 10
-};
+typedef PinSampler<PIN_MAP> InputPins;
+typedef PinWriter<PIN_MAP> OutputPins;
+
+/* Payload of CMD_SENDMSG: the pin bitmap, bit 0 first. It is one byte for up to 8 pins, laid out like
+ * the first byte of the little-endian uint32_t this sketch used to send. With DEDUP_SEQUENCE a sequence
+ * tag byte comes first. */
+#if DEDUP_SEQUENCE
+typedef PLC_Schema<PLC_DEDUP_TAG_BITS, InputPins::bCount> PinMessage;
+#define PIN_FIELD 1
+byte txSequence = PLC_DEDUP_TAG_RESET;
+#else
+typedef PLC_Schema<InputPins::bCount> PinMessage;
+#define PIN_FIELD 0
+#endif
 
 void setup()
 {
@@ -68,7 +142,24 @@ void setup()
 
 
 //  Serial.println("Init Start");
-  plc.init(transmitter);
+  // Run with the profile stored in EEPROM, or the default one on a blank EEPROM
+  PLC_Profile profile;
+  PLC_GetProfile(PLC_PROFILE_DEFAULT, &profile);
+  PLC_LoadProfile(PLC_PROFILE_EEPROM_ADDRESS, &profile);
+#if SNIFFER_MODE
+  // The sniffer only listens; none of the bridge setup below applies
+  plc.init(false, &profile);
+  sniffer.begin(&plc);
+  Serial.begin(SNIFFER_BAUD);
+#elif BRIDGE_MODE
+  // The PC addresses every frame itself; only the local address is set here
+  plc.init(true, &profile);
+  localAddress = 0x01;
+  plc.WriteToOffset(Local_LA_LSB, &localAddress, 1);
+  Serial.begin(BRIDGE_BAUD);
+  bridge.begin(&plc);
+#else
+  plc.init(transmitter, &profile);
 //  Serial.println("Init End");
   
   if (transmitter) {
@@ -88,92 +179,395 @@ void setup()
 
   plc.WriteToOffset(Local_LA_LSB, &localAddress, 1);
   plc.SetDestinationAddress (TX_DA_Type_Log, &destinationAddress);
+  links.begin(&plc);
+#if TDMA_MODE
+  // One slot, the transmitter's; the receiver sends the beacons and owns none
+  PLC_TdmaConfig tdmaConfig = { TDMA_SLOT_MS, 1, TDMA_GUARD_MS, TDMA_FRAME_MS, PLC_TDMA_GROUP, transmitter ? 0x01UL : 0 };
+  tdma.begin(&plc, &tdmaConfig, receiver, tdmaSource, tdmaDone);
+#endif
+
+  heartbeat.begin(HEARTBEAT_PERIOD_MS, HEARTBEAT_JITTER_MS, localAddress);
+  tasks.begin();
 
   if(receiver) {
-    for(i=0; i<sizeof(pinArray);i++){
-      pinMode( pinArray[i], OUTPUT);
-    }
+    OutputPins::begin();
+    dispatcher.begin();
+    dispatcher.Register(CMD_SENDMSG, onSendMsg, NULL, DEDUP_SEQUENCE);
+#if DEDUP_SEQUENCE
+    dedup.begin();
+    dispatcher.SetDedup(&dedup);
+#endif
+#if AGGREGATE_MS
+    unpacker.begin();
+    unpacker.Attach(&dispatcher);
+#endif
+    tasks.Add(receiveFrames, NULL, TASK_EVERY_PASS);
+    outputTask = tasks.Add(writeOutputs, NULL, TASK_EVENT);
   }
   else if (transmitter) {
-    for(i=0; i<sizeof(pinArray);i++){
-      pinMode( pinArray[i], INPUT_PULLUP);
-    }
+    InputPins::begin(INPUT_PULLUP);
+#if INPUT_PIN_CHANGE
+    PinChange::begin(InputPins::bMaskB, InputPins::bMaskC, InputPins::bMaskD);
+#endif
+    pinState = InputPins::Sample();
+    edgeTime = micros();
+    heartbeat.AddPeer(destinationAddress);
+#if AGGREGATE_MS
+    aggregator.begin(AGGREGATE_MS);
+#endif
+#if INPUT_PIN_CHANGE
+    tasks.Add(sampleInputs, NULL, TASK_EVERY_PASS);
+#else
+    tasks.Add(sampleInputs, NULL, SAMPLE_PERIOD_MS);
+#endif
+#if TDMA_MODE
+    dispatcher.begin();
+    tdma.Attach(&dispatcher);
+    tasks.Add(serviceSlots, NULL, TASK_EVERY_PASS);
+#else
+    sendTask = tasks.Add(sendState, NULL, TASK_EVENT);
+#endif
   }
+#if PROFILE_SERIAL_CONFIG || LINK_SERIAL_REPORT || TASK_SERIAL_REPORT
+  tasks.Add(serialCommands, NULL, SERIAL_PERIOD_MS);
+#endif
+
+#if REPORT_SAMPLE_CYCLES || PROFILE_SERIAL_CONFIG || REPORT_BOOT_TIME || LINK_SERIAL_REPORT || TASK_SERIAL_REPORT
+  Serial.begin(9600);
+#endif
+#if REPORT_SAMPLE_CYCLES
+  Serial.print("Sample cycles:");
+  Serial.println(InputPins::MeasureCycles(4096));
+#endif
+#endif
 }
 
 void loop()
 {
-  if (transmitter) {
-    (*dataVal) = 0;
-    for(i=0; i<sizeof(pinArray);i++){
-      (*dataVal) |= digitalRead( pinArray[i] ) << i;
-    }
+#if SNIFFER_MODE
+  sniff();
+#elif BRIDGE_MODE
+  bridgeSerial();
+#else
+  tasks.Service();
+#if INPUT_PIN_CHANGE
+  // Nothing is due before the next interrupt: sleep until it
+  if (transmitter && tasks.Idle() != 0) {
+    PinChange::Idle();
+  }
+#endif
+#endif
+}
 
-    if (oldData != (*dataVal) || timeoutCount > 0xFFF)
-    {
-      oldData = (*dataVal);
-      transmit(data, 2);
-//      Serial.print("Tx:");
-//      Serial.println(data[0]);
-      timeoutCount = 0;
-    }
-    delay(1);
-    timeoutCount ++;
+#if !BRIDGE_MODE && !SNIFFER_MODE
+char sampleInputs(Task *task, void *context) {
+  byte heartbeatPeer;
+
+  TASK_BEGIN(task);
+#if INPUT_PIN_CHANGE
+  if (PinChange::Poll(&edgeTime))
+  {
+    pinState = InputPins::Sample();
   }
-  else if (receiver) {
-    receive();
-    if(oldData != (*dataVal))
+#else
+  pinState = InputPins::Sample();
+  edgeTime = micros();
+#endif
+
+  if (oldData != pinState || heartbeat.Due(&heartbeatPeer))
+  {
+    if (oldData != pinState)
     {
-      oldData = (*dataVal);
-//      Serial.print("Rx:");
-//      Serial.println(*dataVal);
-      for(i=0; i<sizeof(pinArray);i++){
-        if ( (*dataVal) & (0x01<< i) )
-        {
-          digitalWrite( pinArray[i], true );
-        }
-        else
-        {
-          digitalWrite( pinArray[i], false );
-        }
+      edgeLatency = micros() - edgeTime;
+      if (edgeLatency > edgeLatencyMax)
+      {
+        edgeLatencyMax = edgeLatency;
       }
     }
+    oldData = pinState;
+#if DEDUP_SEQUENCE
+    PinMessage::Set<0>(data, txSequence);
+    txSequence = PLC_DedupCache::NextTag(txSequence);
+#endif
+    PinMessage::Set<PIN_FIELD>(data, pinState);
+#if TDMA_MODE
+    txPending = true;
+#elif AGGREGATE_MS
+    aggregator.Queue(destinationAddress, CMD_SENDMSG, data, PinMessage::bLength);
+#else
+    tasks.Signal(sendTask);
+#endif
+//    Serial.print("Tx:");
+//    Serial.println(data[0]);
+  }
+#if AGGREGATE_MS && !TDMA_MODE
+  if (aggregator.Ready())
+  {
+    tasks.Signal(sendTask);
+  }
+#endif
+  TASK_END(task);
+}
+
+char sendState(Task *task, void *context) {
+  TASK_BEGIN(task);
+#if AGGREGATE_MS
+  // Transmit the changes queued for the destination, which TX_DA already holds, in one frame. Sampling goes
+  // on while it is on the line, queueing the changes for the next.
+  frameLength = aggregator.Next(&frameAddress, &frameCommand, frame);
+  if (frameLength == PLC_NO_FRAME)
+  {
+    TASK_EXIT(task);
+  }
+  links.Prepare(frameAddress);
+  bPLC_Success = plc.StartTransmit(frameCommand, frame, frameLength);
+#else
+  // Transmit the latest pin state, with the retries picked for this link. Sampling goes on while the frame
+  // is on the line; changes in the meantime are sent together, as the state they end in, once it is done.
+  links.Prepare(destinationAddress);
+  bPLC_Success = plc.StartTransmit(CMD_SENDMSG, data, PinMessage::bLength);
+#endif
+  // A frame that could not be loaded is finished already, with that status
+  if (bPLC_Success == I2C_SUCCESS)
+  {
+    TASK_WAIT_UNTIL(task, (bPLC_Success = plc.PollTransmit()) != PLC_TX_PENDING);
   }
+#if AGGREGATE_MS
+  links.Record(frameAddress, bPLC_Success);
+  heartbeat.NoteTransmit(frameAddress);
+#else
+  links.Record(destinationAddress, bPLC_Success);
+  heartbeat.NoteTransmit(destinationAddress);
+#endif
+  if (bPLC_Success & Status_TX_Data_Sent)
+  {
+    wSuccessCount++;
+  }
+  wTxCount++;
+#if REPORT_BOOT_TIME
+  reportBootTime();
+#endif
+  TASK_END(task);
 }
 
-void transmit(byte *message, byte dataLength) {
-    // Transmit the packet with the data read from the ADC
-    bPLC_Success = plc.TransmitPacket(CMD_SENDMSG, message, dataLength);
-    if (bPLC_Success & Status_TX_Data_Sent)
-    {
-      wSuccessCount++;
-    }
-    wTxCount++;
+#if TDMA_MODE
+char serviceSlots(Task *task, void *context) {
+  TASK_BEGIN(task);
+  dispatcher.Service(&plc);
+  tdma.Service();
+  TASK_END(task);
 }
+#endif
 
-void receive() {
-  byte temp;
-  while (plc.IsPacketReceived() == true) {
-//    wRxCount++;
-//    plc.ReadFromOffset(RX_SA, &temp, 1);
-//    destinationAddress = temp;
-//    plc.WriteToOffset(TX_DA, &destinationAddress, 1);
-
-    //Serial.print("SA =");
-    //Serial.println(temp);
-//    Serial.print("RX# = ");
-    plc.ReadFromOffset(RX_CommandID, &temp, 1);
-    if (temp == CMD_SENDMSG)
-    { 
-      plc.ReadFromOffset(RX_Message_INFO, &temp, 1);
-      plc.ReadFromOffset(RX_Data, data, temp & 0xF);
-//      Serial.println(*dataVal);
-      //Serial.print("PK Len# = ");
-      //Serial.println(temp & 0xF);
-    }
-    temp = 0x00; 
-    plc.WriteToOffset(RX_Message_INFO, &temp, 1);
+char receiveFrames(Task *task, void *context) {
+  TASK_BEGIN(task);
+#if TDMA_MODE
+  tdma.Service();
+#endif
+  receive();
+  TASK_END(task);
+}
+
+char writeOutputs(Task *task, void *context) {
+  TASK_BEGIN(task);
+  if(oldData != pinState)
+  {
+    oldData = pinState;
+//    Serial.print("Rx:");
+//    Serial.println(pinState);
+    OutputPins::Write(pinState);
+  }
+  TASK_END(task);
+}
+
+#if PROFILE_SERIAL_CONFIG || LINK_SERIAL_REPORT || TASK_SERIAL_REPORT
+char serialCommands(Task *task, void *context) {
+  TASK_BEGIN(task);
+#if LINK_SERIAL_REPORT
+  checkLinkCommand();
+#endif
+#if TASK_SERIAL_REPORT
+  checkTaskCommand();
+#endif
+#if PROFILE_SERIAL_CONFIG
+  checkProfileCommand();
+#endif
+  TASK_END(task);
+}
+#endif
+
+#if TDMA_MODE
+byte tdmaSource(void *context, byte *address, byte *command, byte *payload) {
+  // Only the latest pin state is kept; a newer one replaces a frame still waiting for the slot
+  if (!txPending) {
+    return PLC_NO_FRAME;
+  }
+  txPending = false;
+  *address = destinationAddress;
+  *command = CMD_SENDMSG;
+  memcpy(payload, data, PinMessage::bLength);
+  return PinMessage::bLength;
+}
+
+void tdmaDone(void *context, byte address, byte status) {
+  bPLC_Success = status;
+  heartbeat.NoteTransmit(address);
+  if (status & Status_TX_Data_Sent)
+  {
+    wSuccessCount++;
+  }
+  wTxCount++;
+#if REPORT_BOOT_TIME
+  reportBootTime();
+#endif
+}
+#endif
+
+#endif
+
+#if REPORT_BOOT_TIME
+void reportBootTime() {
+  static bool reported = false;
+
+  if (reported) {
+    return;
+  }
+  reported = true;
+  Serial.print(plc.bWarmStart ? "Warm" : "Cold");
+  Serial.print(" boot, PLC ready:");
+  Serial.print(plc.dwReadyTime);
+  Serial.print("ms, first frame:");
+  Serial.print(millis());
+  Serial.println("ms");
+}
+#endif
+
+#if SNIFFER_MODE
+void sniff() {
+  byte chunk[SERIAL_TX_BUFFER_SIZE];
+  int room;
+
+  sniffer.Service();
+  // Only hand Serial what fits in its buffer, so a write never blocks the next capture
+  room = Serial.availableForWrite();
+  if (room > (int)sizeof(chunk)) {
+    room = sizeof(chunk);
+  }
+  Serial.write(chunk, sniffer.Read(chunk, room));
+}
+#endif
+
+#if BRIDGE_MODE
+void bridgeSerial() {
+  byte chunk[SERIAL_TX_BUFFER_SIZE];
+  int room;
+
+  while (Serial.available() > 0) {
+    bridge.Input(Serial.read());
+  }
+  bridge.Service();
+  // As in sniff(): never write more than Serial can take without blocking
+  room = Serial.availableForWrite();
+  if (room > (int)sizeof(chunk)) {
+    room = sizeof(chunk);
+  }
+  Serial.write(chunk, bridge.Output(chunk, room));
+}
+#endif
+
+#if !BRIDGE_MODE && !SNIFFER_MODE
+#if PROFILE_SERIAL_CONFIG
+void checkProfileCommand() {
+  PLC_Profile profile;
+  int command = Serial.read();
+
+  if (command < '0' || !PLC_GetProfile(command - '0', &profile)) {
+    return;
+  }
+  PLC_SaveProfile(PLC_PROFILE_EEPROM_ADDRESS, &profile);
+  profile.bPLCMode |= transmitter ? TX_Enable : (RX_Enable | RX_Override);
+  Serial.print("Profile ");
+  Serial.print(command - '0');
+  Serial.println(plc.ApplyProfile(&profile, true) == I2C_SUCCESS ? " applied" : " failed");
+  // The profile wrote TX_Config with a logical destination; set it back for this link
+  plc.SetDestinationAddress (TX_DA_Type_Log, &destinationAddress);
+  links.begin(&plc);
+}
+#endif
+
+#if TASK_SERIAL_REPORT
+void checkTaskCommand() {
+  Task *task;
+
+  if (Serial.peek() != 't') {
+    return;
+  }
+  Serial.read();
+  // One line per task, in the order setup() added them: activations, mean and longest call in us, overruns
+  for (byte n = 0; n < tasks.Count(); n++) {
+    task = tasks.Entry(n);
+    Serial.print(n);
+    Serial.print(" runs:");
+    Serial.print(task->dwRuns);
+    Serial.print(" mean:");
+    Serial.print(task->dwCalls ? task->dwRunUs / task->dwCalls : 0);
+    Serial.print("us max:");
+    Serial.print(task->dwMaxUs);
+    Serial.print("us overruns:");
+    Serial.println(task->wOverruns);
+  }
+  tasks.ResetStats();
+}
+#endif
+
+#if LINK_SERIAL_REPORT
+void checkLinkCommand() {
+  const PLC_Link *link;
+
+  if (Serial.peek() != 'l') {
+    return;
+  }
+  Serial.read();
+  // One line per peer: address, ACK rate %, retries, acknowledged or not, frames, NO_ACK, NO_RESP, latency ms
+  for (byte n = 0; n < links.Count(); n++) {
+    link = links.Entry(n);
+    Serial.print(link->bAddress);
+    Serial.print(" ack:");
+    Serial.print((unsigned long)link->wAckRate * 100 / 0xFFFF);
+    Serial.print("% retry:");
+    Serial.print(link->bRetry);
+    Serial.print(links.Acknowledged(link) ? " acked" : " unacked");
+    Serial.print(" sent:");
+    Serial.print(link->wSent);
+    Serial.print(" noack:");
+    Serial.print(link->wNoAck);
+    Serial.print(" noresp:");
+    Serial.print(link->wNoResp);
+    Serial.print(" latency:");
+    Serial.print(link->wLatency);
+    Serial.println("ms");
   }
 }
+#endif
+
+void receive() {
+  // Frames with other command IDs are counted in dispatcher.wUnknown and dropped
+  dispatcher.Service(&plc);
+}
+
+void onSendMsg(const PLC_Frame *frame, void *context) {
+//  wRxCount++;
+  //Serial.print("SA =");
+  //Serial.println(frame->pbSource[0]);
+  if (frame->bLength >= PinMessage::bLength)
+    pinState = PinMessage::Get<PIN_FIELD>(frame->pbData);
+  tasks.Signal(outputTask);
+#if REPORT_BOOT_TIME
+  reportBootTime();
+#endif
+//  Serial.print("RX# = ");
+//  Serial.println(pinState);
+}
+#endif
 
 
@@ -0,0 +1,150 @@
+#include "heartbeat.h"
+
+/*****************************************************************************
+* Function Name: Heartbeat::begin()
+******************************************************************************
+* Summary:
+* Set the heartbeat period and jitter and forget all peers
+**
+Parameters:
+* dwPeriod: idle time in ms after which a peer gets a heartbeat
+* wJitter: maximum random offset in ms applied to each period. Must be below dwPeriod.
+* bSeed: per-node seed, such as the local address, mixed with analog noise so every node draws different offsets
+**
+Return:
+* None
+**
+Note:
+*
+*****************************************************************************/
+void Heartbeat::begin(unsigned long dwPeriod, unsigned int wJitter, byte bSeed)
+{
+	this->dwPeriod = dwPeriod;
+	this->wJitter = (wJitter < dwPeriod) ? wJitter : 0;
+	bPeerCount = 0;
+	randomSeed(((unsigned long)bSeed << 16) ^ ((unsigned long)analogRead(A5) << 4) ^ micros());
+}
+
+/*****************************************************************************
+* Function Name: Heartbeat::AddPeer()
+******************************************************************************
+* Summary:
+* Start scheduling heartbeats to a peer
+**
+Parameters:
+* bAddress: logical address of the peer
+**
+Return:
+* TRUE if the peer is tracked, FALSE if the table is full
+**
+Note:
+* The first heartbeat is due one jittered period from now.
+*****************************************************************************/
+byte Heartbeat::AddPeer(byte bAddress)
+{
+	byte i;
+
+	for (i = 0; i < bPeerCount; i++)
+	{
+		if (abPeer[i] == bAddress)
+		{
+			return true;
+		}
+	}
+	if (bPeerCount >= HEARTBEAT_MAX_PEERS)
+	{
+		return false;
+	}
+	abPeer[bPeerCount] = bAddress;
+	adwDeadline[bPeerCount] = NextDeadline(millis());
+	bPeerCount++;
+	return true;
+}
+
+/*****************************************************************************
+* Function Name: Heartbeat::NoteTransmit()
+******************************************************************************
+* Summary:
+* Record that a frame went to a peer, which counts as its heartbeat
+**
+Parameters:
+* bAddress: destination of the frame
+**
+Return:
+* None
+**
+Note:
+* Call this for every frame sent, heartbeat or not.
+*****************************************************************************/
+void Heartbeat::NoteTransmit(byte bAddress)
+{
+	byte i;
+
+	for (i = 0; i < bPeerCount; i++)
+	{
+		if (abPeer[i] == bAddress)
+		{
+			adwDeadline[i] = NextDeadline(millis());
+			return;
+		}
+	}
+}
+
+/*****************************************************************************
+* Function Name: Heartbeat::Due()
+******************************************************************************
+* Summary:
+* Responds TRUE if a peer has reached its heartbeat deadline
+**
+Parameters:
+* pbAddress: set to the address of the peer that is due
+**
+Return:
+* TRUE if a heartbeat should be sent to *pbAddress. FALSE otherwise
+**
+Note:
+* The peer's deadline moves a period on as the heartbeat is taken, so it is only due once while the frame
+* waits in a queue or is on the line. NoteTransmit() moves it again once the frame has gone.
+*****************************************************************************/
+bool Heartbeat::Due(byte *pbAddress)
+{
+	unsigned long dwNow = millis();
+	byte i;
+
+	for (i = 0; i < bPeerCount; i++)
+	{
+		if ((long)(dwNow - adwDeadline[i]) >= 0)
+		{
+			*pbAddress = abPeer[i];
+			adwDeadline[i] = NextDeadline(dwNow);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*****************************************************************************
+* Function Name: Heartbeat::NextDeadline()
+******************************************************************************
+* Summary:
+* One period from dwNow, offset by a fresh random jitter
+**
+Parameters:
+* dwNow: current millis()
+**
+Return:
+* The millis() value of the next deadline
+**
+Note:
+*
+*****************************************************************************/
+unsigned long Heartbeat::NextDeadline(unsigned long dwNow)
+{
+	long lOffset = 0;
+
+	if (wJitter)
+	{
+		lOffset = random(-(long)wJitter, (long)wJitter + 1);
+	}
+	return dwNow + dwPeriod + lOffset;
+}
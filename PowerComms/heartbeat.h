@@ -0,0 +1,46 @@
+/*
+* File Name: heartbeat.h
+**
+Version: 2.1
+**
+Description:
+* Time based keepalive scheduling.
+* Each peer gets a heartbeat deadline of one period plus a random jitter, so bridges that power up together
+* drift apart instead of keying up on the same instant. Any frame sent to a peer pushes its deadline out by a
+* full period, so a heartbeat only goes out on a link that has otherwise been idle. Taking a heartbeat that is
+* due pushes the deadline out as well, so a send that takes a while does not yield a second one.
+**
+Note:
+* Deadlines are compared with unsigned subtraction, so millis() wrap-around is handled.
+*/
+
+#ifndef HEARTBEAT_H
+#define HEARTBEAT_H
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#define HEARTBEAT_MAX_PEERS		4		/* Peers tracked by one scheduler */
+#define HEARTBEAT_PERIOD_MS		4096	/* Default idle time before a heartbeat is sent */
+#define HEARTBEAT_JITTER_MS		512		/* Default maximum random offset added to each period, either way */
+
+class Heartbeat {
+  public:
+    void begin(unsigned long dwPeriod, unsigned int wJitter, byte bSeed);
+    byte AddPeer(byte bAddress);
+    void NoteTransmit(byte bAddress);
+    bool Due(byte *pbAddress);
+  private:
+    unsigned long NextDeadline(unsigned long dwNow);
+
+    unsigned long dwPeriod;
+    unsigned int wJitter;
+    byte bPeerCount;
+    byte abPeer[HEARTBEAT_MAX_PEERS];
+    unsigned long adwDeadline[HEARTBEAT_MAX_PEERS];
+};
+
+#endif
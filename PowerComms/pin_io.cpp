@@ -0,0 +1,175 @@
+#include "pin_io.h"
+
+#if PIN_IO_PORT_MAP
+
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+volatile unsigned long PinChange::dwEdgeCount = 0;
+bool PinChange::bLockout = false;
+unsigned long PinChange::dwLockoutStart = 0;
+
+static volatile byte bEdgePending = 0;			/* Pins of each port that toggled since the last Poll(), merged */
+static volatile unsigned long dwFirstEdgeTime = 0;	/* micros() of the first unreported edge */
+static volatile byte abLastPort[3];			/* Port value seen by the previous interrupt, per port */
+
+/*****************************************************************************
+* Function Name: PinChange_Latch()
+******************************************************************************
+* Summary:
+* Common body of the pin-change interrupt handlers
+**
+Parameters:
+* bPort: PIN_PORT_B, PIN_PORT_C or PIN_PORT_D
+* bValue: current value of the port input register
+* bMask: pins of the port that are being watched
+**
+Return:
+* None
+**
+Note:
+* Called with interrupts disabled.
+*****************************************************************************/
+static inline void PinChange_Latch(byte bPort, byte bValue, byte bMask)
+{
+	byte bEdges = (bValue ^ abLastPort[bPort]) & bMask;
+
+	abLastPort[bPort] = bValue;
+	if (bEdges)
+	{
+		if (!bEdgePending)
+		{
+			dwFirstEdgeTime = micros();
+		}
+		bEdgePending = 1;
+		PinChange::dwEdgeCount++;
+	}
+}
+
+ISR(PCINT0_vect)
+{
+	PinChange_Latch(PIN_PORT_B, PINB, PCMSK0);
+}
+
+ISR(PCINT1_vect)
+{
+	PinChange_Latch(PIN_PORT_C, PINC, PCMSK1);
+}
+
+ISR(PCINT2_vect)
+{
+	PinChange_Latch(PIN_PORT_D, PIND, PCMSK2);
+}
+
+/*****************************************************************************
+* Function Name: PinChange::begin()
+******************************************************************************
+* Summary:
+* Enable the pin-change interrupts for the given port masks
+**
+Parameters:
+* bMaskB, bMaskC, bMaskD: pins to watch on each port. Pass the masks of a PinSampler.
+**
+Return:
+* None
+**
+Note:
+* On the ATmega328P PORTB, PORTC and PORTD map one to one onto PCMSK0, PCMSK1 and PCMSK2.
+*****************************************************************************/
+void PinChange::begin(byte bMaskB, byte bMaskC, byte bMaskD)
+{
+	byte bSREG = SREG;
+
+	cli();
+	abLastPort[PIN_PORT_B] = PINB;
+	abLastPort[PIN_PORT_C] = PINC;
+	abLastPort[PIN_PORT_D] = PIND;
+	PCMSK0 = bMaskB;
+	PCMSK1 = bMaskC;
+	PCMSK2 = bMaskD;
+	PCIFR = _BV(PCIF0) | _BV(PCIF1) | _BV(PCIF2);
+	PCICR = (bMaskB ? _BV(PCIE0) : 0) | (bMaskC ? _BV(PCIE1) : 0) | (bMaskD ? _BV(PCIE2) : 0);
+	bEdgePending = 0;
+	SREG = bSREG;
+
+	bLockout = false;
+}
+
+/*****************************************************************************
+* Function Name: PinChange::Poll()
+******************************************************************************
+* Summary:
+* Responds TRUE when the inputs should be sampled and reported
+**
+Parameters:
+* pdwEdgeTime: set to the micros() of the first edge behind this report
+**
+Return:
+* TRUE on the first edge after a quiet period and at the end of a lockout that saw further edges.
+* FALSE otherwise.
+**
+Note:
+*
+*****************************************************************************/
+bool PinChange::Poll(unsigned long *pdwEdgeTime)
+{
+	byte bPending;
+	unsigned long dwEdgeTime;
+
+	if (bLockout)
+	{
+		if ((micros() - dwLockoutStart) < PIN_CHANGE_DEBOUNCE_US)
+		{
+			return false;
+		}
+		bLockout = false;
+	}
+
+	cli();
+	bPending = bEdgePending;
+	dwEdgeTime = dwFirstEdgeTime;
+	bEdgePending = 0;
+	sei();
+
+	if (!bPending)
+	{
+		return false;
+	}
+
+	*pdwEdgeTime = dwEdgeTime;
+	bLockout = true;
+	dwLockoutStart = micros();
+	return true;
+}
+
+/*****************************************************************************
+* Function Name: PinChange::Idle()
+******************************************************************************
+* Summary:
+* Sleep until the next interrupt unless an edge is waiting to be reported
+**
+Parameters:
+* None
+**
+Return:
+* None
+**
+Note:
+* Idle mode keeps timer0 running, so millis() advances and the CPU is woken at least every tick.
+* Interrupts are enabled in the instruction before SLEEP, so an edge arriving after the check still wakes it.
+*****************************************************************************/
+void PinChange::Idle(void)
+{
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	cli();
+	if (!bEdgePending || bLockout)
+	{
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+	}
+	sei();
+}
+
+#endif
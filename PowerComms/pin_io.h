@@ -0,0 +1,391 @@
+/*
+* File Name: pin_io.h
+**
+Version: 2.1
+**
+Description:
+* Port-level sampling and driving of the bridged GPIO pins.
+* The pin list is given as template arguments and resolved at compile time into one mask per AVR port,
+* so a sample is a single read of each port input register (PINB/PINC/PIND) instead of one digitalRead()
+* per pin. All ports are read back to back with interrupts held off, so the bitmap is a coherent snapshot.
+* PinWriter is the receive side counterpart: a bitmap is turned into per-port set/clear masks and applied
+* with one write per port, so all outputs change together.
+* PinChange uses the pin-change interrupts of the same port masks to timestamp and latch input edges, so
+* the transmitter only samples when something moved and can sleep otherwise.
+**
+Note:
+* The compile-time pin map is the ATmega328P one (Uno, Nano, Pro Mini):
+*   D0-D7 -> PORTD bit 0-7, D8-D13 -> PORTB bit 0-5, D14-D19 (A0-A5) -> PORTC bit 0-5.
+* On other boards PinSampler and PinWriter fall back to one digitalRead()/digitalWrite() per pin, which is
+* functionally the same but neither fast nor coherent.
+*
+* Cost: the sample itself is three IN instructions plus one bit move per pin. Call MeasureCycles() on the
+* target to get the real figure; the sketch prints it at boot when REPORT_SAMPLE_CYCLES is 1.
+*/
+
+#ifndef PIN_IO_H
+#define PIN_IO_H
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__) || defined(__AVR_ATmega328__)
+#define PIN_IO_PORT_MAP 1
+#include <avr/io.h>
+#else
+#define PIN_IO_PORT_MAP 0
+#endif
+
+#ifndef PIN_IO_LATCH_TIMESTAMP
+#define PIN_IO_LATCH_TIMESTAMP 0	/* When 1, PinWriter records micros() at each output latch in dwLatchTime */
+#endif
+
+#ifndef PIN_CHANGE_DEBOUNCE_US
+#define PIN_CHANGE_DEBOUNCE_US 2000	/* Edges within this window of a reported edge are folded into one re-sample */
+#endif
+
+#define PIN_PORT_B 0
+#define PIN_PORT_C 1
+#define PIN_PORT_D 2
+
+/* Compile-time ATmega328P pin map */
+constexpr byte PinPort(byte bPin)
+{
+	return (bPin < 8) ? PIN_PORT_D : ((bPin < 14) ? PIN_PORT_B : PIN_PORT_C);
+}
+
+constexpr byte PinBit(byte bPin)
+{
+	return (bPin < 8) ? bPin : ((bPin < 14) ? (bPin - 8) : (bPin - 14));
+}
+
+/* Smallest unsigned type holding one bit per pin */
+template <bool bFitsByte, bool bFitsWord> struct PinBitmapSelect { typedef uint32_t Type; };
+template <bool bFitsWord> struct PinBitmapSelect<true, bFitsWord> { typedef uint8_t Type; };
+template <> struct PinBitmapSelect<false, true> { typedef uint16_t Type; };
+
+/* Mask of the pins that live on bPort */
+template <byte bPort, byte... Pins> struct PinPortMask;
+
+template <byte bPort> struct PinPortMask<bPort>
+{
+	static const byte value = 0;
+};
+
+template <byte bPort, byte bPin, byte... Rest> struct PinPortMask<bPort, bPin, Rest...>
+{
+	static const byte value = ((PinPort(bPin) == bPort) ? (byte)(1 << PinBit(bPin)) : 0) | PinPortMask<bPort, Rest...>::value;
+};
+
+/* Moves each pin's port bit to its bitmap position. Every selector and shift is a constant, so this unrolls to
+ * one bit extract and insert per pin. */
+template <typename Bitmap, byte bIndex, byte... Pins> struct PinGather;
+
+template <typename Bitmap, byte bIndex> struct PinGather<Bitmap, bIndex>
+{
+	static inline Bitmap Get(byte, byte, byte) { return 0; }
+};
+
+template <typename Bitmap, byte bIndex, byte bPin, byte... Rest> struct PinGather<Bitmap, bIndex, bPin, Rest...>
+{
+	static inline Bitmap Get(byte bPortB, byte bPortC, byte bPortD)
+	{
+		byte bPortVal = (PinPort(bPin) == PIN_PORT_B) ? bPortB : ((PinPort(bPin) == PIN_PORT_C) ? bPortC : bPortD);
+		return (Bitmap)((Bitmap)((bPortVal >> PinBit(bPin)) & 0x01) << bIndex) | PinGather<Bitmap, bIndex + 1, Rest...>::Get(bPortB, bPortC, bPortD);
+	}
+};
+
+/* Collects the bitmap bits that belong to bPort into that port's bit positions. The inverse of PinGather. */
+template <typename Bitmap, byte bPort, byte bIndex, byte... Pins> struct PinScatter;
+
+template <typename Bitmap, byte bPort, byte bIndex> struct PinScatter<Bitmap, bPort, bIndex>
+{
+	static inline byte Get(Bitmap) { return 0; }
+};
+
+template <typename Bitmap, byte bPort, byte bIndex, byte bPin, byte... Rest> struct PinScatter<Bitmap, bPort, bIndex, bPin, Rest...>
+{
+	static inline byte Get(Bitmap bitmap)
+	{
+		byte bBit = (PinPort(bPin) == bPort) ? (byte)(((bitmap >> bIndex) & 0x01) << PinBit(bPin)) : 0;
+		return bBit | PinScatter<Bitmap, bPort, bIndex + 1, Rest...>::Get(bitmap);
+	}
+};
+
+template <byte... Pins>
+class PinSampler {
+  public:
+    typedef typename PinBitmapSelect<(sizeof...(Pins) <= 8), (sizeof...(Pins) <= 16)>::Type Bitmap;
+
+    static const byte bCount = sizeof...(Pins);
+    static const byte bMaskB = PinPortMask<PIN_PORT_B, Pins...>::value;
+    static const byte bMaskC = PinPortMask<PIN_PORT_C, Pins...>::value;
+    static const byte bMaskD = PinPortMask<PIN_PORT_D, Pins...>::value;
+
+    static void begin(byte bMode);
+    static Bitmap Sample(void);
+    static unsigned long MeasureCycles(unsigned int wSamples);
+};
+
+/*****************************************************************************
+* Function Name: PinSampler::begin()
+******************************************************************************
+* Summary:
+* Set the mode of every pin in the map
+**
+Parameters:
+* bMode: INPUT, INPUT_PULLUP or OUTPUT
+**
+Return:
+* None
+**
+Note:
+*
+*****************************************************************************/
+template <byte... Pins>
+void PinSampler<Pins...>::begin(byte bMode)
+{
+	static const byte abPins[] = { Pins... };
+	for (byte i = 0; i < bCount; i++)
+	{
+		pinMode(abPins[i], bMode);
+	}
+}
+
+/*****************************************************************************
+* Function Name: PinSampler::Sample()
+******************************************************************************
+* Summary:
+* Take a coherent snapshot of every mapped pin
+**
+Parameters:
+* None
+**
+Return:
+* Bitmap with bit i set when the i-th pin of the map reads high
+**
+Note:
+* Only the ports that carry a mapped pin are read. Interrupts are held off for the few cycles between the
+* port reads so an ISR cannot split the snapshot.
+*****************************************************************************/
+template <byte... Pins>
+inline typename PinSampler<Pins...>::Bitmap PinSampler<Pins...>::Sample(void)
+{
+#if PIN_IO_PORT_MAP
+	byte bPortB = 0, bPortC = 0, bPortD = 0;
+	byte bSREG = SREG;
+
+	cli();
+	if (bMaskB) bPortB = PINB;
+	if (bMaskC) bPortC = PINC;
+	if (bMaskD) bPortD = PIND;
+	SREG = bSREG;
+
+	return PinGather<Bitmap, 0, Pins...>::Get(bPortB, bPortC, bPortD);
+#else
+	static const byte abPins[] = { Pins... };
+	Bitmap bitmap = 0;
+	for (byte i = 0; i < bCount; i++)
+	{
+		bitmap |= (Bitmap)digitalRead(abPins[i]) << i;
+	}
+	return bitmap;
+#endif
+}
+
+/*****************************************************************************
+* Function Name: PinSampler::MeasureCycles()
+******************************************************************************
+* Summary:
+* Measure the average CPU cycles spent in Sample()
+**
+Parameters:
+* wSamples: number of samples to average over. A few thousand gives a stable figure with micros()' 4us tick.
+**
+Return:
+* Average cycles per sample with the loop overhead removed
+**
+Note:
+*
+*****************************************************************************/
+template <byte... Pins>
+unsigned long PinSampler<Pins...>::MeasureCycles(unsigned int wSamples)
+{
+	volatile Bitmap sink;
+	volatile unsigned int wCount;
+	unsigned long dwStart, dwSampleTime, dwLoopTime;
+
+	dwStart = micros();
+	for (wCount = 0; wCount < wSamples; wCount++)
+	{
+		sink = Sample();
+	}
+	dwSampleTime = micros() - dwStart;
+
+	/* Same loop with a constant store, to subtract the loop and store overhead */
+	dwStart = micros();
+	for (wCount = 0; wCount < wSamples; wCount++)
+	{
+		sink = 0;
+	}
+	dwLoopTime = micros() - dwStart;
+	(void)sink;
+
+	if (dwSampleTime <= dwLoopTime || wSamples == 0)
+	{
+		return 0;
+	}
+	return ((dwSampleTime - dwLoopTime) * (F_CPU / 1000000UL)) / wSamples;
+}
+
+/*****************************************************************************
+* Class Name: PinWriter
+******************************************************************************
+* Summary:
+* Drives the mapped pins from a bitmap with one read-modify-write per port
+**
+Note:
+* The last written bitmap is kept, so only pins whose bit changed are touched and a repeated bitmap
+* costs nothing. Port writes are done back to back with interrupts held off.
+*****************************************************************************/
+template <byte... Pins>
+class PinWriter {
+  public:
+    typedef typename PinSampler<Pins...>::Bitmap Bitmap;
+
+    static const byte bCount = sizeof...(Pins);
+
+    static void begin(void);
+    static void Write(Bitmap bitmap);
+#if PIN_IO_LATCH_TIMESTAMP
+    static unsigned long dwLatchTime;	/* micros() when the last changed bitmap reached the pins */
+#endif
+  private:
+    static Bitmap lastBitmap;
+};
+
+template <byte... Pins>
+typename PinWriter<Pins...>::Bitmap PinWriter<Pins...>::lastBitmap = 0;
+
+#if PIN_IO_LATCH_TIMESTAMP
+template <byte... Pins>
+unsigned long PinWriter<Pins...>::dwLatchTime = 0;
+#endif
+
+/*****************************************************************************
+* Function Name: PinWriter::begin()
+******************************************************************************
+* Summary:
+* Drive every mapped pin low and make it an output
+**
+Parameters:
+* None
+**
+Return:
+* None
+**
+Note:
+*
+*****************************************************************************/
+template <byte... Pins>
+void PinWriter<Pins...>::begin(void)
+{
+	static const byte abPins[] = { Pins... };
+	for (byte i = 0; i < bCount; i++)
+	{
+		digitalWrite(abPins[i], LOW);
+		pinMode(abPins[i], OUTPUT);
+	}
+	lastBitmap = 0;
+}
+
+/*****************************************************************************
+* Function Name: PinWriter::Write()
+******************************************************************************
+* Summary:
+* Apply a bitmap to the mapped pins
+**
+Parameters:
+* bitmap: bit i drives the i-th pin of the map
+**
+Return:
+* None
+**
+Note:
+* Set and clear masks are computed per port from the bits that changed since the last call, then every
+* port is updated inside one interrupt-free window.
+*****************************************************************************/
+template <byte... Pins>
+inline void PinWriter<Pins...>::Write(Bitmap bitmap)
+{
+	Bitmap changed = bitmap ^ lastBitmap;
+
+	if (!changed)
+	{
+		return;
+	}
+	lastBitmap = bitmap;
+
+#if PIN_IO_PORT_MAP
+	Bitmap set = bitmap & changed;
+	Bitmap clr = (Bitmap)~bitmap & changed;
+	byte bSetB = PinScatter<Bitmap, PIN_PORT_B, 0, Pins...>::Get(set);
+	byte bClrB = PinScatter<Bitmap, PIN_PORT_B, 0, Pins...>::Get(clr);
+	byte bSetC = PinScatter<Bitmap, PIN_PORT_C, 0, Pins...>::Get(set);
+	byte bClrC = PinScatter<Bitmap, PIN_PORT_C, 0, Pins...>::Get(clr);
+	byte bSetD = PinScatter<Bitmap, PIN_PORT_D, 0, Pins...>::Get(set);
+	byte bClrD = PinScatter<Bitmap, PIN_PORT_D, 0, Pins...>::Get(clr);
+	byte bSREG = SREG;
+
+	cli();
+	if (PinSampler<Pins...>::bMaskB) PORTB = (PORTB | bSetB) & ~bClrB;
+	if (PinSampler<Pins...>::bMaskC) PORTC = (PORTC | bSetC) & ~bClrC;
+	if (PinSampler<Pins...>::bMaskD) PORTD = (PORTD | bSetD) & ~bClrD;
+	SREG = bSREG;
+#else
+	static const byte abPins[] = { Pins... };
+	for (byte i = 0; i < bCount; i++)
+	{
+		if ((changed >> i) & 0x01)
+		{
+			digitalWrite(abPins[i], (bitmap >> i) & 0x01);
+		}
+	}
+#endif
+
+#if PIN_IO_LATCH_TIMESTAMP
+	dwLatchTime = micros();
+#endif
+}
+
+#if PIN_IO_PORT_MAP
+/*****************************************************************************
+* Class Name: PinChange
+******************************************************************************
+* Summary:
+* Event-driven edge detection on the mapped input pins
+**
+Note:
+* The PCINT0/1/2 handlers in pin_io.cpp latch which pins toggled and the micros() of the first edge.
+* Poll() reports an edge as soon as it is seen, then holds a PIN_CHANGE_DEBOUNCE_US lockout. Edges inside
+* the lockout are folded into a single report at its end, so a bouncing contact costs at most two frames
+* and the first one carries no debounce delay.
+* The handlers claim all three PCINT vectors, so this cannot be combined with SoftwareSerial.
+*****************************************************************************/
+class PinChange {
+  public:
+    static void begin(byte bMaskB, byte bMaskC, byte bMaskD);
+    static bool Poll(unsigned long *pdwEdgeTime);
+    static void Idle(void);
+
+    static volatile unsigned long dwEdgeCount;		/* Edges seen by the interrupt handlers */
+  private:
+    static bool bLockout;
+    static unsigned long dwLockoutStart;
+};
+#endif
+
+#endif
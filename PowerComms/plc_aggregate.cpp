@@ -0,0 +1,343 @@
+#include "plc_aggregate.h"
+
+#define ENTRY_DESTINATION	0
+#define ENTRY_COMMAND		1
+#define ENTRY_LENGTH		2
+#define ENTRY_TIME			3		/* (word)millis() when queued, LSB first */
+
+/* Dispatcher handler for CMD_AGGREGATE, see PLC_AggregateReceiver::Attach() */
+static void OnAggregateFrame(const PLC_Frame *pFrame, void *pContext)
+{
+	((PLC_AggregateReceiver *)pContext)->OnFrame(pFrame);
+}
+
+/*****************************************************************************
+* Function Name: PLC_AggregateSender::begin()
+******************************************************************************
+* Summary:
+* Empty the queue and set the latency budget
+**
+Parameters:
+* wBudgetMs: longest a message waits for others to share its frame. 0 sends each frame as soon as it can go,
+* with whatever has queued up for its destination by then.
+**
+Return:
+* None
+**
+Note:
+*
+*****************************************************************************/
+void PLC_AggregateSender::begin(word wBudgetMs)
+{
+	this->wBudgetMs = wBudgetMs;
+	bUsed = 0;
+	bCount = 0;
+	wQueued = 0;
+	wFrames = 0;
+	wDropped = 0;
+}
+
+/*****************************************************************************
+* Function Name: PLC_AggregateSender::Queue()
+******************************************************************************
+* Summary:
+* Queue a message to go out in a later frame
+**
+Parameters:
+* bDestination: logical address of the destination
+* bCommand: command ID the receiver dispatches the message on
+* pbData: the message, copied into the queue
+* bLength: its length, up to MAX_PLC_PACKET_LENGTH. Messages longer than PLC_AGGREGATE_MAX always go alone.
+**
+Return:
+* FALSE if the message is too long or the queue has no room for it. It is counted in wDropped.
+**
+Note:
+*
+*****************************************************************************/
+bool PLC_AggregateSender::Queue(byte bDestination, byte bCommand, const byte *pbData, byte bLength)
+{
+	byte *pbEntry = &abQueue[bUsed];
+	word wNow = (word)millis();
+
+	if (bLength > MAX_PLC_PACKET_LENGTH || PLC_AGGREGATE_ENTRY + bLength > PLC_AGGREGATE_QUEUE - bUsed)
+	{
+		wDropped++;
+		return false;
+	}
+	pbEntry[ENTRY_DESTINATION] = bDestination;
+	pbEntry[ENTRY_COMMAND] = bCommand;
+	pbEntry[ENTRY_LENGTH] = bLength;
+	pbEntry[ENTRY_TIME] = (byte)wNow;
+	pbEntry[ENTRY_TIME + 1] = (byte)(wNow >> 8);
+	memcpy(&pbEntry[PLC_AGGREGATE_ENTRY], pbData, bLength);
+	bUsed += PLC_AGGREGATE_ENTRY + bLength;
+	bCount++;
+	wQueued++;
+	return true;
+}
+
+/*****************************************************************************
+* Function Name: PLC_AggregateSender::Ready()
+******************************************************************************
+* Summary:
+* Whether a frame should be sent now
+**
+Parameters:
+* None
+**
+Return:
+* TRUE once the oldest message has waited the latency budget, or when its destination has more queued than
+* fits in one frame
+**
+Note:
+* Next() hands out a frame whether or not this is TRUE, so the application can also send early, when the line
+* is free anyway, or when Queue() refuses a message.
+*****************************************************************************/
+bool PLC_AggregateSender::Ready(void)
+{
+	byte bMessages;
+	bool bFull;
+
+	if (bCount == 0)
+	{
+		return false;
+	}
+	Pack(NULL, &bMessages, &bFull);
+	return bFull || Wait() == 0;
+}
+
+/*****************************************************************************
+* Function Name: PLC_AggregateSender::Wait()
+******************************************************************************
+* Summary:
+* Time left until the oldest message has waited the latency budget
+**
+Parameters:
+* None
+**
+Return:
+* ms left, 0 if it has, or PLC_AGGREGATE_NEVER with nothing queued
+**
+Note:
+* Does not look at full frames; check Ready() for those as messages are queued.
+*****************************************************************************/
+word PLC_AggregateSender::Wait(void)
+{
+	word wAge;
+
+	if (bCount == 0)
+	{
+		return PLC_AGGREGATE_NEVER;
+	}
+	wAge = (word)millis() - (abQueue[ENTRY_TIME] | (abQueue[ENTRY_TIME + 1] << 8));
+	return (wAge >= wBudgetMs) ? 0 : wBudgetMs - wAge;
+}
+
+/*****************************************************************************
+* Function Name: PLC_AggregateSender::Next()
+******************************************************************************
+* Summary:
+* Take the next frame off the queue: the oldest message and the ones after it for the same destination that fit
+**
+Parameters:
+* pbDestination: set to the logical address to send the frame to
+* pbCommand: set to the command ID of the frame, CMD_AGGREGATE or that of a message sent alone
+* pbPayload: filled with up to MAX_PLC_PACKET_LENGTH bytes of payload
+**
+Return:
+* The payload length, or PLC_NO_FRAME with nothing queued
+**
+Note:
+* The messages are off the queue whatever becomes of the frame; the application sends them again if it must.
+*****************************************************************************/
+byte PLC_AggregateSender::Next(byte *pbDestination, byte *pbCommand, byte *pbPayload)
+{
+	byte bDestination;
+	byte bMessages;
+	byte bLength;
+	byte bRemoved;
+	byte bEntry;
+	byte i;
+	bool bFull;
+
+	if (bCount == 0)
+	{
+		return PLC_NO_FRAME;
+	}
+	bDestination = abQueue[ENTRY_DESTINATION];
+	*pbDestination = bDestination;
+	Pack(NULL, &bMessages, &bFull);
+	if (bMessages <= 1)
+	{
+		/* Alone: no sub-header needed */
+		bMessages = 1;
+		*pbCommand = abQueue[ENTRY_COMMAND];
+		bLength = abQueue[ENTRY_LENGTH];
+		memcpy(pbPayload, &abQueue[PLC_AGGREGATE_ENTRY], bLength);
+	}
+	else
+	{
+		*pbCommand = CMD_AGGREGATE;
+		bLength = Pack(pbPayload, &bMessages, &bFull);
+	}
+
+	/* The messages sent are the first bMessages of the destination's */
+	bRemoved = 0;
+	i = 0;
+	while (i < bUsed && bRemoved < bMessages)
+	{
+		bEntry = PLC_AGGREGATE_ENTRY + abQueue[i + ENTRY_LENGTH];
+		if (abQueue[i + ENTRY_DESTINATION] == bDestination)
+		{
+			memmove(&abQueue[i], &abQueue[i + bEntry], bUsed - i - bEntry);
+			bUsed -= bEntry;
+			bRemoved++;
+		}
+		else
+		{
+			i += bEntry;
+		}
+	}
+	bCount -= bRemoved;
+	wFrames++;
+	return bLength;
+}
+
+/*****************************************************************************
+* Function Name: PLC_AggregateSender::Count()
+******************************************************************************
+* Summary:
+* Number of messages queued
+*****************************************************************************/
+byte PLC_AggregateSender::Count(void)
+{
+	return bCount;
+}
+
+/* Lay out the oldest message and the ones after it for its destination, as far as they fit in one
+ * CMD_AGGREGATE payload. pbPayload may be NULL to count them only. *pbFull is set when one was left out. */
+byte PLC_AggregateSender::Pack(byte *pbPayload, byte *pbMessages, bool *pbFull)
+{
+	byte bDestination = abQueue[ENTRY_DESTINATION];
+	byte bLength = 0;
+	byte bPrevious = 0;
+	byte bCost;
+	byte *pbEntry;
+	byte i;
+	bool bCommand;
+
+	*pbMessages = 0;
+	*pbFull = false;
+	for (i = 0; i < bUsed; i += PLC_AGGREGATE_ENTRY + pbEntry[ENTRY_LENGTH])
+	{
+		pbEntry = &abQueue[i];
+		if (pbEntry[ENTRY_DESTINATION] != bDestination)
+		{
+			continue;
+		}
+		bCommand = (*pbMessages == 0 || pbEntry[ENTRY_COMMAND] != bPrevious);
+		bCost = 1 + (bCommand ? 1 : 0) + pbEntry[ENTRY_LENGTH];
+		if (bLength + bCost > MAX_PLC_PACKET_LENGTH)
+		{
+			*pbFull = true;
+			break;
+		}
+		if (pbPayload != NULL)
+		{
+			pbPayload[bLength] = pbEntry[ENTRY_LENGTH] | (bCommand ? PLC_AGGREGATE_COMMAND : 0);
+			if (bCommand)
+			{
+				pbPayload[bLength + 1] = pbEntry[ENTRY_COMMAND];
+			}
+			memcpy(&pbPayload[bLength + bCost - pbEntry[ENTRY_LENGTH]], &pbEntry[PLC_AGGREGATE_ENTRY],
+				pbEntry[ENTRY_LENGTH]);
+		}
+		bLength += bCost;
+		bPrevious = pbEntry[ENTRY_COMMAND];
+		(*pbMessages)++;
+	}
+	return bLength;
+}
+
+/*****************************************************************************
+* Function Name: PLC_AggregateReceiver::begin()
+******************************************************************************
+* Summary:
+* Clear the counters
+*****************************************************************************/
+void PLC_AggregateReceiver::begin(void)
+{
+	pDispatcher = NULL;
+	wMessages = 0;
+	wMalformed = 0;
+}
+
+/*****************************************************************************
+* Function Name: PLC_AggregateReceiver::Attach()
+******************************************************************************
+* Summary:
+* Have a dispatcher pass CMD_AGGREGATE frames to this receiver, which hands the messages back to it
+**
+Return:
+* FALSE if the dispatcher has no handler slot left
+*****************************************************************************/
+bool PLC_AggregateReceiver::Attach(PLC_Dispatcher *pDispatcher)
+{
+	this->pDispatcher = pDispatcher;
+	return pDispatcher->Register(CMD_AGGREGATE, OnAggregateFrame, this);
+}
+
+/*****************************************************************************
+* Function Name: PLC_AggregateReceiver::OnFrame()
+******************************************************************************
+* Summary:
+* Unpack a CMD_AGGREGATE frame and dispatch each of its messages
+**
+Parameters:
+* pFrame: the frame
+**
+Return:
+* None
+**
+Note:
+* Each message goes to the dispatcher as a frame with the aggregate's source and address types, and its own
+* command ID, payload and length.
+*****************************************************************************/
+void PLC_AggregateReceiver::OnFrame(const PLC_Frame *pFrame)
+{
+	PLC_Frame message;
+	byte bHeader;
+	byte i = 0;
+	bool bMalformed = false;
+
+	message.pbSource = pFrame->pbSource;
+	while (i < pFrame->bLength && !bMalformed)
+	{
+		bHeader = pFrame->pbData[i++];
+		message.bLength = bHeader & PLC_AGGREGATE_LENGTH;
+		if (bHeader & PLC_AGGREGATE_COMMAND)
+		{
+			bMalformed = (i >= pFrame->bLength);
+			message.bCommand = bMalformed ? 0 : pFrame->pbData[i++];
+		}
+		else
+		{
+			bMalformed = (i == 1);		/* The first message must carry its command ID */
+		}
+		if (bMalformed || message.bLength > pFrame->bLength - i)
+		{
+			bMalformed = true;
+			break;
+		}
+		message.bInfo = (pFrame->bInfo & ~RX_Msg_Length) | message.bLength;
+		message.pbData = &pFrame->pbData[i];
+		i += message.bLength;
+		wMessages++;
+		pDispatcher->Dispatch(&message);
+	}
+	if (bMalformed)
+	{
+		wMalformed++;
+	}
+}
@@ -0,0 +1,76 @@
+/*
+* File Name: plc_aggregate.h
+**
+Version: 2.1
+**
+Description:
+* Packs several small messages for the same destination into one CMD_AGGREGATE frame, so they share one TX
+* delay, preamble and ACK. PLC_AggregateSender queues the messages, each with its own command ID, and hands
+* out frames through Next(). A frame takes the oldest message and the ones after it for the same destination,
+* in order, as far as they fit. A message alone in its frame goes out as it is, under its own command ID.
+* Each message in a CMD_AGGREGATE payload has a 1-byte sub-header: its length, and PLC_AGGREGATE_COMMAND when
+* a command ID byte follows. Without it the message has the command ID of the one before, so a run of the same
+* message type costs one byte per message.
+* Ready() says when to send: once the oldest message has waited the latency budget, or its destination has a
+* full frame queued. PLC_AggregateReceiver unpacks a CMD_AGGREGATE frame and hands each message to the
+* dispatcher as a frame of its own, from the same source.
+**
+Note:
+* The destination is a logical address; the application sets it in TX_DA before sending each frame.
+* The receiver dispatches tagged messages through the dedup cache like any frame, so each message of an
+* aggregate needs its own tag. A frame that runs out part way through a message is counted as malformed; the
+* messages before that point have been dispatched.
+*/
+
+#ifndef PLC_AGGREGATE_H
+#define PLC_AGGREGATE_H
+
+#include "plc_i2c.h"
+#include "plc_scheduler.h"	/* PLC_NO_FRAME */
+#include "plc_dispatch.h"
+
+#define CMD_AGGREGATE			0x22		/* Application command ID, see CMD_TDMA_BEACON */
+#define PLC_AGGREGATE_COMMAND	0x80		/* Sub-header: a command ID byte follows */
+#define PLC_AGGREGATE_LENGTH	0x1F		/* Sub-header: message length */
+#define PLC_AGGREGATE_MAX		(MAX_PLC_PACKET_LENGTH - 2)	/* Longest message that fits an aggregate */
+#define PLC_AGGREGATE_NEVER		0xFFFF		/* Wait(): nothing queued */
+
+#ifndef PLC_AGGREGATE_QUEUE
+#define PLC_AGGREGATE_QUEUE		96			/* Bytes of queue, up to 255: PLC_AGGREGATE_ENTRY per message plus its data */
+#endif
+#define PLC_AGGREGATE_ENTRY		5			/* Destination, command ID, length, queue time */
+
+class PLC_AggregateSender {
+  public:
+    void begin(word wBudgetMs);
+    bool Queue(byte bDestination, byte bCommand, const byte *pbData, byte bLength);
+    bool Ready(void);
+    word Wait(void);
+    byte Next(byte *pbDestination, byte *pbCommand, byte *pbPayload);
+    byte Count(void);
+
+    word wQueued;			/* Messages queued */
+    word wFrames;			/* Frames handed out by Next() */
+    word wDropped;			/* Messages refused by a full queue */
+  private:
+    byte Pack(byte *pbPayload, byte *pbMessages, bool *pbFull);
+
+    word wBudgetMs;
+    byte bUsed;				/* Bytes of abQueue in use */
+    byte bCount;			/* Messages in abQueue */
+    byte abQueue[PLC_AGGREGATE_QUEUE];	/* Messages oldest first: PLC_AGGREGATE_ENTRY bytes, then the data */
+};
+
+class PLC_AggregateReceiver {
+  public:
+    void begin(void);
+    bool Attach(PLC_Dispatcher *pDispatcher);
+    void OnFrame(const PLC_Frame *pFrame);
+
+    word wMessages;			/* Messages unpacked and dispatched */
+    word wMalformed;		/* Frames that ran out part way through a message */
+  private:
+    PLC_Dispatcher *pDispatcher;
+};
+
+#endif
@@ -0,0 +1,318 @@
+#include "plc_bridge.h"
+
+#define OUT_MASK (PLC_BRIDGE_OUT_RING - 1)
+#define IN_SKIPPING 0xFF
+
+/* Output room needed before a message is produced: an encoded RECV and its delimiter */
+#define RECV_ROOM (PLC_COBS_MAX(PLC_BRIDGE_MAX_MESSAGE) + 1)
+#define DONE_ROOM (PLC_COBS_MAX(3) + 1)
+
+/*****************************************************************************
+* Function Name: PLC_Bridge::begin()
+******************************************************************************
+* Summary:
+* Start bridging an initialised PLC device, and tell the PC how many frames it may send
+**
+Parameters:
+* pModem: the PLC device, set up with init() and its local address
+**
+Return:
+* Status of the I2C communication
+**
+Note:
+* The PLC device is enabled to both transmit and receive, whichever role init() gave it. RX_Override is
+* cleared, so a frame the PC has not yet made room for stays in the PLC device and a later one is dropped
+* and reported, instead of silently overwriting it.
+*****************************************************************************/
+byte PLC_Bridge::begin(PLC_I2C *pModem)
+{
+	byte abReady[3] = { PLC_BRIDGE_READY, PLC_BRIDGE_QUEUE, PLC_BRIDGE_VERSION };
+	byte bPLCMode;
+
+	this->pModem = pModem;
+	memset(&stats, 0, sizeof(stats));
+	dispatcher.begin();
+	dispatcher.SetDefault(OnFrame, this);
+	bQueueHead = 0;
+	bQueued = 0;
+	bOnLine = false;
+	bHelloPending = false;
+	bLastDAType = 0xFF;
+	bInLength = 0;
+	bOutHead = 0;
+	bOutTail = 0;
+	Send(abReady, sizeof(abReady));
+
+	if (pModem->ReadFromOffset(PLC_Mode, &bPLCMode, 1) != I2C_SUCCESS)
+	{
+		return I2C_FAIL;
+	}
+	bPLCMode = (bPLCMode | TX_Enable | RX_Enable) & ~RX_Override;
+	return pModem->WriteToOffset(PLC_Mode, &bPLCMode, 1);
+}
+
+/*****************************************************************************
+* Function Name: PLC_Bridge::Input()
+******************************************************************************
+* Summary:
+* Take one byte received on Serial
+**
+Parameters:
+* bData: the byte
+**
+Return:
+* None
+**
+Note:
+* A message is acted on when its delimiter arrives. One that is too long to be valid is skipped up to the
+* next delimiter and counted.
+*****************************************************************************/
+void PLC_Bridge::Input(byte bData)
+{
+	byte bLength;
+
+	if (bData != 0x00)
+	{
+		if (bInLength == IN_SKIPPING)
+		{
+			return;
+		}
+		if (bInLength >= sizeof(abIn))
+		{
+			bInLength = IN_SKIPPING;
+			stats.wBadMessages++;
+			return;
+		}
+		abIn[bInLength++] = bData;
+		return;
+	}
+
+	bLength = (bInLength == IN_SKIPPING) ? 0 : bInLength;
+	bInLength = 0;
+	if (bLength == 0)
+	{
+		return;
+	}
+	bLength = PLC_CobsDecode(abIn, bLength);
+	if (bLength == 0)
+	{
+		stats.wBadMessages++;
+		return;
+	}
+	HandleMessage(abIn, bLength);
+}
+
+/*****************************************************************************
+* Function Name: PLC_Bridge::Service()
+******************************************************************************
+* Summary:
+* Move frames between the TX queue, the PLC device and the Serial output
+**
+Parameters:
+* None
+**
+Return:
+* Number of frames finished, started or received in this pass. Zero means the caller may sleep until
+* Serial input or a HOST_INT.
+**
+Note:
+* Results and received frames are only collected while the output has room for them. The destination
+* address is only written to the PLC device when it differs from the previous frame's.
+*****************************************************************************/
+byte PLC_Bridge::Service(void)
+{
+	byte abReady[3] = { PLC_BRIDGE_READY, PLC_BRIDGE_QUEUE, PLC_BRIDGE_VERSION };
+	byte bEvents = 0;
+	byte bStatus;
+	TxSlot *pSlot;
+
+	if (bOnLine && OutputFree() >= DONE_ROOM)
+	{
+		bStatus = pModem->PollTransmit();
+		if (bStatus != PLC_TX_PENDING)
+		{
+			stats.wSent++;
+			bOnLine = false;
+			Retire(bStatus);
+			bEvents++;
+		}
+	}
+
+	while (!bOnLine && bQueued > 0)
+	{
+		pSlot = &aQueue[bQueueHead];
+		if (pSlot->bDAType != bLastDAType || memcmp(pSlot->abDA, abLastDA, sizeof(abLastDA)) != 0)
+		{
+			bLastDAType = 0xFF;
+			if (pModem->SetDestinationAddress(pSlot->bDAType, pSlot->abDA) != I2C_SUCCESS)
+			{
+				if (OutputFree() < DONE_ROOM)
+				{
+					break;
+				}
+				stats.wRejected++;
+				Retire(PLC_BRIDGE_REJECTED);
+				continue;
+			}
+			bLastDAType = pSlot->bDAType;
+			memcpy(abLastDA, pSlot->abDA, sizeof(abLastDA));
+		}
+		if (pModem->StartTransmit(pSlot->bCommand, pSlot->abData, pSlot->bLength) != I2C_SUCCESS)
+		{
+			if (OutputFree() < DONE_ROOM)
+			{
+				break;
+			}
+			stats.wRejected++;
+			Retire(PLC_BRIDGE_REJECTED);
+			continue;
+		}
+		bOnLine = true;
+		bEvents++;
+	}
+
+	/* The READY answering a HELLO waits for the results of every frame sent before it */
+	if (bHelloPending && bQueued == 0 && Send(abReady, sizeof(abReady)))
+	{
+		bHelloPending = false;
+	}
+
+	if (OutputFree() >= RECV_ROOM && (pModem->ReadStatus() & Status_RX_Data_Available))
+	{
+		while (OutputFree() >= RECV_ROOM && dispatcher.Poll(pModem))
+		{
+			bEvents++;
+		}
+	}
+	return bEvents;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Bridge::Output()
+******************************************************************************
+* Summary:
+* Take encoded bytes for Serial out of the output ring
+**
+Parameters:
+* pbData: where to put them
+* bMax: room in pbData, e.g. Serial.availableForWrite() so the write does not block
+**
+Return:
+* Number of bytes taken
+**
+Note:
+*
+*****************************************************************************/
+byte PLC_Bridge::Output(byte *pbData, byte bMax)
+{
+	byte bCount = 0;
+
+	while (bCount < bMax && bOutTail != bOutHead)
+	{
+		pbData[bCount++] = abOut[bOutTail];
+		bOutTail = (bOutTail + 1) & OUT_MASK;
+	}
+	return bCount;
+}
+
+/* Act on one decoded message from the PC */
+void PLC_Bridge::HandleMessage(byte *pbMessage, byte bLength)
+{
+	byte bDALength;
+	TxSlot *pSlot;
+
+	if (pbMessage[0] == PLC_BRIDGE_HELLO)
+	{
+		bHelloPending = true;
+		return;
+	}
+	if (pbMessage[0] != PLC_BRIDGE_SEND || bLength < 3)
+	{
+		stats.wBadMessages++;
+		return;
+	}
+
+	bDALength = (pbMessage[2] == TX_DA_Type_Phy) ? 8 : 1;
+	/* A SEND that cannot be queued, such as one sent without credit, is answered at once if there is room */
+	if (bLength < 3 + bDALength + 1 || bLength - 3 - bDALength - 1 > MAX_PLC_PACKET_LENGTH
+		|| bQueued >= PLC_BRIDGE_QUEUE || bHelloPending)
+	{
+		stats.wRejected++;
+		if (OutputFree() >= DONE_ROOM)
+		{
+			Done(pbMessage[1], PLC_BRIDGE_REJECTED);
+		}
+		return;
+	}
+
+	pSlot = &aQueue[(bQueueHead + bQueued) % PLC_BRIDGE_QUEUE];
+	bQueued++;
+	pSlot->bSeq = pbMessage[1];
+	pSlot->bDAType = pbMessage[2];
+	memset(pSlot->abDA, 0, sizeof(pSlot->abDA));
+	memcpy(pSlot->abDA, &pbMessage[3], bDALength);
+	pSlot->bCommand = pbMessage[3 + bDALength];
+	pSlot->bLength = bLength - 3 - bDALength - 1;
+	memcpy(pSlot->abData, &pbMessage[3 + bDALength + 1], pSlot->bLength);
+}
+
+/* Report the result of the frame at the head of the queue and free its slot, which returns the PC's credit */
+void PLC_Bridge::Retire(byte bStatus)
+{
+	Done(aQueue[bQueueHead].bSeq, bStatus);
+	bQueueHead = (bQueueHead + 1) % PLC_BRIDGE_QUEUE;
+	bQueued--;
+}
+
+void PLC_Bridge::Done(byte bSeq, byte bStatus)
+{
+	byte abDone[3] = { PLC_BRIDGE_DONE, bSeq, bStatus };
+
+	Send(abDone, sizeof(abDone));
+}
+
+/* Dispatcher default handler: pass every received frame to the PC */
+void PLC_Bridge::OnFrame(const PLC_Frame *pFrame, void *pContext)
+{
+	PLC_Bridge *pBridge = (PLC_Bridge *)pContext;
+	byte abRecv[PLC_BRIDGE_MAX_MESSAGE];
+	byte bSALength = (pFrame->bInfo & RX_SA_PHY) ? 8 : 2;
+
+	abRecv[0] = PLC_BRIDGE_RECV;
+	abRecv[1] = pFrame->bInfo;
+	memcpy(&abRecv[2], pFrame->pbSource, bSALength);
+	abRecv[2 + bSALength] = pFrame->bCommand;
+	memcpy(&abRecv[3 + bSALength], pFrame->pbData, pFrame->bLength);
+	if (pBridge->Send(abRecv, 3 + bSALength + pFrame->bLength))
+	{
+		pBridge->stats.wReceived++;
+	}
+}
+
+/* Queue one message for the PC, COBS encoded and delimited, or nothing if it does not fit */
+bool PLC_Bridge::Send(const byte *pbMessage, byte bLength)
+{
+	byte abEncoded[PLC_COBS_MAX(PLC_BRIDGE_MAX_MESSAGE)];
+	byte bEncoded;
+	byte i;
+
+	if (PLC_COBS_MAX(bLength) + 1 > OutputFree())
+	{
+		return false;
+	}
+	bEncoded = PLC_CobsEncode(pbMessage, bLength, abEncoded);
+	for (i = 0; i < bEncoded; i++)
+	{
+		abOut[bOutHead] = abEncoded[i];
+		bOutHead = (bOutHead + 1) & OUT_MASK;
+	}
+	abOut[bOutHead] = 0x00;
+	bOutHead = (bOutHead + 1) & OUT_MASK;
+	return true;
+}
+
+/* Output ring room; one slot stays empty to tell a full ring from an empty one */
+byte PLC_Bridge::OutputFree(void)
+{
+	return OUT_MASK - ((bOutHead - bOutTail) & OUT_MASK);
+}
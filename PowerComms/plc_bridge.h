@@ -0,0 +1,95 @@
+/*
+* File Name: plc_bridge.h
+**
+Version: 2.1
+**
+Description:
+* Serial bridge: lets a PC use the Arduino and its PLC device as a powerline network interface.
+* Messages on Serial are COBS framed (plc_cobs.h), each ended by a 0x00. The PC sends frames to transmit and
+* gets back their results and every frame received. Sending is credit based: each credit is a free slot of
+* the bridge's TX queue and comes back with the result of a frame, so the PC can keep the queue full without
+* ever overrunning it. Received frames are only taken out of the PLC device while the Serial output has room
+* for them, so when the PC falls behind, frames are dropped by the PLC device (Status_RX_Packet_Dropped)
+* rather than half written to Serial.
+**
+Note:
+* Messages, first byte the type:
+*   PC to bridge  PLC_BRIDGE_SEND   seq, DA type (TX_DA_Type_*), DA (8 bytes if physical, else 1), command, payload
+*                 PLC_BRIDGE_HELLO  (nothing) - resynchronise the credits
+*   bridge to PC  PLC_BRIDGE_READY  credits (the free queue slots), PLC_BRIDGE_VERSION
+*                 PLC_BRIDGE_DONE   seq, status (PollTransmit() result, or PLC_BRIDGE_REJECTED)
+*                 PLC_BRIDGE_RECV   RX_Message_INFO, source address (8 bytes if RX_SA_PHY, else 2), command, payload
+* No 0x00 is ever sent other than as a delimiter; the bridge never blocks on Serial and never waits for the
+* line, so Service() can be called from a loop doing other work.
+*/
+
+#ifndef PLC_BRIDGE_H
+#define PLC_BRIDGE_H
+
+#include "plc_i2c.h"
+#include "plc_dispatch.h"
+#include "plc_cobs.h"
+
+#define PLC_BRIDGE_VERSION		1
+
+#define PLC_BRIDGE_SEND			0x01
+#define PLC_BRIDGE_HELLO		0x02
+#define PLC_BRIDGE_READY		0x81
+#define PLC_BRIDGE_DONE			0x82
+#define PLC_BRIDGE_RECV			0x83
+
+#define PLC_BRIDGE_REJECTED		0x00	/* DONE status of a SEND that was malformed or had no credit */
+
+#define PLC_BRIDGE_QUEUE		3		/* TX queue slots: one frame on the line, the rest ready to follow it */
+#define PLC_BRIDGE_MAX_MESSAGE	(1 + 1 + 1 + 8 + 1 + MAX_PLC_PACKET_LENGTH)		/* Longest decoded message */
+#define PLC_BRIDGE_OUT_RING		128		/* Bytes of encoded output, a power of 2 */
+
+struct PLC_BridgeStats {
+    word wSent;					/* Frames the PLC device finished, whatever the result */
+    word wReceived;				/* Frames passed to the PC */
+    word wRejected;
+    word wBadMessages;			/* Serial input that did not decode */
+};
+
+class PLC_Bridge {
+  public:
+    byte begin(PLC_I2C *pModem);
+    void Input(byte bData);
+    byte Service(void);
+    byte Output(byte *pbData, byte bMax);
+
+    PLC_BridgeStats stats;
+  private:
+    struct TxSlot {
+        byte bSeq;
+        byte bDAType;
+        byte abDA[8];
+        byte bCommand;
+        byte bLength;
+        byte abData[MAX_PLC_PACKET_LENGTH];
+    };
+
+    static void OnFrame(const PLC_Frame *pFrame, void *pContext);
+    void HandleMessage(byte *pbMessage, byte bLength);
+    void Retire(byte bStatus);
+    void Done(byte bSeq, byte bStatus);
+    bool Send(const byte *pbMessage, byte bLength);
+    byte OutputFree(void);
+
+    PLC_I2C *pModem;
+    PLC_Dispatcher dispatcher;
+    TxSlot aQueue[PLC_BRIDGE_QUEUE];
+    byte bQueueHead;			/* Oldest queued frame; on the line if bOnLine */
+    byte bQueued;
+    bool bOnLine;
+    bool bHelloPending;
+    byte bLastDAType;			/* Destination last written to the PLC device; 0xFF when unknown */
+    byte abLastDA[8];
+    byte abIn[PLC_COBS_MAX(PLC_BRIDGE_MAX_MESSAGE)];
+    byte bInLength;				/* Encoded bytes since the last delimiter, or 0xFF while skipping an overlong one */
+    byte abOut[PLC_BRIDGE_OUT_RING];
+    byte bOutHead;
+    byte bOutTail;
+};
+
+#endif
@@ -0,0 +1,428 @@
+#include "plc_bulk.h"
+
+/* Dispatcher handler for CMD_BULK, see PLC_BulkReceiver::Attach() */
+static void OnBulkFrame(const PLC_Frame *pFrame, void *pContext)
+{
+	((PLC_BulkReceiver *)pContext)->OnFrame(pFrame);
+}
+
+/*****************************************************************************
+* Function Name: PLC_BulkSender::begin()
+******************************************************************************
+* Summary:
+* Set the group size and parity frames per group of the transfers to come
+**
+Parameters:
+* bGroup: fragments per group, 1 to PLC_BULK_MAX_GROUP
+* bParity: parity frames per group, 0 to bGroup
+**
+Return:
+* FALSE for a group size or parity count out of range
+**
+Note:
+*
+*****************************************************************************/
+bool PLC_BulkSender::begin(byte bGroup, byte bParity)
+{
+	if (bGroup == 0 || bGroup > PLC_BULK_MAX_GROUP || bParity > bGroup)
+	{
+		return false;
+	}
+	this->bGroup = bGroup;
+	this->bParity = bParity;
+	bTransfer = 0;
+	bFragments = 0;
+	bCursorGroup = 0;
+	bCursorStep = 0;
+	return true;
+}
+
+/*****************************************************************************
+* Function Name: PLC_BulkSender::Start()
+******************************************************************************
+* Summary:
+* Start a new transfer, dropping what is left of the current one
+**
+Parameters:
+* pbData: the data, which must stay in place until Busy() returns FALSE
+* wLength: its length, 1 to PLC_BULK_MAX_BYTES
+**
+Return:
+* FALSE if the length is out of range
+**
+Note:
+*
+*****************************************************************************/
+bool PLC_BulkSender::Start(const byte *pbData, word wLength)
+{
+	if (wLength == 0 || wLength > PLC_BULK_MAX_BYTES)
+	{
+		return false;
+	}
+	this->pbData = pbData;
+	this->wLength = wLength;
+	bFragments = (byte)((wLength + PLC_BULK_CHUNK - 1) / PLC_BULK_CHUNK);
+	bTransfer++;
+	bCursorGroup = 0;
+	bCursorStep = 0;
+	bLastGroup = 0;
+	bLastStep = 0;
+	return true;
+}
+
+/*****************************************************************************
+* Function Name: PLC_BulkSender::Next()
+******************************************************************************
+* Summary:
+* Fill in the payload of the transfer's next CMD_BULK frame
+**
+Parameters:
+* pbPayload: MAX_PLC_PACKET_LENGTH bytes
+**
+Return:
+* The payload length, or PLC_NO_FRAME once every frame has been handed out
+**
+Note:
+* Parity frames are computed here from the application's data, so nothing is buffered.
+* The signature suits a PLC_FrameSource or PLC_TdmaSource wrapper as well as a TransmitPacket() loop.
+*****************************************************************************/
+byte PLC_BulkSender::Next(byte *pbPayload)
+{
+	byte *pbChunk = &pbPayload[PLC_BulkHeader::bLength];
+	byte bFirst = bCursorGroup * bGroup;
+	byte bCount;
+	byte bParityCount;
+	byte bClass;
+	byte bLength;
+	byte bIndex;
+	byte i;
+
+	if (!Busy())
+	{
+		return PLC_NO_FRAME;
+	}
+	bCount = GroupSize(bCursorGroup);
+	bParityCount = (bParity < bCount) ? bParity : bCount;
+
+	if (bCursorStep < bCount)
+	{
+		bIndex = bFirst + bCursorStep;
+		bClass = 0;
+		bLength = FragmentLength(bIndex);
+		memcpy(pbChunk, &pbData[(word)bIndex * PLC_BULK_CHUNK], bLength);
+	}
+	else
+	{
+		/* Fragments only get shorter towards the end, so the first of the class is the longest */
+		bIndex = bCursorGroup;
+		bClass = bCursorStep - bCount + 1;
+		bLength = FragmentLength(bFirst + bClass - 1);
+		memset(pbChunk, 0, bLength);
+		for (i = bFirst + bClass - 1; i < bFirst + bCount; i += bParity)
+		{
+			const byte *pbFragment = &pbData[(word)i * PLC_BULK_CHUNK];
+			byte bFragmentLength = FragmentLength(i);
+
+			for (byte n = 0; n < bFragmentLength; n++)
+			{
+				pbChunk[n] ^= pbFragment[n];
+			}
+		}
+	}
+
+	PLC_BulkHeader::Set<0>(pbPayload, bTransfer);
+	PLC_BulkHeader::Set<1>(pbPayload, bIndex);
+	PLC_BulkHeader::Set<2>(pbPayload, wLength);
+	PLC_BulkHeader::Set<3>(pbPayload, bGroup);
+	PLC_BulkHeader::Set<4>(pbPayload, bParity);
+	PLC_BulkHeader::Set<5>(pbPayload, bClass);
+
+	bLastGroup = bCursorGroup;
+	bLastStep = bCursorStep;
+	if (++bCursorStep >= bCount + bParityCount)
+	{
+		bCursorGroup++;
+		bCursorStep = 0;
+	}
+	return PLC_BulkHeader::bLength + bLength;
+}
+
+/*****************************************************************************
+* Function Name: PLC_BulkSender::Repeat()
+******************************************************************************
+* Summary:
+* Have the next Next() return the same frame as the last one
+**
+Note:
+* For a frame that was not acknowledged, when there is no parity to cover it
+*****************************************************************************/
+void PLC_BulkSender::Repeat(void)
+{
+	bCursorGroup = bLastGroup;
+	bCursorStep = bLastStep;
+}
+
+/*****************************************************************************
+* Function Name: PLC_BulkSender::Busy()
+******************************************************************************
+* Summary:
+* Responds TRUE while the transfer has frames left to hand out
+*****************************************************************************/
+bool PLC_BulkSender::Busy(void)
+{
+	return (word)bCursorGroup * bGroup < bFragments;
+}
+
+/*****************************************************************************
+* Function Name: PLC_BulkSender::Frames()
+******************************************************************************
+* Summary:
+* Number of frames the current transfer takes, parity frames included
+*****************************************************************************/
+word PLC_BulkSender::Frames(void)
+{
+	word wFrames = 0;
+	byte bCount;
+
+	for (byte g = 0; (word)g * bGroup < bFragments; g++)
+	{
+		bCount = GroupSize(g);
+		wFrames += bCount + ((bParity < bCount) ? bParity : bCount);
+	}
+	return wFrames;
+}
+
+/* Fragments in a group: bGroup, except for a short last group */
+byte PLC_BulkSender::GroupSize(byte bGroupIndex)
+{
+	byte bFirst = bGroupIndex * bGroup;
+
+	return (bFragments - bFirst < bGroup) ? bFragments - bFirst : bGroup;
+}
+
+byte PLC_BulkSender::FragmentLength(byte bIndex)
+{
+	word wOffset = (word)bIndex * PLC_BULK_CHUNK;
+
+	return (wLength - wOffset < PLC_BULK_CHUNK) ? (byte)(wLength - wOffset) : PLC_BULK_CHUNK;
+}
+
+/*****************************************************************************
+* Function Name: PLC_BulkReceiver::begin()
+******************************************************************************
+* Summary:
+* Set the buffer transfers are received into and the completion callback
+**
+Parameters:
+* pbBuffer: room for the longest transfer expected
+* wSize: its size; longer transfers are rejected
+* pfnDone: called once for each complete transfer
+* pContext: passed to pfnDone
+**
+Return:
+* None
+**
+Note:
+*
+*****************************************************************************/
+void PLC_BulkReceiver::begin(byte *pbBuffer, word wSize, PLC_BulkDone pfnDone, void *pContext)
+{
+	this->pbBuffer = pbBuffer;
+	this->wSize = wSize;
+	this->pfnDone = pfnDone;
+	this->pContext = pContext;
+	bActive = false;
+	bDone = false;
+	wCompleted = 0;
+	wRebuilt = 0;
+	wAbandoned = 0;
+	wRejected = 0;
+}
+
+/*****************************************************************************
+* Function Name: PLC_BulkReceiver::Attach()
+******************************************************************************
+* Summary:
+* Have a dispatcher pass CMD_BULK frames to this receiver
+**
+Return:
+* FALSE if the dispatcher has no handler slot left
+*****************************************************************************/
+bool PLC_BulkReceiver::Attach(PLC_Dispatcher *pDispatcher)
+{
+	return pDispatcher->Register(CMD_BULK, OnBulkFrame, this);
+}
+
+/*****************************************************************************
+* Function Name: PLC_BulkReceiver::OnFrame()
+******************************************************************************
+* Summary:
+* Take in a CMD_BULK frame: store a fragment, or rebuild one from a parity frame
+**
+Parameters:
+* pFrame: the frame
+**
+Return:
+* None
+**
+Note:
+* Repeats of a fragment already held are ignored, so acknowledged fragments need no duplicate filter.
+*****************************************************************************/
+void PLC_BulkReceiver::OnFrame(const PLC_Frame *pFrame)
+{
+	const byte *pbChunk = &pFrame->pbData[PLC_BulkHeader::bLength];
+	byte bTransfer;
+	byte bIndex;
+	byte bClass;
+	byte bLength;
+	byte bGroup;
+	byte bParity;
+	word wLength;
+
+	if (pFrame->bLength < PLC_BulkHeader::bLength)
+	{
+		return;
+	}
+	bTransfer = (byte)PLC_BulkHeader::Get<0>(pFrame->pbData);
+	bIndex = (byte)PLC_BulkHeader::Get<1>(pFrame->pbData);
+	wLength = (word)PLC_BulkHeader::Get<2>(pFrame->pbData);
+	bGroup = (byte)PLC_BulkHeader::Get<3>(pFrame->pbData);
+	bParity = (byte)PLC_BulkHeader::Get<4>(pFrame->pbData);
+	bClass = (byte)PLC_BulkHeader::Get<5>(pFrame->pbData);
+	bLength = pFrame->bLength - PLC_BulkHeader::bLength;
+
+	if (!bActive || memcmp(abSource, pFrame->pbSource, sizeof(abSource)) != 0 || bTransfer != this->bTransfer
+		|| wLength != this->wLength || bGroup != this->bGroup || bParity != this->bParity)
+	{
+		if (bActive && !bDone)
+		{
+			wAbandoned++;
+		}
+		bActive = false;
+		if (wLength == 0 || wLength > wSize)
+		{
+			wRejected++;
+			return;
+		}
+		bActive = true;
+		bDone = false;
+		memcpy(abSource, pFrame->pbSource, sizeof(abSource));
+		this->bTransfer = bTransfer;
+		this->wLength = wLength;
+		bFragments = (byte)((wLength + PLC_BULK_CHUNK - 1) / PLC_BULK_CHUNK);
+		this->bGroup = bGroup;
+		this->bParity = bParity;
+		bReceived = 0;
+		memset(abHave, 0, sizeof(abHave));
+	}
+	if (bDone)
+	{
+		return;
+	}
+
+	if (bClass == 0)
+	{
+		if (bIndex < bFragments && !Have(bIndex) && bLength >= FragmentLength(bIndex))
+		{
+			memcpy(&pbBuffer[(word)bIndex * PLC_BULK_CHUNK], pbChunk, FragmentLength(bIndex));
+			abHave[bIndex >> 3] |= 1 << (bIndex & 7);
+			bReceived++;
+		}
+	}
+	else if (bGroup != 0 && bClass <= bParity)
+	{
+		Rebuild(bIndex, bClass, pbChunk, bLength);
+	}
+
+	if (bReceived == bFragments)
+	{
+		bDone = true;
+		wCompleted++;
+		if (pfnDone != NULL)
+		{
+			pfnDone(pContext, pbBuffer, wLength);
+		}
+	}
+}
+
+/*****************************************************************************
+* Function Name: PLC_BulkReceiver::Complete()
+******************************************************************************
+* Summary:
+* Responds TRUE when the last transfer followed was received whole
+*****************************************************************************/
+bool PLC_BulkReceiver::Complete(void)
+{
+	return bActive && bDone;
+}
+
+/* Rebuild the one missing fragment of a parity class, if exactly one is missing */
+void PLC_BulkReceiver::Rebuild(byte bGroupIndex, byte bClass, const byte *pbParity, byte bLength)
+{
+	byte abChunk[PLC_BULK_CHUNK];
+	word wFirst = (word)bGroupIndex * bGroup;
+	word wEnd = wFirst + bGroup;
+	byte bMissing = 0xFF;
+	word i;
+
+	if (wFirst >= bFragments)
+	{
+		return;
+	}
+	if (wEnd > bFragments)
+	{
+		wEnd = bFragments;
+	}
+	for (i = wFirst + bClass - 1; i < wEnd; i += bParity)
+	{
+		if (!Have((byte)i))
+		{
+			if (bMissing != 0xFF)
+			{
+				return;
+			}
+			bMissing = (byte)i;
+		}
+	}
+	if (bMissing == 0xFF || bLength < FragmentLength(bMissing))
+	{
+		return;
+	}
+
+	memcpy(abChunk, pbParity, FragmentLength(bMissing));
+	for (i = wFirst + bClass - 1; i < wEnd; i += bParity)
+	{
+		const byte *pbFragment = &pbBuffer[i * PLC_BULK_CHUNK];
+		byte bFragmentLength = FragmentLength((byte)i);
+
+		if (i == bMissing)
+		{
+			continue;
+		}
+		/* Only the missing fragment's bytes matter; the others' beyond its length are ignored */
+		if (bFragmentLength > FragmentLength(bMissing))
+		{
+			bFragmentLength = FragmentLength(bMissing);
+		}
+		for (byte n = 0; n < bFragmentLength; n++)
+		{
+			abChunk[n] ^= pbFragment[n];
+		}
+	}
+	memcpy(&pbBuffer[(word)bMissing * PLC_BULK_CHUNK], abChunk, FragmentLength(bMissing));
+	abHave[bMissing >> 3] |= 1 << (bMissing & 7);
+	bReceived++;
+	wRebuilt++;
+}
+
+byte PLC_BulkReceiver::FragmentLength(byte bIndex)
+{
+	word wOffset = (word)bIndex * PLC_BULK_CHUNK;
+
+	return (wLength - wOffset < PLC_BULK_CHUNK) ? (byte)(wLength - wOffset) : PLC_BULK_CHUNK;
+}
+
+bool PLC_BulkReceiver::Have(byte bIndex)
+{
+	return (abHave[bIndex >> 3] & (1 << (bIndex & 7))) != 0;
+}
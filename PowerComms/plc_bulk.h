@@ -0,0 +1,105 @@
+/*
+* File Name: plc_bulk.h
+**
+Version: 2.1
+**
+Description:
+* Bulk transfers of up to PLC_BULK_MAX_BYTES, split into CMD_BULK fragments, with optional parity frames.
+* The fragments are grouped, bGroup to a group, and each group is followed by up to bParity parity frames.
+* Parity frame j of a group is the XOR of the group's fragments j, j + bParity, j + 2 * bParity and so on.
+* When the receiver is missing a single fragment of those, it rebuilds it from the parity frame and the
+* others, without asking for it again. So a group survives any burst of up to bParity lost frames, and
+* generally any loss that leaves no two missing fragments in the same parity class.
+* With bParity 0 nothing is added. A lost fragment then has to be sent again, which the sender does by
+* calling Repeat() after a frame that was not acknowledged.
+**
+Note:
+* Every fragment carries a PLC_BulkHeader: transfer number, fragment index (the group number for a parity
+* frame), total length, group size, parity count and class (0 for data, j + 1 for parity frame j). A receiver
+* therefore needs no setup per transfer, and a transfer can be picked up from any of its frames.
+* Parity frames are worth most sent unacknowledged: the PLC device's retries and the ACK wait are what the
+* parity replaces. The sender does not set the service type; the application does, in TX_Config.
+* The receiver follows one transfer at a time, from one source. A frame of another transfer starts it over,
+* and the unfinished one is counted as abandoned. A frame belongs to another transfer when its source (both
+* RX_SA bytes), its transfer number, or its length, group size or parity count differ, so a sender that was
+* reset and numbers its transfers from 1 again is followed once its transfer differs in any of these.
+*/
+
+#ifndef PLC_BULK_H
+#define PLC_BULK_H
+
+#include "plc_i2c.h"
+#include "plc_scheduler.h"	/* PLC_NO_FRAME */
+#include "plc_dispatch.h"
+#include "plc_schema.h"
+
+#define CMD_BULK				0x21		/* Application command ID, see CMD_TDMA_BEACON */
+#define PLC_BULK_MAX_GROUP		15
+#define PLC_BULK_MAX_BYTES		4095		/* Largest length the header can carry */
+
+/* Transfer number, fragment index or group number, total length, group size, parity count, class */
+typedef PLC_Schema<8, 8, 12, 4, 4, 4> PLC_BulkHeader;
+
+#define PLC_BULK_CHUNK			(MAX_PLC_PACKET_LENGTH - PLC_BulkHeader::bLength)	/* Data bytes per fragment */
+#define PLC_BULK_MAX_FRAGMENTS	((PLC_BULK_MAX_BYTES + PLC_BULK_CHUNK - 1) / PLC_BULK_CHUNK)
+
+/* Called once a transfer is complete, with the data in the receiver's buffer */
+typedef void (*PLC_BulkDone)(void *pContext, const byte *pbData, word wLength);
+
+class PLC_BulkSender {
+  public:
+    bool begin(byte bGroup, byte bParity);
+    bool Start(const byte *pbData, word wLength);
+    byte Next(byte *pbPayload);
+    void Repeat(void);
+    bool Busy(void);
+    word Frames(void);
+  private:
+    byte GroupSize(byte bGroupIndex);
+    byte FragmentLength(byte bIndex);
+
+    const byte *pbData;		/* The application's data, read as the frames go out */
+    word wLength;
+    byte bFragments;
+    byte bGroup;
+    byte bParity;
+    byte bTransfer;
+    byte bCursorGroup;		/* Frame Next() returns next: group, and step within the group's frames */
+    byte bCursorStep;
+    byte bLastGroup;		/* Frame Next() returned last, for Repeat() */
+    byte bLastStep;
+};
+
+class PLC_BulkReceiver {
+  public:
+    void begin(byte *pbBuffer, word wSize, PLC_BulkDone pfnDone, void *pContext = NULL);
+    bool Attach(PLC_Dispatcher *pDispatcher);
+    void OnFrame(const PLC_Frame *pFrame);
+    bool Complete(void);
+
+    word wCompleted;		/* Transfers received whole */
+    word wRebuilt;			/* Fragments rebuilt from parity */
+    word wAbandoned;		/* Transfers replaced by another before they were complete */
+    word wRejected;			/* Transfers longer than the buffer */
+  private:
+    void Rebuild(byte bGroupIndex, byte bClass, const byte *pbParity, byte bLength);
+    byte FragmentLength(byte bIndex);
+    bool Have(byte bIndex);
+
+    byte *pbBuffer;
+    word wSize;
+    PLC_BulkDone pfnDone;
+    void *pContext;
+    bool bActive;			/* A transfer is being followed */
+    bool bDone;				/* ... and it is complete */
+    byte abSource[2];		/* First two bytes of its RX_SA: a logical address, or the start of a physical one */
+    byte bTransfer;
+    word wLength;
+    byte bFragments;
+    byte bGroup;
+    byte bParity;
+    byte bReceived;			/* Fragments in the buffer */
+    byte abHave[(PLC_BULK_MAX_FRAGMENTS + 7) / 8];
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include "plc_cobs.h"
+
+/*****************************************************************************
+* Function Name: PLC_CobsEncode()
+******************************************************************************
+* Summary:
+* Encode a message so it contains no 0x00 bytes
+**
+Parameters:
+* pbData: the message
+* bLength: its length
+* pbOut: room for PLC_COBS_MAX(bLength) bytes. Must not overlap pbData.
+**
+Return:
+* Length of the encoded message
+**
+Note:
+* The 0x00 delimiter is not written.
+*****************************************************************************/
+byte PLC_CobsEncode(const byte *pbData, byte bLength, byte *pbOut)
+{
+	byte bCode = 1;
+	byte bCodeAt = 0;
+	byte bOut = 1;
+	byte i;
+
+	for (i = 0; i < bLength; i++)
+	{
+		if (pbData[i] != 0x00)
+		{
+			pbOut[bOut++] = pbData[i];
+			bCode++;
+		}
+		if (pbData[i] == 0x00 || bCode == 0xFF)
+		{
+			pbOut[bCodeAt] = bCode;
+			bCodeAt = bOut++;
+			bCode = 1;
+		}
+	}
+	pbOut[bCodeAt] = bCode;
+	return bOut;
+}
+
+/*****************************************************************************
+* Function Name: PLC_CobsDecode()
+******************************************************************************
+* Summary:
+* Decode a message in place
+**
+Parameters:
+* pbData: the encoded message, without its 0x00 delimiter
+* bLength: its length
+**
+Return:
+* Length of the decoded message, or 0 if it is not valid COBS
+**
+Note:
+* Decoding never makes a message longer, so it is done in the same buffer.
+*****************************************************************************/
+byte PLC_CobsDecode(byte *pbData, byte bLength)
+{
+	byte bIn = 0;
+	byte bOut = 0;
+	byte bCode;
+	byte i;
+
+	while (bIn < bLength)
+	{
+		bCode = pbData[bIn++];
+		if (bCode == 0x00 || (word)bIn + bCode - 1 > bLength)
+		{
+			return 0;
+		}
+		for (i = 1; i < bCode; i++)
+		{
+			pbData[bOut++] = pbData[bIn++];
+		}
+		if (bCode != 0xFF && bIn < bLength)
+		{
+			pbData[bOut++] = 0x00;
+		}
+	}
+	return bOut;
+}
@@ -0,0 +1,30 @@
+/*
+* File Name: plc_cobs.h
+**
+Version: 2.1
+**
+Description:
+* Consistent Overhead Byte Stuffing, used to frame messages on a byte stream such as Serial.
+* An encoded message contains no 0x00 bytes, so a 0x00 can mark the end of each message, and a receiver that
+* joins the stream at any point is back in step after the next 0x00. The overhead is one byte per 254 bytes
+* of message.
+**
+Note:
+* The encoded form of bLength bytes takes at most PLC_COBS_MAX(bLength) bytes, without the 0x00 delimiter.
+*/
+
+#ifndef PLC_COBS_H
+#define PLC_COBS_H
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#define PLC_COBS_MAX(length)	((length) + (length) / 254 + 1)
+
+byte PLC_CobsEncode(const byte *pbData, byte bLength, byte *pbOut);
+byte PLC_CobsDecode(byte *pbData, byte bLength);
+
+#endif
@@ -0,0 +1,149 @@
+#include "plc_dedup.h"
+
+/*****************************************************************************
+* Function Name: PLC_DedupCache::begin()
+******************************************************************************
+* Summary:
+* Forget all sources and clear the counters
+**
+Parameters:
+* None
+**
+Return:
+* None
+**
+Note:
+*
+*****************************************************************************/
+void PLC_DedupCache::begin(void)
+{
+	bCount = 0;
+	wChecks = 0;
+	wDuplicates = 0;
+}
+
+/*****************************************************************************
+* Function Name: PLC_DedupCache::Check()
+******************************************************************************
+* Summary:
+* Tell a new frame from a repeat of one already received, and remember its tag
+**
+Parameters:
+* bInfo: RX_Message_INFO of the frame, for the source address type
+* pbSource: RX_SA of the frame, 8 bytes
+* bTag: the frame's sequence tag
+**
+Return:
+* TRUE for a new frame, FALSE for a duplicate
+**
+Note:
+* A source that is not in the cache takes the place of the one heard from least recently.
+* PLC_DEDUP_TAG_RESET marks the source's first frame after boot: its window is cleared before the check.
+*****************************************************************************/
+bool PLC_DedupCache::Check(byte bInfo, const byte *pbSource, byte bTag)
+{
+	bool bPhysical = (bInfo & RX_SA_PHY) != 0;
+	byte bLength = bPhysical ? 8 : 2;
+	PLC_DedupSource *pSource = NULL;
+	byte i;
+
+	wChecks++;
+	for (i = 0; i < bCount; i++)
+	{
+		if (aSources[i].bPhysical == bPhysical && memcmp(aSources[i].abAddress, pbSource, bLength) == 0)
+		{
+			pSource = &aSources[i];
+			break;
+		}
+	}
+
+	if (pSource == NULL)
+	{
+		if (bCount < PLC_DEDUP_SOURCES)
+		{
+			pSource = &aSources[bCount++];
+		}
+		else
+		{
+			pSource = &aSources[0];
+			for (i = 1; i < bCount; i++)
+			{
+				if ((word)(wChecks - aSources[i].wLastHeard) > (word)(wChecks - pSource->wLastHeard))
+				{
+					pSource = &aSources[i];
+				}
+			}
+		}
+		memset(pSource, 0, sizeof(*pSource));
+		memcpy(pSource->abAddress, pbSource, bLength);
+		pSource->bPhysical = bPhysical;
+	}
+	pSource->wLastHeard = wChecks;
+
+	if (bTag == PLC_DEDUP_TAG_RESET)
+	{
+		pSource->bNext = 0;
+		pSource->bFilled = 0;
+	}
+
+	for (i = 0; i < pSource->bFilled; i++)
+	{
+		if (pSource->abTag[i] == bTag)
+		{
+			pSource->wDuplicates++;
+			wDuplicates++;
+			return false;
+		}
+	}
+	pSource->abTag[pSource->bNext] = bTag;
+	pSource->bNext = (pSource->bNext + 1) % PLC_DEDUP_WINDOW;
+	if (pSource->bFilled < PLC_DEDUP_WINDOW)
+	{
+		pSource->bFilled++;
+	}
+	return true;
+}
+
+/*****************************************************************************
+* Function Name: PLC_DedupCache::NextTag()
+******************************************************************************
+* Summary:
+* The sender's tag for the next new frame to a destination
+**
+Parameters:
+* bTag: the tag of the last frame
+**
+Return:
+* bTag plus one, skipping PLC_DEDUP_TAG_RESET when the count wraps
+**
+Note:
+* Start a destination's count at PLC_DEDUP_TAG_RESET at boot.
+*****************************************************************************/
+byte PLC_DedupCache::NextTag(byte bTag)
+{
+	bTag++;
+	if (bTag == PLC_DEDUP_TAG_RESET)
+	{
+		bTag++;
+	}
+	return bTag;
+}
+
+/*****************************************************************************
+* Function Name: PLC_DedupCache::Count() / Entry()
+******************************************************************************
+* Summary:
+* Read the cache, for reporting: the number of sources, and a source by index
+**
+Return:
+* Entry() returns NULL past the last source
+*****************************************************************************/
+byte PLC_DedupCache::Count(void)
+{
+	return bCount;
+}
+
+const PLC_DedupSource *PLC_DedupCache::Entry(byte bIndex)
+{
+	return (bIndex < bCount) ? &aSources[bIndex] : NULL;
+}
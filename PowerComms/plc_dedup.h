@@ -0,0 +1,60 @@
+/*
+* File Name: plc_dedup.h
+**
+Version: 2.1
+**
+Description:
+* Receiver side duplicate suppression for acknowledged frames.
+* When an ACK is lost the sender's PLC device retries, and the receiver gets the same frame again. Frames of
+* a command ID registered as tagged (PLC_Dispatcher::Register()) carry a sequence tag in their first payload
+* byte, and the cache remembers the last PLC_DEDUP_WINDOW tags from each source. A frame whose tag is among
+* them is dropped before it reaches its handler and counted.
+**
+Note:
+* The sender counts the tag up by one for every new frame to a destination (NextTag()); a retry, by the PLC
+* device or by the application resending the same frame, keeps the tag. The first frame after the sender boots
+* carries PLC_DEDUP_TAG_RESET, which the count skips otherwise, and clears the receiver's window for that source,
+* so a rebooted sender counting from the start again is not taken for a repeat. A retry of that first frame is
+* let through once. A single counter is enough for a sender with one
+* destination. With one counter shared by several destinations, a new frame is mistaken for a duplicate
+* once the counter has wrapped back to a tag still in the receiver's window.
+* The cache holds PLC_DEDUP_SOURCES sources and replaces the one heard from least recently, so memory is fixed
+* however many nodes there are. A frame that repeats after its source was replaced is let through.
+*/
+
+#ifndef PLC_DEDUP_H
+#define PLC_DEDUP_H
+
+#include "plc_i2c.h"
+
+#define PLC_DEDUP_SOURCES	8
+#define PLC_DEDUP_WINDOW	4		/* Tags remembered per source */
+#define PLC_DEDUP_TAG_BITS	8		/* Width of the tag, for a PLC_Schema field 0 */
+#define PLC_DEDUP_TAG_RESET	0		/* Tag of the first frame after boot */
+
+struct PLC_DedupSource {
+    byte abAddress[8];			/* RX_SA: the logical address in the first byte, or the physical address */
+    bool bPhysical;
+    byte bNext;					/* Slot of abTag to write next */
+    byte bFilled;				/* Slots of abTag in use */
+    byte abTag[PLC_DEDUP_WINDOW];
+    word wDuplicates;
+    word wLastHeard;			/* Check() count when last heard from, for replacement */
+};
+
+class PLC_DedupCache {
+  public:
+    void begin(void);
+    bool Check(byte bInfo, const byte *pbSource, byte bTag);
+    byte Count(void);
+    const PLC_DedupSource *Entry(byte bIndex);
+    static byte NextTag(byte bTag);
+
+    word wDuplicates;			/* Frames dropped, from all sources */
+  private:
+    PLC_DedupSource aSources[PLC_DEDUP_SOURCES];
+    byte bCount;
+    word wChecks;
+};
+
+#endif
@@ -0,0 +1,263 @@
+#include "plc_dispatch.h"
+
+#define RX_HEADER_LENGTH	(RX_Data - RX_Message_INFO)	/* RX_Message_INFO, RX_SA and RX_CommandID */
+
+/*****************************************************************************
+* Function Name: PLC_Dispatcher::begin()
+******************************************************************************
+* Summary:
+* Forget all handlers and clear the counters
+**
+Parameters:
+* None
+**
+Return:
+* None
+**
+Note:
+*
+*****************************************************************************/
+void PLC_Dispatcher::begin(void)
+{
+	memset(abSlot, 0, sizeof(abSlot));
+	bHandlerCount = 0;
+	pfnDefault = NULL;
+	wTagged = 0;
+	pDedup = NULL;
+	wUnknown = 0;
+	wReadErrors = 0;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Dispatcher::Register()
+******************************************************************************
+* Summary:
+* Route the frames with a command ID to a handler
+**
+Parameters:
+* bCommand: the command ID
+* pfnHandler: called with every frame carrying bCommand
+* pContext: passed to the handler as it is
+* bTagged: the frames carry a sequence tag in their first payload byte, see SetDedup()
+**
+Return:
+* FALSE if PLC_DISPATCH_MAX_HANDLERS command IDs already have a handler
+**
+Note:
+* Registering an ID again replaces its handler and keeps its counter. The handler gets the payload with the
+* tag still in it.
+*****************************************************************************/
+bool PLC_Dispatcher::Register(byte bCommand, PLC_Handler pfnHandler, void *pContext, bool bTagged)
+{
+	byte bSlot = Slot(bCommand);
+
+	if (bSlot == 0)
+	{
+		if (bHandlerCount >= PLC_DISPATCH_MAX_HANDLERS)
+		{
+			return false;
+		}
+		bSlot = ++bHandlerCount;
+		awCount[bSlot - 1] = 0;
+		abSlot[bCommand >> 1] |= (bCommand & 1) ? (bSlot << 4) : bSlot;
+	}
+	apfnHandler[bSlot - 1] = pfnHandler;
+	apContext[bSlot - 1] = pContext;
+	if (bTagged)
+	{
+		wTagged |= 1 << (bSlot - 1);
+	}
+	else
+	{
+		wTagged &= ~(1 << (bSlot - 1));
+	}
+	return true;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Dispatcher::SetDefault()
+******************************************************************************
+* Summary:
+* Route the frames whose command ID has no handler
+**
+Parameters:
+* pfnHandler: called with every such frame. NULL drops them.
+* pContext: passed to the handler as it is
+**
+Return:
+* None
+**
+Note:
+*
+*****************************************************************************/
+void PLC_Dispatcher::SetDefault(PLC_Handler pfnHandler, void *pContext)
+{
+	pfnDefault = pfnHandler;
+	pDefaultContext = pContext;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Dispatcher::SetDedup()
+******************************************************************************
+* Summary:
+* Drop repeated frames of the tagged command IDs
+**
+Parameters:
+* pDedup: the cache their tags are checked against, or NULL to pass every frame
+**
+Return:
+* None
+**
+Note:
+* Dropped frames are counted in the cache and not in Count().
+*****************************************************************************/
+void PLC_Dispatcher::SetDedup(PLC_DedupCache *pDedup)
+{
+	this->pDedup = pDedup;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Dispatcher::Service()
+******************************************************************************
+* Summary:
+* Dispatch every frame the PLC device reports as received
+**
+Parameters:
+* pModem: the PLC device
+**
+Return:
+* Number of frames read
+**
+Note:
+* Only reads the device when its HOST_INT is set, see PLC_I2C::IsPacketReceived().
+*****************************************************************************/
+byte PLC_Dispatcher::Service(PLC_I2C *pModem)
+{
+	byte bFrames = 0;
+
+	while (pModem->IsPacketReceived() && Poll(pModem))
+	{
+		bFrames++;
+	}
+	return bFrames;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Dispatcher::Poll()
+******************************************************************************
+* Summary:
+* Read the RX buffer of the PLC device and dispatch its frame, if it holds one
+**
+Parameters:
+* pModem: the PLC device
+**
+Return:
+* TRUE if a frame was read
+**
+Note:
+* Does not look at HOST_INT, so it also finds a frame whose RX_Data_Available was read and lost along with a
+* TX result. The header and the first PLC_DISPATCH_PREFETCH payload bytes are read in one transaction, and only
+* a longer payload needs a second. The RX buffer is released before the handler runs, so the device can take
+* the next frame meanwhile. It is also released when that second read fails, as with RX_Override cleared the
+* device would otherwise hold on to the frame and drop every later one; the frame is counted in wReadErrors.
+*****************************************************************************/
+bool PLC_Dispatcher::Poll(PLC_I2C *pModem)
+{
+	PLC_Frame frame;
+	byte bTemp;
+
+	if (pModem->ReadFromOffset(RX_Message_INFO, abRx, RX_HEADER_LENGTH + PLC_DISPATCH_PREFETCH) != I2C_SUCCESS
+		|| !(abRx[0] & New_RX_Msg))
+	{
+		return false;
+	}
+	frame.bInfo = abRx[0];
+	frame.pbSource = &abRx[RX_SA - RX_Message_INFO];
+	frame.bCommand = abRx[RX_CommandID - RX_Message_INFO];
+	frame.pbData = &abRx[RX_HEADER_LENGTH];
+	frame.bLength = frame.bInfo & RX_Msg_Length;
+	if (frame.bLength > MAX_PLC_PACKET_LENGTH)
+	{
+		frame.bLength = MAX_PLC_PACKET_LENGTH;
+	}
+	if (frame.bLength > PLC_DISPATCH_PREFETCH
+		&& pModem->ReadFromOffset(RX_Data + PLC_DISPATCH_PREFETCH, &abRx[RX_HEADER_LENGTH + PLC_DISPATCH_PREFETCH],
+			frame.bLength - PLC_DISPATCH_PREFETCH) != I2C_SUCCESS)
+	{
+		wReadErrors++;
+		bTemp = 0x00;
+		pModem->WriteToOffset(RX_Message_INFO, &bTemp, 1);
+		return false;
+	}
+
+	bTemp = 0x00;
+	pModem->WriteToOffset(RX_Message_INFO, &bTemp, 1);
+	Dispatch(&frame);
+	return true;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Dispatcher::Dispatch()
+******************************************************************************
+* Summary:
+* Hand a frame to the handler of its command ID and count it
+**
+Parameters:
+* pFrame: the frame, from Poll() or from another source
+**
+Return:
+* None
+**
+Note:
+* A tagged frame the dedup cache has seen before is dropped here, uncounted.
+*****************************************************************************/
+void PLC_Dispatcher::Dispatch(const PLC_Frame *pFrame)
+{
+	byte bSlot = Slot(pFrame->bCommand);
+
+	if (bSlot == 0)
+	{
+		wUnknown++;
+		if (pfnDefault != NULL)
+		{
+			pfnDefault(pFrame, pDefaultContext);
+		}
+		return;
+	}
+	if ((wTagged & (1 << (bSlot - 1))) && pDedup != NULL && pFrame->bLength > 0
+		&& !pDedup->Check(pFrame->bInfo, pFrame->pbSource, pFrame->pbData[0]))
+	{
+		return;
+	}
+	awCount[bSlot - 1]++;
+	apfnHandler[bSlot - 1](pFrame, apContext[bSlot - 1]);
+}
+
+/*****************************************************************************
+* Function Name: PLC_Dispatcher::Count()
+******************************************************************************
+* Summary:
+* Frames dispatched to the handler of a command ID
+**
+Parameters:
+* bCommand: the command ID
+**
+Return:
+* The count, which wraps at 65535. 0 for an ID without a handler.
+**
+Note:
+*
+*****************************************************************************/
+word PLC_Dispatcher::Count(byte bCommand)
+{
+	byte bSlot = Slot(bCommand);
+
+	return bSlot ? awCount[bSlot - 1] : 0;
+}
+
+byte PLC_Dispatcher::Slot(byte bCommand)
+{
+	byte bPair = abSlot[bCommand >> 1];
+
+	return (bCommand & 1) ? (bPair >> 4) : (bPair & 0x0F);
+}
@@ -0,0 +1,67 @@
+/*
+* File Name: plc_dispatch.h
+**
+Version: 2.1
+**
+Description:
+* Hands each received PLC message to the handler registered for its command ID.
+* The handler is found with one lookup in a table indexed by the command ID, holding a 4-bit handler slot per
+* ID, so the cost does not grow with the number of message types and the table takes 128 bytes for all 256
+* IDs. Frames for IDs without a handler are counted and passed to the default handler, if one is set.
+* A command ID registered as tagged has a sequence tag in its first payload byte; with a PLC_DedupCache set,
+* repeats of a frame are dropped before its handler (plc_dedup.h).
+**
+Note:
+* A frame is read from the PLC device once, into the dispatcher's buffer, and handlers get a PLC_Frame pointing
+* into it. The data is only valid until the handler returns.
+*/
+
+#ifndef PLC_DISPATCH_H
+#define PLC_DISPATCH_H
+
+#include "plc_i2c.h"
+#include "plc_dedup.h"
+
+#define PLC_DISPATCH_MAX_HANDLERS	15		/* Command IDs with a handler at the same time; slot 0 means none */
+#define PLC_DISPATCH_PREFETCH		8		/* Payload bytes read together with the frame header */
+
+/* A received message, valid during the handler call */
+struct PLC_Frame {
+    byte bInfo;				/* RX_Message_INFO: address types and payload length */
+    const byte *pbSource;	/* RX_SA, 8 bytes. A logical source address is in the first byte. */
+    byte bCommand;
+    const byte *pbData;
+    byte bLength;
+};
+
+typedef void (*PLC_Handler)(const PLC_Frame *pFrame, void *pContext);
+
+class PLC_Dispatcher {
+  public:
+    void begin(void);
+    bool Register(byte bCommand, PLC_Handler pfnHandler, void *pContext = NULL, bool bTagged = false);
+    void SetDefault(PLC_Handler pfnHandler, void *pContext = NULL);
+    void SetDedup(PLC_DedupCache *pDedup);
+    byte Service(PLC_I2C *pModem);
+    bool Poll(PLC_I2C *pModem);
+    void Dispatch(const PLC_Frame *pFrame);
+    word Count(byte bCommand);
+
+    word wUnknown;			/* Frames whose command ID has no handler, whether or not a default one took them */
+    word wReadErrors;		/* Frames dropped because their payload could not be read */
+  private:
+    byte Slot(byte bCommand);
+
+    byte abSlot[128];		/* Handler slot of each command ID, two IDs per byte, even ID in the low nibble */
+    byte bHandlerCount;
+    PLC_Handler apfnHandler[PLC_DISPATCH_MAX_HANDLERS];
+    void *apContext[PLC_DISPATCH_MAX_HANDLERS];
+    PLC_Handler pfnDefault;
+    void *pDefaultContext;
+    word awCount[PLC_DISPATCH_MAX_HANDLERS];
+    word wTagged;			/* Handler slots whose frames carry a sequence tag, bit n - 1 for slot n */
+    PLC_DedupCache *pDedup;
+    byte abRx[RX_Data - RX_Message_INFO + MAX_PLC_PACKET_LENGTH];	/* RX_Message_INFO up to the end of RX_Data */
+};
+
+#endif
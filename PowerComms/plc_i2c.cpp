@@ -1,14 +1,38 @@
 
 #include "plc_i2c.h"
+#include "plc_profile.h"
 
 #define I2C_GAP 	  1		/* The gap between the stop bit and start bit of the next I2C message. In multiples of 1ms. */
 #define I2C_TIMEOUT	250		/* Set the I2C timeout to be 250ms. If there is no response, it will give up */
+#define I2C_RETRIES	3		/* Retries of a failed transfer, with the backoff doubling from I2C_GAP */
+#define I2C_RECOVERY_HALF_US 5	/* Half period of the clock pulses used to free a stuck bus */
+
+#define PLC_BOOT_MAX_MS 1250	/* Longest the PLC device may take after power up to answer on I2C */
+#define PLC_PROBE_MIN_MS 2		/* Readiness probe backoff, doubling up to PLC_PROBE_MAX_MS */
+#define PLC_PROBE_MAX_MS 64
+
+/*****************************************************************************
+* Function Name: PLC_I2C()
+******************************************************************************
+* Summary:
+* Bind an instance to one PLC device
+**
+Parameters:
+* bAddress: I2C address of the PLC device
+* bIntPin: pin connected to the PLC device's HOST_INT
+**
+Return:
+* None
+**
+Note:
+* Several instances with different addresses and pins can share the bus, one per PLC device.
+*****************************************************************************/
+template <class Policy>
+PLC_Driver<Policy>::PLC_Driver(byte bAddress, byte bIntPin) : dwReadyTime(0), bWarmStart(false), bAddress(bAddress), bIntPin(bIntPin),
+	bTxLength(0), bBusSuspect(false), bStatus(0)
+{
+}
 
-#define PLC_INT_BYPASS 0 	/* When 0, this device will check if the PLC device has asserted its HOST_INT pin high to 
-							 * 	indicate than a PLC event has occurred. This device will then check the event type via I2C.
-						  	 * When 1, this device will ignore the HOST_INT pin and continuosly poll the PLC device for 
-							 * 	event updates with I2C. */
-#define HOST_INIT 2
 /*****************************************************************************
 * Function Name: PLC_Init()
 ******************************************************************************
@@ -16,55 +40,135 @@
 * Initialize the PLC interface
 **
 Parameters:
-* None
+* transmitter: TRUE to enable the transmitter, FALSE to enable the receiver
+* pProfile: modem settings to apply, NULL for PLC_PROFILE_DEFAULT (acknowledged, 1 retry, 2400 bps)
 **
 Return:
 * I2C_SUCCESS if I2C communication was successful. I2C_FAIL otherwise.
 **
 Note:
-* 
+* After a reset of the host alone the PLC device keeps its settings. If Lock_Configuration is set and every
+* register of the profile already matches, nothing is written and bWarmStart is set.
 *****************************************************************************/
-byte PLC_I2C::init(bool transmitter)
+template <class Policy>
+byte PLC_Driver<Policy>::init(bool transmitter, const PLC_Profile *pProfile)
 {
-	byte bTemp; 
-	byte bI2CResult = I2C_SUCCESS;
+	PLC_Profile profile;
 	
 	/* Start the I2C master and enable the global and local interrupts */   
     Start();
     
-	/* Enable the PLC device */
-  bTemp = (Lock_Configuration | Promiscuous_MASK);
+	if (pProfile != NULL)
+	{
+		profile = *pProfile;
+	}
+	else
+	{
+		PLC_GetProfile(PLC_PROFILE_DEFAULT, &profile);
+	}
+	
+	/* Enable the PLC device for its role */
   if (transmitter) {
-    bTemp |= TX_Enable;
+    profile.bPLCMode |= TX_Enable;
   }
   else {
-    bTemp |= (RX_Enable | RX_Override);
+    profile.bPLCMode |= (RX_Enable | RX_Override);
   }
-  bI2CResult &= WriteToOffset(PLC_Mode, &bTemp, 1);
-	
-	/* Enable Interrupt reporting for all events */
-	bTemp = (INT_UnableToTX | INT_TX_NO_ACK | INT_TX_NO_RESP | INT_RX_Packet_Dropped | INT_RX_Data_Available | INT_TX_Data_Sent);
-	bI2CResult &= WriteToOffset(INT_Enable, &bTemp, 1);
-	
-	/* Set the PLC device to acknowledgment mode and 1 retry*/
-	bTemp = (TX_Service_Type | 0x01) ;
-  bI2CResult &= WriteToOffset(TX_Config, &bTemp, 1);
+  
+  if (Policy::bInterrupt)
+    pinMode( bIntPin, INPUT);
 
-  /* Set Config */
-  bTemp = (Modem_TXDelay_7ms | Modem_FSKBW_3M | Modem_BPS_2400);
-  bI2CResult &= WriteToOffset (Modem_Config, &bTemp, 1);
-      
-	/* Set the transmitter gain. */
-	bTemp = 0x0E;
-	bI2CResult &= WriteToOffset (TX_Gain, &bTemp, 1);
-	
-	/* Set the receiver gain. */
-	bTemp = 0x01;
-	bI2CResult &= WriteToOffset (RX_Gain, &bTemp, 1);
+	bWarmStart = (profile.bPLCMode & Lock_Configuration) && VerifyProfile(&profile) == I2C_SUCCESS;
+	if (bWarmStart)
+	{
+		return I2C_SUCCESS;
+	}
+	return ApplyProfile(&profile, false) == I2C_SUCCESS ? I2C_SUCCESS : I2C_FAIL;
+}
 
-  pinMode( HOST_INIT, INPUT);
+/*****************************************************************************
+* Function Name: PLC_ApplyProfile()
+******************************************************************************
+* Summary:
+* Write a set of modem settings in three bursts, and optionally read them back
+**
+Parameters:
+* pProfile: the settings, with the role bits of PLC_Mode already included
+* bVerify: TRUE to read the registers back and compare them
+**
+Return:
+* I2C_SUCCESS, I2C_FAIL, or PLC_VERIFY_FAIL if a register read back differently
+**
+Note:
+* TX_Message_Length sits between PLC_Mode and TX_Config; it is written as 0, which leaves Send_Message clear.
+* Local_LA and the group registers between INT_Enable and PLC_Mode are not touched.
+*****************************************************************************/
+template <class Policy>
+byte PLC_Driver<Policy>::ApplyProfile(const PLC_Profile *pProfile, bool bVerify)
+{
+	byte bI2CResult = I2C_SUCCESS;
+	byte abMode[3] = { pProfile->bPLCMode, 0x00, pProfile->bTxConfig };
+	byte abModem[4] = { pProfile->bThreshold, pProfile->bModemConfig, pProfile->bTxGain, pProfile->bRxGain };
+	byte bSkip = (pProfile->bThreshold == PLC_PROFILE_KEEP) ? 1 : 0;
+	
+	/* Without a threshold the modem burst starts one register later */
+	bI2CResult &= WriteToOffset(INT_Enable, (byte *)&pProfile->bIntEnable, 1);
+	bI2CResult &= WriteToOffset(PLC_Mode, abMode, sizeof(abMode));
+	bI2CResult &= WriteToOffset(Threshold_Noise + bSkip, &abModem[bSkip], sizeof(abModem) - bSkip);
+	if (bI2CResult != I2C_SUCCESS || !bVerify)
+	{
+		return bI2CResult;
+	}
+	return VerifyProfile(pProfile);
+}
 
-	return bI2CResult;
+/*****************************************************************************
+* Function Name: PLC_VerifyProfile()
+******************************************************************************
+* Summary:
+* Read the registers of a profile back from the PLC device and compare them
+**
+Parameters:
+* pProfile: the settings, with the role bits of PLC_Mode included
+**
+Return:
+* I2C_SUCCESS if they all match, I2C_FAIL, or PLC_VERIFY_FAIL
+**
+Note:
+* 
+*****************************************************************************/
+template <class Policy>
+byte PLC_Driver<Policy>::VerifyProfile(const PLC_Profile *pProfile)
+{
+	byte abModem[4] = { pProfile->bThreshold, pProfile->bModemConfig, pProfile->bTxGain, pProfile->bRxGain };
+	byte bSkip = (pProfile->bThreshold == PLC_PROFILE_KEEP) ? 1 : 0;
+	byte abRead[4];
+	
+	if (ReadFromOffset(INT_Enable, abRead, 1) != I2C_SUCCESS)
+	{
+		return I2C_FAIL;
+	}
+	if (abRead[0] != pProfile->bIntEnable)
+	{
+		return PLC_VERIFY_FAIL;
+	}
+	if (ReadFromOffset(PLC_Mode, abRead, 3) != I2C_SUCCESS)
+	{
+		return I2C_FAIL;
+	}
+	if (abRead[0] != pProfile->bPLCMode || abRead[2] != pProfile->bTxConfig)
+	{
+		return PLC_VERIFY_FAIL;
+	}
+	if (ReadFromOffset(Threshold_Noise + bSkip, abRead, sizeof(abModem) - bSkip) != I2C_SUCCESS)
+	{
+		return I2C_FAIL;
+	}
+	if (memcmp(abRead, &abModem[bSkip], sizeof(abModem) - bSkip) != 0)
+	{
+		return PLC_VERIFY_FAIL;
+	}
+	return I2C_SUCCESS;
 }
 
 /*****************************************************************************
@@ -81,36 +185,52 @@ Return:
 * Status of the I2C communication and address type validity.  
 **
 Note:
-* 
+* Address types the policy leaves out of bAddressing are PLC_INVALID. With the register shadow, TX_Config is
+* not read, and nothing is written when the type and address are the ones already set.
 *****************************************************************************/
-byte PLC_I2C::SetDestinationAddress (byte bAddrType, byte *pbDestinationAddress)
+template <class Policy>
+byte PLC_Driver<Policy>::SetDestinationAddress (byte bAddrType, byte *pbDestinationAddress)
 {
 	byte bI2CResult = I2C_SUCCESS;
 	byte bTxConfigTemp = 0x00;
-	
-	/* Read the PLC TX_Config setting and prepare to update the value */
-	bI2CResult &= ReadFromOffset(TX_Config, &bTxConfigTemp, 1);
-	bTxConfigTemp &= ~TX_DA_Type;
-	bTxConfigTemp |= bAddrType;
+	byte bLength;
 	
 	/* Based on the addressing type, set the destination address with the corresponding number of bytes */
-	if (bAddrType == TX_DA_Type_Log)
+	if (bAddrType == TX_DA_Type_Log && (Policy::bAddressing & PLC_ADDR_LOGICAL))
 	{
-		bI2CResult &= WriteToOffset(TX_DA, pbDestinationAddress, 1);
+		bLength = 1;
 	}
-	else if (bAddrType == TX_DA_Type_Grp)
+	else if (bAddrType == TX_DA_Type_Grp && (Policy::bAddressing & PLC_ADDR_GROUP))
 	{
-		bI2CResult &= WriteToOffset(TX_DA, pbDestinationAddress, 1);
+		bLength = 1;
 	}
-	else if (bAddrType == TX_DA_Type_Phy)
+	else if (bAddrType == TX_DA_Type_Phy && (Policy::bAddressing & PLC_ADDR_PHYSICAL))
 	{
-		bI2CResult &= WriteToOffset(TX_DA, pbDestinationAddress, 8);
+		bLength = 8;
 	}
 	else
 		return PLC_INVALID;
 	
+	/* Read the PLC TX_Config setting, unless the shadow has it, and prepare to update the value */
+	if (!Shadow::GetConfig(&bTxConfigTemp))
+	{
+		bI2CResult &= ReadFromOffset(TX_Config, &bTxConfigTemp, 1);
+	}
+	bTxConfigTemp &= ~TX_DA_Type;
+	bTxConfigTemp |= bAddrType;
+	if (Shadow::Matches(bTxConfigTemp, pbDestinationAddress, bLength))
+	{
+		return I2C_SUCCESS;
+	}
+	
+	bI2CResult &= WriteToOffset(TX_DA, pbDestinationAddress, bLength);
+	
 	/* Since the address type was valid, the PLC TX_Config setting can get set */
 	bI2CResult &= WriteToOffset(TX_Config, &bTxConfigTemp, 1);
+	if (bI2CResult == I2C_SUCCESS)
+	{
+		Shadow::Set(bTxConfigTemp, pbDestinationAddress, bLength);
+	}
 	
 	return bI2CResult;
 }
@@ -132,55 +252,207 @@ Return:
 Note:
 * 
 *****************************************************************************/
-byte PLC_I2C::TransmitPacket(byte bCommand, byte *pbTXData, byte bDataLength)
+template <class Policy>
+byte PLC_Driver<Policy>::TransmitPacket(byte bCommand, byte *pbTXData, byte bDataLength)
+{
+	PLC_Fragment payload = { pbTXData, bDataLength };
+	
+	return TransmitGather(bCommand, &payload, 1);
+}
+
+/*****************************************************************************
+* Function Name: PLC_TransmitGather()
+******************************************************************************
+* Summary:
+* Transmit a data packet whose payload is given as a list of fragments, and wait for the result
+**
+Parameters:
+* bCommand: Command ID of the PLC message
+* pFragments: the payload fragments, in order, such as an application header and a sample buffer
+* bCount: number of fragments, up to PLC_MAX_FRAGMENTS
+**
+Return:
+* Status of the PLC communication.  
+**
+Note:
+* The fragments are streamed to the PLC device where they lie; their total length is limited to
+* MAX_PLC_PACKET_LENGTH.
+*****************************************************************************/
+template <class Policy>
+byte PLC_Driver<Policy>::TransmitGather(byte bCommand, const PLC_Fragment *pFragments, byte bCount)
 {
-	byte bI2CResult = I2C_SUCCESS;
 	byte bPLCResult;
-	byte bBIUThreshold;
-	byte bPLCMode;
 	
-	if (bDataLength > MAX_PLC_PACKET_LENGTH)
+	bPLCResult = StartTransmitGather(bCommand, pFragments, bCount);
+	if (bPLCResult != I2C_SUCCESS)
 	{
-		return PLC_INVALID;
+		return bPLCResult;
 	}
-	/* Clear the PLC device's interrupt status, set the bCommand ID and write the data payload */
-	bI2CResult &= WriteToOffset(TX_CommandID, &bCommand, 1);
-	bI2CResult &= WriteToOffset(TX_Data, pbTXData, bDataLength);
 	
 	/* Loop until the message is transmitted */
 	do
-	{	
-		/* Set the Send_Message bit and the length of the PLC packet, which will initiate transmission */
-		bDataLength |= Send_Message; 
-		bI2CResult &= WriteToOffset(TX_Message_Length, &bDataLength, 1);
-		
-		/* Wait until the transmitter status is updated */
-		do
+	{
+		bPLCResult = PollTransmit();
+	} while (bPLCResult == PLC_TX_PENDING);
+	
+	return bPLCResult;
+}
+
+/*****************************************************************************
+* Function Name: PLC_StartTransmit()
+******************************************************************************
+* Summary:
+* Load a data packet into the PLC device and start its transmission without waiting for the result
+**
+Parameters:
+* bCommand: Command ID of the PLC message
+* pbTXData: pointer to the data payload that will be in the PLC message
+* bDataLength: length of the data payload
+**
+Return:
+* I2C_SUCCESS once the packet is on its way. Otherwise its final status: PLC_INVALID if the payload is too long,
+* PLC_TX_LOST if it could not be loaded into the PLC device.
+**
+Note:
+* After I2C_SUCCESS, call PollTransmit() until it returns the final status. While the packet is on the line the
+* host is free to work with other PLC devices.
+*****************************************************************************/
+template <class Policy>
+byte PLC_Driver<Policy>::StartTransmit(byte bCommand, byte *pbTXData, byte bDataLength)
+{
+	PLC_Fragment payload = { pbTXData, bDataLength };
+	
+	return StartTransmitGather(bCommand, &payload, 1);
+}
+
+/*****************************************************************************
+* Function Name: PLC_StartTransmitGather()
+******************************************************************************
+* Summary:
+* StartTransmit() for a payload given as a list of fragments
+**
+Parameters:
+* bCommand: Command ID of the PLC message
+* pFragments: the payload fragments, in order
+* bCount: number of fragments, up to PLC_MAX_FRAGMENTS
+**
+Return:
+* As StartTransmit()
+**
+Note:
+* TX_CommandID and TX_Data are adjacent, so the command ID and the payload go out as one burst. Only a
+* payload that overflows the Wire buffer needs a second transaction. TX_Message_Length is written last, on
+* its own, so Send_Message is only set once the whole frame is in place.
+*****************************************************************************/
+template <class Policy>
+byte PLC_Driver<Policy>::StartTransmitGather(byte bCommand, const PLC_Fragment *pFragments, byte bCount)
+{
+	PLC_Fragment aFrame[1 + PLC_MAX_FRAGMENTS];
+	byte bI2CResult = I2C_SUCCESS;
+	byte bDataLength = 0;
+	byte i;
+	
+	if (bCount > PLC_MAX_FRAGMENTS)
+	{
+		return PLC_INVALID;
+	}
+	aFrame[0].pbData = &bCommand;
+	aFrame[0].bLength = 1;
+	for (i = 0; i < bCount; i++)
+	{
+		bDataLength += pFragments[i].bLength;
+		if (pFragments[i].bLength > MAX_PLC_PACKET_LENGTH || bDataLength > MAX_PLC_PACKET_LENGTH)
+		{
+			return PLC_INVALID;
+		}
+		aFrame[1 + i] = pFragments[i];
+	}
+	
+	/* A TX result still held from an earlier packet does not belong to this one */
+	bStatus &= ~Status_TX;
+	
+	/* Write the bCommand ID followed by the data payload. Without it in place the packet must not be started. */
+	bI2CResult = WriteGather(TX_CommandID, aFrame, 1 + bCount);
+	
+	/* Set the Send_Message bit and the length of the PLC packet, which will initiate transmission */
+	if (bI2CResult == I2C_SUCCESS)
+	{
+		bTxLength = bDataLength;
+		bI2CResult = SendMessage();
+	}
+	
+	return (bI2CResult == I2C_SUCCESS) ? I2C_SUCCESS : PLC_TX_LOST;
+}
+
+/*****************************************************************************
+* Function Name: PLC_PollTransmit()
+******************************************************************************
+* Summary:
+* Check on the packet started by StartTransmit()
+**
+Parameters:
+* None
+**
+Return:
+* PLC_TX_PENDING while the packet is in flight, otherwise the INT_Status that ended it
+**
+Note:
+* On a Band-In-Use(BIU) timeout the BIU threshold is raised, or BIU disabled at the maximum threshold, and the
+* packet is sent again; this still reports PLC_TX_PENDING. A policy without bBiuEscalation returns the
+* Status_UnableToTX instead.
+* A failed INT_Status read is treated as no news. If no result arrives within PLC_TX_TIMEOUT ms of the last
+* (re)send, PLC_TX_LOST is returned, so a status lost on the bus cannot hang the caller. A resend that
+* fails on the bus is PLC_TX_LOST at once.
+*****************************************************************************/
+template <class Policy>
+byte PLC_Driver<Policy>::PollTransmit(void)
+{
+	byte bPLCResult;
+	byte bBIUThreshold;
+	byte bPLCMode;
+	
+	/* Take only the TX result; RX events read along with it stay for ReadStatus() */
+	FetchStatus();
+	bPLCResult = bStatus & Status_TX;
+	bStatus &= ~Status_TX;
+	if (!bPLCResult)
+	{
+		/* A status lost to a failed read would leave HOST_INT low for good: give up on the packet */
+		if ((millis() - dwTxStart) >= PLC_TX_TIMEOUT)
 		{
-			while(!(PLC_INT_BYPASS || IsUpdated()));
-			bI2CResult &= ReadFromOffset(INT_Status, &bPLCResult, 1);
-		}while (!(bPLCResult & (Status_UnableToTX | Status_TX_Data_Sent | Status_TX_NO_ACK | Status_TX_NO_RESP)));
-		
+			this->Count(&PLC_I2CHealth::wLostStatus);
+			return PLC_TX_LOST;
+		}
+		return PLC_TX_PENDING;
+	}
+	
+	/* Without escalation a Band-In-Use(BIU) timeout is a result like any other */
+	if (!Policy::bBiuEscalation)
+	{
+		return bPLCResult;
+	}
 	
-		/* If there was a Band-In-Use(BIU) Timeout condition, increase the BIU threshold until the packet is transmitted */
-		if (bPLCResult & Status_UnableToTX)
+	/* If there was a Band-In-Use(BIU) Timeout condition, increase the BIU threshold until the packet is transmitted */
+	if (bPLCResult & Status_UnableToTX)
+	{
+		ReadFromOffset(Threshold_Noise, &bBIUThreshold, 1);
+		if ((bBIUThreshold & BIU_Threshold_Mask) < BIU_Threshold_Mask)
+		{
+			bBIUThreshold++;
+			WriteToOffset(Threshold_Noise, &bBIUThreshold, 1);
+		}
+		/* If it is still timing out at the maximum BIU threshold, then disable BIU */
+		else if (ReadFromOffset(PLC_Mode, &bPLCMode, 1) == I2C_SUCCESS)
 		{
-			bI2CResult &= ReadFromOffset(Threshold_Noise, &bBIUThreshold, 1);
-			if ((bBIUThreshold & BIU_Threshold_Mask) < BIU_Threshold_Mask)
-			{
-				bBIUThreshold++;
-				bI2CResult &= WriteToOffset(Threshold_Noise, &bBIUThreshold, 1);
-			}
-			/* If it is still timing out at the maximum BIU threshold, then disable BIU */
-			else
-			{
-				bI2CResult &= ReadFromOffset(PLC_Mode, &bPLCMode, 1);
-				bPLCMode |= Disable_BIU;
-				bI2CResult &= WriteToOffset(PLC_Mode, &bPLCMode, 1);
-			}
-		}	
-	} while (!(bPLCResult & (Status_TX_Data_Sent | Status_TX_NO_ACK | Status_TX_NO_RESP)));
+			bPLCMode |= Disable_BIU;
+			WriteToOffset(PLC_Mode, &bPLCMode, 1);
+		}
+	}
 	
+	if (!(bPLCResult & (Status_TX_Data_Sent | Status_TX_NO_ACK | Status_TX_NO_RESP)))
+	{
+		return (SendMessage() == I2C_SUCCESS) ? PLC_TX_PENDING : PLC_TX_LOST;
+	}
 	return bPLCResult;
 }
 
@@ -199,22 +471,58 @@ Return:
 Note:
 * 
 *****************************************************************************/
-byte PLC_I2C::IsPacketReceived(void)
+template <class Policy>
+byte PLC_Driver<Policy>::IsPacketReceived(void)
+{
+	/* Check if the PLC device's status register indicates that a new received message is available */
+	if (ReadStatus() & Status_RX_Data_Available)
+	{
+		return true;
+	}
+	return false;
+}
+
+/*****************************************************************************
+* Function Name: PLC_ReadStatus()
+******************************************************************************
+* Summary:
+* Read INT_Status if the PLC device signals a status update
+**
+Parameters:
+* None
+**
+Return:
+* INT_Status, or 0 if there was no update or the read failed
+**
+Note:
+* INT_Status is cleared by the read. The TX result bits (Status_TX) are returned but kept for PollTransmit(),
+* so the status can be checked for received frames while a packet is in flight. Every other bit is handed out
+* once, including RX events that PollTransmit() read while waiting for its result.
+*****************************************************************************/
+template <class Policy>
+byte PLC_Driver<Policy>::ReadStatus(void)
 {
 	byte bPLC_Status;
+	
+	FetchStatus();
+	bPLC_Status = bStatus;
+	bStatus &= Status_TX;
+	return bPLC_Status;
+}
+
+/* Add a new INT_Status, if the PLC device signals one, to the bits not yet handed out */
+template <class Policy>
+void PLC_Driver<Policy>::FetchStatus(void)
+{
+	byte bPLC_Status;
+	
 	/* First, check if the PLC device's HOST_INT pin (which is connected to P1[7] of this device) is set to '1'
 	 * This indicates that a PLC status update has occurred.
-	 * To skip checking the HOST_INT pin and to continously poll the INT_Status register via I2C, set PLC_INT_BYPASS to 1 */ 
-	if (PLC_INT_BYPASS || IsUpdated()) 
+	 * A policy without bInterrupt skips checking the HOST_INT pin and continously polls the INT_Status register via I2C */ 
+	if ((!Policy::bInterrupt || IsUpdated()) && ReadFromOffset(INT_Status, &bPLC_Status, 1) == I2C_SUCCESS)
 	{
-		/* Check if the PLC device's status register indicates that a new received message is available */
-		ReadFromOffset(INT_Status, &bPLC_Status, 1);
-		if (bPLC_Status & Status_RX_Data_Available)
-		{
-			return true;
-		}
+		bStatus |= bPLC_Status;
 	}
-	return false;
 }
 
 /*****************************************************************************
@@ -230,14 +538,34 @@ Return:
 * None
 **
 Note:
-* 
+* The PLC device needs up to 1.25s after power up before I2C communication can start. Rather than
+* always waiting that long, Local_FW is polled with a backoff doubling from PLC_PROBE_MIN_MS to
+* PLC_PROBE_MAX_MS until the device answers with a firmware version. The full 1.25s remains the
+* worst case. Failed probes are not counted in health. The register shadow is dropped, as the device may
+* have been reset.
 *****************************************************************************/
 
-void PLC_I2C::Start(void)
+template <class Policy>
+void PLC_Driver<Policy>::Start(void)
 {
-  /* Initial delay of 1.25s is required before I2C communication should start with PLC */
-  delay(1250);
+  unsigned long dwStart = millis();
+  unsigned int wBackoff = PLC_PROBE_MIN_MS;
+  Health saved(*this);
+  byte bFirmware;
+  
   Wire.begin();
+  while ((millis() - dwStart) < PLC_BOOT_MAX_MS)
+  {
+    if (ReadOnce(Local_FW, &bFirmware, 1) == I2C_SUCCESS && bFirmware != 0x00 && bFirmware != 0xFF)
+      break;
+    delay(wBackoff);
+    if (wBackoff < PLC_PROBE_MAX_MS)
+      wBackoff <<= 1;
+  }
+  Health::operator=(saved);
+  Shadow::Invalidate();
+  bBusSuspect = false;
+  dwReadyTime = millis();
 }
 
 /*****************************************************************************
@@ -257,30 +585,180 @@ Return:
 * Status of the I2C communication.  
 **
 Note:
-* 
+* Retried as described for WriteGather().
 *****************************************************************************/
-byte PLC_I2C::WriteToOffset(byte bOffset, byte *pbData, byte bDataLength)
+template <class Policy>
+byte PLC_Driver<Policy>::WriteToOffset(byte bOffset, byte *pbData, byte bDataLength)
 {
-  byte bI2CResult = I2C_SUCCESS;
+  PLC_Fragment data = { pbData, bDataLength };
   
-  /* Send the start bit and address byte */
-  Wire.beginTransmission(PLC_ADDRESS);
-	
-  /* Send the offset byte */
-  bI2CResult = Wire.write(bOffset);
-	
-  /* Send each data byte and check if there was an I2C failure*/
-  bI2CResult = Wire.write(pbData, bDataLength);
-  if (bI2CResult == I2C_FAIL)
-    return I2C_FAIL;
+  return WriteGather(bOffset, &data, 1);
+}
+
+/*****************************************************************************
+* Function Name: PLC_I2C_WriteGather()
+******************************************************************************
+* Summary:
+* Write a list of fragments to consecutive PLC memory starting at the specified offset.
+* Each fragment is handed to the Wire library where it lies. The data goes out in as few I2C
+* messages as the Wire buffer allows, each one starting with the offset it continues from.
+**
+Parameters:
+* bOffset: PLC memory offset to write to
+* pFragments: the fragments to write, in order
+* bCount: number of fragments
+**
+Return:
+* Status of the I2C communication.  
+**
+Note:
+* A write that is not acknowledged is repeated up to I2C_RETRIES times, with a backoff that doubles
+* each time. The bus is recovered before the last attempt. The whole write is simply repeated, which is
+* safe for every register but TX_Message_Length with Send_Message, which SendMessage() writes instead.
+* A write that reaches TX_Config or TX_DA drops the register shadow; SetDestinationAddress() sets it again.
+*****************************************************************************/
+template <class Policy>
+byte PLC_Driver<Policy>::WriteGather(byte bOffset, const PLC_Fragment *pFragments, byte bCount)
+{
+  if (Policy::bShadow)
+  {
+    word wEnd = bOffset;
+    
+    for (byte i = 0; i < bCount; i++)
+      wEnd += pFragments[i].bLength;
+    if (bOffset < TX_DA + 8 && wEnd > TX_Config)
+      Shadow::Invalidate();
+  }
+  
+  for (byte bAttempt = 0; ; bAttempt++)
+  {
+    if (WriteGatherOnce(bOffset, pFragments, bCount) == I2C_SUCCESS)
+      return I2C_SUCCESS;
+    if (!Retry(bAttempt))
+      return I2C_FAIL;
+  }
+}
+
+template <class Policy>
+byte PLC_Driver<Policy>::WriteGatherOnce(byte bOffset, const PLC_Fragment *pFragments, byte bCount)
+{
+  byte bRoom = 0;
+  bool bOpen = false;
+  
+  for (byte i = 0; i < bCount; i++)
+  {
+    const byte *pbData = pFragments[i].pbData;
+    byte bLeft = pFragments[i].bLength;
+    
+    while (bLeft > 0)
+    {
+      byte bChunk;
+      
+      /* Start a new message at the current offset once the Wire buffer is full */
+      if (bRoom == 0)
+      {
+        if (bOpen && EndWrite() != I2C_SUCCESS)
+          return I2C_FAIL;
+        Wire.beginTransmission(bAddress);
+        Wire.write(bOffset);
+        bRoom = I2C_WRITE_MAX;
+        bOpen = true;
+      }
+      bChunk = (bLeft < bRoom) ? bLeft : bRoom;
+      Wire.write(pbData, bChunk);
+      pbData += bChunk;
+      bLeft -= bChunk;
+      bRoom -= bChunk;
+      bOffset += bChunk;
+    }
+  }
+  
+  return bOpen ? EndWrite() : I2C_SUCCESS;
+}
+
+/*****************************************************************************
+* Function Name: PLC_I2C_SendMessage()
+******************************************************************************
+* Summary:
+* Set the Send_Message bit with the length of the frame in place, which starts its transmission
+**
+Parameters:
+* None
+**
+Return:
+* Status of the I2C communication.  
+**
+Note:
+* Not retried blindly like WriteGather(): a data NACK or bus timeout can follow the byte the PLC device
+* has already latched, and a repeat would then send the frame a second time. After a failed write,
+* TX_Message_Length is read back. Send_Message still set, or a TX result already in INT_Status, means the
+* frame started; the write is only repeated when neither is seen. If the read back fails too, it is not
+* known whether the frame went out, and I2C_FAIL is returned.
+*****************************************************************************/
+template <class Policy>
+byte PLC_Driver<Policy>::SendMessage(void)
+{
+  byte bTemp = bTxLength | Send_Message;
+  PLC_Fragment data = { &bTemp, 1 };
+  byte bLatched;
   
+  for (byte bAttempt = 0; ; bAttempt++)
+  {
+    dwTxStart = millis();
+    if (WriteGatherOnce(TX_Message_Length, &data, 1) == I2C_SUCCESS)
+      return I2C_SUCCESS;
+    if (ReadFromOffset(TX_Message_Length, &bLatched, 1) != I2C_SUCCESS)
+      return I2C_FAIL;
+    if (bLatched & Send_Message)
+      return I2C_SUCCESS;
+    FetchStatus();
+    if (bStatus & Status_TX)
+      return I2C_SUCCESS;
+    if (!Retry(bAttempt))
+      return I2C_FAIL;
+  }
+}
+
+/*****************************************************************************
+* Function Name: PLC_I2C_EndWrite()
+******************************************************************************
+* Summary:
+* Send the stop bit of a write message and classify the result of Wire.endTransmission()
+**
+Parameters:
+* None
+**
+Return:
+* Status of the I2C communication.  
+**
+Note:
+* 
+*****************************************************************************/
+template <class Policy>
+byte PLC_Driver<Policy>::EndWrite(void)
+{
   /* Send the stop bit */
-  Wire.endTransmission();
+  byte bResult = Wire.endTransmission();
   
   /* Ensure that there is sufficient delay between stop and start bits */
   delay(I2C_GAP);
-  		
-  return bI2CResult;    
+  
+  switch (bResult)
+  {
+    case 0:
+      return I2C_SUCCESS;
+    case 2:
+      this->Count(&PLC_I2CHealth::wAddressNack);
+      break;
+    case 3:
+      this->Count(&PLC_I2CHealth::wDataNack);
+      break;
+    default:		/* 1: too long for the Wire buffer, 4: bus error, 5: timeout on newer cores */
+      this->Count(&PLC_I2CHealth::wBusError);
+      bBusSuspect = true;
+      break;
+  }
+  return I2C_FAIL;
 }
 
 /*****************************************************************************
@@ -297,68 +775,145 @@ Parameters:
 * bDataLength: length of the data
 **
 Return:
-* Status of the I2C communication.  
+* Status of the I2C communication. pbData is only written when the whole read succeeded.
 **
 Note:
-* 
+* Retried like WriteGather(). A repeated read of a clear-on-read register such as INT_Status may
+* miss an event whose first read was lost; PollTransmit() guards against that with its timeout.
 *****************************************************************************/
-byte PLC_I2C::ReadFromOffset (byte bOffset, byte *pbData, byte bDataLength)
+template <class Policy>
+byte PLC_Driver<Policy>::ReadFromOffset (byte bOffset, byte *pbData, byte bDataLength)
+{
+  for (byte bAttempt = 0; ; bAttempt++)
+  {
+    if (ReadOnce(bOffset, pbData, bDataLength) == I2C_SUCCESS)
+      return I2C_SUCCESS;
+    if (!Retry(bAttempt))
+      return I2C_FAIL;
+  }
+}
+
+template <class Policy>
+byte PLC_Driver<Policy>::ReadOnce(byte bOffset, byte *pbData, byte bDataLength)
 {
-	byte bI2C_Timeout_Cycles = 0;
-  int i = 0;
-	/* Make sure the interrupts are enabled */
+  byte abTemp[I2C_READ_MAX];
+  byte i;
   
-  // TODO INT
-	/* I2CHW_EnableInt();  */
-	
-	/* Ensure that there is sufficient delay between stop and start bits */
-	delay(I2C_GAP);
+  if (bDataLength > sizeof(abTemp))
+  {
+    return I2C_FAIL;
+  }
   
-  /* Send the start bit and address byte */
-  Wire.beginTransmission(PLC_ADDRESS);
+  /* Ensure that there is sufficient delay between stop and start bits */
+  delay(I2C_GAP);
   
-  /* Send the offset byte */
+  /* Send the start bit, address byte and the offset byte */
+  Wire.beginTransmission(bAddress);
   Wire.write(bOffset);
-	
-  /* Send the stop bit */
-  Wire.endTransmission();
-	
-//	 /* Wait until the data is written or a timeout occurs*/ 
-//	while(!(I2CHW_bReadI2CStatus() & I2CHW_WR_COMPLETE) && (bI2C_Timeout_Cycles < I2C_TIMEOUT))
-//	{
-//		delay(1);	// 1ms delay
-//		bI2C_Timeout_Cycles++;
-//	}
-			
-//	/* Clear Write Complete Status bit */  
-//    I2CHW_ClrWrStatus(); 
-	
-	/* Ensure that there is sufficient delay between stop and start bits */
-	delay(I2C_GAP);
-	
-  /* Read from the slave and place in pbData */;
-  Wire.requestFrom(PLC_ADDRESS, (int)bDataLength);
+  if (EndWrite() != I2C_SUCCESS)
+    return I2C_FAIL;
   
-  for (i=0; Wire.available(); i++) // slave may send less than requested
+  /* Read from the slave; it may send less than requested */
+  if (Wire.requestFrom((int)bAddress, (int)bDataLength) != bDataLength)
   {
-    pbData[i] = Wire.read();    // receive a byte as character
+    while (Wire.available())
+      Wire.read();
+    this->Count(&PLC_I2CHealth::wShortRead);
+    delay(I2C_GAP);
+    return I2C_FAIL;
   }
-	
-//  /* Wait until the data is read or a timeout occurs*/  
-//	bI2C_Timeout_Cycles = 0;
-//	while(!(I2CHW_bReadI2CStatus() & I2CHW_RD_COMPLETE) && (bI2C_Timeout_Cycles < I2C_TIMEOUT))
-//	{
-//		delay(1);	/* 1ms delay */
-//		bI2C_Timeout_Cycles++;
-//	}
-//	 /* Clear Read Complete Status bit */  
-//    I2CHW_ClrRdStatus();
-	
-	/* Ensure that there is sufficient delay between stop and start bits */
-	delay(I2C_GAP);
-		
-	return I2C_SUCCESS;
-     
+  for (i = 0; i < bDataLength; i++)
+  {
+    abTemp[i] = Wire.read();
+  }
+  memcpy(pbData, abTemp, bDataLength);
+  
+  /* Ensure that there is sufficient delay between stop and start bits */
+  delay(I2C_GAP);
+  
+  return I2C_SUCCESS;
+}
+
+/*****************************************************************************
+* Function Name: PLC_I2C_Retry()
+******************************************************************************
+* Summary:
+* Decide whether a failed transfer is attempted again, and wait before it is
+**
+Parameters:
+* bAttempt: number of the attempt that just failed, from 0
+**
+Return:
+* TRUE to try again, FALSE once I2C_RETRIES retries have failed
+**
+Note:
+* The backoff is I2C_GAP doubled on every retry. Before the final attempt, or at once after a bus
+* error, the bus is recovered.
+*****************************************************************************/
+template <class Policy>
+bool PLC_Driver<Policy>::Retry(byte bAttempt)
+{
+  if (bAttempt >= I2C_RETRIES)
+  {
+    this->Count(&PLC_I2CHealth::wFailures);
+    bBusSuspect = false;
+    return false;
+  }
+  this->Count(&PLC_I2CHealth::wRetries);
+  delay((unsigned long)I2C_GAP << bAttempt);
+  if (bBusSuspect || bAttempt + 1 == I2C_RETRIES)
+  {
+    RecoverBus();
+  }
+  return true;
+}
+
+/*****************************************************************************
+* Function Name: PLC_I2C_RecoverBus()
+******************************************************************************
+* Summary:
+* Free a bus held by a slave stuck mid-byte, then restart the Wire library
+**
+Parameters:
+* None
+**
+Return:
+* None
+**
+Note:
+* With the TWI disabled, SCL is clocked by hand until the slave releases SDA (at most nine clocks,
+* one byte and its acknowledge), and a stop condition is generated. Pins are only ever driven low;
+* the pull-ups pull them high.
+*****************************************************************************/
+template <class Policy>
+void PLC_Driver<Policy>::RecoverBus(void)
+{
+  this->Count(&PLC_I2CHealth::wRecoveries);
+  bBusSuspect = false;
+  Wire.end();
+  
+  pinMode(SDA, INPUT_PULLUP);
+  pinMode(SCL, INPUT_PULLUP);
+  delayMicroseconds(I2C_RECOVERY_HALF_US);
+  for (byte i = 0; i < 9 && digitalRead(SDA) == LOW; i++)
+  {
+    pinMode(SCL, OUTPUT);
+    digitalWrite(SCL, LOW);
+    delayMicroseconds(I2C_RECOVERY_HALF_US);
+    pinMode(SCL, INPUT_PULLUP);
+    delayMicroseconds(I2C_RECOVERY_HALF_US);
+  }
+  
+  /* Stop condition: SDA rises while SCL is high */
+  pinMode(SDA, OUTPUT);
+  digitalWrite(SDA, LOW);
+  delayMicroseconds(I2C_RECOVERY_HALF_US);
+  pinMode(SCL, INPUT_PULLUP);
+  delayMicroseconds(I2C_RECOVERY_HALF_US);
+  pinMode(SDA, INPUT_PULLUP);
+  delayMicroseconds(I2C_RECOVERY_HALF_US);
+  
+  Wire.begin();
 }
 
 /*****************************************************************************
@@ -376,9 +931,12 @@ Return:
 Note:
 * 
 *****************************************************************************/
-byte PLC_I2C::IsUpdated(void)
+template <class Policy>
+byte PLC_Driver<Policy>::IsUpdated(void)
 {
   // Check the status of the pin P0[7] to see if the PLC device has asserted the HOST_INT pin.
-	return digitalRead(HOST_INIT);
+	return digitalRead(bIntPin);
 }
 
+/* The driver the sketch uses as PLC_I2C */
+template class PLC_Driver<PLC_POLICY>;
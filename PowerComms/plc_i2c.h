@@ -10,6 +10,9 @@ Note:
 
  */
 
+#ifndef PLC_I2C_H
+#define PLC_I2C_H
+
 #if defined(ARDUINO) && ARDUINO >= 100
 #include "Arduino.h"
 #else
@@ -18,25 +21,159 @@ Note:
 
 #include <Wire.h>
 #include "plc_commands.h"
+#include "plc_policy.h"
 
-#define PLC_ADDRESS 0x01
+#define PLC_ADDRESS 0x01	/* Defaults for an instance constructed without arguments */
+#define HOST_INIT 2
 
 #define I2C_FAIL 0x00
 #define I2C_SUCCESS 0x01
 #define PLC_INVALID 0x02
+#define PLC_VERIFY_FAIL 0x03	/* ApplyProfile(): a register read back differently from what was written */
 
 #define MAX_PLC_PACKET_LENGTH 31
 
-class PLC_I2C {
+#define PLC_TX_PENDING 0x00	/* PollTransmit(): the frame is still in flight */
+#define PLC_TX_LOST 0x40		/* The frame or its status was lost on the bus: StartTransmit() could not load it, or
+								 * PollTransmit() had no result within PLC_TX_TIMEOUT */
+#define PLC_TX_TIMEOUT 5000		/* ms from (re)send to result before the frame is given up */
+
+#define PLC_MAX_FRAGMENTS (PLC_POLICY::bMaxFragments)	/* Payload fragments accepted by one gather transmit */
+
+/* Write as many bytes as the Wire library buffers, less the offset byte, in one I2C transaction, and read
+ * as many as it buffers */
+#ifdef BUFFER_LENGTH
+#define I2C_WRITE_MAX (BUFFER_LENGTH - 1)
+#define I2C_READ_MAX BUFFER_LENGTH
+#else
+#define I2C_WRITE_MAX 31
+#define I2C_READ_MAX 32
+#endif
+
+/* One piece of a payload, sent in place without being copied into a contiguous buffer */
+struct PLC_Fragment {
+    const byte *pbData;
+    byte bLength;
+};
+
+#define PLC_PROFILE_KEEP 0xFF	/* PLC_Profile::bThreshold: leave Threshold_Noise as it is */
+
+/* Modem settings written by init(). The fields follow the register map so they can be written in bursts:
+ * INT_Enable (0x00), PLC_Mode and TX_Config (0x05, 0x07), Threshold_Noise to RX_Gain (0x30 - 0x33) */
+struct PLC_Profile {
+    byte bIntEnable;
+    byte bPLCMode;			/* Mode flags; init() adds TX_Enable, or RX_Enable and RX_Override, for the role */
+    byte bTxConfig;
+    byte bThreshold;		/* Or PLC_PROFILE_KEEP */
+    byte bModemConfig;
+    byte bTxGain;
+    byte bRxGain;
+};
+
+/* I2C failures by class, since the instance was created. Kept as PLC_I2C::health when the policy has bStats. */
+struct PLC_I2CHealth {
+    word wAddressNack;		/* Address not acknowledged: device absent or busy */
+    word wDataNack;			/* A data byte not acknowledged */
+    word wBusError;			/* Arbitration lost, bus error or timeout */
+    word wShortRead;		/* Fewer bytes read than requested */
+    word wRetries;
+    word wRecoveries;		/* Stuck bus recoveries */
+    word wFailures;			/* Transfers given up after I2C_RETRIES retries */
+    word wLostStatus;		/* Frames given up by PollTransmit() without a result */
+};
+
+/* Health counters, when the policy keeps them */
+template <bool bStats> struct PLC_HealthStore
+{
+	PLC_I2CHealth health;
+
+	PLC_HealthStore() { memset(&health, 0, sizeof(health)); }
+	void Count(word PLC_I2CHealth::*pwCounter) { (health.*pwCounter)++; }
+};
+
+template <> struct PLC_HealthStore<false>
+{
+	void Count(word PLC_I2CHealth::*) {}
+};
+
+/* TX_Config and TX_DA as last written, when the policy keeps them, with bDALength address bytes */
+template <bool bShadow, byte bDALength> struct PLC_ShadowStore
+{
+	PLC_ShadowStore() : bValid(false) {}
+	bool GetConfig(byte *pbConfig) { *pbConfig = bTxConfig; return bValid; }
+	bool Matches(byte bConfig, const byte *pbAddress, byte bLength)
+	{
+		return bValid && bTxConfig == bConfig && memcmp(abDA, pbAddress, bLength) == 0;
+	}
+	void Set(byte bConfig, const byte *pbAddress, byte bLength)
+	{
+		bTxConfig = bConfig;
+		memcpy(abDA, pbAddress, bLength);
+		bValid = true;
+	}
+	void Invalidate(void) { bValid = false; }
+
+	bool bValid;
+	byte bTxConfig;
+	byte abDA[bDALength];
+};
+
+template <byte bDALength> struct PLC_ShadowStore<false, bDALength>
+{
+	bool GetConfig(byte *) { return false; }
+	bool Matches(byte, const byte *, byte) { return false; }
+	void Set(byte, const byte *, byte) {}
+	void Invalidate(void) {}
+};
+
+/* Address bytes the shadow of a policy keeps */
+#define PLC_SHADOW_DA(Policy) (((Policy::bAddressing) & PLC_ADDR_PHYSICAL) ? 8 : 1)
+
+/* The driver of one PLC device, with the features of Policy (plc_policy.h). The sketch uses it as PLC_I2C. */
+template <class Policy> class PLC_Driver : public PLC_HealthStore<Policy::bStats>,
+	private PLC_ShadowStore<Policy::bShadow, PLC_SHADOW_DA(Policy)> {
   public:
-    byte init(bool transmitter);
+    PLC_Driver(byte bAddress = PLC_ADDRESS, byte bIntPin = HOST_INIT);
+    byte init(bool transmitter, const PLC_Profile *pProfile = NULL);
+    byte ApplyProfile(const PLC_Profile *pProfile, bool bVerify);
     byte SetDestinationAddress (byte bAddrType, byte *pbDestinationAddress);
     byte TransmitPacket(byte bCommand, byte *pbTXData, byte bDataLength);
+    byte TransmitGather(byte bCommand, const PLC_Fragment *pFragments, byte bCount);
+    byte StartTransmit(byte bCommand, byte *pbTXData, byte bDataLength);
+    byte StartTransmitGather(byte bCommand, const PLC_Fragment *pFragments, byte bCount);
+    byte PollTransmit(void);
     byte IsPacketReceived(void);
+    byte ReadStatus(void);
     
     byte ReadFromOffset (byte bOffset, byte *pbData, byte bDataLength);
     byte WriteToOffset(byte bOffset, byte *pbData, byte bDataLength);
+    byte WriteGather(byte bOffset, const PLC_Fragment *pFragments, byte bCount);
+    
+    unsigned long dwReadyTime;	/* millis() when init() found the PLC device answering */
+    bool bWarmStart;			/* init() found the device already configured and wrote nothing */
   private:
+    typedef PLC_HealthStore<Policy::bStats> Health;
+    typedef PLC_ShadowStore<Policy::bShadow, PLC_SHADOW_DA(Policy)> Shadow;
+
     void Start(void);
     byte IsUpdated(void);
+    void FetchStatus(void);
+    byte WriteGatherOnce(byte bOffset, const PLC_Fragment *pFragments, byte bCount);
+    byte ReadOnce(byte bOffset, byte *pbData, byte bDataLength);
+    byte SendMessage(void);
+    byte EndWrite(void);
+    byte VerifyProfile(const PLC_Profile *pProfile);
+    bool Retry(byte bAttempt);
+    void RecoverBus(void);
+
+    byte bAddress;		/* 7-bit I2C address of this instance's PLC device */
+    byte bIntPin;		/* Pin wired to its HOST_INT */
+    byte bTxLength;		/* Length of the frame in flight, for resending after a BIU timeout */
+    unsigned long dwTxStart;	/* millis() of the last (re)send */
+    bool bBusSuspect;	/* A bus error was seen: recover the bus before the next retry */
+    byte bStatus;		/* INT_Status bits read but not yet handed out by PollTransmit() or ReadStatus() */
 };
+
+typedef PLC_Driver<PLC_POLICY> PLC_I2C;
+
+#endif
@@ -0,0 +1,249 @@
+#include "plc_link.h"
+
+/*****************************************************************************
+* Function Name: PLC_LinkTable::begin()
+******************************************************************************
+* Summary:
+* Forget all peers and take the profile's TX_Config as the starting point
+**
+Parameters:
+* pModem: the PLC device, set up with init()
+**
+Return:
+* Status of the I2C communication
+**
+Note:
+* With an unacknowledged profile the retry count and service type are left as the profile has them; the
+* table then only keeps latency and counts.
+*****************************************************************************/
+byte PLC_LinkTable::begin(PLC_I2C *pModem)
+{
+	byte bTxConfig;
+	byte bI2CResult;
+
+	this->pModem = pModem;
+	bCount = 0;
+	bLastValid = false;
+	wUses = 0;
+	/* Without TX_Config, start from the default profile's: acknowledged, 1 retry */
+	bI2CResult = pModem->ReadFromOffset(TX_Config, &bTxConfig, 1);
+	if (bI2CResult != I2C_SUCCESS)
+	{
+		bTxConfig = TX_Service_Type | 0x01;
+	}
+	bBaseConfig = bTxConfig & ~(TX_DA_Type | TX_Service_Type | TX_Retry);
+	bBaseRetry = bTxConfig & TX_Retry;
+	bAdaptive = (bTxConfig & TX_Service_Type) != 0;
+	return bI2CResult;
+}
+
+/*****************************************************************************
+* Function Name: PLC_LinkTable::Prepare()
+******************************************************************************
+* Summary:
+* Address the next frame to a peer, with the retry count and service type picked for it
+**
+Parameters:
+* bAddress: logical address of the peer
+**
+Return:
+* Status of the I2C communication
+**
+Note:
+* Call this instead of SetDestinationAddress(), just before StartTransmit() or TransmitPacket(), and pass
+* the result to Record(). TX_Config and TX_DA are adjacent, so both go in one write, and nothing is written
+* when they already hold what this frame needs.
+*****************************************************************************/
+byte PLC_LinkTable::Prepare(byte bAddress)
+{
+	PLC_Link *pLink = Lookup(bAddress);
+	byte abConfig[2];
+
+	pLink->wLastUse = ++wUses;
+	dwStart = millis();
+
+	abConfig[0] = bBaseConfig | TX_DA_Type_Log;
+	abConfig[0] |= Acknowledged(pLink) ? (TX_Service_Type | pLink->bRetry) : (bAdaptive ? 0 : bBaseRetry);
+	abConfig[1] = bAddress;
+	if (bLastValid && bLastAddress == bAddress && bLastConfig == abConfig[0])
+	{
+		return I2C_SUCCESS;
+	}
+	bLastValid = false;
+	if (pModem->WriteToOffset(TX_Config, abConfig, sizeof(abConfig)) != I2C_SUCCESS)
+	{
+		return I2C_FAIL;
+	}
+	bLastAddress = bAddress;
+	bLastConfig = abConfig[0];
+	bLastValid = true;
+	return I2C_SUCCESS;
+}
+
+/*****************************************************************************
+* Function Name: PLC_LinkTable::Record()
+******************************************************************************
+* Summary:
+* Update a peer with the result of a frame sent to it
+**
+Parameters:
+* bAddress: logical address the frame was prepared for
+* bStatus: the result from TransmitPacket() or PollTransmit()
+**
+Return:
+* None
+**
+Note:
+* Status_UnableToTX and PLC_TX_LOST say nothing about the peer and are ignored, as is the Data_Sent of an
+* unacknowledged frame apart from its latency.
+*****************************************************************************/
+void PLC_LinkTable::Record(byte bAddress, byte bStatus)
+{
+	PLC_Link *pLink = (PLC_Link *)Find(bAddress);
+	unsigned long dwLatency = millis() - dwStart;
+
+	if (pLink == NULL || !(bStatus & (Status_TX_Data_Sent | Status_TX_NO_ACK | Status_TX_NO_RESP)))
+	{
+		return;
+	}
+
+	if (dwLatency > 0xFFFF)
+	{
+		dwLatency = 0xFFFF;
+	}
+	if (pLink->wSent == 0)
+	{
+		pLink->wLatency = (word)dwLatency;
+	}
+	else
+	{
+		pLink->wLatency = (word)((long)pLink->wLatency + ((long)dwLatency - (long)pLink->wLatency) / 8);
+	}
+	if (pLink->wSent < 0xFFFF)
+	{
+		pLink->wSent++;
+	}
+
+	if (!Acknowledged(pLink))
+	{
+		pLink->bSinceProbe++;
+		return;
+	}
+	pLink->bSinceProbe = 0;
+
+	/* Moving average with a weight of 1/8; 0x1FFF rather than 0x2000 keeps it within a word */
+	pLink->wAckRate -= pLink->wAckRate >> 3;
+	if (bStatus & Status_TX_Data_Sent)
+	{
+		pLink->wAckRate += 0x1FFF;
+		if (++pLink->bStreak >= PLC_LINK_STEP_DOWN)
+		{
+			pLink->bStreak = 0;
+			if (pLink->bRetry > 0)
+			{
+				pLink->bRetry--;
+			}
+		}
+		return;
+	}
+
+	if ((bStatus & Status_TX_NO_RESP) && pLink->wNoResp < 0xFFFF)
+	{
+		pLink->wNoResp++;
+	}
+	else if (pLink->wNoAck < 0xFFFF)
+	{
+		pLink->wNoAck++;
+	}
+	pLink->bStreak = 0;
+	if (pLink->bRetry < PLC_LINK_MAX_RETRY)
+	{
+		pLink->bRetry++;
+	}
+}
+
+/*****************************************************************************
+* Function Name: PLC_LinkTable::Count() / Entry() / Find()
+******************************************************************************
+* Summary:
+* Read the table, for reporting: the number of peers, a peer by index, or a peer by address
+**
+Return:
+* Entry() and Find() return NULL for a peer that is not in the table
+*****************************************************************************/
+byte PLC_LinkTable::Count(void)
+{
+	return bCount;
+}
+
+const PLC_Link *PLC_LinkTable::Entry(byte bIndex)
+{
+	return (bIndex < bCount) ? &aLinks[bIndex] : NULL;
+}
+
+const PLC_Link *PLC_LinkTable::Find(byte bAddress)
+{
+	byte i;
+
+	for (i = 0; i < bCount; i++)
+	{
+		if (aLinks[i].bAddress == bAddress)
+		{
+			return &aLinks[i];
+		}
+	}
+	return NULL;
+}
+
+/*****************************************************************************
+* Function Name: PLC_LinkTable::Acknowledged()
+******************************************************************************
+* Summary:
+* Whether the next frame to a peer goes out acknowledged
+**
+Parameters:
+* pLink: the peer, from Entry() or Find()
+**
+Return:
+* FALSE for a mute peer between probes, or when the profile is unacknowledged
+*****************************************************************************/
+bool PLC_LinkTable::Acknowledged(const PLC_Link *pLink)
+{
+	if (!bAdaptive)
+	{
+		return false;
+	}
+	return pLink->wAckRate >= PLC_LINK_MUTE_RATE || pLink->bSinceProbe >= PLC_LINK_PROBE_EVERY - 1;
+}
+
+/* Find a peer, adding it in place of the one used least recently when the table is full */
+PLC_Link *PLC_LinkTable::Lookup(byte bAddress)
+{
+	PLC_Link *pLink = (PLC_Link *)Find(bAddress);
+	byte i;
+
+	if (pLink != NULL)
+	{
+		return pLink;
+	}
+	if (bCount < PLC_LINK_MAX_PEERS)
+	{
+		pLink = &aLinks[bCount++];
+	}
+	else
+	{
+		pLink = &aLinks[0];
+		for (i = 1; i < bCount; i++)
+		{
+			if ((word)(wUses - aLinks[i].wLastUse) > (word)(wUses - pLink->wLastUse))
+			{
+				pLink = &aLinks[i];
+			}
+		}
+	}
+	memset(pLink, 0, sizeof(*pLink));
+	pLink->bAddress = bAddress;
+	pLink->bRetry = bBaseRetry;
+	pLink->wAckRate = 0xFFFF;
+	return pLink;
+}
@@ -0,0 +1,76 @@
+/*
+* File Name: plc_link.h
+**
+Version: 2.1
+**
+Description:
+* Per-peer link quality, used to pick the retry count and service type of each frame.
+* Every result from TransmitPacket() or PollTransmit() updates the peer's moving ACK rate, its NO_ACK and
+* NO_RESP counts and a moving average of the time from submit to result. Before each frame, Prepare()
+* writes the destination and a TX_Config chosen for that peer:
+*   - a frame that is not acknowledged raises the peer's retry count by one, up to PLC_LINK_MAX_RETRY
+*   - PLC_LINK_STEP_DOWN acknowledged frames in a row lower it by one
+*   - a peer that has stopped acknowledging (ACK rate below PLC_LINK_MUTE_RATE) is sent unacknowledged
+*     frames, which cost one transmission instead of every retry, with an acknowledged probe every
+*     PLC_LINK_PROBE_EVERY frames to notice when it comes back
+* A good link settles at no retries and a poor one at as many as it needs for about one loss in
+* PLC_LINK_STEP_DOWN frames.
+**
+Note:
+* The table holds PLC_LINK_MAX_PEERS peers. When it is full the peer used least recently is dropped, so
+* the memory used is fixed however many peers there are; a peer that comes back starts from the profile's
+* settings again.
+* Only logical unicast destinations are tracked. After anything else writes TX_Config or TX_DA, such as
+* SetDestinationAddress() or ApplyProfile(), call begin() again.
+*/
+
+#ifndef PLC_LINK_H
+#define PLC_LINK_H
+
+#include "plc_i2c.h"
+
+#define PLC_LINK_MAX_PEERS		8
+#define PLC_LINK_MAX_RETRY		7		/* Highest TX_Retry used; the register allows 15 */
+#define PLC_LINK_STEP_DOWN		32		/* Consecutive ACKs before trying one retry less */
+#define PLC_LINK_MUTE_RATE		0x1000	/* ACK rate below which a peer counts as mute (1/16), about 20 losses in a row */
+#define PLC_LINK_PROBE_EVERY	16		/* Every so many frames to a mute peer goes out acknowledged */
+
+struct PLC_Link {
+    byte bAddress;				/* Logical address of the peer */
+    byte bRetry;				/* TX_Retry for the next acknowledged frame */
+    byte bStreak;				/* ACKs in a row since the retry count last changed */
+    byte bSinceProbe;			/* Unacknowledged frames since the last acknowledged one */
+    word wAckRate;				/* Moving share of acknowledged frames that got an ACK, 0xFFFF for all */
+    word wLatency;				/* Moving average of Prepare() to result, in ms */
+    word wSent;					/* Frames with a result, saturating */
+    word wNoAck;
+    word wNoResp;
+    word wLastUse;				/* Prepare() count when last used, for replacement */
+};
+
+class PLC_LinkTable {
+  public:
+    byte begin(PLC_I2C *pModem);
+    byte Prepare(byte bAddress);
+    void Record(byte bAddress, byte bStatus);
+    byte Count(void);
+    const PLC_Link *Entry(byte bIndex);
+    const PLC_Link *Find(byte bAddress);
+    bool Acknowledged(const PLC_Link *pLink);
+  private:
+    PLC_Link *Lookup(byte bAddress);
+
+    PLC_I2C *pModem;
+    PLC_Link aLinks[PLC_LINK_MAX_PEERS];
+    byte bCount;
+    byte bBaseConfig;			/* TX_Config without the destination type, service type and retry bits */
+    byte bBaseRetry;			/* Retry count of the profile, for new peers */
+    bool bAdaptive;				/* FALSE when the profile is unacknowledged: nothing to measure */
+    byte bLastAddress;			/* Destination and TX_Config in the PLC device, valid if bLastValid */
+    byte bLastConfig;
+    bool bLastValid;
+    word wUses;
+    unsigned long dwStart;		/* millis() of the last Prepare() */
+};
+
+#endif
@@ -0,0 +1,81 @@
+/*
+* File Name: plc_policy.h
+**
+Version: 2.1
+**
+Description:
+* Compile-time feature selection for the PLC device driver. A policy is a struct of constants and the driver,
+* PLC_Driver, is a template on it. A feature the policy leaves out is compiled out: its code is never
+* generated and its state takes no RAM. The features it keeps are tested against constants, so the tests
+* fold away and nothing is left of them at run time.
+*   bInterrupt      Read INT_Status only when HOST_INT is asserted; false polls INT_Status over I2C instead
+*   bShadow         Keep TX_Config and TX_DA in RAM, so SetDestinationAddress() skips the TX_Config read and
+*                   writes nothing when the address is already set
+*   bStats          Count I2C failures in PLC_I2CHealth
+*   bBiuEscalation  On Status_UnableToTX, raise the BIU threshold (then disable BIU) and send again; false
+*                   returns Status_UnableToTX to the caller
+*   bAddressing     Destination address types SetDestinationAddress() accepts, PLC_ADDR_*. With
+*                   PLC_ADDR_PHYSICAL left out, the shadow keeps one address byte instead of eight.
+*   bMaxFragments   Depth of the fragment list of a gather transmit, which the driver copies on the stack
+**
+Note:
+* PLC_I2C, which every module of the sketch uses, is the driver on PLC_POLICY. Change PLC_POLICY below, or
+* define it on the compiler command line, to build a smaller driver. host/Makefile's size-report target
+* builds each policy here and prints its flash and RAM.
+* PLC_SmallPolicy is meant for 2 KB parts: logical addressing only, no health counters, a single fragment,
+* and the PLC device's result handed straight back on a BIU timeout.
+* The shadow assumes the PLC device keeps its registers. Any write through the driver that touches TX_Config
+* or TX_DA refreshes it, and init() clears it, but a PLC device reset behind the host's back does not.
+*/
+
+#ifndef PLC_POLICY_H
+#define PLC_POLICY_H
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#define PLC_ADDR_LOGICAL	0x01
+#define PLC_ADDR_GROUP		0x02
+#define PLC_ADDR_PHYSICAL	0x04
+#define PLC_ADDR_ALL		(PLC_ADDR_LOGICAL | PLC_ADDR_GROUP | PLC_ADDR_PHYSICAL)
+
+/* The driver as it has always been */
+struct PLC_DefaultPolicy
+{
+	static const bool bInterrupt = true;
+	static const bool bShadow = false;
+	static const bool bStats = true;
+	static const bool bBiuEscalation = true;
+	static const byte bAddressing = PLC_ADDR_ALL;
+	static const byte bMaxFragments = 4;
+};
+
+/* No HOST_INT line: INT_Status is read on every check */
+struct PLC_PollPolicy : PLC_DefaultPolicy
+{
+	static const bool bInterrupt = false;
+};
+
+/* Everything, with the register shadow */
+struct PLC_FullPolicy : PLC_DefaultPolicy
+{
+	static const bool bShadow = true;
+};
+
+struct PLC_SmallPolicy : PLC_DefaultPolicy
+{
+	static const bool bShadow = true;
+	static const bool bStats = false;
+	static const bool bBiuEscalation = false;
+	static const byte bAddressing = PLC_ADDR_LOGICAL;
+	static const byte bMaxFragments = 1;
+};
+
+#ifndef PLC_POLICY
+#define PLC_POLICY PLC_DefaultPolicy	/* Policy of PLC_I2C */
+#endif
+
+#endif
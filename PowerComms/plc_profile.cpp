@@ -0,0 +1,120 @@
+#include "plc_profile.h"
+#include <EEPROM.h>
+
+#define PLC_INT_ALL (INT_UnableToTX | INT_TX_NO_ACK | INT_TX_NO_RESP | INT_RX_Packet_Dropped | INT_RX_Data_Available | INT_TX_Data_Sent)
+
+static const PLC_Profile aProfiles[PLC_PROFILE_COUNT] PROGMEM = {
+	/* Default */
+	{ PLC_INT_ALL, Lock_Configuration | Promiscuous_MASK, TX_Service_Type | 0x01, PLC_PROFILE_KEEP,
+	  Modem_TXDelay_7ms | Modem_FSKBW_3M | Modem_BPS_2400, 0x0E, 0x01 },
+	/* Long range: slowest bit rate, narrow deviation, full gains, more retries */
+	{ PLC_INT_ALL, Lock_Configuration | Promiscuous_MASK, TX_Service_Type | 0x03, PLC_PROFILE_KEEP,
+	  Modem_TXDelay_7ms | Modem_FSKBW_1_5M | Modem_BPS_600, 0x0F, 0x07 },
+	/* Low latency: fastest bit rate and no retries, the application resends what matters */
+	{ PLC_INT_ALL, Lock_Configuration | Promiscuous_MASK, TX_Service_Type, PLC_PROFILE_KEEP,
+	  Modem_TXDelay_7ms | Modem_FSKBW_3M | Modem_BPS_2400, 0x0E, 0x01 },
+	/* Dense network: lower transmit level, the most sensitive BIU threshold so nodes defer to each other, two retries */
+	{ PLC_INT_ALL, Lock_Configuration | Promiscuous_MASK, TX_Service_Type | 0x02, 0x00,
+	  Modem_TXDelay_7ms | Modem_FSKBW_3M | Modem_BPS_2400, 0x0B, 0x03 },
+};
+
+/*****************************************************************************
+* Function Name: PLC_GetProfile()
+******************************************************************************
+* Summary:
+* Copy a built-in profile out of flash
+**
+Parameters:
+* bId: PLC_PROFILE_DEFAULT, PLC_PROFILE_LONG_RANGE, PLC_PROFILE_LOW_LATENCY or PLC_PROFILE_DENSE_NETWORK
+* pProfile: receives the settings
+**
+Return:
+* FALSE if bId is unknown, in which case the default profile is returned
+**
+Note:
+*
+*****************************************************************************/
+bool PLC_GetProfile(byte bId, PLC_Profile *pProfile)
+{
+	bool bKnown = bId < PLC_PROFILE_COUNT;
+
+	memcpy_P(pProfile, &aProfiles[bKnown ? bId : PLC_PROFILE_DEFAULT], sizeof(PLC_Profile));
+	return bKnown;
+}
+
+static byte Checksum(const byte *pbData, byte bLength)
+{
+	byte bSum = PLC_PROFILE_MAGIC;
+
+	for (byte i = 0; i < bLength; i++)
+	{
+		bSum = (bSum << 1 | bSum >> 7) ^ pbData[i];
+	}
+	return bSum;
+}
+
+/*****************************************************************************
+* Function Name: PLC_LoadProfile()
+******************************************************************************
+* Summary:
+* Read the profile stored in EEPROM
+**
+Parameters:
+* iAddress: EEPROM address of the record, such as PLC_PROFILE_EEPROM_ADDRESS
+* pProfile: receives the settings
+**
+Return:
+* TRUE if a valid record was found. Otherwise pProfile is left unchanged.
+**
+Note:
+* The record is the magic byte, the version, the profile and a checksum over the profile.
+*****************************************************************************/
+bool PLC_LoadProfile(int iAddress, PLC_Profile *pProfile)
+{
+	PLC_Profile stored;
+	byte *pbStored = (byte *)&stored;
+
+	if (EEPROM.read(iAddress) != PLC_PROFILE_MAGIC || EEPROM.read(iAddress + 1) != PLC_PROFILE_VERSION)
+	{
+		return false;
+	}
+	for (byte i = 0; i < sizeof(stored); i++)
+	{
+		pbStored[i] = EEPROM.read(iAddress + 2 + i);
+	}
+	if (EEPROM.read(iAddress + 2 + sizeof(stored)) != Checksum(pbStored, sizeof(stored)))
+	{
+		return false;
+	}
+	*pProfile = stored;
+	return true;
+}
+
+/*****************************************************************************
+* Function Name: PLC_SaveProfile()
+******************************************************************************
+* Summary:
+* Store a profile in EEPROM for PLC_LoadProfile() to find at the next boot
+**
+Parameters:
+* iAddress: EEPROM address of the record
+* pProfile: the settings
+**
+Return:
+* None
+**
+Note:
+* EEPROM.update() only writes cells that change, which spares the EEPROM's write endurance.
+*****************************************************************************/
+void PLC_SaveProfile(int iAddress, const PLC_Profile *pProfile)
+{
+	const byte *pbProfile = (const byte *)pProfile;
+
+	EEPROM.update(iAddress, PLC_PROFILE_MAGIC);
+	EEPROM.update(iAddress + 1, PLC_PROFILE_VERSION);
+	for (byte i = 0; i < sizeof(PLC_Profile); i++)
+	{
+		EEPROM.update(iAddress + 2 + i, pbProfile[i]);
+	}
+	EEPROM.update(iAddress + 2 + sizeof(PLC_Profile), Checksum(pbProfile, sizeof(PLC_Profile)));
+}
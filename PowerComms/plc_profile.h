@@ -0,0 +1,35 @@
+/*
+* File Name: plc_profile.h
+**
+Version: 2.1
+**
+Description:
+* Named modem setting profiles, and storage of the profile a node runs with in EEPROM, so a node can be
+* re-tuned in the field without reflashing.
+**
+Note:
+* The built-in values are starting points. Long range trades bit rate for sensitivity, low latency drops the
+* retries, and dense network lowers the transmit level and senses band-in-use at the lowest threshold, so
+* contending nodes hear and defer to each other.
+*/
+
+#ifndef PLC_PROFILE_H
+#define PLC_PROFILE_H
+
+#include "plc_i2c.h"
+
+#define PLC_PROFILE_DEFAULT			0	/* The settings init() has always used */
+#define PLC_PROFILE_LONG_RANGE		1
+#define PLC_PROFILE_LOW_LATENCY		2
+#define PLC_PROFILE_DENSE_NETWORK	3
+#define PLC_PROFILE_COUNT			4
+
+#define PLC_PROFILE_EEPROM_ADDRESS	0		/* Default EEPROM location of the stored profile */
+#define PLC_PROFILE_MAGIC			0xC7
+#define PLC_PROFILE_VERSION			1
+
+bool PLC_GetProfile(byte bId, PLC_Profile *pProfile);
+bool PLC_LoadProfile(int iAddress, PLC_Profile *pProfile);
+void PLC_SaveProfile(int iAddress, const PLC_Profile *pProfile);
+
+#endif
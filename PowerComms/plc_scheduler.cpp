@@ -0,0 +1,131 @@
+#include "plc_scheduler.h"
+
+/*****************************************************************************
+* Function Name: PLC_Scheduler::begin()
+******************************************************************************
+* Summary:
+* Set the frame callbacks and forget all modems
+**
+Parameters:
+* pfnSource: called for the next frame whenever a modem is idle
+* pfnDone: called with the result of every frame. May be NULL.
+**
+Return:
+* None
+**
+Note:
+*
+*****************************************************************************/
+void PLC_Scheduler::begin(PLC_FrameSource pfnSource, PLC_FrameDone pfnDone)
+{
+	this->pfnSource = pfnSource;
+	this->pfnDone = pfnDone;
+	bModemCount = 0;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Scheduler::Add()
+******************************************************************************
+* Summary:
+* Put an initialised modem under the scheduler
+**
+Parameters:
+* pModem: the modem, already set up with init() and its destination address
+**
+Return:
+* The modem's index, as passed to the callbacks, or PLC_NO_FRAME if the table is full
+**
+Note:
+*
+*****************************************************************************/
+byte PLC_Scheduler::Add(PLC_I2C *pModem)
+{
+	if (bModemCount >= PLC_SCHEDULER_MAX_MODEMS)
+	{
+		return PLC_NO_FRAME;
+	}
+	apModem[bModemCount] = pModem;
+	abBusy[bModemCount] = false;
+	return bModemCount++;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Scheduler::Service()
+******************************************************************************
+* Summary:
+* One pass over the modems: collect finished frames and start new ones on idle modems
+**
+Parameters:
+* None
+**
+Return:
+* Number of frames started or finished in this pass. Zero means every modem is waiting on the line or has
+* nothing to send, and the caller may sleep until a HOST_INT asserts.
+**
+Note:
+* A modem is started again in the same pass that finishes its frame, so it does not sit idle for a pass.
+*****************************************************************************/
+byte PLC_Scheduler::Service(void)
+{
+	byte abData[MAX_PLC_PACKET_LENGTH];
+	byte bEvents = 0;
+	byte bCommand;
+	byte bLength;
+	byte bStatus;
+
+	for (byte i = 0; i < bModemCount; i++)
+	{
+		if (abBusy[i])
+		{
+			bStatus = apModem[i]->PollTransmit();
+			if (bStatus == PLC_TX_PENDING)
+			{
+				continue;
+			}
+			abBusy[i] = false;
+			bEvents++;
+			if (pfnDone != NULL)
+			{
+				pfnDone(i, bStatus);
+			}
+		}
+
+		bLength = pfnSource(i, &bCommand, abData);
+		if (bLength == PLC_NO_FRAME)
+		{
+			continue;
+		}
+		bStatus = apModem[i]->StartTransmit(bCommand, abData, bLength);
+		if (bStatus != I2C_SUCCESS)
+		{
+			/* Never reached the line: finished already */
+			bEvents++;
+			if (pfnDone != NULL)
+			{
+				pfnDone(i, bStatus);
+			}
+			continue;
+		}
+		abBusy[i] = true;
+		bEvents++;
+	}
+	return bEvents;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Scheduler::Busy()
+******************************************************************************
+* Summary:
+* Responds TRUE while any modem has a frame in flight
+*****************************************************************************/
+bool PLC_Scheduler::Busy(void)
+{
+	for (byte i = 0; i < bModemCount; i++)
+	{
+		if (abBusy[i])
+		{
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,46 @@
+/*
+* File Name: plc_scheduler.h
+**
+Version: 2.1
+**
+Description:
+* Keeps several PLC devices, each on its own phase or circuit, transmitting at the same time from one host.
+* Each pass of Service() loads a frame into every idle device and checks every busy one, so the I2C work for
+* one device is done while the others are waiting on the line. Aggregate throughput grows with the number of
+* devices instead of being limited to one TransmitPacket() at a time.
+**
+Note:
+* Frames are pulled from the application through a callback when a device goes idle, so no per-device queue
+* is kept here.
+*/
+
+#ifndef PLC_SCHEDULER_H
+#define PLC_SCHEDULER_H
+
+#include "plc_i2c.h"
+
+#define PLC_SCHEDULER_MAX_MODEMS	4
+#define PLC_NO_FRAME				0xFF	/* Returned by a PLC_FrameSource with nothing to send */
+
+/* Fill in the next frame for modem bModem: its command ID in *pbCommand and up to MAX_PLC_PACKET_LENGTH
+ * bytes of payload in pbData. Returns the payload length, or PLC_NO_FRAME. */
+typedef byte (*PLC_FrameSource)(byte bModem, byte *pbCommand, byte *pbData);
+
+/* Called with the final INT_Status of each frame */
+typedef void (*PLC_FrameDone)(byte bModem, byte bStatus);
+
+class PLC_Scheduler {
+  public:
+    void begin(PLC_FrameSource pfnSource, PLC_FrameDone pfnDone);
+    byte Add(PLC_I2C *pModem);
+    byte Service(void);
+    bool Busy(void);
+  private:
+    PLC_FrameSource pfnSource;
+    PLC_FrameDone pfnDone;
+    byte bModemCount;
+    PLC_I2C *apModem[PLC_SCHEDULER_MAX_MODEMS];
+    bool abBusy[PLC_SCHEDULER_MAX_MODEMS];
+};
+
+#endif
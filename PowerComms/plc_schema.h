@@ -0,0 +1,141 @@
+/*
+* File Name: plc_schema.h
+**
+Version: 2.1
+**
+Description:
+* Compile-time layout of a PLC message payload as a list of bit fields.
+* A schema is declared with the width in bits of each field, e.g. PLC_Schema<6, 10, 16>. The bit offset of
+* every field, the bytes it touches and their masks are resolved at compile time, so Set() and Get() come
+* out as a fixed sequence of shifts and masked byte moves with no loops or branches. The total size is
+* checked against MAX_PLC_PACKET_LENGTH when the schema is declared.
+**
+Note:
+* Fields are packed LSB first: field 0 starts at bit 0 of byte 0, and a field that crosses a byte boundary
+* continues in bit 0 of the next byte. The layout is the same on any host, so it does not depend on the
+* endianness of the two ends. Fields are 1 to 32 bits wide and are read back as uint32_t.
+*/
+
+#ifndef PLC_SCHEMA_H
+#define PLC_SCHEMA_H
+
+#include "plc_i2c.h"
+
+/* Mask of the low bBits bits */
+template <byte bBits> struct PLC_BitMask
+{
+	static const uint32_t value = (1UL << bBits) - 1;
+};
+
+template <> struct PLC_BitMask<32>
+{
+	static const uint32_t value = 0xFFFFFFFFUL;
+};
+
+/* Moves field bits to and from one payload byte. iShift is the field bit that lands on bit 0 of the byte;
+ * it is negative for the first byte of a field that does not start on a byte boundary. */
+template <int iShift, bool bBelow = (iShift < 0)> struct PLC_ByteShift
+{
+	static constexpr byte ToByte(uint32_t dwValue) { return (byte)(dwValue >> iShift); }
+	static inline uint32_t FromByte(byte bValue) { return (uint32_t)bValue << iShift; }
+};
+
+template <int iShift> struct PLC_ByteShift<iShift, true>
+{
+	static constexpr byte ToByte(uint32_t dwValue) { return (byte)(dwValue << -iShift); }
+	static inline uint32_t FromByte(byte bValue) { return bValue >> -iShift; }
+};
+
+/* The payload bytes covered by a field of bWidth bits at bit wOffset, from byte bByte on */
+template <word wOffset, byte bWidth, byte bByte = wOffset / 8, bool bLast = (bByte == (wOffset + bWidth - 1) / 8)>
+struct PLC_FieldBytes
+{
+	typedef PLC_ByteShift<bByte * 8 - (int)wOffset> Shift;
+	typedef PLC_FieldBytes<wOffset, bWidth, bByte + 1> Next;
+	static const byte bMask = Shift::ToByte(PLC_BitMask<bWidth>::value);
+
+	static inline void Set(byte *pbPayload, uint32_t dwValue)
+	{
+		pbPayload[bByte] = (pbPayload[bByte] & (byte)~bMask) | (Shift::ToByte(dwValue) & bMask);
+		Next::Set(pbPayload, dwValue);
+	}
+	static inline uint32_t Get(const byte *pbPayload)
+	{
+		return Shift::FromByte(pbPayload[bByte] & bMask) | Next::Get(pbPayload);
+	}
+};
+
+template <word wOffset, byte bWidth, byte bByte> struct PLC_FieldBytes<wOffset, bWidth, bByte, true>
+{
+	typedef PLC_ByteShift<bByte * 8 - (int)wOffset> Shift;
+	static const byte bMask = Shift::ToByte(PLC_BitMask<bWidth>::value);
+
+	static inline void Set(byte *pbPayload, uint32_t dwValue)
+	{
+		pbPayload[bByte] = (pbPayload[bByte] & (byte)~bMask) | (Shift::ToByte(dwValue) & bMask);
+	}
+	static inline uint32_t Get(const byte *pbPayload)
+	{
+		return Shift::FromByte(pbPayload[bByte] & bMask);
+	}
+};
+
+/* Total width of a field list */
+template <byte... Widths> struct PLC_SchemaBits;
+
+template <> struct PLC_SchemaBits<>
+{
+	static const word value = 0;
+};
+
+template <byte bWidth, byte... Rest> struct PLC_SchemaBits<bWidth, Rest...>
+{
+	static_assert(bWidth >= 1 && bWidth <= 32, "PLC_Schema fields are 1 to 32 bits wide");
+	static const word value = bWidth + PLC_SchemaBits<Rest...>::value;
+};
+
+/* Bit offset and width of field bField. Naming a field past the end of the list does not compile. */
+template <byte bField, byte... Widths> struct PLC_SchemaField;
+
+template <byte bWidth, byte... Rest> struct PLC_SchemaField<0, bWidth, Rest...>
+{
+	static const word wOffset = 0;
+	static const byte bBits = bWidth;
+};
+
+template <byte bField, byte bWidth, byte... Rest> struct PLC_SchemaField<bField, bWidth, Rest...>
+{
+	static const word wOffset = bWidth + PLC_SchemaField<bField - 1, Rest...>::wOffset;
+	static const byte bBits = PLC_SchemaField<bField - 1, Rest...>::bBits;
+};
+
+template <byte... Widths>
+class PLC_Schema {
+  public:
+    static const byte bFields = sizeof...(Widths);
+    static const word wBits = PLC_SchemaBits<Widths...>::value;
+    static const byte bLength = (wBits + 7) / 8;	/* Payload bytes of a message */
+    static_assert(wBits <= MAX_PLC_PACKET_LENGTH * 8, "PLC_Schema does not fit in one PLC message");
+
+    /* Write field bField, keeping the other bits of its bytes. Value bits above the field width are dropped. */
+    template <byte bField> static inline void Set(byte *pbPayload, uint32_t dwValue)
+    {
+        typedef PLC_SchemaField<bField, Widths...> Field;
+        PLC_FieldBytes<Field::wOffset, Field::bBits>::Set(pbPayload, dwValue);
+    }
+
+    /* Read field bField */
+    template <byte bField> static inline uint32_t Get(const byte *pbPayload)
+    {
+        typedef PLC_SchemaField<bField, Widths...> Field;
+        return PLC_FieldBytes<Field::wOffset, Field::bBits>::Get(pbPayload);
+    }
+
+    /* Zero the whole message, including the padding bits of the last byte */
+    static inline void Clear(byte *pbPayload)
+    {
+        memset(pbPayload, 0, bLength);
+    }
+};
+
+#endif
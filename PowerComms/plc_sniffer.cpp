@@ -0,0 +1,240 @@
+#include "plc_sniffer.h"
+
+#define RING_MASK (PLC_SNIFFER_RING - 1)
+
+static void PutLong(byte *pbData, unsigned long dwValue)
+{
+	pbData[0] = (byte)dwValue;
+	pbData[1] = (byte)(dwValue >> 8);
+	pbData[2] = (byte)(dwValue >> 16);
+	pbData[3] = (byte)(dwValue >> 24);
+}
+
+/*****************************************************************************
+* Function Name: PLC_Sniffer::begin()
+******************************************************************************
+* Summary:
+* Switch an initialised PLC device to capturing every frame on the line
+**
+Parameters:
+* pModem: the PLC device, set up with init() as a receiver
+**
+Return:
+* Status of the I2C communication
+**
+Note:
+* Promiscuous_MASK is set so frames for other addresses are received too. RX_Override is cleared, so a frame
+* arriving before the last one was read is dropped and reported, instead of silently overwriting it.
+*****************************************************************************/
+byte PLC_Sniffer::begin(PLC_I2C *pModem)
+{
+	byte bPLCMode;
+
+	this->pModem = pModem;
+	memset(&stats, 0, sizeof(stats));
+	dispatcher.begin();
+	dispatcher.SetDefault(OnFrame, this);
+	bHead = 0;
+	bTail = 0;
+	dwStatsTime = millis();
+	bStatsDue = true;
+
+	if (pModem->ReadFromOffset(PLC_Mode, &bPLCMode, 1) != I2C_SUCCESS)
+	{
+		return I2C_FAIL;
+	}
+	bPLCMode = (bPLCMode | RX_Enable | Promiscuous_MASK) & ~RX_Override;
+	return pModem->WriteToOffset(PLC_Mode, &bPLCMode, 1);
+}
+
+/*****************************************************************************
+* Function Name: PLC_Sniffer::Service()
+******************************************************************************
+* Summary:
+* Capture the frame the PLC device holds, if any, and queue the records that are due
+**
+Parameters:
+* None
+**
+Return:
+* Number of frames captured
+**
+Note:
+* Call as often as possible; between calls the PLC device can hold only one frame. The Serial side is
+* drained separately with Read().
+*****************************************************************************/
+byte PLC_Sniffer::Service(void)
+{
+	byte bStatus = pModem->ReadStatus();
+	byte bFrames = 0;
+
+	dwSeen = micros();
+	if (bStatus & Status_RX_Packet_Dropped)
+	{
+		stats.wChipDrops++;
+		bStatsDue = true;
+	}
+	if (bStatus & Status_RX_Data_Available)
+	{
+		while (dispatcher.Poll(pModem))
+		{
+			bFrames++;
+		}
+	}
+	if (bStatsDue || (millis() - dwStatsTime) >= PLC_SNIFFER_STATS_MS)
+	{
+		AppendStats();
+	}
+	return bFrames;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Sniffer::Read()
+******************************************************************************
+* Summary:
+* Take queued stream bytes out of the ring
+**
+Parameters:
+* pbData: where to put them
+* bMax: room in pbData, e.g. Serial.availableForWrite() so the write does not block
+**
+Return:
+* Number of bytes taken
+**
+Note:
+*
+*****************************************************************************/
+byte PLC_Sniffer::Read(byte *pbData, byte bMax)
+{
+	byte bCount = 0;
+
+	while (bCount < bMax && bTail != bHead)
+	{
+		pbData[bCount++] = abRing[bTail];
+		bTail = (bTail + 1) & RING_MASK;
+	}
+	return bCount;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Sniffer::Pending()
+******************************************************************************
+* Summary:
+* Stream bytes waiting in the ring
+**
+Parameters:
+* None
+**
+Return:
+* The byte count
+**
+Note:
+*
+*****************************************************************************/
+byte PLC_Sniffer::Pending(void)
+{
+	return (bHead - bTail) & RING_MASK;
+}
+
+/* Dispatcher default handler: every frame lands here, as no command ID has a handler of its own */
+void PLC_Sniffer::OnFrame(const PLC_Frame *pFrame, void *pContext)
+{
+	PLC_Sniffer *pSniffer = (PLC_Sniffer *)pContext;
+	byte abHead[4 + 1];
+	PLC_Fragment aBody[4];
+
+	PutLong(abHead, pSniffer->dwSeen);
+	abHead[4] = pFrame->bInfo;
+	aBody[0].pbData = abHead;
+	aBody[0].bLength = sizeof(abHead);
+	aBody[1].pbData = pFrame->pbSource;
+	aBody[1].bLength = (pFrame->bInfo & RX_SA_PHY) ? PLC_SNIFF_PHYSICAL_SA : PLC_SNIFF_LOGICAL_SA;
+	aBody[2].pbData = &pFrame->bCommand;
+	aBody[2].bLength = 1;
+	aBody[3].pbData = pFrame->pbData;
+	aBody[3].bLength = pFrame->bLength;
+
+	if (pSniffer->Append(PLC_SNIFF_FRAME, aBody, 4))
+	{
+		pSniffer->stats.dwFrames++;
+	}
+	else
+	{
+		pSniffer->stats.wRingDrops++;
+		pSniffer->bStatsDue = true;
+	}
+}
+
+void PLC_Sniffer::AppendStats(void)
+{
+	byte abBody[4 + 4 + 2 + 2];
+	PLC_Fragment body = { abBody, sizeof(abBody) };
+
+	PutLong(&abBody[0], micros());
+	PutLong(&abBody[4], stats.dwFrames);
+	abBody[8] = (byte)stats.wChipDrops;
+	abBody[9] = (byte)(stats.wChipDrops >> 8);
+	abBody[10] = (byte)stats.wRingDrops;
+	abBody[11] = (byte)(stats.wRingDrops >> 8);
+
+	/* A full ring keeps the record due, so the drop counts go out once there is room */
+	if (Append(PLC_SNIFF_STATS, &body, 1))
+	{
+		bStatsDue = false;
+		dwStatsTime = millis();
+	}
+}
+
+/*****************************************************************************
+* Function Name: PLC_Sniffer::Append()
+******************************************************************************
+* Summary:
+* Queue one whole record, framed and checksummed, or nothing
+**
+Parameters:
+* bType: record type
+* pFragments: the record body, in pieces
+* bCount: number of pieces
+**
+Return:
+* FALSE if the ring has no room for it
+**
+Note:
+*
+*****************************************************************************/
+bool PLC_Sniffer::Append(byte bType, const PLC_Fragment *pFragments, byte bCount)
+{
+	byte bLength = 1;
+	byte bSum;
+	byte i, j;
+
+	for (i = 0; i < bCount; i++)
+	{
+		bLength += pFragments[i].bLength;
+	}
+	/* Sync, length and checksum on top; one slot stays empty to tell a full ring from an empty one */
+	if ((word)bLength + 3 > (word)(RING_MASK - Pending()))
+	{
+		return false;
+	}
+
+	abRing[bHead] = PLC_SNIFF_SYNC;
+	bHead = (bHead + 1) & RING_MASK;
+	abRing[bHead] = bLength;
+	bHead = (bHead + 1) & RING_MASK;
+	abRing[bHead] = bType;
+	bHead = (bHead + 1) & RING_MASK;
+	bSum = bLength + bType;
+	for (i = 0; i < bCount; i++)
+	{
+		for (j = 0; j < pFragments[i].bLength; j++)
+		{
+			abRing[bHead] = pFragments[i].pbData[j];
+			bHead = (bHead + 1) & RING_MASK;
+			bSum += pFragments[i].pbData[j];
+		}
+	}
+	abRing[bHead] = (byte)-bSum;
+	bHead = (bHead + 1) & RING_MASK;
+	return true;
+}
@@ -0,0 +1,69 @@
+/*
+* File Name: plc_sniffer.h
+**
+Version: 2.1
+**
+Description:
+* Line sniffer: puts the PLC device in promiscuous mode and turns every frame it hears into a record of a
+* compact binary capture stream, to be sent over Serial and converted on a PC (host/sniffer/plc_sniffconv).
+* Records are queued in a small ring so a slow Serial write never holds up reading the next frame; the PLC
+* device can only hold one received frame, and one left unread when the next arrives is dropped.
+**
+Note:
+* Stream format, all multi-byte fields little-endian:
+*   PLC_SNIFF_SYNC, length of type and body, type, body, checksum
+* The checksum makes the sum of the length, type, body and checksum bytes zero (mod 256).
+* PLC_SNIFF_FRAME body: micros() when the frame was seen (4), RX_Message_INFO (1), source address (2 bytes
+*   for a logical address, 8 for a physical one, see RX_SA_PHY), command ID (1), payload (RX_Msg_Length).
+* PLC_SNIFF_STATS body: micros() (4), frames captured (4), PLC device drops (2), ring drops (2).
+* A STATS record follows any drop and is otherwise sent every PLC_SNIFFER_STATS_MS. The destination address of
+* a frame is not available from the PLC device, only its type (RX_DA_GROUP).
+*/
+
+#ifndef PLC_SNIFFER_H
+#define PLC_SNIFFER_H
+
+#include "plc_i2c.h"
+#include "plc_dispatch.h"
+
+#define PLC_SNIFF_SYNC		0xA5
+#define PLC_SNIFF_FRAME		0x01
+#define PLC_SNIFF_STATS		0x02
+
+#define PLC_SNIFF_LOGICAL_SA	2		/* Source address bytes in a FRAME record */
+#define PLC_SNIFF_PHYSICAL_SA	8
+#define PLC_SNIFF_MAX_RECORD	(4 + 4 + 1 + PLC_SNIFF_PHYSICAL_SA + 1 + MAX_PLC_PACKET_LENGTH)	/* Framing and the longest FRAME body */
+
+#define PLC_SNIFFER_RING		128		/* Bytes of queued records, a power of 2 */
+#define PLC_SNIFFER_STATS_MS	1000
+
+struct PLC_SnifferStats {
+    unsigned long dwFrames;		/* Frames captured */
+    word wChipDrops;			/* Status_RX_Packet_Dropped reported by the PLC device */
+    word wRingDrops;			/* Frames lost because the ring was full */
+};
+
+class PLC_Sniffer {
+  public:
+    byte begin(PLC_I2C *pModem);
+    byte Service(void);
+    byte Read(byte *pbData, byte bMax);
+    byte Pending(void);
+
+    PLC_SnifferStats stats;
+  private:
+    static void OnFrame(const PLC_Frame *pFrame, void *pContext);
+    bool Append(byte bType, const PLC_Fragment *pFragments, byte bCount);
+    void AppendStats(void);
+
+    PLC_I2C *pModem;
+    PLC_Dispatcher dispatcher;
+    unsigned long dwSeen;		/* micros() of the status read that reported the frame */
+    unsigned long dwStatsTime;
+    bool bStatsDue;
+    byte bHead;
+    byte bTail;
+    byte abRing[PLC_SNIFFER_RING];
+};
+
+#endif
@@ -0,0 +1,409 @@
+#include "plc_tdma.h"
+
+/* Dispatcher handler for CMD_TDMA_BEACON, see PLC_Tdma::Attach() */
+static void OnTdmaBeacon(const PLC_Frame *pFrame, void *pContext)
+{
+	((PLC_Tdma *)pContext)->OnBeacon(pFrame);
+}
+
+/*****************************************************************************
+* Function Name: PLC_Tdma::begin()
+******************************************************************************
+* Summary:
+* Set up slotted access for a node or the coordinator
+**
+Parameters:
+* pModem: the PLC device, set up with init() and its local address
+* pConfig: slot plan and the slots this node owns. Only the coordinator's slot length, count and guard
+*          time are used; nodes take them from the beacons.
+* bCoordinator: TRUE for the node that sends the beacons
+* pfnSource: called for the next frame whenever one can go out
+* pfnDone: called with the result of every frame. May be NULL.
+* pContext: passed to both callbacks
+**
+Return:
+* Status of the I2C communication
+**
+Note:
+* Every node both sends and receives, so TX_Enable and RX_Enable are added to PLC_Mode.
+* The coordinator sends its first beacon on the first Service(); a node sends nothing before it hears one.
+*****************************************************************************/
+byte PLC_Tdma::begin(PLC_I2C *pModem, const PLC_TdmaConfig *pConfig, bool bCoordinator,
+                     PLC_TdmaSource pfnSource, PLC_TdmaDone pfnDone, void *pContext)
+{
+	byte bTemp;
+	byte bI2CResult;
+
+	this->pModem = pModem;
+	this->bCoordinator = bCoordinator;
+	this->pfnSource = pfnSource;
+	this->pfnDone = pfnDone;
+	this->pContext = pContext;
+	config = *pConfig;
+	if (config.bSlots > PLC_TDMA_MAX_SLOTS)
+	{
+		config.bSlots = PLC_TDMA_MAX_SLOTS;
+	}
+	wBeacons = 0;
+	wMissed = 0;
+	wLostSync = 0;
+	bLastValid = false;
+	bSynced = false;
+	bBusy = false;
+	bBeaconBusy = false;
+	bSuperframe = 0;
+	bMissed = 0;
+	dwRef = 0;
+	dwBeaconDue = 0;
+	dwTxStart = 0;
+	dwHeard = 0;
+	dwPeriod = 0;
+
+	/* Without TX_Config, start from the default profile's: acknowledged, 1 retry */
+	bI2CResult = pModem->ReadFromOffset(TX_Config, &bTemp, 1);
+	if (bI2CResult != I2C_SUCCESS)
+	{
+		bTemp = TX_Service_Type | 0x01;
+	}
+	bBaseConfig = bTemp & ~TX_DA_Type;
+
+	if (bI2CResult == I2C_SUCCESS)
+	{
+		bI2CResult = pModem->ReadFromOffset(PLC_Mode, &bTemp, 1);
+	}
+	if (bI2CResult == I2C_SUCCESS)
+	{
+		bTemp |= TX_Enable | RX_Enable;
+		bI2CResult = pModem->WriteToOffset(PLC_Mode, &bTemp, 1);
+	}
+	return bI2CResult;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Tdma::Attach()
+******************************************************************************
+* Summary:
+* Have a dispatcher pass received beacons to this node
+**
+Parameters:
+* pDispatcher: the dispatcher the application services
+**
+Return:
+* FALSE if the dispatcher has no handler slot left
+**
+Note:
+* The coordinator does not need this. An application that reads frames some other way can hand
+* CMD_TDMA_BEACON frames to OnBeacon() itself.
+*****************************************************************************/
+bool PLC_Tdma::Attach(PLC_Dispatcher *pDispatcher)
+{
+	return pDispatcher->Register(CMD_TDMA_BEACON, OnTdmaBeacon, this);
+}
+
+/*****************************************************************************
+* Function Name: PLC_Tdma::Service()
+******************************************************************************
+* Summary:
+* Collect a finished frame, send the beacon when it is due and start a frame when a slot allows it
+**
+Parameters:
+* None
+**
+Return:
+* Number of frames started or finished. Zero means nothing can be done before Idle() ms have passed or
+* HOST_INT asserts.
+**
+Note:
+* Call it often: frames only start while Service() is running, so a slot the host is late for is lost.
+*****************************************************************************/
+byte PLC_Tdma::Service(void)
+{
+	byte abData[MAX_PLC_PACKET_LENGTH];
+	byte bEvents = 0;
+	byte bAddress;
+	byte bCommand;
+	byte bLength;
+	byte bStatus;
+	unsigned long dwNow;
+
+	if (bBusy)
+	{
+		bStatus = pModem->PollTransmit();
+		if (bStatus == PLC_TX_PENDING)
+		{
+			return 0;
+		}
+		bBusy = false;
+		bEvents++;
+		if (bBeaconBusy)
+		{
+			/* Slot 0 starts now, as it does for the nodes reading the beacon */
+			bBeaconBusy = false;
+			dwRef = millis();
+			dwBeaconDue = (unsigned long)config.bSlots * config.wSlotMs;
+			bSynced = true;
+			wBeacons++;
+		}
+		else if (pfnDone != NULL)
+		{
+			pfnDone(pContext, bTxAddress, bStatus);
+		}
+	}
+
+	dwNow = millis();
+	if (bCoordinator && dwNow - dwRef >= dwBeaconDue)
+	{
+		return bEvents + SendBeacon(dwNow);
+	}
+	Track(dwNow);
+	if (SlotWait(dwNow) != 0)
+	{
+		return bEvents;
+	}
+
+	bLength = pfnSource(pContext, &bAddress, &bCommand, abData);
+	if (bLength == PLC_NO_FRAME)
+	{
+		return bEvents;
+	}
+	if (Address(bBaseConfig | TX_DA_Type_Log, bAddress) != I2C_SUCCESS)
+	{
+		/* Sending it anyway could put it at the previous destination */
+		if (pfnDone != NULL)
+		{
+			pfnDone(pContext, bAddress, PLC_TX_LOST);
+		}
+		return bEvents;
+	}
+	bStatus = pModem->StartTransmit(bCommand, abData, bLength);
+	if (bStatus != I2C_SUCCESS)
+	{
+		if (pfnDone != NULL)
+		{
+			pfnDone(pContext, bAddress, bStatus);
+		}
+		return bEvents;
+	}
+	bTxAddress = bAddress;
+	dwTxStart = millis();
+	bBusy = true;
+	return bEvents + 1;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Tdma::Idle()
+******************************************************************************
+* Summary:
+* How long the host may sleep before Service() has something to do
+**
+Parameters:
+* None
+**
+Return:
+* ms until the next beacon is due or the next owned slot can take a frame, 0 if a frame can go out now, or
+* PLC_TDMA_NEVER when only HOST_INT (a frame result or a beacon) can change anything. With a frame in flight,
+* the ms until PollTransmit() would give it up, as its status can be lost on the bus without HOST_INT.
+**
+Note:
+* A frame queued while the host sleeps waits for the time returned anyway, so the host need not wake for it.
+*****************************************************************************/
+unsigned long PLC_Tdma::Idle(void)
+{
+	unsigned long dwNow = millis();
+	unsigned long dwOffset;
+	unsigned long dwWait;
+	unsigned long dwDue;
+
+	if (bBusy)
+	{
+		return PLC_TX_TIMEOUT - (dwNow - dwTxStart) % PLC_TX_TIMEOUT;
+	}
+	Track(dwNow);
+	dwOffset = dwNow - dwRef;
+	dwWait = SlotWait(dwNow);
+	if (bCoordinator)
+	{
+		dwDue = dwBeaconDue;
+	}
+	else if (bSynced)
+	{
+		dwDue = dwPeriod + config.wSlotMs / 2;
+	}
+	else
+	{
+		return dwWait;
+	}
+	dwDue = (dwOffset >= dwDue) ? 0 : dwDue - dwOffset;
+	return (dwDue < dwWait) ? dwDue : dwWait;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Tdma::Synced()
+******************************************************************************
+* Summary:
+* Responds TRUE while the slot clock follows the beacons, and on the coordinator once its first beacon is out
+*****************************************************************************/
+bool PLC_Tdma::Synced(void)
+{
+	return bSynced;
+}
+
+/*****************************************************************************
+* Function Name: PLC_Tdma::OnBeacon()
+******************************************************************************
+* Summary:
+* Align the slot clock to a beacon just read
+**
+Parameters:
+* pFrame: a CMD_TDMA_BEACON frame
+**
+Return:
+* None
+**
+Note:
+* The beacon to beacon time is measured from beacons heard in sync, so a node that misses one counts on by
+* the real superframe length, beacon included, rather than just its slots.
+*****************************************************************************/
+void PLC_Tdma::OnBeacon(const PLC_Frame *pFrame)
+{
+	unsigned long dwNow = millis();
+	byte bNumber;
+	byte bGap;
+
+	if (bCoordinator || pFrame->bLength < PLC_TdmaBeacon::bLength)
+	{
+		return;
+	}
+	bNumber = (byte)PLC_TdmaBeacon::Get<0>(pFrame->pbData);
+	config.wSlotMs = (word)PLC_TdmaBeacon::Get<1>(pFrame->pbData);
+	config.bSlots = (byte)PLC_TdmaBeacon::Get<2>(pFrame->pbData);
+	config.bGuardMs = (byte)PLC_TdmaBeacon::Get<3>(pFrame->pbData);
+	if (config.bSlots > PLC_TDMA_MAX_SLOTS)
+	{
+		config.bSlots = PLC_TDMA_MAX_SLOTS;
+	}
+
+	bGap = bNumber - bSuperframe;
+	if (bSynced && bGap >= 1 && bGap <= PLC_TDMA_MAX_MISSED + 1)
+	{
+		dwPeriod = (dwNow - dwHeard) / bGap;
+	}
+	else if (!bSynced)
+	{
+		/* First guess, until two beacons have been heard: the beacon takes no more than a slot */
+		dwPeriod = (unsigned long)(config.bSlots + 1) * config.wSlotMs;
+	}
+	bSuperframe = bNumber;
+	dwRef = dwNow;
+	dwHeard = dwNow;
+	bMissed = 0;
+	bSynced = true;
+	wBeacons++;
+}
+
+/* Count on through superframes whose beacon was not heard, and drop sync after too many */
+void PLC_Tdma::Track(unsigned long dwNow)
+{
+	if (bCoordinator || !bSynced)
+	{
+		return;
+	}
+	/* Half a slot after a beacon should have been read, take it as missed */
+	while (dwNow - dwRef >= dwPeriod + config.wSlotMs / 2)
+	{
+		dwRef += dwPeriod;
+		wMissed++;
+		if (++bMissed > PLC_TDMA_MAX_MISSED)
+		{
+			bSynced = false;
+			wLostSync++;
+			return;
+		}
+	}
+}
+
+/* Write TX_Config and TX_DA, which are adjacent, in one go, unless they already hold these values */
+byte PLC_Tdma::Address(byte bConfig, byte bAddress)
+{
+	byte abConfig[2] = { bConfig, bAddress };
+
+	if (bLastValid && abLast[0] == bConfig && abLast[1] == bAddress)
+	{
+		return I2C_SUCCESS;
+	}
+	bLastValid = false;
+	if (pModem->WriteToOffset(TX_Config, abConfig, sizeof(abConfig)) != I2C_SUCCESS)
+	{
+		return I2C_FAIL;
+	}
+	abLast[0] = bConfig;
+	abLast[1] = bAddress;
+	bLastValid = true;
+	return I2C_SUCCESS;
+}
+
+/*
+ * Start the next beacon: to the group, unacknowledged. Returns the number of frames started. A beacon that
+ * cannot be loaded is tried again at the next slot boundary; until then the slots run on from dwRef.
+ */
+byte PLC_Tdma::SendBeacon(unsigned long dwNow)
+{
+	byte abBeacon[PLC_TdmaBeacon::bLength];
+	unsigned long dwSlotMs = (config.wSlotMs != 0) ? config.wSlotMs : 1;
+
+	PLC_TdmaBeacon::Clear(abBeacon);
+	PLC_TdmaBeacon::Set<0>(abBeacon, (byte)(bSuperframe + 1));
+	PLC_TdmaBeacon::Set<1>(abBeacon, config.wSlotMs);
+	PLC_TdmaBeacon::Set<2>(abBeacon, config.bSlots);
+	PLC_TdmaBeacon::Set<3>(abBeacon, config.bGuardMs);
+	if (Address((bBaseConfig & ~(TX_Service_Type | TX_Retry)) | TX_DA_Type_Grp, config.bGroup) != I2C_SUCCESS
+		|| pModem->StartTransmit(CMD_TDMA_BEACON, abBeacon, sizeof(abBeacon)) != I2C_SUCCESS)
+	{
+		dwBeaconDue = ((dwNow - dwRef) / dwSlotMs + 1) * dwSlotMs;
+		return 0;
+	}
+	bSuperframe++;
+	dwTxStart = millis();
+	bBusy = true;
+	bBeaconBusy = true;
+	return 1;
+}
+
+/*
+ * ms from dwNow until a frame can start in an owned slot: this superframe's, or else the next one's. The
+ * next superframe starts where the coordinator sends its beacon, or for a node a measured beacon later.
+ */
+unsigned long PLC_Tdma::SlotWait(unsigned long dwNow)
+{
+	unsigned long dwOffset = dwNow - dwRef;
+	unsigned long dwBase;
+	unsigned long dwFirst;
+	unsigned long dwLast;
+	byte bPass;
+	byte i;
+
+	if (!bSynced || config.wSlotMs == 0)
+	{
+		return PLC_TDMA_NEVER;
+	}
+	for (bPass = 0; bPass < 2; bPass++)
+	{
+		dwBase = (bPass == 0) ? 0 : (bCoordinator ? (unsigned long)config.bSlots * config.wSlotMs : dwPeriod);
+		for (i = 0; i < config.bSlots; i++)
+		{
+			if (!(config.dwSlots & (1UL << i))
+				|| (unsigned long)config.bGuardMs * 2 + config.wFrameMs > config.wSlotMs)
+			{
+				continue;
+			}
+			/* Earliest and latest start of a frame in slot i */
+			dwFirst = dwBase + (unsigned long)i * config.wSlotMs + config.bGuardMs;
+			dwLast = dwBase + (unsigned long)(i + 1) * config.wSlotMs - config.bGuardMs - config.wFrameMs;
+			if (dwOffset <= dwLast)
+			{
+				return (dwOffset >= dwFirst) ? 0 : dwFirst - dwOffset;
+			}
+		}
+	}
+	return PLC_TDMA_NEVER;
+}
@@ -0,0 +1,107 @@
+/*
+* File Name: plc_tdma.h
+**
+Version: 2.1
+**
+Description:
+* Time-slotted access to the line, as an alternative to every node contending for it through band-in-use.
+* A coordinator sends a beacon to a group address at the start of every superframe. The beacon carries the
+* superframe number, the slot length, the slot count and the guard time. Every other node takes the time it
+* reads the beacon as the end of the beacon and counts its slots from there:
+*
+*   | beacon | slot 0 | slot 1 | ... | slot n-1 | beacon | slot 0 | ...
+*            ^ reference: beacon read (nodes), Data_Sent of the beacon (coordinator)
+*
+* A node owns the slots set in its PLC_TdmaConfig::dwSlots and only starts a frame in one of them, at least
+* bGuardMs after the slot begins and only when wFrameMs more still leaves bGuardMs before it ends. Several
+* frames go out in one slot when they fit. The guard covers the difference between the nodes' clocks, which
+* is mostly the time each takes to read the beacon.
+* wFrameMs need not cover the PLC device's retries: a retry that runs into the next slot is seen by that
+* slot's owner as band-in-use, which holds its frame off rather than letting the two collide. Packing slots
+* for the rare retry would waste most of them, so keep band-in-use detection enabled.
+**
+Note:
+* Frames are pulled from the application through a callback when one can go out, as in PLC_Scheduler, so
+* the queue stays with the application.
+* A node that misses a beacon keeps counting from where it expected it, for up to PLC_TDMA_MAX_MISSED
+* superframes. After that it has lost sync and sends nothing until it hears a beacon again.
+* While in use, the slot scheduler owns TX_Config and TX_DA: data frames are acknowledged as the profile sets
+* it, beacons are not. Do not use SetDestinationAddress() or a PLC_LinkTable alongside it.
+* Every node must be a member of the beacon group (Local_Group, 0 after reset).
+*/
+
+#ifndef PLC_TDMA_H
+#define PLC_TDMA_H
+
+#include "plc_i2c.h"
+#include "plc_scheduler.h"	/* PLC_NO_FRAME */
+#include "plc_dispatch.h"
+#include "plc_schema.h"
+
+#define CMD_TDMA_BEACON		0x20		/* Application command ID, clear of the remote commands 0x01 - 0x0F */
+#define PLC_TDMA_GROUP		0x00		/* Default beacon group */
+#define PLC_TDMA_MAX_SLOTS	32			/* Bits in PLC_TdmaConfig::dwSlots */
+#define PLC_TDMA_MAX_MISSED	3			/* Superframes counted on without a beacon before sync is lost */
+#define PLC_TDMA_NEVER		0xFFFFFFFFUL	/* Idle(): nothing is due until HOST_INT asserts */
+
+/* Payload of CMD_TDMA_BEACON: superframe number, slot length in ms, slot count, guard time in ms */
+typedef PLC_Schema<8, 16, 8, 8> PLC_TdmaBeacon;
+
+struct PLC_TdmaConfig {
+    word wSlotMs;			/* Coordinator: slot length. Nodes take it from the beacon. */
+    byte bSlots;			/* Coordinator: slots per superframe, up to PLC_TDMA_MAX_SLOTS */
+    byte bGuardMs;			/* Coordinator: idle time kept at both ends of a slot */
+    word wFrameMs;			/* Time one frame of this node takes, with its ACK but without retries */
+    byte bGroup;			/* Group address of the beacons */
+    unsigned long dwSlots;	/* Slots this node owns, bit n for slot n */
+};
+
+/* Fill in the next frame: its logical destination in *pbAddress, its command ID in *pbCommand and up to
+ * MAX_PLC_PACKET_LENGTH bytes of payload in pbData. Returns the payload length, or PLC_NO_FRAME. */
+typedef byte (*PLC_TdmaSource)(void *pContext, byte *pbAddress, byte *pbCommand, byte *pbData);
+
+/* Called with the final status of each frame, from PollTransmit() */
+typedef void (*PLC_TdmaDone)(void *pContext, byte bAddress, byte bStatus);
+
+class PLC_Tdma {
+  public:
+    byte begin(PLC_I2C *pModem, const PLC_TdmaConfig *pConfig, bool bCoordinator,
+               PLC_TdmaSource pfnSource, PLC_TdmaDone pfnDone, void *pContext = NULL);
+    bool Attach(PLC_Dispatcher *pDispatcher);
+    byte Service(void);
+    unsigned long Idle(void);
+    bool Synced(void);
+    void OnBeacon(const PLC_Frame *pFrame);
+
+    word wBeacons;			/* Beacons sent (coordinator) or heard (node) */
+    word wMissed;			/* Beacons a node expected and did not hear */
+    word wLostSync;			/* Times a node lost sync */
+  private:
+    void Track(unsigned long dwNow);
+    byte Address(byte bConfig, byte bAddress);
+    byte SendBeacon(unsigned long dwNow);
+    unsigned long SlotWait(unsigned long dwNow);
+
+    PLC_I2C *pModem;
+    PLC_TdmaConfig config;
+    bool bCoordinator;
+    PLC_TdmaSource pfnSource;
+    PLC_TdmaDone pfnDone;
+    void *pContext;
+    byte bBaseConfig;		/* TX_Config without the destination type */
+    byte abLast[2];			/* TX_Config and TX_DA in the PLC device, valid if bLastValid */
+    bool bLastValid;
+    bool bSynced;			/* Node: the slot clock follows the beacons. Coordinator: the first beacon is out. */
+    bool bBusy;				/* A frame is in flight */
+    bool bBeaconBusy;		/* ... and it is a beacon */
+    byte bTxAddress;		/* Destination of the data frame in flight */
+    byte bSuperframe;		/* Number of the last beacon sent or heard */
+    byte bMissed;			/* Superframes counted on since the last beacon heard */
+    unsigned long dwRef;	/* millis() at the start of the current superframe's slot 0 */
+    unsigned long dwBeaconDue;	/* Coordinator: ms from dwRef until the next beacon is started */
+    unsigned long dwTxStart;	/* millis() when the frame in flight was started */
+    unsigned long dwHeard;	/* millis() when the last beacon was heard */
+    unsigned long dwPeriod;	/* Beacon to beacon, measured by nodes */
+};
+
+#endif
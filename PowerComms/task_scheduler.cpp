@@ -0,0 +1,260 @@
+#include "task_scheduler.h"
+
+/*****************************************************************************
+* Function Name: TaskScheduler::begin()
+******************************************************************************
+* Summary:
+* Forget all tasks
+**
+Parameters:
+* None
+**
+Return:
+* None
+**
+Note:
+*
+*****************************************************************************/
+void TaskScheduler::begin(void)
+{
+	bTaskCount = 0;
+}
+
+/*****************************************************************************
+* Function Name: TaskScheduler::Add()
+******************************************************************************
+* Summary:
+* Add a task
+**
+Parameters:
+* pfnRun: the task body
+* pContext: handed to the body on every call
+* dwPeriodMs: time between activations, TASK_EVERY_PASS or TASK_EVENT
+**
+Return:
+* The task, for Signal() and its statistics, or NULL if TASK_MAX tasks are already added
+**
+Note:
+* A periodic task is first due at once. Any task can also be started early by Signal().
+*****************************************************************************/
+Task *TaskScheduler::Add(TaskFunction pfnRun, void *pContext, unsigned long dwPeriodMs)
+{
+	Task *pTask;
+
+	if (bTaskCount >= TASK_MAX)
+	{
+		return NULL;
+	}
+	pTask = &aTasks[bTaskCount++];
+	memset(pTask, 0, sizeof(*pTask));
+	pTask->pfnRun = pfnRun;
+	pTask->pContext = pContext;
+	pTask->dwPeriodMs = dwPeriodMs;
+	pTask->dwNext = millis();
+	return pTask;
+}
+
+/*****************************************************************************
+* Function Name: TaskScheduler::Signal()
+******************************************************************************
+* Summary:
+* Have a task start an activation on the next pass
+**
+Parameters:
+* pTask: the task
+**
+Return:
+* None
+**
+Note:
+* Safe from an interrupt handler. A task signalled while it is part way through an activation starts another
+* once that one is done; several signals before then make one activation.
+*****************************************************************************/
+void TaskScheduler::Signal(Task *pTask)
+{
+	if (pTask != NULL)
+	{
+		pTask->bSignalled = true;
+	}
+}
+
+/* A task is due when it is part way through and not asleep, or, between activations, when signalled or its
+ * period has come */
+bool TaskScheduler::Due(Task *pTask, unsigned long dwNow)
+{
+	if (pTask->wResume != 0)
+	{
+		return !pTask->bSleeping || (long)(dwNow - pTask->dwWake) >= 0;
+	}
+	if (pTask->bSignalled || pTask->dwPeriodMs == TASK_EVERY_PASS)
+	{
+		return true;
+	}
+	return pTask->dwPeriodMs != TASK_EVENT && (long)(dwNow - pTask->dwNext) >= 0;
+}
+
+/*****************************************************************************
+* Function Name: TaskScheduler::Service()
+******************************************************************************
+* Summary:
+* Call every task that is due once, in the order they were added
+**
+Parameters:
+* None
+**
+Return:
+* Number of tasks called
+**
+Note:
+* Each call is timed with micros() for the task's statistics. When a periodic activation finishes, the next
+* one is due a period after the last; periods that have passed by then are counted as overruns and dropped.
+*****************************************************************************/
+byte TaskScheduler::Service(void)
+{
+	byte bCalled = 0;
+	byte i;
+
+	for (i = 0; i < bTaskCount; i++)
+	{
+		Task *pTask = &aTasks[i];
+		unsigned long dwStart;
+		unsigned long dwTime;
+		unsigned long dwNow;
+		char cResult;
+
+		if (!Due(pTask, millis()))
+		{
+			continue;
+		}
+		if (pTask->wResume == 0)
+		{
+			pTask->bSignalled = false;
+		}
+		dwStart = micros();
+		cResult = pTask->pfnRun(pTask, pTask->pContext);
+		dwTime = micros() - dwStart;
+		bCalled++;
+
+		pTask->dwCalls++;
+		pTask->dwRunUs += dwTime;
+		if (dwTime > pTask->dwMaxUs)
+		{
+			pTask->dwMaxUs = dwTime;
+		}
+		pTask->bSleeping = (cResult == TASK_SLEEPING);
+		if (cResult != TASK_DONE)
+		{
+			continue;
+		}
+		pTask->dwRuns++;
+		if (pTask->dwPeriodMs != TASK_EVERY_PASS && pTask->dwPeriodMs != TASK_EVENT)
+		{
+			dwNow = millis();
+			pTask->dwNext += pTask->dwPeriodMs;
+			while ((long)(dwNow - pTask->dwNext) >= 0)
+			{
+				pTask->dwNext += pTask->dwPeriodMs;
+				pTask->wOverruns++;
+			}
+		}
+	}
+	return bCalled;
+}
+
+/*****************************************************************************
+* Function Name: TaskScheduler::Idle()
+******************************************************************************
+* Summary:
+* Time until a periodic activation, a sleeping task or a signalled task is due
+**
+Parameters:
+* None
+**
+Return:
+* ms until then, 0 if one is due now, or TASK_NEVER
+**
+Note:
+* Tasks that poll, TASK_EVERY_PASS tasks and tasks in TASK_WAIT_UNTIL(), are left out: what they wait for
+* changes on an interrupt, and the timer tick wakes the CPU every ms anyway. So the sketch may sleep until the
+* next interrupt whenever this is not 0.
+*****************************************************************************/
+unsigned long TaskScheduler::Idle(void)
+{
+	unsigned long dwNow = millis();
+	unsigned long dwIdle = TASK_NEVER;
+	unsigned long dwDue;
+	byte i;
+
+	for (i = 0; i < bTaskCount; i++)
+	{
+		Task *pTask = &aTasks[i];
+
+		if (pTask->bSignalled && pTask->wResume == 0)
+		{
+			return 0;
+		}
+		if (pTask->wResume != 0 && pTask->bSleeping)
+		{
+			dwDue = pTask->dwWake;
+		}
+		else if (pTask->wResume == 0 && pTask->dwPeriodMs != TASK_EVERY_PASS && pTask->dwPeriodMs != TASK_EVENT)
+		{
+			dwDue = pTask->dwNext;
+		}
+		else
+		{
+			continue;
+		}
+		if ((long)(dwNow - dwDue) >= 0)
+		{
+			return 0;
+		}
+		if (dwDue - dwNow < dwIdle)
+		{
+			dwIdle = dwDue - dwNow;
+		}
+	}
+	return dwIdle;
+}
+
+/*****************************************************************************
+* Function Name: TaskScheduler::Count()
+******************************************************************************
+* Summary:
+* Number of tasks added, for walking their statistics with Entry()
+*****************************************************************************/
+byte TaskScheduler::Count(void)
+{
+	return bTaskCount;
+}
+
+/*****************************************************************************
+* Function Name: TaskScheduler::Entry()
+******************************************************************************
+* Summary:
+* Task number bIndex, in the order they were added, or NULL
+*****************************************************************************/
+Task *TaskScheduler::Entry(byte bIndex)
+{
+	return (bIndex < bTaskCount) ? &aTasks[bIndex] : NULL;
+}
+
+/*****************************************************************************
+* Function Name: TaskScheduler::ResetStats()
+******************************************************************************
+* Summary:
+* Clear the statistics of every task
+*****************************************************************************/
+void TaskScheduler::ResetStats(void)
+{
+	byte i;
+
+	for (i = 0; i < bTaskCount; i++)
+	{
+		aTasks[i].dwRuns = 0;
+		aTasks[i].dwCalls = 0;
+		aTasks[i].dwRunUs = 0;
+		aTasks[i].dwMaxUs = 0;
+		aTasks[i].wOverruns = 0;
+	}
+}
@@ -0,0 +1,115 @@
+/*
+* File Name: task_scheduler.h
+**
+Version: 2.1
+**
+Description:
+* Cooperative tasks for the sketch loop. A task is a function run by TaskScheduler::Service() when it is due:
+* every dwPeriodMs, on every pass (TASK_EVERY_PASS), or when signalled (TASK_EVENT). Tasks are stackless
+* coroutines in the protothread style: the body sits between TASK_BEGIN() and TASK_END(), and can give up
+* the CPU part way with TASK_YIELD(), TASK_WAIT_UNTIL() or TASK_SLEEP(). The next call resumes it where it
+* left off. A wait on the PLC device, such as TASK_WAIT_UNTIL(pTask, (bResult = plc.PollTransmit()) !=
+* PLC_TX_PENDING) after StartTransmit(), leaves the other tasks running while the frame is on the line.
+*
+*   char SendTask(Task *pTask, void *pContext)
+*   {
+*     TASK_BEGIN(pTask);
+*     bResult = plc.StartTransmit(CMD_SENDMSG, abData, bLength);
+*     if (bResult == I2C_SUCCESS)
+*     {
+*       TASK_WAIT_UNTIL(pTask, (bResult = plc.PollTransmit()) != PLC_TX_PENDING);
+*     }
+*     TASK_END(pTask);
+*   }
+*
+* Each task keeps its runtime statistics: activations, calls (an activation that yields takes several), time
+* spent in it, its longest single call, and its overruns, the times a periodic task was still busy or not yet started when its next period began.
+**
+Note:
+* A task's locals do not survive a yield: keep what a task needs across one in statics or in its context.
+* The yield macros expand to case labels, so they cannot be used inside a switch statement of the body.
+* Signal() may be called from an interrupt handler. Overrun periods are dropped, not run late back to back.
+* Times are compared with unsigned subtraction, so millis() and micros() wrap-around is handled.
+*/
+
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#define TASK_MAX			8				/* Tasks one scheduler runs */
+#define TASK_EVERY_PASS		0				/* dwPeriodMs: run on every pass of Service() */
+#define TASK_EVENT			0xFFFFFFFFUL	/* dwPeriodMs: run only when signalled */
+#define TASK_NEVER			0xFFFFFFFFUL	/* Idle(): nothing is due until a task is signalled */
+
+/* What a task body returns, through the macros below */
+#define TASK_WAITING		0		/* Part way through, call again */
+#define TASK_SLEEPING		1		/* Part way through, call again at dwWake */
+#define TASK_DONE			2		/* Activation finished */
+
+/* TASK_WAIT_UNTIL() falls through into its own case label on purpose; a comment cannot say so from inside a
+ * macro, so the attribute does for compilers that warn about it */
+#if defined(__has_attribute)
+#if __has_attribute(__fallthrough__)
+#define TASK_FALLTHROUGH		__attribute__((__fallthrough__))
+#endif
+#endif
+#ifndef TASK_FALLTHROUGH
+#define TASK_FALLTHROUGH		do { } while (0)
+#endif
+
+/* Protothread-style control flow; pTask is the task the body was called with */
+#define TASK_BEGIN(pTask)		switch ((pTask)->wResume) { case 0:
+#define TASK_YIELD(pTask)		do { (pTask)->wResume = __LINE__; return TASK_WAITING; case __LINE__:; } while (0)
+#define TASK_WAIT_UNTIL(pTask, bCondition) \
+	do { (pTask)->wResume = __LINE__; TASK_FALLTHROUGH; case __LINE__: if (!(bCondition)) return TASK_WAITING; } while (0)
+#define TASK_SLEEP(pTask, dwMs) \
+	do { (pTask)->dwWake = millis() + (dwMs); (pTask)->wResume = __LINE__; return TASK_SLEEPING; case __LINE__:; } while (0)
+#define TASK_EXIT(pTask)		do { (pTask)->wResume = 0; return TASK_DONE; } while (0)	/* End the activation early */
+#define TASK_END(pTask)			} (pTask)->wResume = 0; return TASK_DONE
+
+struct Task;
+
+/* A task body: TASK_BEGIN(pTask) ... TASK_END(pTask) */
+typedef char (*TaskFunction)(Task *pTask, void *pContext);
+
+struct Task {
+    TaskFunction pfnRun;
+    void *pContext;
+    unsigned long dwPeriodMs;
+    unsigned long dwNext;		/* millis() the next periodic activation is due */
+    unsigned long dwWake;		/* millis() a sleeping task resumes */
+    word wResume;				/* Resume point in the body, 0 between activations */
+    bool bSleeping;
+    volatile bool bSignalled;
+
+    /* Statistics since the task was added */
+    unsigned long dwRuns;		/* Activations finished */
+    unsigned long dwCalls;		/* Calls of the body, each resume after a yield included */
+    unsigned long dwRunUs;		/* Time spent in the body, all calls: dwRunUs / dwCalls is the mean call */
+    unsigned long dwMaxUs;		/* Longest single call, the most the task held off the others */
+    word wOverruns;				/* Periods begun while the previous activation was still due or running */
+};
+
+class TaskScheduler {
+  public:
+    void begin(void);
+    Task *Add(TaskFunction pfnRun, void *pContext, unsigned long dwPeriodMs);
+    void Signal(Task *pTask);
+    byte Service(void);
+    unsigned long Idle(void);
+    byte Count(void);
+    Task *Entry(byte bIndex);
+    void ResetStats(void);
+  private:
+    bool Due(Task *pTask, unsigned long dwNow);
+
+    byte bTaskCount;
+    Task aTasks[TASK_MAX];
+};
+
+#endif
@@ -56,12 +56,18 @@ Disclaimer: CYPRESS MAKES NO WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, WITH
 
 #define I2C_TIMEOUT	250		/* Set the I2C timeout to be 250ms. If there is no response, it will give up */
 
+#define PLC_BOOT_TIME	25000	/* Time to wait for the PLC before giving up, in multiples of 50us: the old fixed 1.25s boot delay */
+#define PLC_BOOT_READ_TIMEOUT	5	/* I2C timeout of a readiness read, in ms */
+#define PLC_FW_OFFSET	0x72	/* Local_FW. Reads 0x00 or 0xFF until the PLC firmware is running */
+
+static WORD PLC_I2C_ReadTimed(BYTE bOffset, BYTE *pbData, BYTE bDataLength, BYTE bTimeout);
+
 
 /*****************************************************************************
 * Function Name: PLC_I2C_Start()
 ******************************************************************************
 * Summary:
-* Initialize the I2C hardware block
+* Initialize the I2C hardware block and wait until the PLC answers on I2C
 **
 Parameters:
 * None
@@ -70,21 +76,41 @@ Return:
 * None
 **
 Note:
-* 
+* The wait is bounded by the delays and I2C timeouts it has spent, so a PLC that acknowledges its address but
+* does not serve reads yet cannot hold it up for longer than PLC_BOOT_TIME.
 *****************************************************************************/
 void PLC_I2C_Start(void)
 {
-	INT i;
-	/* Initial delay of 1.25s is required before I2C communication should start with PLC */
-	for (i = 0; i < 1000; i++)
-    {
-        Delay50uTimes(25); /* 	50us * 25 = 1.25 ms * 1000 = 1.25 s 	*/
-    }
+	WORD wElapsed = 0;				/* In multiples of 50us */
+	BYTE bFirmware;
 	
 	M8C_EnableGInt;  
 	I2CHW_Start();  
     I2CHW_EnableMstr();  	
     I2CHW_EnableInt();  
+	
+	/* The PLC needs up to 1.25s after power up before it answers on I2C. Rather than always waiting
+	   that long, poll it every 1.25ms and continue as soon as its firmware reports a version */
+	while (wElapsed < PLC_BOOT_TIME)
+    {
+		/* An address NACK means the PLC is still in reset; don't start a full read */
+		if (I2CHW_fSendStart(I2C_SLAVE_ADDRESS, I2CHW_WRITE))
+		{
+			I2CHW_SendStop();
+			bFirmware = 0;
+			wElapsed += PLC_I2C_ReadTimed(PLC_FW_OFFSET, &bFirmware, 1, PLC_BOOT_READ_TIMEOUT);
+			if (bFirmware != 0x00 && bFirmware != 0xFF)
+			{
+				break;
+			}
+		}
+		else
+		{
+			I2CHW_SendStop();
+		}
+        Delay50uTimes(25); /* 	50us * 25 = 1.25 ms 	*/
+		wElapsed += 25;
+    }
 }
 
 /*****************************************************************************
@@ -155,8 +181,33 @@ Note:
 * 
 *****************************************************************************/
 BYTE PLC_I2C_ReadFromOffset (BYTE bOffset, BYTE *pbData, BYTE bDataLength)
+{
+	PLC_I2C_ReadTimed(bOffset, pbData, bDataLength, I2C_TIMEOUT);
+	return I2C_SUCCESS;
+}
+
+/*****************************************************************************
+* Function Name: PLC_I2C_ReadTimed()
+******************************************************************************
+* Summary:
+* PLC_I2C_ReadFromOffset() with a given timeout for each of its two transfers
+**
+Parameters:
+* bOffset: PLC memory offset to read from
+* pbData: pointer to the data that will be stored when read from the PLC device
+* bDataLength: length of the data
+* bTimeout: timeout of each transfer, in ms
+**
+Return:
+* The time spent in delays and waiting for the transfers, in multiples of 50us
+**
+Note:
+* 
+*****************************************************************************/
+static WORD PLC_I2C_ReadTimed(BYTE bOffset, BYTE *pbData, BYTE bDataLength, BYTE bTimeout)
 {
 	BYTE bI2C_Timeout_Cycles = 0;
+	WORD wElapsed = 3 * I2C_GAP;
 	/* Make sure the interrupts are enabled */
 	I2CHW_EnableInt();  
 	
@@ -167,11 +218,12 @@ BYTE PLC_I2C_ReadFromOffset (BYTE bOffset, BYTE *pbData, BYTE bDataLength)
 	I2CHW_bWriteBytes(I2C_SLAVE_ADDRESS, &bOffset, 1, I2CHW_CompleteXfer); 
 	
 	 /* Wait until the data is written or a timeout occurs*/ 
-	while(!(I2CHW_bReadI2CStatus() & I2CHW_WR_COMPLETE) && (bI2C_Timeout_Cycles < I2C_TIMEOUT))
+	while(!(I2CHW_bReadI2CStatus() & I2CHW_WR_COMPLETE) && (bI2C_Timeout_Cycles < bTimeout))
 	{
 		Delay50uTimes(20);	// 1ms delay
 		bI2C_Timeout_Cycles++;
 	}
+	wElapsed += 20 * bI2C_Timeout_Cycles;
 			
 	/* Clear Write Complete Status bit */  
     I2CHW_ClrWrStatus(); 
@@ -184,18 +236,19 @@ BYTE PLC_I2C_ReadFromOffset (BYTE bOffset, BYTE *pbData, BYTE bDataLength)
 	
     /* Wait until the data is read or a timeout occurs*/  
 	bI2C_Timeout_Cycles = 0;
-	while(!(I2CHW_bReadI2CStatus() & I2CHW_RD_COMPLETE) && (bI2C_Timeout_Cycles < I2C_TIMEOUT))
+	while(!(I2CHW_bReadI2CStatus() & I2CHW_RD_COMPLETE) && (bI2C_Timeout_Cycles < bTimeout))
 	{
 		Delay50uTimes(20);	/* 1ms delay */
 		bI2C_Timeout_Cycles++;
 	}
+	wElapsed += 20 * bI2C_Timeout_Cycles;
 	 /* Clear Read Complete Status bit */  
     I2CHW_ClrRdStatus();
 	
 	/* Ensure that there is sufficient delay between stop and start bits */
 	Delay50uTimes(I2C_GAP);
 		
-	return I2C_SUCCESS;
+	return wElapsed;
      
 }
 
@@ -0,0 +1,329 @@
+/*
+* File Name: plc_bridge_client.cpp
+**
+Description:
+* PC side of the Serial bridge, see plc_bridge_client.h.
+*/
+
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "plc_bridge_client.h"
+#include "plc_bridge.h"
+
+#define MAX_ENCODED		PLC_COBS_MAX(PLC_BRIDGE_MAX_MESSAGE)
+
+PlcBridgeClient::PlcBridgeClient() : bVersion(0), bReady(false), iCredits(0), iOutstanding(0), bNextSeq(0), fd(-1)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+PlcBridgeClient::~PlcBridgeClient()
+{
+	Close();
+}
+
+/*****************************************************************************
+* Function Name: PlcBridgeClient::Hello()
+******************************************************************************
+* Summary:
+* Ask the bridge for its credits, such as after connecting to one that may have been in use
+**
+Note:
+* The bridge answers once every frame it already holds is done; their results arrive before READY and are
+* reported but not counted as credits.
+*****************************************************************************/
+void PlcBridgeClient::Hello(void)
+{
+	uint8_t bHello = PLC_BRIDGE_HELLO;
+
+	bReady = false;
+	iCredits = 0;
+	Queue(&bHello, 1);
+}
+
+/*****************************************************************************
+* Function Name: PlcBridgeClient::Send()
+******************************************************************************
+* Summary:
+* Queue a frame for the bridge to transmit
+**
+Parameters:
+* bDAType: TX_DA_Type_Log, _Grp or _Phy
+* pbDA: the destination, 8 bytes for a physical address, else 1
+* bCommand, pbData, bLength: the command ID and payload, up to MAX_PLC_PACKET_LENGTH bytes
+* pbSeq: if not NULL, gets the sequence number its onDone will carry
+**
+Return:
+* false if there is no credit or the frame is invalid
+*****************************************************************************/
+bool PlcBridgeClient::Send(uint8_t bDAType, const uint8_t *pbDA, uint8_t bCommand, const uint8_t *pbData,
+	uint8_t bLength, uint8_t *pbSeq)
+{
+	uint8_t abMessage[PLC_BRIDGE_MAX_MESSAGE];
+	size_t iDA = (bDAType == TX_DA_Type_Phy) ? 8 : 1;
+	size_t iLength = 0;
+
+	if (!bReady || iCredits <= 0 || bLength > MAX_PLC_PACKET_LENGTH)
+	{
+		return false;
+	}
+	abMessage[iLength++] = PLC_BRIDGE_SEND;
+	abMessage[iLength++] = bNextSeq;
+	abMessage[iLength++] = bDAType;
+	memcpy(&abMessage[iLength], pbDA, iDA);
+	iLength += iDA;
+	abMessage[iLength++] = bCommand;
+	memcpy(&abMessage[iLength], pbData, bLength);
+	iLength += bLength;
+	Queue(abMessage, iLength);
+
+	if (pbSeq != NULL)
+	{
+		*pbSeq = bNextSeq;
+	}
+	bNextSeq++;
+	iCredits--;
+	iOutstanding++;
+	stats.qwSent++;
+	return true;
+}
+
+/*****************************************************************************
+* Function Name: PlcBridgeClient::Feed()
+******************************************************************************
+* Summary:
+* Take bytes read from the bridge and act on every message they complete
+*****************************************************************************/
+void PlcBridgeClient::Feed(const uint8_t *pbData, size_t iLength)
+{
+	for (size_t i = 0; i < iLength; i++)
+	{
+		if (pbData[i] != 0x00)
+		{
+			in.push_back(pbData[i]);
+			continue;
+		}
+		if (in.empty())
+		{
+			continue;
+		}
+		if (in.size() > MAX_ENCODED)
+		{
+			stats.qwBadMessages++;
+		}
+		else
+		{
+			uint8_t bLength = PLC_CobsDecode(in.data(), (uint8_t)in.size());
+
+			if (bLength == 0)
+			{
+				stats.qwBadMessages++;
+			}
+			else
+			{
+				Message(in.data(), bLength);
+			}
+		}
+		in.clear();
+	}
+}
+
+void PlcBridgeClient::Message(uint8_t *pbMessage, size_t iLength)
+{
+	PlcBridgeRecv frame;
+	size_t iSA;
+
+	switch (pbMessage[0])
+	{
+		case PLC_BRIDGE_READY:
+			if (iLength < 3)
+			{
+				break;
+			}
+			bReady = true;
+			iCredits = pbMessage[1];
+			iOutstanding = 0;
+			bVersion = pbMessage[2];
+			return;
+
+		case PLC_BRIDGE_DONE:
+			if (iLength < 3)
+			{
+				break;
+			}
+			stats.qwDone++;
+			if (pbMessage[2] == PLC_BRIDGE_REJECTED)
+			{
+				stats.qwRejected++;
+			}
+			/* Results of frames from before a HELLO are reported without returning credit */
+			if (bReady && iOutstanding > 0)
+			{
+				iOutstanding--;
+				iCredits++;
+			}
+			if (onDone)
+			{
+				onDone(pbMessage[1], pbMessage[2]);
+			}
+			return;
+
+		case PLC_BRIDGE_RECV:
+			if (iLength < 2)
+			{
+				break;
+			}
+			iSA = (pbMessage[1] & RX_SA_PHY) ? 8 : 2;
+			if (iLength < 2 + iSA + 1 || iLength - 2 - iSA - 1 > MAX_PLC_PACKET_LENGTH)
+			{
+				break;
+			}
+			memset(&frame, 0, sizeof(frame));
+			frame.bInfo = pbMessage[1];
+			memcpy(frame.abSA, &pbMessage[2], iSA);
+			frame.bCommand = pbMessage[2 + iSA];
+			frame.bLength = (uint8_t)(iLength - 2 - iSA - 1);
+			memcpy(frame.abData, &pbMessage[3 + iSA], frame.bLength);
+			stats.qwReceived++;
+			if (onRecv)
+			{
+				onRecv(frame);
+			}
+			return;
+	}
+	stats.qwBadMessages++;
+}
+
+void PlcBridgeClient::Queue(const uint8_t *pbMessage, size_t iLength)
+{
+	uint8_t abEncoded[MAX_ENCODED];
+	uint8_t bEncoded = PLC_CobsEncode(pbMessage, (uint8_t)iLength, abEncoded);
+
+	out.insert(out.end(), abEncoded, abEncoded + bEncoded);
+	out.push_back(0x00);
+}
+
+/*****************************************************************************
+* Function Name: PlcBridgeClient::TakeOutput()
+******************************************************************************
+* Summary:
+* Take bytes to be written to the bridge
+*****************************************************************************/
+size_t PlcBridgeClient::TakeOutput(uint8_t *pbData, size_t iMax)
+{
+	size_t iCount = out.size() < iMax ? out.size() : iMax;
+
+	memcpy(pbData, out.data(), iCount);
+	out.erase(out.begin(), out.begin() + iCount);
+	return iCount;
+}
+
+size_t PlcBridgeClient::OutputPending(void) const
+{
+	return out.size();
+}
+
+/*****************************************************************************
+* Function Name: PlcBridgeClient::Open()
+******************************************************************************
+* Summary:
+* Open the serial port of a bridge, raw at lBaud, and say HELLO
+*****************************************************************************/
+bool PlcBridgeClient::Open(const char *pszPort, long lBaud)
+{
+	struct termios tio;
+	speed_t speed;
+
+	switch (lBaud)
+	{
+		case 9600: speed = B9600; break;
+		case 57600: speed = B57600; break;
+		case 115200: speed = B115200; break;
+		case 230400: speed = B230400; break;
+		case 500000: speed = B500000; break;
+		case 1000000: speed = B1000000; break;
+		default: return false;
+	}
+	Close();
+	fd = open(pszPort, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0)
+	{
+		return false;
+	}
+	if (tcgetattr(fd, &tio) != 0)
+	{
+		Close();
+		return false;
+	}
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	tcsetattr(fd, TCSANOW, &tio);
+	tcflush(fd, TCIOFLUSH);
+	in.clear();
+	out.clear();
+	Hello();
+	return true;
+}
+
+void PlcBridgeClient::Close(void)
+{
+	if (fd >= 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+}
+
+/*****************************************************************************
+* Function Name: PlcBridgeClient::Pump()
+******************************************************************************
+* Summary:
+* Write what is queued for the bridge and process what it sent, waiting up to iTimeoutMs for either
+**
+Return:
+* false if the port failed or was closed
+*****************************************************************************/
+bool PlcBridgeClient::Pump(int iTimeoutMs)
+{
+	struct pollfd pfd;
+	uint8_t abBuffer[256];
+	ssize_t iCount;
+
+	if (fd < 0)
+	{
+		return false;
+	}
+	pfd.fd = fd;
+	pfd.events = POLLIN | (out.empty() ? 0 : POLLOUT);
+	if (poll(&pfd, 1, iTimeoutMs) < 0)
+	{
+		return false;
+	}
+	if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+	{
+		return false;
+	}
+	if ((pfd.revents & POLLOUT) && !out.empty())
+	{
+		iCount = write(fd, out.data(), out.size());
+		if (iCount > 0)
+		{
+			out.erase(out.begin(), out.begin() + iCount);
+		}
+	}
+	if (pfd.revents & POLLIN)
+	{
+		iCount = read(fd, abBuffer, sizeof(abBuffer));
+		if (iCount <= 0)
+		{
+			return false;
+		}
+		Feed(abBuffer, (size_t)iCount);
+	}
+	return true;
+}
@@ -0,0 +1,77 @@
+/*
+* File Name: plc_bridge_client.h
+**
+Description:
+* PC side of the sketch's Serial bridge mode (PowerComms/plc_bridge.h): a PLC network interface on a serial
+* port. PlcBridgeClient does the COBS framing and the credit accounting; it is fed the bytes read from the port
+* and hands back the bytes to write, so it runs equally on a real port (Open()/Pump()) or inside the simulator.
+**
+Note:
+* Send() fails when no credit is left: that is the bridge's TX queue being full, not an error. Credits come
+* back with each onDone. After Open() or Hello(), nothing can be sent until the bridge answers with READY.
+*/
+
+#ifndef PLC_BRIDGE_CLIENT_H
+#define PLC_BRIDGE_CLIENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <vector>
+
+struct PlcBridgeRecv {
+    uint8_t bInfo;				/* RX_Message_INFO */
+    uint8_t abSA[8];			/* Logical address in the first byte (two with extended addressing) */
+    uint8_t bCommand;
+    uint8_t bLength;
+    uint8_t abData[32];
+};
+
+struct PlcBridgeStats {
+    uint64_t qwSent;
+    uint64_t qwDone;
+    uint64_t qwRejected;		/* DONE with PLC_BRIDGE_REJECTED */
+    uint64_t qwReceived;
+    uint64_t qwBadMessages;		/* Input that did not decode or was not understood */
+};
+
+class PlcBridgeClient {
+  public:
+    PlcBridgeClient();
+    ~PlcBridgeClient();
+
+    /* Transport independent core */
+    void Hello(void);
+    bool Send(uint8_t bDAType, const uint8_t *pbDA, uint8_t bCommand, const uint8_t *pbData, uint8_t bLength,
+        uint8_t *pbSeq = NULL);
+    void Feed(const uint8_t *pbData, size_t iLength);
+    size_t TakeOutput(uint8_t *pbData, size_t iMax);
+    size_t OutputPending(void) const;
+    bool Ready(void) const { return bReady; }
+    int Credits(void) const { return iCredits; }
+    int Outstanding(void) const { return iOutstanding; }
+
+    /* Serial port transport */
+    bool Open(const char *pszPort, long lBaud);
+    void Close(void);
+    int Fd(void) const { return fd; }
+    bool Pump(int iTimeoutMs);
+
+    std::function<void(uint8_t bSeq, uint8_t bStatus)> onDone;
+    std::function<void(const PlcBridgeRecv &frame)> onRecv;
+    PlcBridgeStats stats;
+    uint8_t bVersion;			/* Reported by READY */
+  private:
+    void Message(uint8_t *pbMessage, size_t iLength);
+    void Queue(const uint8_t *pbMessage, size_t iLength);
+
+    std::vector<uint8_t> in;
+    std::vector<uint8_t> out;
+    bool bReady;
+    int iCredits;
+    int iOutstanding;			/* Frames sent and not yet reported done */
+    uint8_t bNextSeq;
+    int fd;
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include "gw_client.h"
+#include "plc_commands.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+GwConnection::GwConnection() : iFd(-1)
+{
+}
+
+GwConnection::~GwConnection()
+{
+	Close();
+}
+
+bool GwConnection::Connect(const char *pszPath)
+{
+	struct sockaddr_un addr;
+
+	Close();
+	iFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (iFd < 0)
+	{
+		return false;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, pszPath, sizeof(addr.sun_path) - 1);
+	if (connect(iFd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void GwConnection::Close(void)
+{
+	if (iFd >= 0)
+	{
+		close(iFd);
+		iFd = -1;
+	}
+	in.clear();
+	out.clear();
+}
+
+void GwConnection::Put(uint8_t bType, const uint8_t *pbBody, uint8_t bLength)
+{
+	out.push_back(bType);
+	out.push_back(bLength);
+	out.insert(out.end(), pbBody, pbBody + bLength);
+}
+
+/*****************************************************************************
+* Function Name: GwConnection::Send()
+******************************************************************************
+* Summary:
+* Queue a frame for the modem. Its completion comes back to onStatus with the same tag.
+**
+Parameters:
+* wTag: chosen by the caller to match the status to the frame
+* bDAType: TX_DA_Type_Log, TX_DA_Type_Grp or TX_DA_Type_Phy
+* pbDA: destination address, one byte for logical and group addresses, eight for physical ones
+* bCommand: command ID of the frame
+* pbData, bLength: payload, up to GW_MAX_PAYLOAD bytes
+*****************************************************************************/
+void GwConnection::Send(uint16_t wTag, uint8_t bDAType, const uint8_t *pbDA, uint8_t bCommand, const uint8_t *pbData, uint8_t bLength)
+{
+	uint8_t abBody[GW_SEND_FIXED + GW_MAX_PAYLOAD];
+
+	if (bLength > GW_MAX_PAYLOAD)
+	{
+		bLength = GW_MAX_PAYLOAD;
+	}
+	memset(abBody, 0, GW_SEND_FIXED);
+	abBody[0] = (uint8_t)wTag;
+	abBody[1] = (uint8_t)(wTag >> 8);
+	abBody[2] = bDAType;
+	memcpy(&abBody[3], pbDA, bDAType == TX_DA_Type_Phy ? 8 : 1);
+	abBody[11] = bCommand;
+	memcpy(&abBody[GW_SEND_FIXED], pbData, bLength);
+	Put(GW_MSG_SEND, abBody, GW_SEND_FIXED + bLength);
+}
+
+void GwConnection::Subscribe(bool bEnable)
+{
+	uint8_t bTemp = bEnable ? 1 : 0;
+
+	Put(GW_MSG_SUBSCRIBE, &bTemp, 1);
+}
+
+void GwConnection::RequestStats(void)
+{
+	Put(GW_MSG_STATS_REQ, NULL, 0);
+}
+
+bool GwConnection::Flush(void)
+{
+	size_t iDone = 0;
+
+	while (iDone < out.size())
+	{
+		ssize_t iSent = send(iFd, &out[iDone], out.size() - iDone, MSG_NOSIGNAL);
+
+		if (iSent < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		iDone += iSent;
+	}
+	out.clear();
+	return true;
+}
+
+/*****************************************************************************
+* Function Name: GwConnection::Poll()
+******************************************************************************
+* Summary:
+* Wait up to iTimeoutMs for the daemon, then dispatch every complete record received
+**
+Return:
+* Number of records dispatched, or -1 once the daemon has closed the connection
+*****************************************************************************/
+int GwConnection::Poll(int iTimeoutMs)
+{
+	struct pollfd pfd;
+	uint8_t abBuffer[8192];
+	ssize_t iRead;
+	size_t i = 0;
+	int iRecords = 0;
+
+	pfd.fd = iFd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, iTimeoutMs) <= 0)
+	{
+		return 0;
+	}
+	iRead = recv(iFd, abBuffer, sizeof(abBuffer), MSG_DONTWAIT);
+	if (iRead == 0 || (iRead < 0 && errno != EAGAIN && errno != EINTR))
+	{
+		return -1;
+	}
+	if (iRead > 0)
+	{
+		in.insert(in.end(), abBuffer, abBuffer + iRead);
+	}
+
+	while (in.size() - i >= GW_HEADER_LENGTH && in.size() - i >= (size_t)GW_HEADER_LENGTH + in[i + 1])
+	{
+		uint8_t bType = in[i];
+		uint8_t bLength = in[i + 1];
+		const uint8_t *pbBody = &in[i + GW_HEADER_LENGTH];
+
+		if (bType == GW_MSG_STATUS && bLength >= 3 && onStatus)
+		{
+			onStatus(pbBody[0] | (pbBody[1] << 8), pbBody[2]);
+		}
+		else if (bType == GW_MSG_RECEIVE && bLength >= GW_RECEIVE_FIXED && onReceive)
+		{
+			onReceive(pbBody[0], &pbBody[1], pbBody[9], &pbBody[GW_RECEIVE_FIXED], bLength - GW_RECEIVE_FIXED);
+		}
+		else if (bType == GW_MSG_STATS && bLength >= sizeof(GwStats) && onStats)
+		{
+			GwStats stats;
+
+			memcpy(&stats, pbBody, sizeof(stats));
+			onStats(stats);
+		}
+		i += GW_HEADER_LENGTH + bLength;
+		iRecords++;
+	}
+	in.erase(in.begin(), in.begin() + i);
+	return iRecords;
+}
@@ -0,0 +1,44 @@
+/*
+* File Name: gw_client.h
+**
+Description:
+* Client side of the plc_gatewayd socket. Send() and the other requests only append a record to an output
+* buffer; Flush() writes everything queued so far in one system call, so a client batches by calling Send()
+* several times before it flushes. Poll() reads whatever the daemon has sent and hands each record to the
+* matching callback.
+*/
+
+#ifndef GW_CLIENT_H
+#define GW_CLIENT_H
+
+#include <stdint.h>
+#include <vector>
+#include <functional>
+#include "gw_protocol.h"
+
+class GwConnection {
+  public:
+    GwConnection();
+    ~GwConnection();
+    bool Connect(const char *pszPath);
+    void Close(void);
+    int Fd(void) const { return iFd; }
+
+    void Send(uint16_t wTag, uint8_t bDAType, const uint8_t *pbDA, uint8_t bCommand, const uint8_t *pbData, uint8_t bLength);
+    void Subscribe(bool bEnable);
+    void RequestStats(void);
+    bool Flush(void);
+    int Poll(int iTimeoutMs);
+
+    std::function<void(uint16_t, uint8_t)> onStatus;					/* Tag and INT_Status TX bits */
+    std::function<void(uint8_t, const uint8_t *, uint8_t, const uint8_t *, uint8_t)> onReceive;	/* info, sa, command, data, length */
+    std::function<void(const GwStats &)> onStats;
+  private:
+    void Put(uint8_t bType, const uint8_t *pbBody, uint8_t bLength);
+
+    int iFd;
+    std::vector<uint8_t> out;
+    std::vector<uint8_t> in;
+};
+
+#endif
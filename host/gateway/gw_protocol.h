@@ -0,0 +1,61 @@
+/*
+* File Name: gw_protocol.h
+**
+Description:
+* Record format spoken over the plc_gatewayd Unix domain socket.
+* The socket is a byte stream of records, each a two byte header (type, body length) followed by the body.
+* Any number of records may be written or read in one system call, which is how clients batch.
+* Multi-byte integers are little endian.
+**
+Records:
+* GW_MSG_SEND       client -> daemon   tag(2) da_type(1) da(8) command(1) payload(0..31)
+* GW_MSG_SUBSCRIBE  client -> daemon   enable(1)       receive every frame the modem delivers
+* GW_MSG_STATS_REQ  client -> daemon   (empty)
+* GW_MSG_STATUS     daemon -> client   tag(2) status(1)  INT_Status TX bits of the send, GW_STATUS_REJECTED or
+*                                                        GW_STATUS_LOST
+* GW_MSG_RECEIVE    daemon -> client   info(1) sa(8) command(1) payload(0..31)   info is RX_Message_INFO
+* GW_MSG_STATS      daemon -> client   GwStats
+*/
+
+#ifndef GW_PROTOCOL_H
+#define GW_PROTOCOL_H
+
+#include <stdint.h>
+
+#define GW_DEFAULT_SOCKET		"/run/plc_gatewayd.sock"
+
+#define GW_MSG_SEND				0x01
+#define GW_MSG_SUBSCRIBE		0x02
+#define GW_MSG_STATS_REQ		0x03
+#define GW_MSG_STATUS			0x81
+#define GW_MSG_RECEIVE			0x82
+#define GW_MSG_STATS			0x83
+
+#define GW_HEADER_LENGTH		2
+#define GW_SEND_FIXED			12		/* Body bytes of GW_MSG_SEND before the payload */
+#define GW_RECEIVE_FIXED		10		/* Body bytes of GW_MSG_RECEIVE before the payload */
+#define GW_MAX_PAYLOAD			31
+#define GW_MAX_RECORD			(GW_HEADER_LENGTH + 255)
+
+#define GW_STATUS_REJECTED		0x00	/* Queue full or malformed request; no PLC status bit is ever 0 on completion */
+#define GW_STATUS_LOST			0x40	/* No result within GW_TX_TIMEOUT_MS, as PLC_TX_LOST; outside Status_TX */
+
+struct GwStats {
+    uint32_t dwQueued;
+    uint32_t dwSent;				/* Completed with Status_TX_Data_Sent */
+    uint32_t dwNoAck;
+    uint32_t dwNoResp;
+    uint32_t dwRejected;
+    uint32_t dwBiuTimeouts;			/* Status_UnableToTX, each followed by a threshold raise and resend */
+    uint32_t dwReceived;
+    uint32_t dwRxDropped;			/* Status_RX_Packet_Dropped reported by the modem */
+    uint32_t dwInterrupts;
+    uint32_t dwBusErrors;
+    uint32_t dwClients;
+    uint32_t dwQueueDepth;
+    uint32_t dwOverheadUsAvg;		/* Host time spent per completed frame, bus transfers included */
+    uint32_t dwOverheadUsMax;
+    uint32_t dwLost;				/* Given up after GW_TX_TIMEOUT_MS without a result */
+};
+
+#endif
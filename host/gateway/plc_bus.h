@@ -0,0 +1,87 @@
+/*
+* File Name: plc_bus.h
+**
+Description:
+* Register access to one CY8CPLC10 for the gateway daemon, with its HOST_INT line exposed as a pollable
+* file descriptor.
+* LinuxPlcBus talks to real hardware through /dev/i2c-N and a GPIO character device line.
+* SimPlcBus runs the chip, and a set of echoing peers, in-process on the simulated medium.
+*/
+
+#ifndef PLC_BUS_H
+#define PLC_BUS_H
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+
+class PlcBus {
+  public:
+    virtual ~PlcBus() {}
+    virtual bool Write(uint8_t bOffset, const uint8_t *pbData, uint8_t bLength) = 0;
+    virtual bool Read(uint8_t bOffset, uint8_t *pbData, uint8_t bLength) = 0;
+    virtual int IntFd(void) = 0;				/* Readable when HOST_INT asserts, -1 if the line is polled */
+    virtual void ClearIntEvent(void) = 0;		/* Consume the pending events on IntFd() */
+    virtual bool IntAsserted(void) = 0;
+    virtual int TimeoutMs(void) { return -1; }	/* Longest the event loop may sleep */
+    virtual void Advance(void) {}				/* Called on every event loop pass */
+};
+
+class LinuxPlcBus : public PlcBus {
+  public:
+    LinuxPlcBus();
+    ~LinuxPlcBus();
+    bool Open(const char *pszI2C, uint8_t bAddress, const char *pszGpioChip, int iLine, unsigned int wGapUs);
+
+    bool Write(uint8_t bOffset, const uint8_t *pbData, uint8_t bLength);
+    bool Read(uint8_t bOffset, uint8_t *pbData, uint8_t bLength);
+    int IntFd(void);
+    void ClearIntEvent(void);
+    bool IntAsserted(void);
+  private:
+    void Gap(void);
+
+    int iI2CFd;
+    int iLineFd;
+    unsigned int wGapUs;
+};
+
+class SimKernel;
+class SimMedium;
+class SimHost;
+class SimChip;
+
+class SimPlcBus : public PlcBus {
+  public:
+    SimPlcBus(int iPeers, uint8_t bLocalAddress, double dSpeed);
+    ~SimPlcBus();
+
+    bool Write(uint8_t bOffset, const uint8_t *pbData, uint8_t bLength);
+    bool Read(uint8_t bOffset, uint8_t *pbData, uint8_t bLength);
+    int IntFd(void);
+    void ClearIntEvent(void);
+    bool IntAsserted(void);
+    int TimeoutMs(void);
+    void Advance(void);
+  private:
+    struct Peer {
+      SimHost *pHost;
+      SimChip *pChip;
+      std::deque<std::vector<uint8_t> > backlog;	/* Echoes waiting for the peer's transmitter */
+    };
+
+    uint64_t VirtualNow(void);
+    void PeerInterrupt(Peer *pPeer);
+    void PeerSend(Peer *pPeer);
+
+    SimKernel *pKernel;
+    SimMedium *pMedium;
+    SimHost *pHost;
+    SimChip *pChip;
+    std::vector<Peer *> peers;
+    int iEventFd;
+    double dSpeed;
+    uint64_t qwStartUs;
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include "plc_bus.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+#include <linux/gpio.h>
+
+LinuxPlcBus::LinuxPlcBus() : iI2CFd(-1), iLineFd(-1), wGapUs(0)
+{
+}
+
+LinuxPlcBus::~LinuxPlcBus()
+{
+	if (iI2CFd >= 0)
+	{
+		close(iI2CFd);
+	}
+	if (iLineFd >= 0)
+	{
+		close(iLineFd);
+	}
+}
+
+/*****************************************************************************
+* Function Name: LinuxPlcBus::Open()
+******************************************************************************
+* Summary:
+* Open the I2C adapter and request the HOST_INT line for rising edge events
+**
+Parameters:
+* pszI2C: I2C adapter, such as /dev/i2c-1
+* bAddress: 7-bit slave address of the CY8CPLC10
+* pszGpioChip: GPIO character device with HOST_INT, such as /dev/gpiochip0. NULL to poll INT_Status instead.
+* iLine: line offset of HOST_INT on that chip
+* wGapUs: idle time enforced between I2C transactions
+**
+Return:
+* true on success. Errors are reported on stderr.
+*****************************************************************************/
+bool LinuxPlcBus::Open(const char *pszI2C, uint8_t bAddress, const char *pszGpioChip, int iLine, unsigned int wGapUs)
+{
+	this->wGapUs = wGapUs;
+
+	iI2CFd = open(pszI2C, O_RDWR | O_CLOEXEC);
+	if (iI2CFd < 0)
+	{
+		fprintf(stderr, "%s: %s\n", pszI2C, strerror(errno));
+		return false;
+	}
+	if (ioctl(iI2CFd, I2C_SLAVE, (unsigned long)bAddress) < 0)
+	{
+		fprintf(stderr, "%s: I2C_SLAVE 0x%02x: %s\n", pszI2C, bAddress, strerror(errno));
+		return false;
+	}
+
+	if (pszGpioChip != NULL)
+	{
+		struct gpio_v2_line_request request;
+		int iChipFd = open(pszGpioChip, O_RDWR | O_CLOEXEC);
+
+		if (iChipFd < 0)
+		{
+			fprintf(stderr, "%s: %s\n", pszGpioChip, strerror(errno));
+			return false;
+		}
+		memset(&request, 0, sizeof(request));
+		request.offsets[0] = (uint32_t)iLine;
+		request.num_lines = 1;
+		request.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING;
+		strncpy(request.consumer, "plc_gatewayd", sizeof(request.consumer) - 1);
+		if (ioctl(iChipFd, GPIO_V2_GET_LINE_IOCTL, &request) < 0)
+		{
+			fprintf(stderr, "%s: line %d: %s\n", pszGpioChip, iLine, strerror(errno));
+			close(iChipFd);
+			return false;
+		}
+		close(iChipFd);
+		iLineFd = request.fd;
+		fcntl(iLineFd, F_SETFL, fcntl(iLineFd, F_GETFL) | O_NONBLOCK);
+	}
+	return true;
+}
+
+void LinuxPlcBus::Gap(void)
+{
+	if (wGapUs)
+	{
+		struct timespec ts;
+		ts.tv_sec = 0;
+		ts.tv_nsec = (long)wGapUs * 1000;
+		nanosleep(&ts, NULL);
+	}
+}
+
+/*****************************************************************************
+* Function Name: LinuxPlcBus::Write()
+******************************************************************************
+* Summary:
+* One write transaction: the offset byte followed by the data, as PLC_I2C::WriteToOffset() sends it
+*****************************************************************************/
+bool LinuxPlcBus::Write(uint8_t bOffset, const uint8_t *pbData, uint8_t bLength)
+{
+	uint8_t abBuffer[256];
+	ssize_t iWritten;
+
+	abBuffer[0] = bOffset;
+	memcpy(&abBuffer[1], pbData, bLength);
+	iWritten = write(iI2CFd, abBuffer, bLength + 1);
+	Gap();
+	return iWritten == (ssize_t)(bLength + 1);
+}
+
+/*****************************************************************************
+* Function Name: LinuxPlcBus::Read()
+******************************************************************************
+* Summary:
+* Set the register pointer with a write, then read, as PLC_I2C::ReadFromOffset() does
+*****************************************************************************/
+bool LinuxPlcBus::Read(uint8_t bOffset, uint8_t *pbData, uint8_t bLength)
+{
+	if (write(iI2CFd, &bOffset, 1) != 1)
+	{
+		Gap();
+		return false;
+	}
+	Gap();
+	if (read(iI2CFd, pbData, bLength) != (ssize_t)bLength)
+	{
+		Gap();
+		return false;
+	}
+	Gap();
+	return true;
+}
+
+int LinuxPlcBus::IntFd(void)
+{
+	return iLineFd;
+}
+
+void LinuxPlcBus::ClearIntEvent(void)
+{
+	struct gpio_v2_line_event aEvents[16];
+
+	if (iLineFd < 0)
+	{
+		return;
+	}
+	while (read(iLineFd, aEvents, sizeof(aEvents)) > 0)
+	{
+	}
+}
+
+bool LinuxPlcBus::IntAsserted(void)
+{
+	struct gpio_v2_line_values values;
+
+	if (iLineFd < 0)
+	{
+		return true;		/* No line: every poll reads INT_Status, like PLC_PollPolicy */
+	}
+	memset(&values, 0, sizeof(values));
+	values.mask = 1;
+	if (ioctl(iLineFd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+	{
+		return true;
+	}
+	return (values.bits & 1) != 0;
+}
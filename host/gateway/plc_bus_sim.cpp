@@ -0,0 +1,187 @@
+#include "plc_bus.h"
+#include "plc_sim.h"
+#include "plc_commands.h"
+
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+#define SIM_BUS_I2C_ADDRESS		0x01
+#define SIM_BUS_INT_PIN			2
+#define SIM_BUS_PEER_BASE		0x10	/* Logical address of the first echoing peer */
+
+static uint64_t MonotonicUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*****************************************************************************
+* Function Name: SimPlcBus::SimPlcBus()
+******************************************************************************
+* Summary:
+* Build a simulated line with the gateway's chip and iPeers echoing peers
+**
+Parameters:
+* iPeers: number of peers, at logical addresses 0x10 upwards. Each sends every frame it receives back to its
+*   source with the same command ID.
+* bLocalAddress: logical address of the gateway's chip
+* dSpeed: simulated seconds per real second
+*****************************************************************************/
+SimPlcBus::SimPlcBus(int iPeers, uint8_t bLocalAddress, double dSpeed) : dSpeed(dSpeed)
+{
+	SimMediumConfig config;
+
+	pKernel = new SimKernel();
+	pMedium = new SimMedium(*pKernel, config, 1);
+	pHost = new SimHost();
+	pChip = new SimChip(*pMedium, pHost, SIM_BUS_I2C_ADDRESS, SIM_BUS_INT_PIN, bLocalAddress, 0x00FF000000000000ULL);
+	iEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	pHost->onInt = [this](SimChip *) {
+		uint64_t qwOne = 1;
+		if (write(iEventFd, &qwOne, sizeof(qwOne)) < 0)
+		{
+		}
+	};
+
+	for (int i = 0; i < iPeers; i++)
+	{
+		Peer *pPeer = new Peer();
+		SimChip *pPeerChip;
+
+		pPeer->pHost = new SimHost();
+		pPeerChip = new SimChip(*pMedium, pPeer->pHost, SIM_BUS_I2C_ADDRESS, SIM_BUS_INT_PIN, (uint8_t)(SIM_BUS_PEER_BASE + i), 0x00FE000000000000ULL + i);
+		pPeer->pChip = pPeerChip;
+		pPeerChip->abReg[PLC_Mode] = TX_Enable | RX_Enable;
+		pPeerChip->abReg[INT_Enable] = INT_UnableToTX | INT_TX_NO_ACK | INT_TX_NO_RESP | INT_RX_Data_Available | INT_TX_Data_Sent;
+		pPeerChip->abReg[TX_Config] = TX_Service_Type | 0x01;
+		pPeer->pHost->onInt = [this, pPeer](SimChip *) { PeerInterrupt(pPeer); };
+		peers.push_back(pPeer);
+	}
+	qwStartUs = MonotonicUs();
+}
+
+SimPlcBus::~SimPlcBus()
+{
+	for (size_t i = 0; i < peers.size(); i++)
+	{
+		delete peers[i]->pChip;
+		delete peers[i]->pHost;
+		delete peers[i];
+	}
+	delete pChip;
+	delete pHost;
+	delete pMedium;
+	delete pKernel;
+	close(iEventFd);
+}
+
+uint64_t SimPlcBus::VirtualNow(void)
+{
+	return (uint64_t)((MonotonicUs() - qwStartUs) * dSpeed);
+}
+
+/* A peer's HOST_INT: queue an echo of a received frame and send whenever the transmitter is free */
+void SimPlcBus::PeerInterrupt(Peer *pPeer)
+{
+	uint8_t *pbReg = pPeer->pChip->abReg;
+	uint8_t bStatus = pbReg[INT_Status];
+
+	pbReg[INT_Status] = 0;
+	if (pbReg[RX_Message_INFO] & New_RX_Msg)
+	{
+		uint8_t bLength = pbReg[RX_Message_INFO] & RX_Msg_Length;
+		std::vector<uint8_t> echo;
+
+		echo.push_back(pbReg[RX_SA]);
+		echo.push_back(pbReg[RX_CommandID]);
+		echo.insert(echo.end(), &pbReg[RX_Data], &pbReg[RX_Data] + bLength);
+		pbReg[RX_Message_INFO] = 0;
+		pPeer->backlog.push_back(echo);
+	}
+	if (bStatus & (Status_TX_Data_Sent | Status_TX_NO_ACK | Status_TX_NO_RESP | Status_UnableToTX))
+	{
+		pbReg[TX_Message_Length] = 0;
+	}
+	PeerSend(pPeer);
+}
+
+void SimPlcBus::PeerSend(Peer *pPeer)
+{
+	uint8_t *pbReg = pPeer->pChip->abReg;
+	std::vector<uint8_t> write;
+
+	if (pPeer->backlog.empty() || (pbReg[TX_Message_Length] & Send_Message))
+	{
+		return;
+	}
+	std::vector<uint8_t> &echo = pPeer->backlog.front();
+	pbReg[TX_DA] = echo[0];
+	pbReg[TX_CommandID] = echo[1];
+	memcpy(&pbReg[TX_Data], &echo[2], echo.size() - 2);
+	write.push_back(TX_Message_Length);
+	write.push_back((uint8_t)((echo.size() - 2) | Send_Message));
+	pPeer->backlog.pop_front();
+	pPeer->pChip->I2CWrite(&write[0], (uint8_t)write.size());
+}
+
+bool SimPlcBus::Write(uint8_t bOffset, const uint8_t *pbData, uint8_t bLength)
+{
+	uint8_t abBuffer[256];
+
+	Advance();
+	abBuffer[0] = bOffset;
+	memcpy(&abBuffer[1], pbData, bLength);
+	return pChip->I2CWrite(abBuffer, bLength + 1);
+}
+
+bool SimPlcBus::Read(uint8_t bOffset, uint8_t *pbData, uint8_t bLength)
+{
+	Advance();
+	pChip->I2CWrite(&bOffset, 1);
+	return pChip->I2CRead(pbData, bLength) == bLength;
+}
+
+int SimPlcBus::IntFd(void)
+{
+	return iEventFd;
+}
+
+void SimPlcBus::ClearIntEvent(void)
+{
+	uint64_t qwCount;
+
+	if (read(iEventFd, &qwCount, sizeof(qwCount)) < 0)
+	{
+	}
+}
+
+bool SimPlcBus::IntAsserted(void)
+{
+	return pChip->IntAsserted();
+}
+
+/* Sleep no longer than until the next simulated event is due */
+int SimPlcBus::TimeoutMs(void)
+{
+	uint64_t qwNext = pKernel->NextEvent();
+	uint64_t qwNow = VirtualNow();
+
+	if (qwNext == SIM_FOREVER)
+	{
+		return -1;
+	}
+	if (qwNext <= qwNow)
+	{
+		return 0;
+	}
+	return (int)((qwNext - qwNow) / dSpeed / 1000) + 1;
+}
+
+void SimPlcBus::Advance(void)
+{
+	pKernel->Run(VirtualNow());
+}
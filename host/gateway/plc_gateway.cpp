@@ -0,0 +1,382 @@
+#include "plc_gateway.h"
+#include "plc_commands.h"
+
+#include <string.h>
+#include <time.h>
+
+#define GW_RX_HEADER		(RX_Data - RX_Message_INFO)		/* RX_Message_INFO, RX_SA[8], RX_CommandID */
+
+static uint64_t MonotonicNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+PlcGateway::PlcGateway(PlcBus &bus) : bus(bus), bSending(false), bTxConfig(0), bTxDAType(0), bTxDAValid(false),
+	bTxLength(0), bPlcMode(0), bThreshold(0), qwSendNs(0), qwFrameNs(0), qwOverheadNs(0), dwOverheadFrames(0)
+{
+	memset(&stats, 0, sizeof(stats));
+	memset(abTxDA, 0, sizeof(abTxDA));
+}
+
+/*****************************************************************************
+* Function Name: PlcGateway::begin()
+******************************************************************************
+* Summary:
+* Configure the modem as PLC_I2C::init() does, with both the transmitter and the receiver enabled
+**
+Parameters:
+* bLocalAddress: logical address of the modem
+**
+Return:
+* false if the modem did not answer on the bus
+**
+Note:
+* Promiscuous mode is left off, unlike PLC_I2C::init(), so only frames addressed to the gateway are queued.
+*****************************************************************************/
+bool PlcGateway::begin(uint8_t bLocalAddress)
+{
+	bool bResult = true;
+	uint8_t bTemp;
+
+	if (!bus.Read(Local_FW, &bTemp, 1))
+	{
+		return false;
+	}
+
+	bPlcMode = Lock_Configuration | TX_Enable | RX_Enable | RX_Override;
+	bResult &= bus.Write(PLC_Mode, &bPlcMode, 1);
+
+	bTemp = (INT_UnableToTX | INT_TX_NO_ACK | INT_TX_NO_RESP | INT_RX_Packet_Dropped | INT_RX_Data_Available | INT_TX_Data_Sent);
+	bResult &= bus.Write(INT_Enable, &bTemp, 1);
+
+	bTxConfig = (TX_Service_Type | 0x01);
+	bResult &= bus.Write(TX_Config, &bTxConfig, 1);
+	bTxDAValid = false;			/* TX_DA still holds whatever the last user of the modem left there */
+
+	bTemp = (Modem_TXDelay_7ms | Modem_FSKBW_3M | Modem_BPS_2400);
+	bResult &= bus.Write(Modem_Config, &bTemp, 1);
+
+	bTemp = 0x0E;
+	bResult &= bus.Write(TX_Gain, &bTemp, 1);
+
+	bTemp = 0x01;
+	bResult &= bus.Write(RX_Gain, &bTemp, 1);
+
+	bResult &= bus.Write(Local_LA_LSB, &bLocalAddress, 1);
+	bResult &= bus.Read(Threshold_Noise, &bThreshold, 1);
+
+	/* Start from a clean slate: drop a stale status and an unread frame */
+	bResult &= bus.Read(INT_Status, &bTemp, 1);
+	bTemp = 0x00;
+	bResult &= bus.Write(RX_Message_INFO, &bTemp, 1);
+	bus.ClearIntEvent();
+	return bResult;
+}
+
+/*****************************************************************************
+* Function Name: PlcGateway::Queue()
+******************************************************************************
+* Summary:
+* Queue a frame for transmission, and start it at once if the transmitter is idle
+**
+Return:
+* false if the queue is full or the request is malformed
+*****************************************************************************/
+bool PlcGateway::Queue(const GwRequest &request)
+{
+	if (queue.size() >= GW_QUEUE_LENGTH || request.bLength > GW_MAX_PAYLOAD ||
+		(request.bDAType != TX_DA_Type_Log && request.bDAType != TX_DA_Type_Grp && request.bDAType != TX_DA_Type_Phy))
+	{
+		stats.dwRejected++;
+		return false;
+	}
+	queue.push_back(request);
+	stats.dwQueued++;
+	if (!bSending)
+	{
+		StartNext();
+	}
+	stats.dwQueueDepth = (uint32_t)queue.size();
+	return true;
+}
+
+bool PlcGateway::Busy(void) const
+{
+	return bSending || !queue.empty();
+}
+
+/* ms until the frame being sent is given up, 0 if it is due now, -1 with nothing being sent */
+int PlcGateway::TimeoutMs(void) const
+{
+	uint64_t qwElapsedMs;
+
+	if (!bSending)
+	{
+		return -1;
+	}
+	qwElapsedMs = (MonotonicNs() - qwSendNs) / 1000000;
+	return (qwElapsedMs >= GW_TX_TIMEOUT_MS) ? 0 : (int)(GW_TX_TIMEOUT_MS - qwElapsedMs);
+}
+
+/* A client has gone: its frames still go out, but nobody is told about them */
+void PlcGateway::Forget(void *pOwner)
+{
+	for (size_t i = 0; i < queue.size(); i++)
+	{
+		if (queue[i].pOwner == pOwner)
+		{
+			queue[i].pOwner = NULL;
+		}
+	}
+}
+
+/*****************************************************************************
+* Function Name: PlcGateway::StartNext()
+******************************************************************************
+* Summary:
+* Load the head of the queue into the modem and set Send_Message
+**
+Note:
+* The destination and TX_Config are written only when they differ from what was last written to them, and the
+* shadows are only updated once a write has succeeded. The command ID and the payload are adjacent
+* (TX_CommandID, TX_Data) and go out in one write.
+*****************************************************************************/
+void PlcGateway::StartNext(void)
+{
+	uint64_t qwStart = MonotonicNs();
+	bool bResult = true;
+	uint8_t abBuffer[1 + GW_MAX_PAYLOAD];
+	uint8_t bConfig;
+	uint8_t bDALength;
+
+	if (queue.empty())
+	{
+		return;
+	}
+	GwRequest &request = queue.front();
+
+	bDALength = (request.bDAType == TX_DA_Type_Phy) ? 8 : 1;
+	if (!bTxDAValid || bTxDAType != request.bDAType || memcmp(abTxDA, request.abDA, bDALength) != 0)
+	{
+		bTxDAValid = bus.Write(TX_DA, request.abDA, bDALength);
+		if (bTxDAValid)
+		{
+			memcpy(abTxDA, request.abDA, bDALength);
+			bTxDAType = request.bDAType;
+		}
+		bResult &= bTxDAValid;
+	}
+	bConfig = (bTxConfig & ~TX_DA_Type) | request.bDAType;
+	if (bConfig != bTxConfig)
+	{
+		if (bus.Write(TX_Config, &bConfig, 1))
+		{
+			bTxConfig = bConfig;
+		}
+		else
+		{
+			bResult = false;
+		}
+	}
+
+	abBuffer[0] = request.bCommand;
+	memcpy(&abBuffer[1], request.abData, request.bLength);
+	bResult &= bus.Write(TX_CommandID, abBuffer, 1 + request.bLength);
+
+	bTxLength = request.bLength;
+	bSending = true;
+	qwFrameNs = 0;
+	Resend();
+	if (!bResult)
+	{
+		stats.dwBusErrors++;
+	}
+	qwFrameNs += MonotonicNs() - qwStart;
+}
+
+void PlcGateway::Resend(void)
+{
+	uint8_t bTemp = bTxLength | Send_Message;
+
+	qwSendNs = MonotonicNs();
+	if (!bus.Write(TX_Message_Length, &bTemp, 1))
+	{
+		stats.dwBusErrors++;
+	}
+}
+
+/*****************************************************************************
+* Function Name: PlcGateway::EscalateBiu()
+******************************************************************************
+* Summary:
+* Raise the BIU threshold after a Band-In-Use timeout, or disable BIU once it is at its maximum, as
+* PLC_I2C::TransmitPacket() does
+*****************************************************************************/
+void PlcGateway::EscalateBiu(void)
+{
+	bool bResult;
+
+	if ((bThreshold & BIU_Threshold_Mask) < BIU_Threshold_Mask)
+	{
+		bThreshold++;
+		bResult = bus.Write(Threshold_Noise, &bThreshold, 1);
+	}
+	else
+	{
+		bPlcMode |= Disable_BIU;
+		bResult = bus.Write(PLC_Mode, &bPlcMode, 1);
+	}
+	if (!bResult)
+	{
+		stats.dwBusErrors++;
+	}
+}
+
+/*****************************************************************************
+* Function Name: PlcGateway::ReadReceived()
+******************************************************************************
+* Summary:
+* Read the RX buffer out in two transfers, the header and then exactly the payload, and release it
+*****************************************************************************/
+void PlcGateway::ReadReceived(void)
+{
+	uint8_t abFrame[GW_RX_HEADER + GW_MAX_PAYLOAD];
+	uint8_t bLength;
+	uint8_t bTemp = 0x00;
+
+	if (!bus.Read(RX_Message_INFO, abFrame, GW_RX_HEADER))
+	{
+		stats.dwBusErrors++;
+		return;
+	}
+	if (!(abFrame[0] & New_RX_Msg))
+	{
+		return;
+	}
+	bLength = abFrame[0] & RX_Msg_Length;
+	if (bLength > GW_MAX_PAYLOAD)
+	{
+		bLength = GW_MAX_PAYLOAD;
+	}
+	if ((bLength && !bus.Read(RX_Data, &abFrame[GW_RX_HEADER], bLength)) || !bus.Write(RX_Message_INFO, &bTemp, 1))
+	{
+		stats.dwBusErrors++;
+		return;
+	}
+	stats.dwReceived++;
+	if (onReceive)
+	{
+		onReceive(abFrame, GW_RX_HEADER + bLength);
+	}
+}
+
+/* Take the frame being sent off the queue, count its result, start the next one and report it */
+void PlcGateway::Complete(uint8_t bStatus, uint64_t qwSpentNs)
+{
+	GwRequest request = queue.front();
+
+	queue.pop_front();
+	bSending = false;
+	if (bStatus & Status_TX_Data_Sent)
+	{
+		stats.dwSent++;
+	}
+	else if (bStatus & Status_TX_NO_ACK)
+	{
+		stats.dwNoAck++;
+	}
+	else if (bStatus & Status_TX_NO_RESP)
+	{
+		stats.dwNoResp++;
+	}
+	else
+	{
+		stats.dwLost++;
+	}
+	StartNext();
+	stats.dwQueueDepth = (uint32_t)queue.size();
+	Account(qwSpentNs);
+	if (onComplete)
+	{
+		onComplete(request, bStatus);
+	}
+}
+
+void PlcGateway::Account(uint64_t qwNs)
+{
+	uint32_t dwUs = (uint32_t)(qwNs / 1000);
+
+	qwOverheadNs += qwNs;
+	dwOverheadFrames++;
+	stats.dwOverheadUsAvg = (uint32_t)(qwOverheadNs / 1000 / dwOverheadFrames);
+	if (dwUs > stats.dwOverheadUsMax)
+	{
+		stats.dwOverheadUsMax = dwUs;
+	}
+}
+
+/*****************************************************************************
+* Function Name: PlcGateway::Service()
+******************************************************************************
+* Summary:
+* HOST_INT service routine: read INT_Status once and act on every bit in it
+**
+Note:
+* Loops while HOST_INT stays asserted, so a status raised during the read out is not left waiting for an
+* edge that has already been consumed. Also call it once TimeoutMs() reaches 0: with HOST_INT not asserted,
+* the frame being sent is then given up as GW_STATUS_LOST and the next one started.
+*****************************************************************************/
+void PlcGateway::Service(void)
+{
+	uint8_t bStatus;
+	int iRounds = 0;
+
+	if (TimeoutMs() == 0 && !bus.IntAsserted())
+	{
+		Complete(GW_STATUS_LOST, qwFrameNs);
+		return;
+	}
+	while (bus.IntAsserted() && iRounds++ < 4)
+	{
+		uint64_t qwStart = MonotonicNs();
+
+		if (!bus.Read(INT_Status, &bStatus, 1))
+		{
+			stats.dwBusErrors++;
+			return;
+		}
+		if (bStatus == 0)
+		{
+			return;
+		}
+		stats.dwInterrupts++;
+
+		if (bStatus & Status_RX_Packet_Dropped)
+		{
+			stats.dwRxDropped++;
+		}
+		if (bStatus & (Status_RX_Data_Available | Status_RX_Packet_Dropped))
+		{
+			ReadReceived();
+		}
+
+		if (!bSending || !(bStatus & Status_TX))
+		{
+			continue;
+		}
+		if (!(bStatus & (Status_TX_Data_Sent | Status_TX_NO_ACK | Status_TX_NO_RESP)))
+		{
+			/* Band-In-Use timeout: escalate and try the same frame again */
+			stats.dwBiuTimeouts++;
+			EscalateBiu();
+			Resend();
+			qwFrameNs += MonotonicNs() - qwStart;
+			continue;
+		}
+
+		Complete(bStatus & Status_TX, qwFrameNs + (MonotonicNs() - qwStart));
+	}
+}
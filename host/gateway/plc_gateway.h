@@ -0,0 +1,76 @@
+/*
+* File Name: plc_gateway.h
+**
+Description:
+* Event-driven CY8CPLC10 driver for the gateway daemon. It issues the same register sequence as PLC_I2C
+* (init, SetDestinationAddress, TransmitPacket with its Band-In-Use escalation, the RX buffer read out), but
+* never waits: each step is started by Queue() or by the HOST_INT service routine, so one thread can keep the
+* modem busy while it serves its clients.
+**
+Note:
+* INT_Status is read in one place only, Service(), and every bit of it is acted on there. The blocking driver
+* reads INT_Status while it waits for a TX result and loses an RX_Data_Available that arrives meanwhile.
+* A frame whose result has not come GW_TX_TIMEOUT_MS after it was (re)sent is given up as GW_STATUS_LOST, so
+* a lost HOST_INT edge does not stall the queue. The event loop sleeps no longer than TimeoutMs() for it.
+*/
+
+#ifndef PLC_GATEWAY_H
+#define PLC_GATEWAY_H
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include "plc_bus.h"
+#include "gw_protocol.h"
+
+#define GW_QUEUE_LENGTH		256
+#define GW_TX_TIMEOUT_MS	5000		/* From (re)send to result before a frame is given up, as PLC_TX_TIMEOUT */
+
+struct GwRequest {
+    void *pOwner;				/* Client that asked for the send, NULL once it has gone */
+    uint16_t wTag;
+    uint8_t bDAType;			/* TX_DA_Type_Log / _Grp / _Phy */
+    uint8_t abDA[8];
+    uint8_t bCommand;
+    uint8_t bLength;
+    uint8_t abData[GW_MAX_PAYLOAD];
+};
+
+class PlcGateway {
+  public:
+    PlcGateway(PlcBus &bus);
+    bool begin(uint8_t bLocalAddress);
+    bool Queue(const GwRequest &request);
+    void Service(void);
+    void Forget(void *pOwner);
+    bool Busy(void) const;
+    int TimeoutMs(void) const;
+
+    std::function<void(const GwRequest &, uint8_t)> onComplete;		/* Request and its INT_Status TX bits */
+    std::function<void(const uint8_t *, uint8_t)> onReceive;		/* RX_Message_INFO onwards, and its length */
+    GwStats stats;
+  private:
+    void StartNext(void);
+    void Resend(void);
+    void EscalateBiu(void);
+    void ReadReceived(void);
+    void Complete(uint8_t bStatus, uint64_t qwSpentNs);
+    void Account(uint64_t qwNs);
+
+    PlcBus &bus;
+    std::deque<GwRequest> queue;
+    bool bSending;
+    uint8_t bTxConfig;			/* Shadows of the registers the chip only changes when told to */
+    uint8_t abTxDA[8];
+    uint8_t bTxDAType;
+    bool bTxDAValid;			/* abTxDA and bTxDAType hold what TX_DA was last written with */
+    uint8_t bTxLength;
+    uint8_t bPlcMode;
+    uint8_t bThreshold;
+    uint64_t qwSendNs;			/* When the frame being sent was last handed to the modem */
+    uint64_t qwFrameNs;			/* Host time spent on the frame being sent */
+    uint64_t qwOverheadNs;
+    uint32_t dwOverheadFrames;
+};
+
+#endif
@@ -0,0 +1,405 @@
+/*
+* File Name: plc_gatewayd.cpp
+**
+Description:
+* Head-end daemon: drives one CY8CPLC10 through PlcGateway and serves local clients on a Unix domain socket
+* using the records of gw_protocol.h. A single epoll loop waits on HOST_INT, the listening socket and the
+* clients. Replies produced in one pass of the loop are gathered per client and written with one send().
+**
+Usage:
+* plc_gatewayd [--i2c /dev/i2c-1] [--addr 0x01] [--gpiochip /dev/gpiochip0 --line 17] [--gap-us 0]
+*              [--local 0x01] [--socket /run/plc_gatewayd.sock]
+* plc_gatewayd --sim 4 [--sim-speed 1] [--local 0x01] [--socket ...]
+*
+* Without --gpiochip the modem is polled every millisecond while a frame is in flight, as PLC_PollPolicy
+* does in the sketch. --sim runs the modem and the given number of echoing peers (logical addresses 0x10
+* upwards) in-process on the simulated medium.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <vector>
+#include <string>
+
+#include "plc_gateway.h"
+#include "plc_commands.h"
+
+#define GW_MAX_CLIENTS		64
+#define GW_MAX_EVENTS		32
+#define GW_POLL_MS			1
+
+struct GwClient {
+    int iFd;
+    bool bSubscribed;
+    std::vector<uint8_t> in;
+    std::vector<uint8_t> out;
+};
+
+static volatile sig_atomic_t bQuit = 0;
+static std::vector<GwClient *> clients;
+
+static void OnSignal(int)
+{
+	bQuit = 1;
+}
+
+static void Put16(std::vector<uint8_t> &out, uint16_t wValue)
+{
+	out.push_back((uint8_t)wValue);
+	out.push_back((uint8_t)(wValue >> 8));
+}
+
+static void PutStatus(GwClient *pClient, uint16_t wTag, uint8_t bStatus)
+{
+	pClient->out.push_back(GW_MSG_STATUS);
+	pClient->out.push_back(3);
+	Put16(pClient->out, wTag);
+	pClient->out.push_back(bStatus);
+}
+
+static void PutStats(GwClient *pClient, const GwStats &stats)
+{
+	const uint8_t *pbStats = (const uint8_t *)&stats;
+
+	pClient->out.push_back(GW_MSG_STATS);
+	pClient->out.push_back((uint8_t)sizeof(stats));
+	pClient->out.insert(pClient->out.end(), pbStats, pbStats + sizeof(stats));
+}
+
+/*****************************************************************************
+* Function Name: HandleRecords()
+******************************************************************************
+* Summary:
+* Act on every complete record a client has sent, leaving a partial one in its buffer
+*****************************************************************************/
+static void HandleRecords(GwClient *pClient, PlcGateway &gateway)
+{
+	size_t i = 0;
+	std::vector<uint8_t> &in = pClient->in;
+
+	while (in.size() - i >= GW_HEADER_LENGTH && in.size() - i >= (size_t)GW_HEADER_LENGTH + in[i + 1])
+	{
+		uint8_t bType = in[i];
+		uint8_t bLength = in[i + 1];
+		const uint8_t *pbBody = &in[i + GW_HEADER_LENGTH];
+
+		if (bType == GW_MSG_SEND && bLength >= GW_SEND_FIXED)
+		{
+			GwRequest request;
+
+			request.pOwner = pClient;
+			request.wTag = pbBody[0] | (pbBody[1] << 8);
+			request.bDAType = pbBody[2];
+			memcpy(request.abDA, &pbBody[3], 8);
+			request.bCommand = pbBody[11];
+			request.bLength = bLength - GW_SEND_FIXED;
+			if (request.bLength <= GW_MAX_PAYLOAD)
+			{
+				memcpy(request.abData, &pbBody[GW_SEND_FIXED], request.bLength);
+			}
+			if (!gateway.Queue(request))
+			{
+				PutStatus(pClient, request.wTag, GW_STATUS_REJECTED);
+			}
+		}
+		else if (bType == GW_MSG_SUBSCRIBE && bLength >= 1)
+		{
+			pClient->bSubscribed = pbBody[0] != 0;
+		}
+		else if (bType == GW_MSG_STATS_REQ)
+		{
+			gateway.stats.dwClients = (uint32_t)clients.size();
+			PutStats(pClient, gateway.stats);
+		}
+		else if (bType == GW_MSG_SEND)
+		{
+			gateway.stats.dwRejected++;
+			PutStatus(pClient, bLength >= 2 ? (pbBody[0] | (pbBody[1] << 8)) : 0, GW_STATUS_REJECTED);
+		}
+		i += GW_HEADER_LENGTH + bLength;
+	}
+	in.erase(in.begin(), in.begin() + i);
+}
+
+static void CloseClient(GwClient *pClient, PlcGateway &gateway, int iEpoll)
+{
+	epoll_ctl(iEpoll, EPOLL_CTL_DEL, pClient->iFd, NULL);
+	close(pClient->iFd);
+	gateway.Forget(pClient);
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		if (clients[i] == pClient)
+		{
+			clients.erase(clients.begin() + i);
+			break;
+		}
+	}
+	delete pClient;
+}
+
+/*****************************************************************************
+* Function Name: FlushClients()
+******************************************************************************
+* Summary:
+* Write out what the last pass of the loop produced for each client, one send() per client
+**
+Note:
+* A client that does not keep up with its replies is dropped rather than allowed to stall the modem.
+*****************************************************************************/
+static void FlushClients(PlcGateway &gateway, int iEpoll)
+{
+	std::vector<GwClient *> slow;
+
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		GwClient *pClient = clients[i];
+		ssize_t iSent;
+
+		if (pClient->out.empty())
+		{
+			continue;
+		}
+		iSent = send(pClient->iFd, &pClient->out[0], pClient->out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (iSent > 0)
+		{
+			pClient->out.erase(pClient->out.begin(), pClient->out.begin() + iSent);
+		}
+		else if (iSent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			slow.push_back(pClient);
+			continue;
+		}
+		if (pClient->out.size() > 1024 * 1024)
+		{
+			slow.push_back(pClient);
+		}
+	}
+	for (size_t i = 0; i < slow.size(); i++)
+	{
+		CloseClient(slow[i], gateway, iEpoll);
+	}
+}
+
+static int Listen(const char *pszPath)
+{
+	struct sockaddr_un addr;
+	int iFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (iFd < 0)
+	{
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, pszPath, sizeof(addr.sun_path) - 1);
+	unlink(pszPath);
+	if (bind(iFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(iFd, 16) < 0)
+	{
+		close(iFd);
+		return -1;
+	}
+	return iFd;
+}
+
+static void Usage(void)
+{
+	fprintf(stderr, "usage: plc_gatewayd [--i2c dev] [--addr n] [--gpiochip dev --line n] [--gap-us n]\n"
+		"                    [--sim peers] [--sim-speed x] [--local n] [--socket path]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *pszI2C = "/dev/i2c-1";
+	const char *pszGpioChip = NULL;
+	const char *pszSocket = GW_DEFAULT_SOCKET;
+	int iLine = -1;
+	int iSimPeers = -1;
+	double dSimSpeed = 1.0;
+	unsigned int wGapUs = 0;
+	uint8_t bI2CAddress = 0x01;
+	uint8_t bLocal = 0x01;
+	PlcBus *pBus;
+	struct epoll_event event;
+	struct epoll_event aEvents[GW_MAX_EVENTS];
+	int iEpoll;
+	int iListen;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+
+		if (i + 1 >= argc)
+		{
+			Usage();
+		}
+		if (option == "--i2c") pszI2C = argv[++i];
+		else if (option == "--addr") bI2CAddress = (uint8_t)strtoul(argv[++i], NULL, 0);
+		else if (option == "--gpiochip") pszGpioChip = argv[++i];
+		else if (option == "--line") iLine = atoi(argv[++i]);
+		else if (option == "--gap-us") wGapUs = (unsigned int)strtoul(argv[++i], NULL, 0);
+		else if (option == "--sim") iSimPeers = atoi(argv[++i]);
+		else if (option == "--sim-speed") dSimSpeed = atof(argv[++i]);
+		else if (option == "--local") bLocal = (uint8_t)strtoul(argv[++i], NULL, 0);
+		else if (option == "--socket") pszSocket = argv[++i];
+		else Usage();
+	}
+
+	if (iSimPeers >= 0)
+	{
+		pBus = new SimPlcBus(iSimPeers, bLocal, dSimSpeed > 0 ? dSimSpeed : 1.0);
+	}
+	else
+	{
+		LinuxPlcBus *pLinux = new LinuxPlcBus();
+
+		if (pszGpioChip != NULL && iLine < 0)
+		{
+			Usage();
+		}
+		if (!pLinux->Open(pszI2C, bI2CAddress, pszGpioChip, iLine, wGapUs))
+		{
+			return 1;
+		}
+		pBus = pLinux;
+	}
+
+	PlcGateway gateway(*pBus);
+	if (!gateway.begin(bLocal))
+	{
+		fprintf(stderr, "plc_gatewayd: no modem answered at 0x%02x\n", bI2CAddress);
+		return 1;
+	}
+	gateway.onComplete = [](const GwRequest &request, uint8_t bStatus) {
+		if (request.pOwner != NULL)
+		{
+			PutStatus((GwClient *)request.pOwner, request.wTag, bStatus);
+		}
+	};
+	gateway.onReceive = [](const uint8_t *pbFrame, uint8_t bLength) {
+		for (size_t i = 0; i < clients.size(); i++)
+		{
+			if (clients[i]->bSubscribed)
+			{
+				clients[i]->out.push_back(GW_MSG_RECEIVE);
+				clients[i]->out.push_back(bLength);
+				clients[i]->out.insert(clients[i]->out.end(), pbFrame, pbFrame + bLength);
+			}
+		}
+	};
+
+	iListen = Listen(pszSocket);
+	if (iListen < 0)
+	{
+		fprintf(stderr, "plc_gatewayd: %s: %s\n", pszSocket, strerror(errno));
+		return 1;
+	}
+	iEpoll = epoll_create1(EPOLL_CLOEXEC);
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	epoll_ctl(iEpoll, EPOLL_CTL_ADD, iListen, &event);
+	if (pBus->IntFd() >= 0)
+	{
+		event.data.ptr = pBus;
+		epoll_ctl(iEpoll, EPOLL_CTL_ADD, pBus->IntFd(), &event);
+	}
+	signal(SIGINT, OnSignal);
+	signal(SIGTERM, OnSignal);
+
+	while (!bQuit)
+	{
+		int iTimeout = pBus->TimeoutMs();
+		int iTxTimeout = gateway.TimeoutMs();
+		int iCount;
+		bool bInterrupt = pBus->IntFd() < 0;
+		std::vector<GwClient *> closed;
+
+		if (pBus->IntFd() < 0 && gateway.Busy())
+		{
+			iTimeout = GW_POLL_MS;
+		}
+		if (iTxTimeout >= 0 && (iTimeout < 0 || iTxTimeout < iTimeout))
+		{
+			iTimeout = iTxTimeout;
+		}
+		iCount = epoll_wait(iEpoll, aEvents, GW_MAX_EVENTS, iTimeout);
+		if (iCount < 0 && errno != EINTR)
+		{
+			break;
+		}
+		pBus->Advance();
+
+		for (int i = 0; i < iCount; i++)
+		{
+			void *pSource = aEvents[i].data.ptr;
+
+			if (pSource == pBus)
+			{
+				pBus->ClearIntEvent();
+				bInterrupt = true;
+			}
+			else if (pSource == NULL)
+			{
+				int iFd;
+
+				while ((iFd = accept4(iListen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+				{
+					if (clients.size() >= GW_MAX_CLIENTS)
+					{
+						close(iFd);
+						continue;
+					}
+					GwClient *pClient = new GwClient();
+					pClient->iFd = iFd;
+					pClient->bSubscribed = false;
+					clients.push_back(pClient);
+					event.events = EPOLLIN;
+					event.data.ptr = pClient;
+					epoll_ctl(iEpoll, EPOLL_CTL_ADD, iFd, &event);
+				}
+			}
+			else
+			{
+				GwClient *pClient = (GwClient *)pSource;
+				uint8_t abBuffer[4096];
+				ssize_t iRead = recv(pClient->iFd, abBuffer, sizeof(abBuffer), MSG_DONTWAIT);
+
+				if (iRead <= 0)
+				{
+					if (iRead == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+					{
+						closed.push_back(pClient);
+					}
+					continue;
+				}
+				pClient->in.insert(pClient->in.end(), abBuffer, abBuffer + iRead);
+				HandleRecords(pClient, gateway);
+			}
+		}
+
+		/* Closed only now, as later events of the pass may still name them */
+		for (size_t i = 0; i < closed.size(); i++)
+		{
+			CloseClient(closed[i], gateway, iEpoll);
+		}
+		if (bInterrupt || gateway.TimeoutMs() == 0)
+		{
+			gateway.Service();
+		}
+		FlushClients(gateway, iEpoll);
+	}
+
+	close(iListen);
+	unlink(pszSocket);
+	delete pBus;
+	return 0;
+}
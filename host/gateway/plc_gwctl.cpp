@@ -0,0 +1,236 @@
+/*
+* File Name: plc_gwctl.cpp
+**
+Description:
+* Command line client of plc_gatewayd.
+**
+Usage:
+* plc_gwctl [--socket path] send <da> <command> [hex payload]
+* plc_gwctl [--socket path] listen
+* plc_gwctl [--socket path] stats
+* plc_gwctl [--socket path] bench [--count 200] [--window 8] [--da 0x10] [--payload 8]
+*
+* <da> is a logical address, or a 16 digit hex physical address. bench keeps --window frames queued at the
+* daemon, then reports the frame rate it achieved and the daemon's own per-frame overhead.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+#include "gw_client.h"
+#include "plc_commands.h"
+
+static const char *pszSocket = GW_DEFAULT_SOCKET;
+
+static double Seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t ParseAddress(const char *psz, uint8_t *pbDA)
+{
+	memset(pbDA, 0, 8);
+	if (strlen(psz) == 16)
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			char acByte[3] = { psz[2 * i], psz[2 * i + 1], 0 };
+			pbDA[i] = (uint8_t)strtoul(acByte, NULL, 16);
+		}
+		return TX_DA_Type_Phy;
+	}
+	pbDA[0] = (uint8_t)strtoul(psz, NULL, 0);
+	return TX_DA_Type_Log;
+}
+
+static void PrintStats(const GwStats &stats)
+{
+	printf("queued %u sent %u no_ack %u no_resp %u lost %u rejected %u biu_timeouts %u\n", stats.dwQueued,
+		stats.dwSent, stats.dwNoAck, stats.dwNoResp, stats.dwLost, stats.dwRejected, stats.dwBiuTimeouts);
+	printf("received %u rx_dropped %u interrupts %u bus_errors %u clients %u queue %u\n",
+		stats.dwReceived, stats.dwRxDropped, stats.dwInterrupts, stats.dwBusErrors, stats.dwClients, stats.dwQueueDepth);
+	printf("overhead per frame: avg %u us, max %u us\n", stats.dwOverheadUsAvg, stats.dwOverheadUsMax);
+}
+
+static int Send(GwConnection &gw, int argc, char **argv)
+{
+	uint8_t abDA[8];
+	uint8_t abData[GW_MAX_PAYLOAD];
+	uint8_t bLength = 0;
+	uint8_t bDAType;
+	int iStatus = -1;
+
+	if (argc < 2)
+	{
+		return 2;
+	}
+	bDAType = ParseAddress(argv[0], abDA);
+	for (const char *psz = argc > 2 ? argv[2] : ""; psz[0] && psz[1] && bLength < GW_MAX_PAYLOAD; psz += 2)
+	{
+		char acByte[3] = { psz[0], psz[1], 0 };
+		abData[bLength++] = (uint8_t)strtoul(acByte, NULL, 16);
+	}
+	gw.onStatus = [&iStatus](uint16_t, uint8_t bStatus) { iStatus = bStatus; };
+	gw.Send(1, bDAType, abDA, (uint8_t)strtoul(argv[1], NULL, 0), abData, bLength);
+	gw.Flush();
+	while (iStatus < 0)
+	{
+		if (gw.Poll(-1) < 0)
+		{
+			return 1;
+		}
+	}
+	printf("status 0x%02x%s\n", iStatus,
+		(iStatus & Status_TX_Data_Sent) ? " sent" : (iStatus == GW_STATUS_LOST) ? " lost" : "");
+	return (iStatus & Status_TX_Data_Sent) ? 0 : 1;
+}
+
+static int Listen(GwConnection &gw)
+{
+	gw.onReceive = [](uint8_t bInfo, const uint8_t *pbSA, uint8_t bCommand, const uint8_t *pbData, uint8_t bLength) {
+		printf("from ");
+		for (int i = 0; i < ((bInfo & RX_SA_Type) ? 8 : 1); i++)
+		{
+			printf("%02x", pbSA[i]);
+		}
+		printf(" cmd 0x%02x len %u:", bCommand, bLength);
+		for (uint8_t i = 0; i < bLength; i++)
+		{
+			printf(" %02x", pbData[i]);
+		}
+		printf("\n");
+		fflush(stdout);
+	};
+	gw.Subscribe(true);
+	gw.Flush();
+	while (gw.Poll(-1) >= 0)
+	{
+	}
+	return 0;
+}
+
+static int Stats(GwConnection &gw)
+{
+	bool bDone = false;
+
+	gw.onStats = [&bDone](const GwStats &stats) { PrintStats(stats); bDone = true; };
+	gw.RequestStats();
+	gw.Flush();
+	while (!bDone)
+	{
+		if (gw.Poll(-1) < 0)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*****************************************************************************
+* Function Name: Bench()
+******************************************************************************
+* Summary:
+* Keep a window of frames queued at the daemon so the modem never idles, and count what comes back
+*****************************************************************************/
+static int Bench(GwConnection &gw, int argc, char **argv)
+{
+	int iCount = 200;
+	int iWindow = 8;
+	int iPayload = 8;
+	uint8_t abDA[8] = { 0x10 };
+	uint8_t abData[GW_MAX_PAYLOAD];
+	int iQueued = 0;
+	int iDone = 0;
+	int iSent = 0;
+	int iEchoes = 0;
+	double dStart;
+	double dSeconds;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		std::string option = argv[i];
+
+		if (option == "--count") iCount = atoi(argv[i + 1]);
+		else if (option == "--window") iWindow = atoi(argv[i + 1]);
+		else if (option == "--da") abDA[0] = (uint8_t)strtoul(argv[i + 1], NULL, 0);
+		else if (option == "--payload") iPayload = atoi(argv[i + 1]);
+		else return 2;
+	}
+	if (iPayload < 0 || iPayload > GW_MAX_PAYLOAD || iWindow < 1)
+	{
+		return 2;
+	}
+	memset(abData, 0xA5, sizeof(abData));
+
+	gw.onStatus = [&iDone, &iSent](uint16_t, uint8_t bStatus) {
+		iDone++;
+		if (bStatus & Status_TX_Data_Sent)
+		{
+			iSent++;
+		}
+	};
+	gw.onReceive = [&iEchoes](uint8_t, const uint8_t *, uint8_t, const uint8_t *, uint8_t) { iEchoes++; };
+	gw.Subscribe(true);
+
+	dStart = Seconds();
+	while (iDone < iCount)
+	{
+		/* Top the window up with one batch */
+		while (iQueued < iCount && iQueued - iDone < iWindow)
+		{
+			gw.Send((uint16_t)iQueued, TX_DA_Type_Log, abDA, CMD_SENDMSG, abData, (uint8_t)iPayload);
+			iQueued++;
+		}
+		if (!gw.Flush() || gw.Poll(1000) < 0)
+		{
+			fprintf(stderr, "plc_gwctl: connection lost\n");
+			return 1;
+		}
+	}
+	dSeconds = Seconds() - dStart;
+
+	/* Give the last echoes a moment, then read the daemon's view */
+	for (double dEnd = Seconds() + 0.5; Seconds() < dEnd; )
+	{
+		gw.Poll(50);
+	}
+	printf("%d frames in %.2f s: %.1f frames/s, %d acknowledged, %d echoes received\n",
+		iCount, dSeconds, iCount / dSeconds, iSent, iEchoes);
+	return Stats(gw);
+}
+
+int main(int argc, char **argv)
+{
+	GwConnection gw;
+	int i = 1;
+	std::string command;
+
+	if (argc > 2 && strcmp(argv[1], "--socket") == 0)
+	{
+		pszSocket = argv[2];
+		i = 3;
+	}
+	if (i >= argc)
+	{
+		fprintf(stderr, "usage: plc_gwctl [--socket path] send|listen|stats|bench ...\n");
+		return 2;
+	}
+	if (!gw.Connect(pszSocket))
+	{
+		perror(pszSocket);
+		return 1;
+	}
+	command = argv[i++];
+	if (command == "send") return Send(gw, argc - i, &argv[i]);
+	if (command == "listen") return Listen(gw);
+	if (command == "stats") return Stats(gw);
+	if (command == "bench") return Bench(gw, argc - i, &argv[i]);
+	fprintf(stderr, "plc_gwctl: unknown command %s\n", command.c_str());
+	return 2;
+}
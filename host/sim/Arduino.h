@@ -0,0 +1,68 @@
+/*
+* File Name: Arduino.h
+**
+Description:
+* Host-side stand-in for the Arduino core, so the PowerComms sources build unmodified against the simulator.
+* Time is the simulator's virtual clock and every call is charged the time it would take on an AVR, so
+* code that busy-waits still lets simulated time advance.
+**
+Note:
+* Only the subset of the core used by the PowerComms sources is provided.
+*/
+
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint16_t word;
+
+#define F_CPU 16000000UL
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+static const uint8_t SDA = A4;
+static const uint8_t SCL = A5;
+
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define _BV(bit) (1 << (bit))
+
+#define PROGMEM
+#define memcpy_P memcpy
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long dwMs);
+void delayMicroseconds(unsigned int wUs);
+
+void pinMode(uint8_t bPin, uint8_t bMode);
+int digitalRead(uint8_t bPin);
+void digitalWrite(uint8_t bPin, uint8_t bValue);
+int analogRead(uint8_t bPin);
+
+long random(long lMax);
+long random(long lMin, long lMax);
+void randomSeed(unsigned long dwSeed);
+
+void noInterrupts(void);
+void interrupts(void);
+
+#endif
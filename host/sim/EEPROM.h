@@ -0,0 +1,30 @@
+/*
+* File Name: EEPROM.h
+**
+Description:
+* Host-side stand-in for the Arduino EEPROM library: 1 KB of cells that start erased (0xFF). As in the AVR
+* library, the instance is static, so it is not shared between translation units.
+*/
+
+#ifndef SIM_EEPROM_H
+#define SIM_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define SIM_EEPROM_SIZE		1024
+
+class EEPROMClass {
+  public:
+    EEPROMClass() { memset(abCell, 0xFF, sizeof(abCell)); }
+    uint8_t read(int iAddress) { return abCell[iAddress & (SIM_EEPROM_SIZE - 1)]; }
+    void write(int iAddress, uint8_t bValue) { abCell[iAddress & (SIM_EEPROM_SIZE - 1)] = bValue; }
+    void update(int iAddress, uint8_t bValue) { write(iAddress, bValue); }
+    uint16_t length(void) { return SIM_EEPROM_SIZE; }
+  private:
+    uint8_t abCell[SIM_EEPROM_SIZE];
+};
+
+static EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,40 @@
+/*
+* File Name: Wire.h
+**
+Description:
+* Host-side stand-in for the Arduino Wire library. Transactions are routed to the simulated devices on the
+* I2C bus of the simulated host that is currently running, and charged 100 kHz bus time.
+**
+Note:
+* The 32 byte transmit and receive buffers of the AVR Wire library are kept, so oversize writes fail the
+* same way they would on the target.
+*/
+
+#ifndef SIM_WIRE_H
+#define SIM_WIRE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BUFFER_LENGTH 32
+
+class TwoWire {
+  public:
+    void begin(void);
+    void end(void);
+    void setClock(uint32_t dwClock);
+    void beginTransmission(uint8_t bAddress);
+    void beginTransmission(int iAddress) { beginTransmission((uint8_t)iAddress); }
+    uint8_t endTransmission(uint8_t bSendStop);
+    uint8_t endTransmission(void) { return endTransmission(1); }
+    uint8_t requestFrom(uint8_t bAddress, uint8_t bQuantity);
+    uint8_t requestFrom(int iAddress, int iQuantity) { return requestFrom((uint8_t)iAddress, (uint8_t)iQuantity); }
+    size_t write(uint8_t bData);
+    size_t write(const uint8_t *pbData, size_t wLength);
+    int available(void);
+    int read(void);
+};
+
+extern TwoWire Wire;
+
+#endif
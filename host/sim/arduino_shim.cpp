@@ -0,0 +1,327 @@
+#include "Arduino.h"
+#include "Wire.h"
+#include "plc_sim.h"
+
+#define SIM_I2C_BYTE_US		90		/* 9 bit clocks at 100 kHz */
+#define SIM_PIN_READ_US		2
+#define SIM_ADC_US			112
+
+TwoWire Wire;
+
+static std::mt19937 mainRng;
+
+static SimKernel &Kernel(void)
+{
+	return *SimKernel::pActive;
+}
+
+static SimHost *Host(void)
+{
+	return (SimKernel::pCurrent != NULL) ? SimKernel::pCurrent->pHost : NULL;
+}
+
+/* Any call other than an interrupt line read ends a spin on that line */
+static void EndSpin(void)
+{
+	if (SimKernel::pCurrent != NULL)
+	{
+		SimKernel::pCurrent->bSpinPin = 0xFF;
+	}
+}
+
+static std::mt19937 &Rng(void)
+{
+	return (SimKernel::pCurrent != NULL) ? SimKernel::pCurrent->rng : mainRng;
+}
+
+unsigned long millis(void)
+{
+	EndSpin();
+	return (unsigned long)(Kernel().Now() / 1000);
+}
+
+unsigned long micros(void)
+{
+	EndSpin();
+	return (unsigned long)Kernel().Now();
+}
+
+void delay(unsigned long dwMs)
+{
+	EndSpin();
+	Kernel().SleepUntil(Kernel().Now() + (uint64_t)dwMs * 1000);
+}
+
+void delayMicroseconds(unsigned int wUs)
+{
+	EndSpin();
+	Kernel().Charge(wUs);
+}
+
+void pinMode(uint8_t, uint8_t)
+{
+	EndSpin();
+}
+
+/*****************************************************************************
+* Function Name: digitalRead()
+******************************************************************************
+* Summary:
+* Read a pin of the running host, following the HOST_INT line of any chip wired to it
+**
+Note:
+* Two reads in a row of the same deasserted interrupt line are taken to be a busy-wait on it, and the task
+* is blocked until the line asserts instead of being charged for every iteration.
+*****************************************************************************/
+int digitalRead(uint8_t bPin)
+{
+	SimHost *pHost = Host();
+	SimTask *pTask = SimKernel::pCurrent;
+	SimChip *pChip;
+
+	if (pHost == NULL)
+	{
+		return HIGH;
+	}
+	pChip = pHost->IntChip(bPin);
+	if (pChip == NULL)
+	{
+		EndSpin();
+		Kernel().Charge(SIM_PIN_READ_US);
+		return pHost->abPin[bPin & 63];
+	}
+	if (pChip->IntAsserted())
+	{
+		pTask->bSpinPin = 0xFF;
+		return pChip->IntLevel();
+	}
+	if (pTask->bSpinPin == bPin)
+	{
+		Kernel().WaitIrq(SIM_FOREVER);
+	}
+	else
+	{
+		pTask->bSpinPin = bPin;
+		Kernel().Charge(SIM_PIN_READ_US);
+	}
+	return pChip->IntLevel();
+}
+
+void digitalWrite(uint8_t bPin, uint8_t bValue)
+{
+	SimHost *pHost = Host();
+
+	EndSpin();
+	if (pHost != NULL)
+	{
+		pHost->abPin[bPin & 63] = bValue ? 1 : 0;
+	}
+}
+
+int analogRead(uint8_t)
+{
+	EndSpin();
+	Kernel().Charge(SIM_ADC_US);
+	return (int)(Rng()() & 0x3FF);
+}
+
+long random(long lMax)
+{
+	return random(0, lMax);
+}
+
+long random(long lMin, long lMax)
+{
+	EndSpin();
+	if (lMax <= lMin)
+	{
+		return lMin;
+	}
+	return lMin + (long)(Rng()() % (unsigned long)(lMax - lMin));
+}
+
+void randomSeed(unsigned long dwSeed)
+{
+	Rng().seed(dwSeed);
+}
+
+void noInterrupts(void)
+{
+}
+
+void interrupts(void)
+{
+}
+
+void SimIdle(uint64_t qwDeadline)
+{
+	SimHost *pHost = Host();
+
+	EndSpin();
+	if (pHost == NULL || pHost->IntPending())
+	{
+		return;
+	}
+	Kernel().WaitIrq(qwDeadline);
+}
+
+/*****************************************************************************
+* TwoWire
+*****************************************************************************/
+static bool Fault(SimHost *pHost)
+{
+	return pHost->dI2CFaultRate > 0 && std::uniform_real_distribution<double>(0.0, 1.0)(Rng()) < pHost->dI2CFaultRate;
+}
+
+void TwoWire::begin(void)
+{
+	EndSpin();
+}
+
+void TwoWire::end(void)
+{
+	EndSpin();
+}
+
+void TwoWire::setClock(uint32_t)
+{
+}
+
+void TwoWire::beginTransmission(uint8_t bAddress)
+{
+	SimHost *pHost = Host();
+
+	EndSpin();
+	if (pHost != NULL)
+	{
+		pHost->bTxAddress = bAddress;
+		pHost->bTxLength = 0;
+	}
+}
+
+size_t TwoWire::write(uint8_t bData)
+{
+	SimHost *pHost = Host();
+
+	if (pHost == NULL || pHost->bTxLength >= BUFFER_LENGTH)
+	{
+		return 0;
+	}
+	pHost->abTxBuffer[pHost->bTxLength++] = bData;
+	return 1;
+}
+
+size_t TwoWire::write(const uint8_t *pbData, size_t wLength)
+{
+	size_t i;
+
+	for (i = 0; i < wLength; i++)
+	{
+		if (!write(pbData[i]))
+		{
+			break;
+		}
+	}
+	return i;
+}
+
+/*****************************************************************************
+* Function Name: TwoWire::endTransmission()
+******************************************************************************
+* Summary:
+* Deliver the buffered write to the addressed chip
+**
+Return:
+* 0 on success, 2 when no device acknowledges the address, 4 outside of a simulated host
+**
+Note:
+* With SimHost::dI2CFaultRate set, a transaction may fail with a data NACK (3) without reaching the chip.
+*****************************************************************************/
+uint8_t TwoWire::endTransmission(uint8_t)
+{
+	SimHost *pHost = Host();
+	SimChip *pChip;
+
+	EndSpin();
+	if (pHost == NULL)
+	{
+		return 4;
+	}
+	Kernel().Charge((pHost->bTxLength + 1) * SIM_I2C_BYTE_US);
+	pChip = pHost->I2CDevice(pHost->bTxAddress);
+	if (pChip == NULL || !pChip->Ready())
+	{
+		return 2;
+	}
+	if (Fault(pHost))
+	{
+		return 3;
+	}
+	pChip->I2CWrite(pHost->abTxBuffer, pHost->bTxLength);
+	return 0;
+}
+
+/*****************************************************************************
+* Function Name: TwoWire::requestFrom()
+******************************************************************************
+* Summary:
+* Read from the addressed chip into the receive buffer
+**
+Return:
+* Number of bytes read
+**
+Note:
+* An injected fault either NACKs the address, or cuts the read short after the chip has been read, so a
+* clear-on-read register loses its contents as it would on a real bus.
+*****************************************************************************/
+uint8_t TwoWire::requestFrom(uint8_t bAddress, uint8_t bQuantity)
+{
+	SimHost *pHost = Host();
+	SimChip *pChip;
+
+	EndSpin();
+	if (pHost == NULL)
+	{
+		return 0;
+	}
+	if (bQuantity > BUFFER_LENGTH)
+	{
+		bQuantity = BUFFER_LENGTH;
+	}
+	Kernel().Charge((bQuantity + 1) * SIM_I2C_BYTE_US);
+	pHost->bRxLength = 0;
+	pHost->bRxIndex = 0;
+	pChip = pHost->I2CDevice(bAddress);
+	if (pChip == NULL || !pChip->Ready())
+	{
+		return 0;
+	}
+	if (Fault(pHost) && (Rng()() & 1))
+	{
+		return 0;
+	}
+	pHost->bRxLength = pChip->I2CRead(pHost->abRxBuffer, bQuantity);
+	if (pHost->bRxLength > 0 && Fault(pHost))
+	{
+		pHost->bRxLength--;
+	}
+	return pHost->bRxLength;
+}
+
+int TwoWire::available(void)
+{
+	SimHost *pHost = Host();
+
+	return (pHost == NULL) ? 0 : (pHost->bRxLength - pHost->bRxIndex);
+}
+
+int TwoWire::read(void)
+{
+	SimHost *pHost = Host();
+
+	if (pHost == NULL || pHost->bRxIndex >= pHost->bRxLength)
+	{
+		return -1;
+	}
+	return pHost->abRxBuffer[pHost->bRxIndex++];
+}
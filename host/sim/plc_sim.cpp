@@ -0,0 +1,649 @@
+#include "plc_sim.h"
+#include "plc_commands.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+static const uint32_t adwBitRate[4] = { 600, 1200, 1800, 2400 };
+static const uint32_t adwTxDelayMs[4] = { 7, 13, 19, 25 };
+
+static uint32_t dwFrameSequence = 0;
+
+/*****************************************************************************
+* SimHost
+*****************************************************************************/
+SimHost::SimHost() : pTask(NULL), dI2CFaultRate(0.0), bTxAddress(0), bTxLength(0), bRxLength(0), bRxIndex(0)
+{
+	/* Unconnected inputs read high, as with INPUT_PULLUP */
+	memset(abPin, 1, sizeof(abPin));
+}
+
+void SimHost::AttachI2C(uint8_t bAddress, SimChip *pChip)
+{
+	i2c[bAddress] = pChip;
+}
+
+void SimHost::AttachInt(uint8_t bPin, SimChip *pChip)
+{
+	ints[bPin] = pChip;
+}
+
+SimChip *SimHost::I2CDevice(uint8_t bAddress)
+{
+	std::map<uint8_t, SimChip *>::iterator it = i2c.find(bAddress);
+	return (it == i2c.end()) ? NULL : it->second;
+}
+
+SimChip *SimHost::IntChip(uint8_t bPin)
+{
+	std::map<uint8_t, SimChip *>::iterator it = ints.find(bPin);
+	return (it == ints.end()) ? NULL : it->second;
+}
+
+bool SimHost::IntPending(void)
+{
+	for (std::map<uint8_t, SimChip *>::iterator it = ints.begin(); it != ints.end(); ++it)
+	{
+		if (it->second->IntAsserted())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/*****************************************************************************
+* SimMedium
+*****************************************************************************/
+SimMedium::SimMedium(SimKernel &kernel, const SimMediumConfig &config, uint32_t dwSeed)
+	: kernel(kernel), config(config), rng(dwSeed), qwBusySince(0), qwLastEnd(0)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+/*****************************************************************************
+* Function Name: SimMedium::Attach()
+******************************************************************************
+* Summary:
+* Plug a chip into the line, drawing its noise floor and its attenuation to every other chip
+*****************************************************************************/
+void SimMedium::Attach(SimChip *pChip)
+{
+	std::uniform_real_distribution<double> spread(-config.dNoiseSpread, config.dNoiseSpread);
+	std::uniform_real_distribution<double> path(config.dAttenMin, config.dAttenMax);
+	size_t n = chips.size();
+
+	pChip->dwIndex = (uint32_t)n;
+	chips.push_back(pChip);
+	noise.push_back(config.dNoiseFloor + spread(rng));
+	for (size_t i = 0; i < n; i++)
+	{
+		atten[i].push_back(path(rng));
+	}
+	atten.push_back(std::vector<double>(n + 1, 0.0));
+	for (size_t i = 0; i < n; i++)
+	{
+		atten[n][i] = atten[i][n];
+	}
+}
+
+double SimMedium::Level(SimChip *pFrom, SimChip *pTo)
+{
+	return pFrom->TxLevel() - atten[pFrom->dwIndex][pTo->dwIndex];
+}
+
+double SimMedium::Noise(SimChip *pChip)
+{
+	return noise[pChip->dwIndex];
+}
+
+bool SimMedium::Transmitting(SimChip *pChip)
+{
+	for (size_t i = 0; i < active.size(); i++)
+	{
+		if (active[i]->pSource == pChip)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/*****************************************************************************
+* Function Name: SimMedium::Busy()
+******************************************************************************
+* Summary:
+* Band-in-use as sensed by pChip at the current time
+**
+Note:
+* A carrier only counts once it has been on for the sense latency, which is what lets two nodes that
+* start close together collide.
+*****************************************************************************/
+bool SimMedium::Busy(SimChip *pChip)
+{
+	uint64_t qwNow = kernel.Now();
+	double dThreshold = pChip->BiuLevel();
+
+	if (Noise(pChip) > dThreshold)
+	{
+		return true;
+	}
+	if (qwLastEnd != 0 && qwNow - qwLastEnd < config.dwInterFrameUs)
+	{
+		return true;
+	}
+	for (size_t i = 0; i < active.size(); i++)
+	{
+		Carrier *pCarrier = active[i];
+		uint64_t qwSense = (uint64_t)config.dwSenseBits * 1000000 / pCarrier->pSource->BitRate();
+
+		if (pCarrier->pSource == pChip)
+		{
+			return true;
+		}
+		if (qwNow - pCarrier->qwStart >= qwSense && Level(pCarrier->pSource, pChip) > dThreshold)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/*****************************************************************************
+* Function Name: SimMedium::Transmit()
+******************************************************************************
+* Summary:
+* Put a frame on the line for qwAirtime us
+*****************************************************************************/
+void SimMedium::Transmit(SimChip *pChip, const SimFrame &frame, uint64_t qwAirtime)
+{
+	Carrier *pCarrier = new Carrier();
+	uint64_t qwNow = kernel.Now();
+
+	pCarrier->pSource = pChip;
+	pCarrier->frame = frame;
+	pCarrier->qwStart = qwNow;
+	pCarrier->qwEnd = qwNow + qwAirtime;
+	for (size_t i = 0; i < active.size(); i++)
+	{
+		active[i]->overlaps.push_back(pChip);
+		pCarrier->overlaps.push_back(active[i]->pSource);
+	}
+	if (active.empty())
+	{
+		qwBusySince = qwNow;
+	}
+	active.push_back(pCarrier);
+	if (frame.bAck)
+	{
+		stats.qwAcks++;
+	}
+	else
+	{
+		stats.qwFrames++;
+	}
+	kernel.At(pCarrier->qwEnd, [this, pCarrier]() { End(pCarrier); });
+}
+
+/*****************************************************************************
+* Function Name: SimMedium::End()
+******************************************************************************
+* Summary:
+* Carrier off: decide at every receiver whether the frame survived, then tell the sender
+*****************************************************************************/
+void SimMedium::End(Carrier *pCarrier)
+{
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	SimChip *pSource = pCarrier->pSource;
+	uint64_t qwBits = (pCarrier->qwEnd - pCarrier->qwStart) * pSource->BitRate() / 1000000;
+
+	active.erase(std::find(active.begin(), active.end(), pCarrier));
+	qwLastEnd = kernel.Now();
+	if (active.empty())
+	{
+		stats.qwBusyUs += kernel.Now() - qwBusySince;
+	}
+	if (!pCarrier->overlaps.empty())
+	{
+		stats.qwCollided++;
+	}
+
+	for (size_t r = 0; r < chips.size(); r++)
+	{
+		SimChip *pRx = chips[r];
+		double dLevel;
+		double dSnr;
+		double dBer;
+		bool bIntact = true;
+
+		if (pRx == pSource)
+		{
+			continue;
+		}
+		dLevel = Level(pSource, pRx);
+		if (dLevel < pRx->Sensitivity())
+		{
+			continue;
+		}
+		for (size_t i = 0; i < pCarrier->overlaps.size(); i++)
+		{
+			SimChip *pOther = pCarrier->overlaps[i];
+			if (pOther == pRx || Level(pOther, pRx) >= pRx->Sensitivity())
+			{
+				bIntact = false;
+			}
+		}
+		if (bIntact)
+		{
+			/* Non-coherent FSK, with the longer symbols of the slower rates and the wider deviation as gain */
+			dSnr = dLevel - Noise(pRx) + 10.0 * log10(2400.0 / pSource->BitRate());
+			if (pSource->abReg[Modem_Config] & Modem_FSKBW_3M)
+			{
+				dSnr += 1.5;
+			}
+			dBer = 0.5 * exp(-pow(10.0, dSnr / 10.0) / 2.0);
+			if (uniform(rng) > pow(1.0 - dBer, (double)qwBits) || uniform(rng) < config.dLossRate)
+			{
+				bIntact = false;
+			}
+		}
+		pRx->OnReceive(pCarrier->frame, bIntact);
+	}
+	pSource->OnTransmitted(pCarrier->frame);
+	delete pCarrier;
+}
+
+/*****************************************************************************
+* SimChip
+*****************************************************************************/
+SimChip::SimChip(SimMedium &medium, SimHost *pHost, uint8_t bI2CAddress, uint8_t bIntPin, uint8_t bLogicalAddress, uint64_t qwPhysical)
+	: qwReadyUs(0), dwIndex(0), medium(medium), pHost(pHost), bOffset(0), eTxState(TX_IDLE), bRetriesLeft(0), qwBiuStart(0), qwAckGeneration(0)
+{
+	memset(abReg, 0, sizeof(abReg));
+	memset(&stats, 0, sizeof(stats));
+	memset(&txFrame, 0, sizeof(txFrame));
+	abReg[Local_LA_LSB] = bLogicalAddress;
+	for (int i = 0; i < 8; i++)
+	{
+		abReg[Local_PA + i] = (uint8_t)(qwPhysical >> (8 * (7 - i)));
+	}
+	abReg[Local_FW] = SIM_FW_VERSION;
+	abReg[Modem_Config] = Modem_TXDelay_7ms | Modem_FSKBW_3M | Modem_BPS_2400;
+	abReg[TX_Gain] = 0x0B;
+	abReg[RX_Gain] = 0x03;
+	if (pHost != NULL)
+	{
+		pHost->AttachI2C(bI2CAddress, this);
+		pHost->AttachInt(bIntPin, this);
+	}
+	medium.Attach(this);
+}
+
+bool SimChip::Ready(void) const
+{
+	return medium.kernel.Now() >= qwReadyUs;
+}
+
+uint32_t SimChip::BitRate(void) const
+{
+	return adwBitRate[abReg[Modem_Config] & Modem_BPS];
+}
+
+uint64_t SimChip::Airtime(const SimFrame &frame) const
+{
+	uint32_t dwBytes;
+
+	if (frame.bAck)
+	{
+		dwBytes = SIM_ACK_BYTES;
+	}
+	else
+	{
+		dwBytes = SIM_FRAME_OVERHEAD + frame.bLength;
+		dwBytes += (frame.bSAType == TX_SA_Type_Phy) ? 8 : 1;
+		dwBytes += (frame.bDAType == TX_DA_Type_Phy) ? 8 : 1;
+	}
+	return (uint64_t)adwTxDelayMs[(abReg[Modem_Config] & Modem_TXDelay) >> 5] * 1000 + (uint64_t)dwBytes * 8 * 1000000 / BitRate();
+}
+
+double SimChip::TxLevel(void) const
+{
+	return 80.0 + 2.0 * (abReg[TX_Gain] & TX_Gain_Mask);
+}
+
+double SimChip::Sensitivity(void) const
+{
+	return 70.0 - 3.0 * (abReg[RX_Gain] & RX_Gain_Mask);
+}
+
+double SimChip::BiuLevel(void) const
+{
+	return 70.0 + 3.0 * (abReg[Threshold_Noise] & BIU_Threshold_Mask);
+}
+
+bool SimChip::IntAsserted(void) const
+{
+	return (abReg[INT_Status] & abReg[INT_Enable] & 0x3F) != 0;
+}
+
+uint8_t SimChip::IntLevel(void) const
+{
+	return (IntAsserted() ? 1 : 0) ^ ((abReg[INT_Enable] & INT_Polarity) ? 1 : 0);
+}
+
+void SimChip::SetStatus(uint8_t bStatus)
+{
+	abReg[INT_Status] |= bStatus;
+	if (IntAsserted() && pHost != NULL)
+	{
+		if (pHost->onInt)
+		{
+			pHost->onInt(this);
+		}
+		else
+		{
+			medium.kernel.Wake(pHost->pTask);
+		}
+	}
+}
+
+/*****************************************************************************
+* Function Name: SimChip::I2CWrite()
+******************************************************************************
+* Summary:
+* One I2C write transaction: the register offset followed by data written with auto-increment
+*****************************************************************************/
+bool SimChip::I2CWrite(const uint8_t *pbData, uint8_t bLength)
+{
+	bool bSend = false;
+
+	if (bLength == 0)
+	{
+		return true;
+	}
+	bOffset = pbData[0] & (SIM_REG_SIZE - 1);
+	for (uint8_t i = 1; i < bLength; i++)
+	{
+		if (bOffset != Local_FW && bOffset != INT_Status)
+		{
+			abReg[bOffset] = pbData[i];
+		}
+		if (bOffset == TX_Message_Length && (pbData[i] & Send_Message))
+		{
+			bSend = true;
+		}
+		bOffset = (bOffset + 1) & (SIM_REG_SIZE - 1);
+	}
+	if (bSend)
+	{
+		StartTransmit();
+	}
+	return true;
+}
+
+/*****************************************************************************
+* Function Name: SimChip::I2CRead()
+******************************************************************************
+* Summary:
+* One I2C read transaction from the current register pointer, with auto-increment
+**
+Note:
+* Reading INT_Status clears it, which releases HOST_INT.
+*****************************************************************************/
+uint8_t SimChip::I2CRead(uint8_t *pbData, uint8_t bLength)
+{
+	for (uint8_t i = 0; i < bLength; i++)
+	{
+		pbData[i] = abReg[bOffset];
+		if (bOffset == INT_Status)
+		{
+			abReg[INT_Status] = 0;
+		}
+		bOffset = (bOffset + 1) & (SIM_REG_SIZE - 1);
+	}
+	return bLength;
+}
+
+/*****************************************************************************
+* Function Name: SimChip::StartTransmit()
+******************************************************************************
+* Summary:
+* Send_Message was set: latch the TX registers into a frame and contend for the line
+*****************************************************************************/
+void SimChip::StartTransmit(void)
+{
+	uint8_t bConfig = abReg[TX_Config];
+
+	stats.qwTxRequests++;
+	if (eTxState != TX_IDLE)
+	{
+		return;
+	}
+	if (!(abReg[PLC_Mode] & TX_Enable))
+	{
+		FinishTransmit(Status_UnableToTX);
+		return;
+	}
+
+	memset(&txFrame, 0, sizeof(txFrame));
+	txFrame.pSource = this;
+	txFrame.bAck = false;
+	txFrame.bSAType = bConfig & TX_SA_Type;
+	if (txFrame.bSAType == TX_SA_Type_Phy)
+	{
+		memcpy(txFrame.abSA, &abReg[Local_PA], 8);
+	}
+	else
+	{
+		txFrame.abSA[0] = abReg[Local_LA_LSB];
+	}
+	txFrame.bDAType = bConfig & TX_DA_Type;
+	memcpy(txFrame.abDA, &abReg[TX_DA], 8);
+	txFrame.bNeedAck = (bConfig & TX_Service_Type) && txFrame.bDAType != TX_DA_Type_Grp;
+	txFrame.bCommand = abReg[TX_CommandID];
+	txFrame.bLength = abReg[TX_Message_Length] & Payload_Length_MASK;
+	if (txFrame.bLength > 31)
+	{
+		txFrame.bLength = 31;
+	}
+	memcpy(txFrame.abData, &abReg[TX_Data], txFrame.bLength);
+	txFrame.dwSequence = ++dwFrameSequence;
+
+	bRetriesLeft = bConfig & TX_Retry;
+	qwBiuStart = medium.kernel.Now();
+	eTxState = TX_WAIT_BIU;
+	TryAccess();
+}
+
+/*****************************************************************************
+* Function Name: SimChip::TryAccess()
+******************************************************************************
+* Summary:
+* Start the frame if the band is free, otherwise back off or give up with Status_UnableToTX
+*****************************************************************************/
+void SimChip::TryAccess(void)
+{
+	uint64_t qwNow = medium.kernel.Now();
+	uint64_t qwBit = 1000000 / BitRate();
+
+	if (eTxState != TX_WAIT_BIU)
+	{
+		return;
+	}
+	if ((abReg[PLC_Mode] & Disable_BIU) || !medium.Busy(this))
+	{
+		eTxState = TX_SENDING;
+		medium.Transmit(this, txFrame, Airtime(txFrame));
+		return;
+	}
+	stats.qwBiuBackoffs++;
+	if (qwNow - qwBiuStart >= (uint64_t)medium.config.dwBiuTimeoutMs * 1000)
+	{
+		FinishTransmit(Status_UnableToTX);
+		return;
+	}
+	std::uniform_int_distribution<uint64_t> backoff(qwBit, 16 * qwBit);
+	medium.kernel.At(qwNow + backoff(medium.rng), [this]() { TryAccess(); });
+}
+
+void SimChip::FinishTransmit(uint8_t bStatus)
+{
+	eTxState = TX_IDLE;
+	abReg[TX_Message_Length] &= ~Send_Message;
+	if (bStatus & Status_TX_Data_Sent)
+	{
+		stats.qwTxSent++;
+	}
+	if (bStatus & Status_TX_NO_ACK)
+	{
+		stats.qwNoAck++;
+	}
+	if (bStatus & Status_UnableToTX)
+	{
+		stats.qwUnableToTX++;
+	}
+	SetStatus(bStatus);
+}
+
+/*****************************************************************************
+* Function Name: SimChip::OnTransmitted()
+******************************************************************************
+* Summary:
+* Our carrier went off: complete an unacknowledged frame or start waiting for the ACK
+*****************************************************************************/
+void SimChip::OnTransmitted(const SimFrame &frame)
+{
+	uint64_t qwAckWait;
+	uint64_t qwGeneration;
+	SimFrame ack;
+
+	if (frame.bAck || eTxState != TX_SENDING)
+	{
+		return;
+	}
+	if (!txFrame.bNeedAck)
+	{
+		FinishTransmit(Status_TX_Data_Sent);
+		return;
+	}
+
+	memset(&ack, 0, sizeof(ack));
+	ack.bAck = true;
+	qwAckWait = medium.config.dwTurnaroundUs + Airtime(ack) + 2 * 8 * 1000000 / BitRate();
+	qwGeneration = ++qwAckGeneration;
+	eTxState = TX_WAIT_ACK;
+	medium.kernel.At(medium.kernel.Now() + qwAckWait, [this, qwGeneration]() {
+		if (qwGeneration != qwAckGeneration || eTxState != TX_WAIT_ACK)
+		{
+			return;
+		}
+		if (bRetriesLeft)
+		{
+			bRetriesLeft--;
+			stats.qwRetries++;
+			qwBiuStart = medium.kernel.Now();
+			eTxState = TX_WAIT_BIU;
+			TryAccess();
+		}
+		else
+		{
+			FinishTransmit(Status_TX_NO_ACK);
+		}
+	});
+}
+
+bool SimChip::Addressed(const SimFrame &frame, bool *pbUnicast) const
+{
+	*pbUnicast = false;
+	if (frame.bDAType == TX_DA_Type_Grp)
+	{
+		return frame.abDA[0] == abReg[Local_Group];
+	}
+	*pbUnicast = true;
+	if (frame.bDAType == TX_DA_Type_Phy)
+	{
+		return memcmp(frame.abDA, &abReg[Local_PA], 8) == 0;
+	}
+	return frame.abDA[0] == abReg[Local_LA_LSB];
+}
+
+/*****************************************************************************
+* Function Name: SimChip::OnReceive()
+******************************************************************************
+* Summary:
+* An audible frame ended: match ACKs, answer acknowledged frames and fill the RX buffer
+*****************************************************************************/
+void SimChip::OnReceive(const SimFrame &frame, bool bIntact)
+{
+	bool bUnicast;
+	bool bAddressed;
+	uint8_t bInfo;
+
+	if (!bIntact)
+	{
+		stats.qwRxCorrupted++;
+		return;
+	}
+	bAddressed = Addressed(frame, &bUnicast);
+
+	if (frame.bAck)
+	{
+		if (bAddressed && eTxState == TX_WAIT_ACK && frame.dwSequence == txFrame.dwSequence)
+		{
+			qwAckGeneration++;
+			FinishTransmit(Status_TX_Data_Sent);
+		}
+		return;
+	}
+	if (!(abReg[PLC_Mode] & RX_Enable))
+	{
+		return;
+	}
+
+	if (bAddressed && bUnicast && frame.bNeedAck)
+	{
+		SimFrame ack;
+
+		memset(&ack, 0, sizeof(ack));
+		ack.pSource = this;
+		ack.bAck = true;
+		ack.bSAType = TX_SA_Type_Log;
+		ack.abSA[0] = abReg[Local_LA_LSB];
+		ack.bDAType = (frame.bSAType == TX_SA_Type_Phy) ? TX_DA_Type_Phy : TX_DA_Type_Log;
+		memcpy(ack.abDA, frame.abSA, 8);
+		ack.dwSequence = frame.dwSequence;
+		medium.kernel.At(medium.kernel.Now() + medium.config.dwTurnaroundUs, [this, ack]() {
+			if (!medium.Transmitting(this))
+			{
+				medium.Transmit(this, ack, Airtime(ack));
+			}
+		});
+	}
+
+	if (!bAddressed && !(abReg[PLC_Mode] & Promiscuous_MASK))
+	{
+		return;
+	}
+	if ((abReg[RX_Message_INFO] & New_RX_Msg) && !(abReg[PLC_Mode] & RX_Override))
+	{
+		stats.qwRxDropped++;
+		SetStatus(Status_RX_Packet_Dropped);
+		return;
+	}
+
+	bInfo = New_RX_Msg | (frame.bLength & RX_Msg_Length);
+	if (frame.bDAType == TX_DA_Type_Grp)
+	{
+		bInfo |= RX_DA_GROUP;
+	}
+	if (frame.bSAType == TX_SA_Type_Phy)
+	{
+		bInfo |= RX_SA_PHY;
+	}
+	abReg[RX_Message_INFO] = bInfo;
+	memcpy(&abReg[RX_SA], frame.abSA, 8);
+	abReg[RX_CommandID] = frame.bCommand;
+	memcpy(&abReg[RX_Data], frame.abData, frame.bLength);
+	stats.qwRxFrames++;
+	SetStatus(Status_RX_Data_Available);
+}
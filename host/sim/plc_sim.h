@@ -0,0 +1,201 @@
+/*
+* File Name: plc_sim.h
+**
+Description:
+* Simulated CY8CPLC10 devices sharing one powerline medium, and the simulated MCUs that drive them.
+**
+Model:
+* - Airtime of a frame is the Modem_Config TX delay plus its bytes at the Modem_Config bit rate. A data frame
+*   carries SIM_FRAME_OVERHEAD bytes on top of the payload and the address bytes, an ACK SIM_ACK_BYTES.
+* - Levels are in dBuV. A transmitter puts out 80 + 2 * TX_Gain, each pair of nodes sees a fixed random
+*   attenuation, each node a fixed noise floor. A frame is heard when its level reaches the receiver's
+*   sensitivity of 70 - 3 * RX_Gain, and decoded with the non-coherent FSK bit error rate of its SNR.
+* - Band-in-use is sensed when the noise or a carrier that has been on for SenseBits bit times exceeds the
+*   Threshold_Noise level of 70 + 3 * threshold. The chip backs off at random while the band is in use and
+*   reports Status_UnableToTX once BiuTimeoutMs has passed. The band also counts as in use for InterFrameUs
+*   after any carrier ends, which keeps the slot for the ACK clear.
+* - Any other audible carrier overlapping a frame at a receiver destroys it there (no capture effect).
+* - Acknowledged unicast frames are answered by an ACK after TurnaroundUs. A missing ACK is retried
+*   TX_Retry times, each retry going through band-in-use again, before Status_TX_NO_ACK is reported.
+* - The RX buffer holds one frame. A new frame overwrites it only with RX_Override, otherwise it is dropped
+*   with Status_RX_Packet_Dropped. INT_Status is cleared when read and HOST_INT follows INT_Status & INT_Enable.
+* - The chip does not answer on I2C until qwReadyUs, which models its power up time.
+* These figures are modelling assumptions, not datasheet values; they are all in SimMediumConfig.
+*/
+
+#ifndef PLC_SIM_H
+#define PLC_SIM_H
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <random>
+#include <functional>
+#include "sim_kernel.h"
+
+#define SIM_FRAME_OVERHEAD	7		/* Preamble, start of packet, control, command ID, length, 2 byte CRC */
+#define SIM_ACK_BYTES		6
+#define SIM_REG_SIZE		0x80
+#define SIM_FW_VERSION		0x21
+
+class SimChip;
+class SimMedium;
+
+struct SimMediumConfig {
+    double dNoiseFloor;			/* Mean noise floor, dBuV */
+    double dNoiseSpread;		/* Each node's floor is drawn uniformly within +/- this */
+    double dAttenMin;			/* Pairwise attenuation range, dB */
+    double dAttenMax;
+    double dLossRate;			/* Extra random loss applied to every reception, 0..1 */
+    uint32_t dwBiuTimeoutMs;
+    uint32_t dwSenseBits;		/* Carrier detect latency, in bit times */
+    uint32_t dwTurnaroundUs;	/* Gap between the end of a frame and its ACK */
+    uint32_t dwInterFrameUs;	/* Quiet time after a carrier before the band counts as free */
+
+    SimMediumConfig() : dNoiseFloor(60.0), dNoiseSpread(3.0), dAttenMin(10.0), dAttenMax(30.0), dLossRate(0.0),
+        dwBiuTimeoutMs(700), dwSenseBits(2), dwTurnaroundUs(2000), dwInterFrameUs(4000) {}
+};
+
+struct SimFrame {
+    SimChip *pSource;
+    bool bAck;				/* ACK frames carry no payload and only bSequence */
+    bool bNeedAck;
+    uint8_t bSAType;		/* TX_SA_Type_Log / TX_SA_Type_Phy */
+    uint8_t abSA[8];
+    uint8_t bDAType;		/* TX_DA_Type_Log / _Grp / _Phy */
+    uint8_t abDA[8];
+    uint8_t bCommand;
+    uint8_t bLength;
+    uint8_t abData[32];
+    uint32_t dwSequence;	/* Matches an ACK to the frame it acknowledges */
+};
+
+struct SimMediumStats {
+    uint64_t qwFrames;			/* Data frames put on the line, retries included */
+    uint64_t qwAcks;
+    uint64_t qwCollided;		/* Frames that overlapped another carrier */
+    uint64_t qwBusyUs;			/* Time with at least one carrier on */
+};
+
+/* A simulated MCU: its I2C bus, its pins and the task running its firmware, or an interrupt handler run on
+ * the kernel thread for hosts that live outside the simulation */
+class SimHost {
+  public:
+    SimHost();
+    void AttachI2C(uint8_t bAddress, SimChip *pChip);
+    void AttachInt(uint8_t bPin, SimChip *pChip);
+    SimChip *I2CDevice(uint8_t bAddress);
+    SimChip *IntChip(uint8_t bPin);
+    bool IntPending(void);
+
+    SimTask *pTask;
+    std::function<void(SimChip *)> onInt;	/* Called instead of waking pTask when a HOST_INT asserts */
+    uint8_t abPin[64];			/* Level of the pins that are not wired to a chip */
+    double dI2CFaultRate;		/* Chance of each I2C transaction failing, 0..1 */
+
+    /* Wire library state */
+    uint8_t bTxAddress;
+    uint8_t abTxBuffer[32];
+    uint8_t bTxLength;
+    uint8_t abRxBuffer[32];
+    uint8_t bRxLength;
+    uint8_t bRxIndex;
+  private:
+    std::map<uint8_t, SimChip *> i2c;
+    std::map<uint8_t, SimChip *> ints;
+};
+
+class SimMedium {
+  public:
+    SimMedium(SimKernel &kernel, const SimMediumConfig &config, uint32_t dwSeed);
+    void Attach(SimChip *pChip);
+    bool Busy(SimChip *pChip);
+    void Transmit(SimChip *pChip, const SimFrame &frame, uint64_t qwAirtime);
+    double Level(SimChip *pFrom, SimChip *pTo);
+    double Noise(SimChip *pChip);
+    bool Transmitting(SimChip *pChip);
+
+    SimKernel &kernel;
+    SimMediumConfig config;
+    SimMediumStats stats;
+    std::mt19937 rng;
+  private:
+    struct Carrier {
+      SimChip *pSource;
+      SimFrame frame;
+      uint64_t qwStart;
+      uint64_t qwEnd;
+      std::vector<SimChip *> overlaps;
+    };
+
+    void End(Carrier *pCarrier);
+
+    std::vector<SimChip *> chips;
+    std::vector<double> noise;
+    std::vector<std::vector<double> > atten;
+    std::vector<Carrier *> active;
+    uint64_t qwBusySince;
+    uint64_t qwLastEnd;			/* End of the last carrier heard anywhere on the line */
+};
+
+struct SimChipStats {
+    uint64_t qwTxRequests;
+    uint64_t qwTxSent;
+    uint64_t qwNoAck;
+    uint64_t qwUnableToTX;
+    uint64_t qwBiuBackoffs;
+    uint64_t qwRetries;			/* Retries started after a missing ACK */
+    uint64_t qwRxFrames;		/* Frames handed to the RX buffer */
+    uint64_t qwRxDropped;
+    uint64_t qwRxCorrupted;	/* Audible frames lost to collisions or bit errors */
+};
+
+class SimChip {
+  public:
+    SimChip(SimMedium &medium, SimHost *pHost, uint8_t bI2CAddress, uint8_t bIntPin, uint8_t bLogicalAddress, uint64_t qwPhysical);
+
+    /* I2C slave side */
+    bool I2CWrite(const uint8_t *pbData, uint8_t bLength);
+    uint8_t I2CRead(uint8_t *pbData, uint8_t bLength);
+    bool IntAsserted(void) const;
+    uint8_t IntLevel(void) const;
+
+    /* Medium side */
+    void OnReceive(const SimFrame &frame, bool bIntact);
+    void OnTransmitted(const SimFrame &frame);
+
+    uint32_t BitRate(void) const;
+    uint64_t Airtime(const SimFrame &frame) const;
+    double TxLevel(void) const;
+    double Sensitivity(void) const;
+    double BiuLevel(void) const;
+
+    bool Ready(void) const;
+
+    uint8_t abReg[SIM_REG_SIZE];
+    SimChipStats stats;
+    uint64_t qwReadyUs;				/* Time after which the chip answers on I2C; it NACKs before */
+    uint32_t dwIndex;				/* Position on the medium */
+  private:
+    enum TxState { TX_IDLE, TX_WAIT_BIU, TX_SENDING, TX_WAIT_ACK };
+
+    void SetStatus(uint8_t bStatus);
+    void StartTransmit(void);
+    void TryAccess(void);
+    void FinishTransmit(uint8_t bStatus);
+    bool Addressed(const SimFrame &frame, bool *pbUnicast) const;
+
+    SimMedium &medium;
+    SimHost *pHost;
+    uint8_t bOffset;				/* Register pointer of the I2C slave */
+    TxState eTxState;
+    SimFrame txFrame;
+    uint8_t bRetriesLeft;
+    uint64_t qwBiuStart;
+    uint64_t qwAckGeneration;		/* Bumped to cancel a pending ACK timeout */
+};
+
+/* Firmware-side idle: sleep until any HOST_INT of the running host is asserted or qwDeadline passes */
+void SimIdle(uint64_t qwDeadline);
+
+#endif
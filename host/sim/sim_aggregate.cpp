@@ -0,0 +1,428 @@
+/*
+* File Name: sim_aggregate.cpp
+**
+Description:
+* Chatty control traffic from node 1 to node 2: short messages of two types at random times, sent either
+* one frame per message or packed by PLC_AggregateSender (PowerComms/plc_aggregate.h) under each latency
+* budget. For each run the table gives the frames sent per message, the share of time the line was busy and
+* that time per message delivered, the messages delivered, and the time from queueing a message to its
+* dispatch at the receiver.
+* The budgets then run again on a quiet link, with node 1 queueing a heartbeat (PowerComms/heartbeat.h) as the
+* sketch does. That table adds the heartbeats the receiver got per heartbeat period, which should not exceed one.
+**
+Usage:
+* sim_aggregate [--rate 20] [--payload 2] [--mix 0.5] [--budget off,0,20,50,100] [--seconds 60]
+*               [--heartbeat 1000] [--quiet 0.5] [--seed 1]
+*
+* --rate is messages per second, --mix the share of them of the second type. "off" in --budget sends one
+* frame per message. --heartbeat is the heartbeat period in ms, 0 for no heartbeat runs, and --quiet the
+* message rate of those runs.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "plc_i2c.h"
+#include "plc_dispatch.h"
+#include "plc_aggregate.h"
+#include "heartbeat.h"
+#include "plc_sim.h"
+
+#define NODE_SENDER		0x01
+#define NODE_RECEIVER	0x02
+#define CMD_TELEMETRY	0x30		/* The second message type */
+#define BUDGET_OFF		-1
+#define HEARTBEAT_INDEX	0xFFFF		/* Message index a heartbeat carries */
+
+struct Message {
+    uint64_t qwTime;
+    byte bCommand;
+};
+
+struct AggregateConfig {
+    double dRate;
+    int iPayload;
+    double dMix;
+    std::vector<int> budgets;
+    double dSeconds;
+    unsigned long dwHeartbeat;
+    double dQuiet;
+    uint32_t dwSeed;
+};
+
+struct AggregateResult {
+    uint64_t qwFrames;			/* Frames the sender handed the PLC device */
+    uint64_t qwBusyUs;
+    std::vector<uint64_t> latencies;
+    std::vector<bool> received;
+    uint64_t qwHeartbeats;		/* Heartbeats the receiver got */
+    word wDropped;
+    word wMalformed;
+};
+
+static std::vector<Message> messages;
+
+/*****************************************************************************
+* Function Name: SenderMain()
+******************************************************************************
+* Summary:
+* Firmware of node 1: queue each message when it is due, send a frame whenever one is ready
+*****************************************************************************/
+static void SenderMain(SimKernel &kernel, const AggregateConfig &config, int iBudget, unsigned long dwHeartbeat,
+	AggregateResult &result)
+{
+	PLC_I2C plc;
+	PLC_AggregateSender aggregator;
+	Heartbeat heartbeat;
+	byte abBeat[MAX_PLC_PACKET_LENGTH];
+	std::deque<size_t> separate;
+	byte abMessage[MAX_PLC_PACKET_LENGTH];
+	byte abFrame[MAX_PLC_PACKET_LENGTH];
+	byte bLocal = NODE_SENDER;
+	byte bDestination = NODE_RECEIVER;
+	byte bCommand;
+	byte bLength;
+	byte bPeer;
+	size_t next = 0;
+	uint64_t qwWake;
+
+	plc.init(true);
+	plc.WriteToOffset(Local_LA_LSB, &bLocal, 1);
+	plc.SetDestinationAddress(TX_DA_Type_Log, &bDestination);
+	aggregator.begin((word)std::max(iBudget, 0));
+	memset(abMessage, 0, sizeof(abMessage));
+	memset(abBeat, 0, sizeof(abBeat));
+	abBeat[0] = (byte)HEARTBEAT_INDEX;
+	abBeat[1] = (byte)(HEARTBEAT_INDEX >> 8);
+	if (dwHeartbeat != 0)
+	{
+		heartbeat.begin(dwHeartbeat, (unsigned int)(dwHeartbeat / 8), bLocal);
+		heartbeat.AddPeer(NODE_RECEIVER);
+	}
+
+	for (;;)
+	{
+		for (; next < messages.size() && messages[next].qwTime <= kernel.Now(); next++)
+		{
+			if (iBudget == BUDGET_OFF)
+			{
+				separate.push_back(next);
+				continue;
+			}
+			abMessage[0] = (byte)next;
+			abMessage[1] = (byte)(next >> 8);
+			aggregator.Queue(NODE_RECEIVER, messages[next].bCommand, abMessage, (byte)config.iPayload);
+		}
+		if (dwHeartbeat != 0 && heartbeat.Due(&bPeer))
+		{
+			if (iBudget == BUDGET_OFF)
+			{
+				plc.TransmitPacket(CMD_SENDMSG, abBeat, (byte)config.iPayload);
+				heartbeat.NoteTransmit(bPeer);
+				result.qwFrames++;
+				continue;
+			}
+			aggregator.Queue(bPeer, CMD_SENDMSG, abBeat, (byte)config.iPayload);
+		}
+
+		if (!separate.empty())
+		{
+			abMessage[0] = (byte)separate.front();
+			abMessage[1] = (byte)(separate.front() >> 8);
+			plc.TransmitPacket(messages[separate.front()].bCommand, abMessage, (byte)config.iPayload);
+			heartbeat.NoteTransmit(bDestination);
+			separate.pop_front();
+			result.qwFrames++;
+			continue;
+		}
+		if (aggregator.Ready())
+		{
+			bLength = aggregator.Next(&bDestination, &bCommand, abFrame);
+			plc.TransmitPacket(bCommand, abFrame, bLength);
+			heartbeat.NoteTransmit(bDestination);
+			result.qwFrames++;
+			continue;
+		}
+
+		qwWake = (next < messages.size()) ? messages[next].qwTime : SIM_FOREVER;
+		if (aggregator.Wait() != PLC_AGGREGATE_NEVER)
+		{
+			qwWake = std::min(qwWake, (kernel.Now() / 1000 + aggregator.Wait()) * 1000);
+		}
+		if (dwHeartbeat != 0)
+		{
+			/* Look for a due heartbeat every ms, as the sketch's sampling does */
+			qwWake = std::min(qwWake, (kernel.Now() / 1000 + 1) * 1000);
+		}
+		SimIdle(qwWake);
+		result.wDropped = aggregator.wDropped;
+	}
+}
+
+struct ReceiverContext {
+    SimKernel *pKernel;
+    AggregateResult *pResult;
+};
+
+static void OnMessage(const PLC_Frame *pFrame, void *pContext)
+{
+	ReceiverContext &receiver = *(ReceiverContext *)pContext;
+	size_t index;
+
+	if (pFrame->bLength < 2)
+	{
+		return;
+	}
+	index = pFrame->pbData[0] | (pFrame->pbData[1] << 8);
+	if (index == HEARTBEAT_INDEX)
+	{
+		receiver.pResult->qwHeartbeats++;
+	}
+	else if (index < messages.size() && !receiver.pResult->received[index])
+	{
+		receiver.pResult->received[index] = true;
+		receiver.pResult->latencies.push_back(receiver.pKernel->Now() - messages[index].qwTime);
+	}
+}
+
+/* Node 2: the dispatcher, with the aggregate receiver handing it the messages of each CMD_AGGREGATE */
+static void ReceiverMain(ReceiverContext &receiver)
+{
+	PLC_I2C plc;
+	PLC_Dispatcher dispatcher;
+	PLC_AggregateReceiver unpacker;
+	byte bLocal = NODE_RECEIVER;
+
+	plc.init(false);
+	plc.WriteToOffset(Local_LA_LSB, &bLocal, 1);
+	dispatcher.begin();
+	dispatcher.Register(CMD_SENDMSG, OnMessage, &receiver);
+	dispatcher.Register(CMD_TELEMETRY, OnMessage, &receiver);
+	unpacker.begin();
+	unpacker.Attach(&dispatcher);
+	for (;;)
+	{
+		dispatcher.Service(&plc);
+		receiver.pResult->wMalformed = unpacker.wMalformed;
+		SimIdle(SIM_FOREVER);
+	}
+}
+
+static AggregateResult RunOnce(const AggregateConfig &config, int iBudget, unsigned long dwHeartbeat)
+{
+	SimMediumConfig mediumConfig;
+	AggregateResult result;
+	ReceiverContext receiver;
+	SimHost *apHost[2];
+	SimChip *apChip[2];
+
+	result.qwFrames = 0;
+	result.received.assign(messages.size(), false);
+	result.qwHeartbeats = 0;
+	result.wDropped = 0;
+	result.wMalformed = 0;
+	{
+		SimKernel kernel;
+		SimMedium medium(kernel, mediumConfig, config.dwSeed);
+
+		receiver.pKernel = &kernel;
+		receiver.pResult = &result;
+		for (int i = 0; i < 2; i++)
+		{
+			apHost[i] = new SimHost();
+			apChip[i] = new SimChip(medium, apHost[i], PLC_ADDRESS, 2, (uint8_t)(NODE_SENDER + i), 0x0001000000000000ULL + i);
+		}
+		apHost[0]->pTask = kernel.Spawn(apHost[0], [&]() { SenderMain(kernel, config, iBudget, dwHeartbeat, result); }, config.dwSeed * 7919);
+		apHost[1]->pTask = kernel.Spawn(apHost[1], [&]() { ReceiverMain(receiver); }, config.dwSeed * 7919 + 1);
+
+		/* Leave time for what is still queued or on the line at the end */
+		kernel.Run((uint64_t)(config.dSeconds * 1e6) + 2000000);
+		kernel.Stop();
+		result.qwBusyUs = medium.stats.qwBusyUs;
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		delete apChip[i];
+		delete apHost[i];
+	}
+	return result;
+}
+
+static double Percentile(std::vector<uint64_t> &values, double dShare)
+{
+	if (values.empty())
+	{
+		return 0;
+	}
+	std::sort(values.begin(), values.end());
+	return (double)values[(size_t)(dShare * (values.size() - 1))];
+}
+
+/* Messages start after a second, once both nodes are up */
+static void Generate(const AggregateConfig &config, double dRate)
+{
+	std::mt19937 rng(config.dwSeed);
+	std::exponential_distribution<double> interval(dRate);
+	std::uniform_real_distribution<double> type(0, 1);
+
+	messages.clear();
+	for (double t = 1 + interval(rng); t < config.dSeconds; t += interval(rng))
+	{
+		Message message = { (uint64_t)(t * 1e6), (byte)(type(rng) < config.dMix ? CMD_TELEMETRY : CMD_SENDMSG) };
+		messages.push_back(message);
+	}
+}
+
+static void BudgetName(int iBudget, char *pszBudget, size_t size)
+{
+	if (iBudget == BUDGET_OFF)
+	{
+		snprintf(pszBudget, size, "off");
+	}
+	else
+	{
+		snprintf(pszBudget, size, "%dms", iBudget);
+	}
+}
+
+static void ParseBudgets(const char *pszArg, std::vector<int> &budgets)
+{
+	std::string list(pszArg);
+	size_t start = 0;
+
+	budgets.clear();
+	while (start <= list.size())
+	{
+		size_t end = list.find(',', start);
+		if (end == std::string::npos)
+		{
+			end = list.size();
+		}
+		std::string item = list.substr(start, end - start);
+		budgets.push_back(item == "off" ? BUDGET_OFF : atoi(item.c_str()));
+		start = end + 1;
+	}
+}
+
+static void Usage(void)
+{
+	fprintf(stderr, "usage: sim_aggregate [--rate 20] [--payload 2] [--mix 0.5] [--budget off,0,20,50,100]\n"
+		"                     [--seconds 60] [--heartbeat 1000] [--quiet 0.5] [--seed 1]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	AggregateConfig config;
+
+	config.dRate = 20;
+	config.iPayload = 2;
+	config.dMix = 0.5;
+	config.budgets = { BUDGET_OFF, 0, 20, 50, 100 };
+	config.dSeconds = 60;
+	config.dwHeartbeat = 1000;
+	config.dQuiet = 0.5;
+	config.dwSeed = 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *pszValue = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (pszValue == NULL)
+		{
+			Usage();
+		}
+		if (!strcmp(argv[i], "--rate"))
+		{
+			config.dRate = atof(pszValue);
+		}
+		else if (!strcmp(argv[i], "--payload"))
+		{
+			config.iPayload = atoi(pszValue);
+		}
+		else if (!strcmp(argv[i], "--mix"))
+		{
+			config.dMix = atof(pszValue);
+		}
+		else if (!strcmp(argv[i], "--budget"))
+		{
+			ParseBudgets(pszValue, config.budgets);
+		}
+		else if (!strcmp(argv[i], "--seconds"))
+		{
+			config.dSeconds = atof(pszValue);
+		}
+		else if (!strcmp(argv[i], "--heartbeat"))
+		{
+			config.dwHeartbeat = (unsigned long)atol(pszValue);
+		}
+		else if (!strcmp(argv[i], "--quiet"))
+		{
+			config.dQuiet = atof(pszValue);
+		}
+		else if (!strcmp(argv[i], "--seed"))
+		{
+			config.dwSeed = (uint32_t)atol(pszValue);
+		}
+		else
+		{
+			Usage();
+		}
+		i++;
+	}
+	if (config.dRate <= 0 || config.dSeconds <= 0 || config.dRate * config.dSeconds > 65535
+		|| config.dQuiet <= 0 || config.dQuiet > config.dRate || config.iPayload < 2
+		|| config.iPayload > PLC_AGGREGATE_MAX)
+	{
+		Usage();
+	}
+
+	Generate(config, config.dRate);
+	printf("%zu messages of %d bytes at %.1f/s, %.0f%% of them of the second type\n", messages.size(), config.iPayload,
+		config.dRate, 100.0 * config.dMix);
+	printf("%-8s %8s %10s %7s %11s %8s %10s %10s %8s\n", "budget", "frames", "frames/msg", "line%", "air ms/msg", "deliv%",
+		"lat p50 ms", "lat p99 ms", "dropped");
+	for (size_t b = 0; b < config.budgets.size(); b++)
+	{
+		AggregateResult r = RunOnce(config, config.budgets[b], 0);
+		char szBudget[16];
+
+		BudgetName(config.budgets[b], szBudget, sizeof(szBudget));
+		printf("%-8s %8llu %10.2f %6.1f%% %11.1f %7.1f%% %10.1f %10.1f %8u\n", szBudget, (unsigned long long)r.qwFrames,
+			(double)r.qwFrames / messages.size(), 100.0 * r.qwBusyUs / (config.dSeconds * 1e6 + 2e6),
+			r.latencies.empty() ? 0.0 : r.qwBusyUs / 1e3 / r.latencies.size(),
+			100.0 * r.latencies.size() / messages.size(), Percentile(r.latencies, 0.5) / 1e3,
+			Percentile(r.latencies, 0.99) / 1e3, r.wDropped);
+		if (r.wMalformed > 0)
+		{
+			printf("         %u malformed aggregates\n", r.wMalformed);
+		}
+		fflush(stdout);
+	}
+	if (config.dwHeartbeat == 0)
+	{
+		return 0;
+	}
+
+	Generate(config, config.dQuiet);
+	printf("\n%zu messages at %.1f/s, heartbeat every %lu ms\n", messages.size(), config.dQuiet, config.dwHeartbeat);
+	printf("%-8s %8s %10s %10s %8s %8s\n", "budget", "frames", "heartbeats", "hb/period", "deliv%", "dropped");
+	for (size_t b = 0; b < config.budgets.size(); b++)
+	{
+		AggregateResult r = RunOnce(config, config.budgets[b], config.dwHeartbeat);
+		char szBudget[16];
+
+		BudgetName(config.budgets[b], szBudget, sizeof(szBudget));
+		printf("%-8s %8llu %10llu %10.2f %7.1f%% %8u\n", szBudget, (unsigned long long)r.qwFrames,
+			(unsigned long long)r.qwHeartbeats, r.qwHeartbeats / (config.dSeconds * 1e3 / config.dwHeartbeat),
+			messages.empty() ? 0.0 : 100.0 * r.latencies.size() / messages.size(), r.wDropped);
+		fflush(stdout);
+	}
+	return 0;
+}
@@ -0,0 +1,432 @@
+/*
+* File Name: sim_bridge.cpp
+**
+Description:
+* Loopback test of the Serial bridge (PowerComms/plc_bridge.h) against the simulator. Two nodes run the
+* bridge firmware, each with a PC on its Serial link running PlcBridgeClient. PC A sends numbered frames to
+* node B as fast as its credits allow and PC B checks that each arrives intact, once and in order. The
+* Serial links are modelled byte by byte at the baud rate, with the 64 byte buffer of the Arduino
+* HardwareSerial driver in front of the MCU's transmitter.
+* The same run is repeated with node A's firmware calling TransmitPacket() back to back, the rate a sketch
+* gets on its own, to show what the bridge costs.
+**
+Usage:
+* sim_bridge [--frames 500] [--payload 8] [--baud 115200] [--seed 1]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+
+#include "plc_i2c.h"
+#include "plc_bridge.h"
+#include "plc_dispatch.h"
+#include "plc_sim.h"
+#include "../bridge/plc_bridge_client.h"
+
+#define SERIAL_TX_BUFFER	64		/* Bytes buffered by the Arduino HardwareSerial driver */
+#define NODE_A				0x01
+#define NODE_B				0x02
+#define IDLE_US				100000	/* Longest sleep of a loop with nothing to wait for */
+
+/* One direction of a Serial link: each byte arrives a byte time after the previous one left */
+struct SimSerial {
+    std::deque<std::pair<uint64_t, uint8_t> > bytes;
+    double dByteUs;
+    double dLineFree;			/* When the last byte written finishes arriving */
+    SimTask *pReader;
+    uint64_t qwBytes;
+
+    void Write(SimKernel &kernel, const uint8_t *pbData, size_t iLength)
+    {
+        for (size_t i = 0; i < iLength; i++)
+        {
+            dLineFree = std::max(dLineFree, (double)kernel.Now()) + dByteUs;
+            bytes.push_back(std::make_pair((uint64_t)dLineFree, pbData[i]));
+        }
+        qwBytes += iLength;
+        if (iLength > 0)
+        {
+            kernel.Wake(pReader);
+        }
+    }
+    size_t Read(SimKernel &kernel, uint8_t *pbData, size_t iMax)
+    {
+        size_t iCount = 0;
+
+        while (iCount < iMax && !bytes.empty() && bytes.front().first <= kernel.Now())
+        {
+            pbData[iCount++] = bytes.front().second;
+            bytes.pop_front();
+        }
+        return iCount;
+    }
+    /* Bytes written and not yet arrived, the fill of the sender's buffer */
+    size_t InFlight(SimKernel &kernel) const
+    {
+        size_t iCount = 0;
+
+        for (size_t i = bytes.size(); i > 0 && bytes[i - 1].first > kernel.Now(); i--)
+        {
+            iCount++;
+        }
+        return iCount;
+    }
+    uint64_t NextArrival(void) const
+    {
+        return bytes.empty() ? SIM_FOREVER : bytes.front().first;
+    }
+};
+
+struct BridgeResult {
+    uint64_t qwSent;			/* Frames the PLC device of node A finished */
+    uint64_t qwAcked;
+    uint64_t qwReceived;		/* Frames that reached PC B (or node B's firmware in the direct run) */
+    uint64_t qwCorrupt;
+    uint64_t qwOutOfOrder;		/* Duplicates and frames older than one already received */
+    uint64_t qwRejected;
+    uint64_t qwBadMessages;
+    uint64_t qwSerialBytes;		/* Both directions of both links */
+    double dSeconds;			/* First frame queued to last result */
+};
+
+static void FillPayload(uint32_t dwNumber, uint8_t *pbData, int iPayload)
+{
+	for (int i = 0; i < iPayload; i++)
+	{
+		pbData[i] = (uint8_t)(i < 4 ? dwNumber >> (8 * i) : dwNumber * 31 + i);
+	}
+}
+
+static uint64_t Earliest(uint64_t qwA, uint64_t qwB)
+{
+	return qwA < qwB ? qwA : qwB;
+}
+
+/*****************************************************************************
+* Function Name: BridgeNodeMain()
+******************************************************************************
+* Summary:
+* Firmware of a node in BRIDGE_MODE: the bridgeSerial() loop of the sketch
+*****************************************************************************/
+static void BridgeNodeMain(SimKernel &kernel, byte bLocal, SimSerial &fromPc, SimSerial &toPc)
+{
+	PLC_I2C plc;
+	PLC_Bridge bridge;
+	uint8_t abChunk[SERIAL_TX_BUFFER];
+	size_t iCount;
+	uint64_t qwDeadline;
+
+	plc.init(true);
+	plc.WriteToOffset(Local_LA_LSB, &bLocal, 1);
+	bridge.begin(&plc);
+	for (;;)
+	{
+		iCount = fromPc.Read(kernel, abChunk, sizeof(abChunk));
+		for (size_t i = 0; i < iCount; i++)
+		{
+			bridge.Input(abChunk[i]);
+		}
+		bridge.Service();
+		iCount = bridge.Output(abChunk, (byte)(SERIAL_TX_BUFFER - toPc.InFlight(kernel)));
+		toPc.Write(kernel, abChunk, iCount);
+
+		/* Sleep until Serial input, room in the Serial buffer or a HOST_INT */
+		qwDeadline = Earliest(fromPc.NextArrival(), kernel.Now() + IDLE_US);
+		if (toPc.InFlight(kernel) > 0)
+		{
+			qwDeadline = Earliest(qwDeadline, (uint64_t)(kernel.Now() + toPc.dByteUs * 16));
+		}
+		if (fromPc.NextArrival() > kernel.Now())
+		{
+			SimIdle(qwDeadline);
+		}
+	}
+}
+
+/*****************************************************************************
+* Function Name: PcMain()
+******************************************************************************
+* Summary:
+* A PC on a bridge: the sender sends iFrames numbered frames to node B, the receiver checks them
+*****************************************************************************/
+static void PcMain(SimKernel &kernel, bool bSender, int iFrames, int iPayload, SimSerial &fromMcu, SimSerial &toMcu,
+	BridgeResult &result, uint64_t &qwStart, uint64_t &qwEnd)
+{
+	PlcBridgeClient client;
+	uint8_t abBuffer[256];
+	uint8_t abPayload[MAX_PLC_PACKET_LENGTH];
+	uint8_t bDestination = NODE_B;
+	uint32_t dwNext = 0;		/* Sender: next frame to send; receiver: next frame expected */
+	int iDone = 0;
+	size_t iCount;
+
+	client.onDone = [&](uint8_t bSeq, uint8_t bStatus) {
+		if (bStatus == PLC_BRIDGE_REJECTED)
+		{
+			return;
+		}
+		result.qwSent++;
+		if (bStatus & Status_TX_Data_Sent)
+		{
+			result.qwAcked++;
+		}
+		if (++iDone == iFrames)
+		{
+			qwEnd = kernel.Now();
+		}
+	};
+	client.onRecv = [&](const PlcBridgeRecv &frame) {
+		uint8_t abExpected[MAX_PLC_PACKET_LENGTH];
+		uint32_t dwNumber;
+
+		if (frame.bLength != iPayload || frame.bCommand != CMD_SENDMSG || frame.abSA[0] != NODE_A)
+		{
+			result.qwCorrupt++;
+			return;
+		}
+		dwNumber = frame.abData[0] | (frame.abData[1] << 8) | (frame.abData[2] << 16) | ((uint32_t)frame.abData[3] << 24);
+		FillPayload(dwNumber, abExpected, iPayload);
+		if (memcmp(frame.abData, abExpected, iPayload) != 0)
+		{
+			result.qwCorrupt++;
+			return;
+		}
+		if (dwNumber < dwNext)
+		{
+			result.qwOutOfOrder++;
+			return;
+		}
+		dwNext = dwNumber + 1;
+		result.qwReceived++;
+	};
+
+	for (;;)
+	{
+		iCount = fromMcu.Read(kernel, abBuffer, sizeof(abBuffer));
+		client.Feed(abBuffer, iCount);
+		while (bSender && (int)dwNext < iFrames && client.Credits() > 0)
+		{
+			FillPayload(dwNext, abPayload, iPayload);
+			if (!client.Send(TX_DA_Type_Log, &bDestination, CMD_SENDMSG, abPayload, (uint8_t)iPayload))
+			{
+				break;
+			}
+			if (dwNext++ == 0)
+			{
+				qwStart = kernel.Now();
+			}
+		}
+		/* A PC's UART driver buffers as much as it is given */
+		iCount = client.TakeOutput(abBuffer, sizeof(abBuffer));
+		toMcu.Write(kernel, abBuffer, iCount);
+		result.qwBadMessages += client.stats.qwBadMessages;
+		client.stats.qwBadMessages = 0;
+		result.qwRejected += client.stats.qwRejected;
+		client.stats.qwRejected = 0;
+		if (fromMcu.NextArrival() > kernel.Now())
+		{
+			SimIdle(Earliest(fromMcu.NextArrival(), kernel.Now() + IDLE_US));
+		}
+	}
+}
+
+/*****************************************************************************
+* Function Name: DirectNodeMain()
+******************************************************************************
+* Summary:
+* Firmware of node A in the direct run: the frames of the bridged run, sent with TransmitPacket()
+*****************************************************************************/
+static void DirectNodeMain(SimKernel &kernel, int iFrames, int iPayload, BridgeResult &result, uint64_t &qwStart,
+	uint64_t &qwEnd)
+{
+	PLC_I2C plc;
+	byte bLocal = NODE_A;
+	byte bDestination = NODE_B;
+	byte abPayload[MAX_PLC_PACKET_LENGTH];
+
+	plc.init(true);
+	plc.WriteToOffset(Local_LA_LSB, &bLocal, 1);
+	plc.SetDestinationAddress(TX_DA_Type_Log, &bDestination);
+	qwStart = kernel.Now();
+	for (int i = 0; i < iFrames; i++)
+	{
+		FillPayload((uint32_t)i, abPayload, iPayload);
+		result.qwSent++;
+		if (plc.TransmitPacket(CMD_SENDMSG, abPayload, (byte)iPayload) & Status_TX_Data_Sent)
+		{
+			result.qwAcked++;
+		}
+	}
+	qwEnd = kernel.Now();
+	SimIdle(SIM_FOREVER);
+}
+
+static void CountFrame(const PLC_Frame *pFrame, void *pContext)
+{
+	((BridgeResult *)pContext)->qwReceived++;
+}
+
+/* Node B of the direct run: count the frames with the receive() loop of the sketch */
+static void DirectSinkMain(BridgeResult &result)
+{
+	PLC_I2C plc;
+	PLC_Dispatcher dispatcher;
+	byte bLocal = NODE_B;
+
+	plc.init(false);
+	plc.WriteToOffset(Local_LA_LSB, &bLocal, 1);
+	dispatcher.begin();
+	dispatcher.SetDefault(CountFrame, &result);
+	for (;;)
+	{
+		dispatcher.Service(&plc);
+		SimIdle(SIM_FOREVER);
+	}
+}
+
+static BridgeResult RunOnce(bool bBridged, int iFrames, int iPayload, uint32_t dwBaud, uint32_t dwSeed)
+{
+	SimKernel kernel;
+	SimMedium medium(kernel, SimMediumConfig(), dwSeed);
+	SimHost *apHost[4];
+	SimChip *apChip[2];
+	SimSerial aSerial[4];		/* PC A to node A, node A to PC A, then the same for B */
+	BridgeResult result;
+	uint64_t qwStart = 0;
+	uint64_t qwEnd = 0;
+
+	memset(&result, 0, sizeof(result));
+	for (int i = 0; i < 4; i++)
+	{
+		apHost[i] = new SimHost();
+		aSerial[i].dByteUs = 10e6 / dwBaud;		/* 8N1 */
+		aSerial[i].dLineFree = 0;
+		aSerial[i].pReader = NULL;
+		aSerial[i].qwBytes = 0;
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		apChip[i] = new SimChip(medium, apHost[i], PLC_ADDRESS, 2, (uint8_t)(NODE_A + i), 0x0001000000000000ULL + i);
+	}
+
+	if (bBridged)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			SimSerial &fromPc = aSerial[2 * i];
+			SimSerial &toPc = aSerial[2 * i + 1];
+			byte bLocal = (byte)(NODE_A + i);
+
+			apHost[i]->pTask = kernel.Spawn(apHost[i], [&kernel, bLocal, &fromPc, &toPc]() {
+				BridgeNodeMain(kernel, bLocal, fromPc, toPc);
+			}, dwSeed * 7919 + i);
+			apHost[2 + i]->pTask = kernel.Spawn(apHost[2 + i], [&, i]() {
+				PcMain(kernel, i == 0, iFrames, iPayload, toPc, fromPc, result, qwStart, qwEnd);
+			}, dwSeed * 7919 + 2 + i);
+			fromPc.pReader = apHost[i]->pTask;
+			toPc.pReader = apHost[2 + i]->pTask;
+		}
+	}
+	else
+	{
+		apHost[0]->pTask = kernel.Spawn(apHost[0], [&]() {
+			DirectNodeMain(kernel, iFrames, iPayload, result, qwStart, qwEnd);
+		}, dwSeed * 7919);
+		apHost[1]->pTask = kernel.Spawn(apHost[1], [&]() { DirectSinkMain(result); }, dwSeed * 7919 + 1);
+	}
+
+	/* Run until node A has finished every frame, with a generous limit */
+	for (uint64_t qwLimit = 1000000; qwEnd == 0 && qwLimit <= (uint64_t)iFrames * 1000000; qwLimit += 1000000)
+	{
+		kernel.Run(qwLimit);
+	}
+	/* Leave time for the last frame to reach PC B */
+	kernel.Run(kernel.Now() + 500000);
+	kernel.Stop();
+
+	result.dSeconds = (qwEnd - qwStart) / 1e6;
+	for (int i = 0; i < 4; i++)
+	{
+		result.qwSerialBytes += aSerial[i].qwBytes;
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		delete apChip[i];
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		delete apHost[i];
+	}
+	return result;
+}
+
+static void Usage(void)
+{
+	fprintf(stderr, "usage: sim_bridge [--frames 500] [--payload 8] [--baud 115200] [--seed 1]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int iFrames = 500;
+	int iPayload = 8;
+	uint32_t dwBaud = 115200;
+	uint32_t dwSeed = 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *pszValue = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (pszValue == NULL)
+		{
+			Usage();
+		}
+		if (!strcmp(argv[i], "--frames"))
+		{
+			iFrames = atoi(pszValue);
+		}
+		else if (!strcmp(argv[i], "--payload"))
+		{
+			iPayload = atoi(pszValue);
+		}
+		else if (!strcmp(argv[i], "--baud"))
+		{
+			dwBaud = (uint32_t)atol(pszValue);
+		}
+		else if (!strcmp(argv[i], "--seed"))
+		{
+			dwSeed = (uint32_t)atol(pszValue);
+		}
+		else
+		{
+			Usage();
+		}
+		i++;
+	}
+	if (iFrames <= 0 || iPayload < 4 || iPayload > MAX_PLC_PACKET_LENGTH || dwBaud == 0)
+	{
+		Usage();
+	}
+
+	BridgeResult direct = RunOnce(false, iFrames, iPayload, dwBaud, dwSeed);
+	BridgeResult bridged = RunOnce(true, iFrames, iPayload, dwBaud, dwSeed);
+
+	printf("direct:  %llu frames in %.2f s, %.2f frames/s, %llu acked, %llu received\n",
+		(unsigned long long)direct.qwSent, direct.dSeconds, direct.qwSent / direct.dSeconds,
+		(unsigned long long)direct.qwAcked, (unsigned long long)direct.qwReceived);
+	printf("bridged: %llu frames in %.2f s, %.2f frames/s (%.0f%% of direct), %llu acked\n",
+		(unsigned long long)bridged.qwSent, bridged.dSeconds, bridged.qwSent / bridged.dSeconds,
+		100 * (bridged.qwSent / bridged.dSeconds) / (direct.qwSent / direct.dSeconds),
+		(unsigned long long)bridged.qwAcked);
+	printf("PC B: %llu received in order, %llu corrupt, %llu duplicate or out of order; %llu rejected, %llu bad messages\n",
+		(unsigned long long)bridged.qwReceived, (unsigned long long)bridged.qwCorrupt,
+		(unsigned long long)bridged.qwOutOfOrder, (unsigned long long)bridged.qwRejected,
+		(unsigned long long)bridged.qwBadMessages);
+	printf("Serial: %.0f B/s over the four directions at %u baud, %.1f bytes per frame\n",
+		bridged.qwSerialBytes / bridged.dSeconds, dwBaud, (double)bridged.qwSerialBytes / bridged.qwSent);
+	return (bridged.qwSent == (uint64_t)iFrames && bridged.qwReceived == bridged.qwAcked && bridged.qwCorrupt == 0
+		&& bridged.qwRejected == 0) ? 0 : 1;
+}
@@ -0,0 +1,340 @@
+/*
+* File Name: sim_bulk.cpp
+**
+Description:
+* Bulk transfers (PowerComms/plc_bulk.h) from node 1 to node 2 over a lossy simulated line, to weigh parity
+* frames against retransmission. Each loss rate is run once with acknowledged fragments and no parity, a
+* fragment that is not acknowledged being sent again up to BULK_REPEATS times, and once for each parity
+* count with unacknowledged fragments and parity frames.
+* For each run the table gives the frames put on the line per transfer and their overhead over the bare
+* fragments, the share of transfers received whole and intact, goodput, and the mean time per transfer.
+**
+Usage:
+* sim_bulk [--bytes 1024] [--transfers 20] [--group 8] [--parity 1,2,4] [--loss 0,0.02,0.05,0.1,0.2] [--seed 1]
+*
+* --loss is the chance of any reception on the line being lost, ACKs included, on top of noise.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "plc_i2c.h"
+#include "plc_dispatch.h"
+#include "plc_bulk.h"
+#include "plc_sim.h"
+
+#define NODE_SENDER		0x01
+#define NODE_RECEIVER	0x02
+#define BULK_REPEATS	3		/* Times the acknowledged run sends a fragment again */
+
+struct BulkConfig {
+    int iBytes;
+    int iTransfers;
+    int iGroup;
+    std::vector<double> parity;
+    std::vector<double> losses;
+    uint32_t dwSeed;
+};
+
+struct BulkResult {
+    uint64_t qwFrames;			/* Data frames put on the line, retries of the PLC device included */
+    uint64_t qwTransferUs;		/* Start to the last frame's result, summed over the transfers */
+    int iSent;					/* Transfers the sender finished */
+    int iIntact;				/* Transfers received whole and matching */
+    int iCorrupt;
+    uint32_t dwRebuilt;
+    bool bFinished;
+};
+
+/* Content of transfer t, so the receiver can check it */
+static byte Pattern(int iTransfer, int i)
+{
+	return (byte)(iTransfer * 131 + i * 7);
+}
+
+/*****************************************************************************
+* Function Name: SenderMain()
+******************************************************************************
+* Summary:
+* Firmware of node 1: the transfers, back to back
+*****************************************************************************/
+static void SenderMain(SimKernel &kernel, const BulkConfig &config, int iParity, BulkResult &result)
+{
+	PLC_I2C plc;
+	PLC_BulkSender sender;
+	std::vector<byte> data(config.iBytes);
+	byte abPayload[MAX_PLC_PACKET_LENGTH];
+	byte bLocal = NODE_SENDER;
+	byte bDestination = NODE_RECEIVER;
+	byte bTxConfig;
+	byte bLength;
+	byte bResult;
+	int iRepeats;
+
+	plc.init(true);
+	plc.WriteToOffset(Local_LA_LSB, &bLocal, 1);
+	plc.SetDestinationAddress(TX_DA_Type_Log, &bDestination);
+	if (iParity > 0)
+	{
+		/* Parity stands in for the ACKs and the PLC device's retries */
+		plc.ReadFromOffset(TX_Config, &bTxConfig, 1);
+		bTxConfig &= ~(TX_Service_Type | TX_Retry);
+		plc.WriteToOffset(TX_Config, &bTxConfig, 1);
+	}
+	sender.begin((byte)config.iGroup, (byte)iParity);
+
+	for (int t = 0; t < config.iTransfers; t++)
+	{
+		uint64_t qwStart = kernel.Now();
+
+		for (int i = 0; i < config.iBytes; i++)
+		{
+			data[i] = Pattern(t, i);
+		}
+		sender.Start(&data[0], (word)config.iBytes);
+		iRepeats = 0;
+		while ((bLength = sender.Next(abPayload)) != PLC_NO_FRAME)
+		{
+			bResult = plc.TransmitPacket(CMD_BULK, abPayload, bLength);
+			if (iParity == 0 && !(bResult & Status_TX_Data_Sent) && iRepeats < BULK_REPEATS)
+			{
+				sender.Repeat();
+				iRepeats++;
+			}
+			else
+			{
+				iRepeats = 0;
+			}
+		}
+		result.qwTransferUs += kernel.Now() - qwStart;
+		result.iSent++;
+	}
+	result.bFinished = true;
+	SimIdle(SIM_FOREVER);
+}
+
+/* What the receiver checks completed transfers against */
+struct CheckContext {
+    const BulkConfig *pConfig;
+    BulkResult *pResult;
+    int iTransfer;
+};
+
+static void OnTransfer(void *pContext, const byte *pbData, word wLength)
+{
+	CheckContext &check = *(CheckContext *)pContext;
+	bool bIntact = false;
+
+	/* The transfer number is not in the data, and lost transfers are skipped: look forward for a match */
+	for (int t = check.iTransfer; !bIntact && t < check.pConfig->iTransfers; t++)
+	{
+		bIntact = wLength == (word)check.pConfig->iBytes;
+		for (int i = 0; bIntact && i < (int)wLength; i++)
+		{
+			bIntact = pbData[i] == Pattern(t, i);
+		}
+		if (bIntact)
+		{
+			check.iTransfer = t + 1;
+		}
+	}
+	if (bIntact)
+	{
+		check.pResult->iIntact++;
+	}
+	else
+	{
+		check.pResult->iCorrupt++;
+	}
+}
+
+/* Node 2: the receive loop of the sketch with a PLC_BulkReceiver on the dispatcher */
+static void ReceiverMain(const BulkConfig &config, BulkResult &result)
+{
+	PLC_I2C plc;
+	PLC_Dispatcher dispatcher;
+	PLC_BulkReceiver receiver;
+	std::vector<byte> buffer(config.iBytes);
+	CheckContext check = { &config, &result, 0 };
+	byte bLocal = NODE_RECEIVER;
+
+	plc.init(false);
+	plc.WriteToOffset(Local_LA_LSB, &bLocal, 1);
+	dispatcher.begin();
+	receiver.begin(&buffer[0], (word)buffer.size(), OnTransfer, &check);
+	receiver.Attach(&dispatcher);
+	for (;;)
+	{
+		dispatcher.Service(&plc);
+		result.dwRebuilt = receiver.wRebuilt;
+		SimIdle(SIM_FOREVER);
+	}
+}
+
+static BulkResult RunOnce(const BulkConfig &config, int iParity, double dLoss)
+{
+	SimMediumConfig mediumConfig;
+	BulkResult result;
+	SimHost *apHost[2];
+	SimChip *apChip[2];
+
+	memset(&result, 0, sizeof(result));
+	mediumConfig.dLossRate = dLoss;
+	{
+		SimKernel kernel;
+		SimMedium medium(kernel, mediumConfig, config.dwSeed);
+
+		for (int i = 0; i < 2; i++)
+		{
+			apHost[i] = new SimHost();
+			apChip[i] = new SimChip(medium, apHost[i], PLC_ADDRESS, 2, (uint8_t)(NODE_SENDER + i), 0x0001000000000000ULL + i);
+		}
+		apHost[0]->pTask = kernel.Spawn(apHost[0], [&]() { SenderMain(kernel, config, iParity, result); }, config.dwSeed * 7919);
+		apHost[1]->pTask = kernel.Spawn(apHost[1], [&]() { ReceiverMain(config, result); }, config.dwSeed * 7919 + 1);
+
+		/* Run until the sender is done, then leave time for the last frame to be read */
+		for (uint64_t qwLimit = 10000000; !result.bFinished; qwLimit += 10000000)
+		{
+			kernel.Run(qwLimit);
+		}
+		kernel.Run(kernel.Now() + 500000);
+		kernel.Stop();
+		result.qwFrames = medium.stats.qwFrames;
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		delete apChip[i];
+		delete apHost[i];
+	}
+	return result;
+}
+
+static void ParseList(const char *pszArg, std::vector<double> &values)
+{
+	std::string list(pszArg);
+	size_t start = 0;
+
+	values.clear();
+	while (start <= list.size())
+	{
+		size_t end = list.find(',', start);
+		if (end == std::string::npos)
+		{
+			end = list.size();
+		}
+		values.push_back(atof(list.substr(start, end - start).c_str()));
+		start = end + 1;
+	}
+}
+
+static void Usage(void)
+{
+	fprintf(stderr, "usage: sim_bulk [--bytes 1024] [--transfers 20] [--group 8] [--parity 1,2,4]\n"
+		"                [--loss 0,0.02,0.05,0.1,0.2] [--seed 1]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	BulkConfig config;
+	std::vector<int> modes;
+	double dFragments;
+
+	config.iBytes = 1024;
+	config.iTransfers = 20;
+	config.iGroup = 8;
+	config.parity = { 1, 2, 4 };
+	config.losses = { 0, 0.02, 0.05, 0.1, 0.2 };
+	config.dwSeed = 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *pszValue = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (pszValue == NULL)
+		{
+			Usage();
+		}
+		if (!strcmp(argv[i], "--bytes"))
+		{
+			config.iBytes = atoi(pszValue);
+		}
+		else if (!strcmp(argv[i], "--transfers"))
+		{
+			config.iTransfers = atoi(pszValue);
+		}
+		else if (!strcmp(argv[i], "--group"))
+		{
+			config.iGroup = atoi(pszValue);
+		}
+		else if (!strcmp(argv[i], "--parity"))
+		{
+			ParseList(pszValue, config.parity);
+		}
+		else if (!strcmp(argv[i], "--loss"))
+		{
+			ParseList(pszValue, config.losses);
+		}
+		else if (!strcmp(argv[i], "--seed"))
+		{
+			config.dwSeed = (uint32_t)atol(pszValue);
+		}
+		else
+		{
+			Usage();
+		}
+		i++;
+	}
+	if (config.iBytes < 1 || config.iBytes > PLC_BULK_MAX_BYTES || config.iTransfers < 1
+		|| config.iGroup < 1 || config.iGroup > PLC_BULK_MAX_GROUP)
+	{
+		Usage();
+	}
+	modes.push_back(0);
+	for (size_t p = 0; p < config.parity.size(); p++)
+	{
+		if (config.parity[p] < 1 || config.parity[p] > config.iGroup)
+		{
+			fprintf(stderr, "parity must be 1..group\n");
+			return 2;
+		}
+		modes.push_back((int)config.parity[p]);
+	}
+	dFragments = (config.iBytes + PLC_BULK_CHUNK - 1) / PLC_BULK_CHUNK;
+
+	printf("%d byte transfers in %.0f fragments of up to %d bytes, groups of %d\n", config.iBytes, dFragments,
+		PLC_BULK_CHUNK, config.iGroup);
+	printf("%6s %-10s %10s %9s %7s %8s %10s %11s\n", "loss", "mode", "frames/tr", "overhead", "intact", "rebuilt",
+		"goodput", "ms/transfer");
+	for (size_t l = 0; l < config.losses.size(); l++)
+	{
+		for (size_t m = 0; m < modes.size(); m++)
+		{
+			BulkResult r = RunOnce(config, modes[m], config.losses[l]);
+			char szMode[16];
+			double dFrames = (double)r.qwFrames / config.iTransfers;
+
+			if (modes[m] == 0)
+			{
+				snprintf(szMode, sizeof(szMode), "ack+rep%d", BULK_REPEATS);
+			}
+			else
+			{
+				snprintf(szMode, sizeof(szMode), "parity %d", modes[m]);
+			}
+			printf("%6.2f %-10s %10.1f %8.0f%% %6.0f%% %8u %7.1fB/s %11.0f\n", config.losses[l], szMode, dFrames,
+				100.0 * (dFrames - dFragments) / dFragments, 100.0 * r.iIntact / config.iTransfers, r.dwRebuilt,
+				r.qwTransferUs ? (double)r.iIntact * config.iBytes / (r.qwTransferUs / 1e6) : 0.0,
+				r.qwTransferUs / 1e3 / config.iTransfers);
+			if (r.iCorrupt > 0)
+			{
+				printf("       %d transfers completed with the wrong content\n", r.iCorrupt);
+			}
+			fflush(stdout);
+		}
+	}
+	return 0;
+}
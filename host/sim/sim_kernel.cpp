@@ -0,0 +1,299 @@
+#include "sim_kernel.h"
+
+SimKernel *SimKernel::pActive = NULL;
+thread_local SimTask *SimKernel::pCurrent = NULL;
+
+SimKernel::SimKernel() : pRunning(NULL), qwNow(0), qwSeq(0), bStopping(false)
+{
+	pActive = this;
+}
+
+SimKernel::~SimKernel()
+{
+	Stop();
+	for (size_t i = 0; i < tasks.size(); i++)
+	{
+		delete tasks[i];
+	}
+	if (pActive == this)
+	{
+		pActive = NULL;
+	}
+}
+
+/*****************************************************************************
+* Function Name: SimKernel::Now()
+******************************************************************************
+* Summary:
+* Current virtual time in us, as seen by the caller
+**
+Note:
+* A running task sees the kernel time plus the cost it has charged since it was resumed.
+*****************************************************************************/
+uint64_t SimKernel::Now(void) const
+{
+	return qwNow + ((pCurrent != NULL) ? pCurrent->qwDebt : 0);
+}
+
+/*****************************************************************************
+* Function Name: SimKernel::NextEvent()
+******************************************************************************
+* Summary:
+* Time of the earliest pending event or task wake-up, SIM_FOREVER if there is none
+*****************************************************************************/
+uint64_t SimKernel::NextEvent(void) const
+{
+	return queue.empty() ? SIM_FOREVER : queue.top().qwTime;
+}
+
+/*****************************************************************************
+* Function Name: SimKernel::At()
+******************************************************************************
+* Summary:
+* Run fn on the kernel thread at qwTime
+*****************************************************************************/
+void SimKernel::At(uint64_t qwTime, std::function<void()> fn)
+{
+	Event e;
+
+	e.qwTime = (qwTime < Now()) ? Now() : qwTime;
+	e.qwSeq = qwSeq++;
+	e.pTask = NULL;
+	e.qwGeneration = 0;
+	e.fn = fn;
+	queue.push(e);
+}
+
+void SimKernel::Schedule(uint64_t qwTime, SimTask *pTask)
+{
+	Event e;
+
+	e.qwTime = qwTime;
+	e.qwSeq = qwSeq++;
+	e.pTask = pTask;
+	e.qwGeneration = pTask->qwGeneration;
+	queue.push(e);
+}
+
+/*****************************************************************************
+* Function Name: SimKernel::Spawn()
+******************************************************************************
+* Summary:
+* Create a task that runs body on behalf of pHost, starting at the current time
+**
+Parameters:
+* pHost: simulated MCU whose I2C bus and pins the task uses
+* body: the firmware, typically setup() followed by loop() forever
+* dwSeed: seed of the task's random() generator
+*****************************************************************************/
+SimTask *SimKernel::Spawn(SimHost *pHost, std::function<void()> body, uint32_t dwSeed)
+{
+	SimTask *pTask = new SimTask();
+
+	pTask->pHost = pHost;
+	pTask->rng.seed(dwSeed);
+	pTask->bSpinPin = 0xFF;
+	pTask->body = body;
+	pTask->qwGeneration = 0;
+	pTask->qwDebt = 0;
+	pTask->bWaitingIrq = false;
+	pTask->bDone = false;
+	tasks.push_back(pTask);
+
+	pTask->thread = std::thread([this, pTask]() {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			pTask->cv.wait(lock, [this, pTask]() { return pRunning == pTask; });
+		}
+		pCurrent = pTask;
+		try
+		{
+			if (!bStopping)
+			{
+				pTask->body();
+			}
+		}
+		catch (SimStop &)
+		{
+		}
+		std::unique_lock<std::mutex> lock(mutex);
+		pTask->bDone = true;
+		pRunning = NULL;
+		cvKernel.notify_one();
+	});
+	Schedule(qwNow, pTask);
+	return pTask;
+}
+
+/* Hand the baton to a task and wait until it blocks or ends */
+void SimKernel::Resume(SimTask *pTask)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	pRunning = pTask;
+	pTask->cv.notify_one();
+	cvKernel.wait(lock, [this]() { return pRunning == NULL; });
+}
+
+/* Hand the baton back to the kernel and wait to be resumed */
+void SimKernel::Yield(SimTask *pTask)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		pRunning = NULL;
+		cvKernel.notify_one();
+		pTask->cv.wait(lock, [this, pTask]() { return pRunning == pTask; });
+	}
+	if (bStopping)
+	{
+		throw SimStop();
+	}
+}
+
+/*****************************************************************************
+* Function Name: SimKernel::Run()
+******************************************************************************
+* Summary:
+* Advance virtual time to qwEnd, running every task and event that falls before it
+*****************************************************************************/
+void SimKernel::Run(uint64_t qwEnd)
+{
+	while (!queue.empty() && queue.top().qwTime <= qwEnd)
+	{
+		Event e = queue.top();
+		queue.pop();
+		if (e.qwTime > qwNow)
+		{
+			qwNow = e.qwTime;
+		}
+		if (e.pTask == NULL)
+		{
+			e.fn();
+		}
+		else if (!e.pTask->bDone && e.qwGeneration == e.pTask->qwGeneration)
+		{
+			Resume(e.pTask);
+		}
+	}
+	if (qwEnd != SIM_FOREVER && qwNow < qwEnd)
+	{
+		qwNow = qwEnd;
+	}
+}
+
+/*****************************************************************************
+* Function Name: SimKernel::Stop()
+******************************************************************************
+* Summary:
+* Unwind and join every task
+*****************************************************************************/
+void SimKernel::Stop(void)
+{
+	bStopping = true;
+	for (size_t i = 0; i < tasks.size(); i++)
+	{
+		if (!tasks[i]->bDone)
+		{
+			Resume(tasks[i]);
+		}
+		if (tasks[i]->thread.joinable())
+		{
+			tasks[i]->thread.join();
+		}
+	}
+}
+
+/*****************************************************************************
+* Function Name: SimKernel::Charge()
+******************************************************************************
+* Summary:
+* Account dwUs of CPU or bus time to the running task
+**
+Note:
+* Outside of a task (set-up code on the main thread) the kernel clock is advanced directly.
+*****************************************************************************/
+void SimKernel::Charge(uint32_t dwUs)
+{
+	if (pCurrent == NULL)
+	{
+		qwNow += dwUs;
+		return;
+	}
+	pCurrent->qwDebt += dwUs;
+	if (pCurrent->qwDebt >= SIM_QUANTUM_US)
+	{
+		SleepUntil(Now());
+	}
+}
+
+/*****************************************************************************
+* Function Name: SimKernel::SleepUntil()
+******************************************************************************
+* Summary:
+* Block the running task until qwTime
+*****************************************************************************/
+void SimKernel::SleepUntil(uint64_t qwTime)
+{
+	SimTask *pTask = pCurrent;
+
+	if (pTask == NULL)
+	{
+		if (qwTime > qwNow)
+		{
+			qwNow = qwTime;
+		}
+		return;
+	}
+	if (qwTime < Now())
+	{
+		qwTime = Now();
+	}
+	pTask->qwDebt = 0;
+	pTask->qwGeneration++;
+	Schedule(qwTime, pTask);
+	Yield(pTask);
+}
+
+/*****************************************************************************
+* Function Name: SimKernel::WaitIrq()
+******************************************************************************
+* Summary:
+* Block the running task until Wake() is called for it or qwDeadline passes
+*****************************************************************************/
+void SimKernel::WaitIrq(uint64_t qwDeadline)
+{
+	SimTask *pTask = pCurrent;
+
+	if (pTask == NULL)
+	{
+		return;
+	}
+	if (pTask->qwDebt)
+	{
+		SleepUntil(Now());
+	}
+	pTask->qwGeneration++;
+	pTask->bWaitingIrq = true;
+	if (qwDeadline != SIM_FOREVER)
+	{
+		Schedule(qwDeadline, pTask);
+	}
+	Yield(pTask);
+	pTask->bWaitingIrq = false;
+}
+
+/*****************************************************************************
+* Function Name: SimKernel::Wake()
+******************************************************************************
+* Summary:
+* Release a task blocked in WaitIrq() at the current time
+*****************************************************************************/
+void SimKernel::Wake(SimTask *pTask)
+{
+	if (pTask == NULL || !pTask->bWaitingIrq)
+	{
+		return;
+	}
+	pTask->bWaitingIrq = false;
+	pTask->qwGeneration++;
+	Schedule(Now(), pTask);
+}
@@ -0,0 +1,99 @@
+/*
+* File Name: sim_kernel.h
+**
+Description:
+* Virtual-time kernel for the PowerComms simulator.
+* Every simulated MCU runs its firmware on its own thread, but only one thread runs at a time: the kernel
+* hands control to the task with the earliest wake time and takes it back when the task blocks. Kernel
+* events (carrier on/off, ACK timeouts, ...) are run on the kernel thread in time order with the tasks.
+**
+Note:
+* Small costs such as a digitalRead() are accumulated per task and only turned into a context switch once
+* they exceed SIM_QUANTUM_US, so ordering between tasks is exact to within that quantum.
+*/
+
+#ifndef SIM_KERNEL_H
+#define SIM_KERNEL_H
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+
+#define SIM_FOREVER			UINT64_MAX
+#define SIM_QUANTUM_US		50
+
+class SimHost;
+class SimKernel;
+
+/* Thrown out of a blocked task when the kernel shuts down, to unwind the firmware stack */
+struct SimStop {};
+
+class SimTask {
+    friend class SimKernel;
+  public:
+    SimHost *pHost;
+    std::mt19937 rng;
+    uint8_t bSpinPin;		/* Pin of the previous call when it was a low interrupt line read, 0xFF otherwise */
+  private:
+    std::thread thread;
+    std::condition_variable cv;
+    std::function<void()> body;
+    uint64_t qwGeneration;	/* Bumped on every block, so stale wake-ups are dropped */
+    uint64_t qwDebt;		/* Time charged but not yet slept, in us */
+    bool bWaitingIrq;
+    bool bDone;
+};
+
+class SimKernel {
+  public:
+    SimKernel();
+    ~SimKernel();
+
+    uint64_t Now(void) const;
+    uint64_t NextEvent(void) const;
+    void At(uint64_t qwTime, std::function<void()> fn);
+    SimTask *Spawn(SimHost *pHost, std::function<void()> body, uint32_t dwSeed);
+    void Run(uint64_t qwEnd);
+    void Stop(void);
+
+    /* Task side */
+    void Charge(uint32_t dwUs);
+    void SleepUntil(uint64_t qwTime);
+    void WaitIrq(uint64_t qwDeadline);
+    void Wake(SimTask *pTask);
+
+    static SimKernel *pActive;
+    static thread_local SimTask *pCurrent;
+  private:
+    struct Event {
+      uint64_t qwTime;
+      uint64_t qwSeq;
+      SimTask *pTask;
+      uint64_t qwGeneration;
+      std::function<void()> fn;
+      bool operator>(const Event &other) const
+      {
+        return (qwTime != other.qwTime) ? (qwTime > other.qwTime) : (qwSeq > other.qwSeq);
+      }
+    };
+
+    void Schedule(uint64_t qwTime, SimTask *pTask);
+    void Resume(SimTask *pTask);
+    void Yield(SimTask *pTask);
+
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event> > queue;
+    std::vector<SimTask *> tasks;
+    std::mutex mutex;
+    std::condition_variable cvKernel;
+    SimTask *pRunning;		/* Task holding the baton, NULL when the kernel has it */
+    uint64_t qwNow;
+    uint64_t qwSeq;
+    bool bStopping;
+};
+
+#endif
@@ -0,0 +1,213 @@
+/*
+* File Name: sim_multi.cpp
+**
+Description:
+* Throughput of one host driving several PLC devices, each on its own circuit with a receiver at the far end.
+* The host either sends round-robin with the blocking TransmitPacket(), or keeps every device busy with
+* PLC_Scheduler. Every device always has a frame waiting, so the figures are the saturated rates.
+**
+Usage:
+* sim_multi [--modems 1,2,3,4] [--seconds 60] [--payload 8] [--seed 1]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "plc_i2c.h"
+#include "plc_scheduler.h"
+#include "plc_sim.h"
+
+#define SENDER_ADDRESS		0x01
+#define SINK_ADDRESS		0x02
+#define FIRST_INT_PIN		2
+
+static int iPayload = 8;
+static std::vector<uint64_t> sent;
+
+static byte NextFrame(byte bModem, byte *pbCommand, byte *pbData)
+{
+	*pbCommand = CMD_SENDMSG;
+	memset(pbData, bModem, iPayload);
+	return (byte)iPayload;
+}
+
+static void FrameDone(byte bModem, byte bStatus)
+{
+	if (bStatus & Status_TX_Data_Sent)
+	{
+		sent[bModem]++;
+	}
+}
+
+/*****************************************************************************
+* Function Name: HostMain()
+******************************************************************************
+* Summary:
+* Firmware of the host: bring up every modem, then send until the simulation ends
+*****************************************************************************/
+static void HostMain(int iModems, bool bScheduled)
+{
+	std::vector<PLC_I2C *> modems;
+	PLC_Scheduler scheduler;
+	byte bDestination = SINK_ADDRESS;
+	byte abData[MAX_PLC_PACKET_LENGTH];
+	byte bCommand;
+
+	scheduler.begin(NextFrame, FrameDone);
+	for (int i = 0; i < iModems; i++)
+	{
+		PLC_I2C *pModem = new PLC_I2C((byte)(PLC_ADDRESS + i), (byte)(FIRST_INT_PIN + i));
+
+		pModem->init(true);
+		pModem->SetDestinationAddress(TX_DA_Type_Log, &bDestination);
+		modems.push_back(pModem);
+		scheduler.Add(pModem);
+	}
+
+	try
+	{
+		for (;;)
+		{
+			if (bScheduled)
+			{
+				if (scheduler.Service() == 0)
+				{
+					SimIdle(SIM_FOREVER);
+				}
+				continue;
+			}
+			for (int i = 0; i < iModems; i++)
+			{
+				byte bLength = NextFrame((byte)i, &bCommand, abData);
+				FrameDone((byte)i, modems[i]->TransmitPacket(bCommand, abData, bLength));
+			}
+		}
+	}
+	catch (...)
+	{
+		for (size_t i = 0; i < modems.size(); i++)
+		{
+			delete modems[i];
+		}
+		throw;
+	}
+}
+
+/* The receiver on each circuit: release the RX buffer as soon as a frame lands */
+static void SinkInterrupt(SimChip *pChip)
+{
+	pChip->abReg[INT_Status] = 0;
+	pChip->abReg[RX_Message_INFO] = 0;
+}
+
+static double RunOnce(int iModems, bool bScheduled, double dSeconds, uint32_t dwSeed)
+{
+	SimKernel kernel;
+	std::vector<SimMedium *> media;
+	std::vector<SimChip *> chips;
+	SimHost host;
+	SimHost sinkHost;
+	uint64_t qwTotal = 0;
+
+	sent.assign(iModems, 0);
+	sinkHost.onInt = SinkInterrupt;
+	for (int i = 0; i < iModems; i++)
+	{
+		SimMedium *pMedium = new SimMedium(kernel, SimMediumConfig(), dwSeed + i);
+		SimChip *pSink;
+
+		media.push_back(pMedium);
+		chips.push_back(new SimChip(*pMedium, &host, (uint8_t)(PLC_ADDRESS + i), (uint8_t)(FIRST_INT_PIN + i), SENDER_ADDRESS, 0x0001000000000000ULL + i));
+		pSink = new SimChip(*pMedium, &sinkHost, (uint8_t)(0x40 + i), (uint8_t)(FIRST_INT_PIN + i), SINK_ADDRESS, 0x0002000000000000ULL + i);
+		pSink->abReg[PLC_Mode] = RX_Enable | RX_Override;
+		pSink->abReg[INT_Enable] = INT_RX_Data_Available;
+		chips.push_back(pSink);
+	}
+	host.pTask = kernel.Spawn(&host, [iModems, bScheduled]() { HostMain(iModems, bScheduled); }, dwSeed);
+	kernel.Run((uint64_t)(dSeconds * 1e6));
+	kernel.Stop();
+
+	for (int i = 0; i < iModems; i++)
+	{
+		qwTotal += sent[i];
+	}
+	for (size_t i = 0; i < chips.size(); i++)
+	{
+		delete chips[i];
+	}
+	for (size_t i = 0; i < media.size(); i++)
+	{
+		delete media[i];
+	}
+	return qwTotal / dSeconds;
+}
+
+static void Usage(void)
+{
+	fprintf(stderr, "usage: sim_multi [--modems 1,2,3,4] [--seconds 60] [--payload 8] [--seed 1]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<int> modems = { 1, 2, 3, 4 };
+	double dSeconds = 60;
+	uint32_t dwSeed = 1;
+
+	for (int i = 1; i < argc; i += 2)
+	{
+		if (i + 1 >= argc)
+		{
+			Usage();
+		}
+		if (!strcmp(argv[i], "--modems"))
+		{
+			modems.clear();
+			for (char *psz = strtok(argv[i + 1], ","); psz != NULL; psz = strtok(NULL, ","))
+			{
+				modems.push_back(atoi(psz));
+			}
+		}
+		else if (!strcmp(argv[i], "--seconds"))
+		{
+			dSeconds = atof(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "--payload"))
+		{
+			iPayload = atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "--seed"))
+		{
+			dwSeed = (uint32_t)atoi(argv[i + 1]);
+		}
+		else
+		{
+			Usage();
+		}
+	}
+	if (iPayload < 0 || iPayload > MAX_PLC_PACKET_LENGTH)
+	{
+		Usage();
+	}
+	for (size_t i = 0; i < modems.size(); i++)
+	{
+		if (modems[i] < 1 || modems[i] > PLC_SCHEDULER_MAX_MODEMS)
+		{
+			fprintf(stderr, "modem count must be 1..%d\n", PLC_SCHEDULER_MAX_MODEMS);
+			return 2;
+		}
+	}
+
+	printf("%7s %14s %14s %8s\n", "modems", "serial fr/s", "scheduled fr/s", "speedup");
+	for (size_t i = 0; i < modems.size(); i++)
+	{
+		double dSerial = RunOnce(modems[i], false, dSeconds, dwSeed);
+		double dScheduled = RunOnce(modems[i], true, dSeconds, dwSeed);
+
+		printf("%7d %14.2f %14.2f %7.2fx\n", modems[i], dSerial, dScheduled, dSerial > 0 ? dScheduled / dSerial : 0.0);
+		fflush(stdout);
+	}
+	return 0;
+}
@@ -0,0 +1,733 @@
+/*
+* File Name: sim_scale.cpp
+**
+Description:
+* Scaling study for a shared circuit. Every node is a simulated MCU running the PLC_I2C driver against its
+* own simulated CY8CPLC10, all on one SimMedium. Each node offers Poisson traffic and reports service
+* latency (queued to TransmitPacket() returning) and end-to-end latency (queued to the receiver reading it).
+**
+Usage:
+* sim_scale [--nodes 10,50,200] [--load 0.02,0.1,0.5] [--seconds 120] [--payload 8] [--pattern sink|random]
+*           [--seed 1] [--noise 60] [--loss 0] [--i2c-faults 0] [--profile 0] [--chip-boot 0]
+*           [--adaptive 0] [--dedup 0] [--tdma 0] [--guard 10] [--per-node nodes.csv]
+*
+* --load is frames per second offered by each node. With --pattern sink every node sends to node 1, which
+* only receives, as a head-end would; with random each frame goes to another node picked at random.
+* --i2c-faults is the chance of each I2C transaction failing; the driver's I2C health counters are then
+* summed over all nodes and printed under each row. --profile picks the plc_profile.h profile every node
+* is initialised with. --chip-boot is the power up time of the simulated chips in ms; the time each node
+* took to come up and be ready to send is then printed under each row. --adaptive 1 has every node address
+* its frames through a PLC_LinkTable, so the retry count and service type follow each link. With --adaptive
+* given, the data frames put on the line per frame offered, and for 1 the mean retry count the tables
+* settled on, are printed under each row. --dedup 1 tags every frame per destination and has the receivers
+* drop repeats with a PLC_DedupCache; with --dedup given, the duplicates that reached the CMD_SENDMSG
+* handler and those the caches dropped are printed under each row.
+* --tdma with a slot length in ms has the nodes share the line in time slots (plc_tdma.h) instead of
+* contending for it: node 1 sends the beacons and every sending node owns one slot, with --guard ms kept idle
+* at both ends of it. The beacons sent, heard and missed, and the times a node lost sync, are then printed
+* under each row.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#include "plc_i2c.h"
+#include "plc_profile.h"
+#include "plc_dispatch.h"
+#include "plc_schema.h"
+#include "plc_link.h"
+#include "plc_dedup.h"
+#include "plc_tdma.h"
+#include "plc_sim.h"
+
+#define MAX_QUEUE		32
+/* Sequence tag for PLC_DedupCache, sequence number and the time the frame was queued, in us */
+typedef PLC_Schema<PLC_DEDUP_TAG_BITS, 16, 32> ProbeMessage;
+#define MIN_PAYLOAD		ProbeMessage::bLength
+
+struct ScaleConfig {
+    std::vector<int> nodes;
+    std::vector<double> loads;
+    double dSeconds;
+    int iPayload;
+    bool bSink;
+    uint32_t dwSeed;
+    double dNoise;
+    double dLoss;
+    double dI2CFaults;
+    int iProfile;
+    double dChipBootMs;
+    int iAdaptive;				/* -1 when not given */
+    int iDedup;					/* -1 when not given */
+    int iTdmaSlotMs;			/* 0 for contention */
+    int iGuardMs;
+    const char *pszPerNode;
+};
+
+struct NodeStats {
+    uint64_t qwOffered;
+    uint64_t qwQueueDrops;
+    uint64_t qwSent;			/* TransmitPacket() returned Status_TX_Data_Sent */
+    uint64_t qwNoAck;
+    uint64_t qwDelivered;		/* Frames from this node read by their destination's host */
+    uint64_t qwDuplicates;
+    std::vector<uint32_t> service;
+    std::vector<uint32_t> endToEnd;
+    PLC_I2CHealth health;
+    uint32_t dwBootUs;			/* Start to end of driver setup */
+    uint32_t dwLinks;			/* Peers in the node's PLC_LinkTable at the end, and their retry counts */
+    uint32_t dwRetrySum;
+    uint32_t dwDedupDrops;		/* Repeats dropped by the node's PLC_DedupCache */
+    uint32_t dwBeacons;			/* PLC_Tdma counters at the end */
+    uint32_t dwMissed;
+    uint32_t dwLostSync;
+};
+
+struct RunResult {
+    int iNodes;
+    double dLoad;
+    uint64_t qwOffered;
+    uint64_t qwDelivered;
+    uint64_t qwDuplicates;
+    uint64_t qwNoAck;
+    uint64_t qwUnableToTX;
+    uint64_t qwRxDropped;
+    SimMediumStats medium;
+    PLC_I2CHealth health;
+    std::vector<uint32_t> boot;
+    uint32_t dwLinks;
+    uint32_t dwRetrySum;
+    uint64_t qwDedupDrops;
+    uint32_t dwBeaconsSent;
+    uint64_t qwBeaconsHeard;
+    uint64_t qwBeaconsMissed;
+    uint64_t qwLostSync;
+    std::vector<uint32_t> endToEnd;
+    std::vector<uint32_t> service;
+};
+
+static uint32_t Percentile(std::vector<uint32_t> &values, double dPercent)
+{
+	size_t i;
+
+	if (values.empty())
+	{
+		return 0;
+	}
+	i = (size_t)(dPercent / 100.0 * (values.size() - 1) + 0.5);
+	return values[i];
+}
+
+/* What a node's CMD_SENDMSG handler accounts received frames to */
+struct RxContext {
+    SimKernel *pKernel;
+    std::vector<NodeStats> *pStats;
+    std::vector<uint16_t> lastSeq;
+};
+
+/*****************************************************************************
+* Function Name: OnSendMsg()
+******************************************************************************
+* Summary:
+* Account a received frame to its source
+*****************************************************************************/
+static void OnSendMsg(const PLC_Frame *pFrame, void *pContext)
+{
+	RxContext &rx = *(RxContext *)pContext;
+	byte bSource = pFrame->pbSource[0];
+	uint16_t wSeq;
+	uint32_t dwQueued;
+
+	if (bSource == 0 || bSource > rx.pStats->size() || pFrame->bLength < ProbeMessage::bLength)
+	{
+		return;
+	}
+	NodeStats &source = (*rx.pStats)[bSource - 1];
+	wSeq = ProbeMessage::Get<1>(pFrame->pbData);
+	dwQueued = ProbeMessage::Get<2>(pFrame->pbData);
+	if (rx.lastSeq[bSource - 1] == wSeq)
+	{
+		source.qwDuplicates++;
+		return;
+	}
+	rx.lastSeq[bSource - 1] = wSeq;
+	source.qwDelivered++;
+	source.endToEnd.push_back((uint32_t)rx.pKernel->Now() - dwQueued);
+}
+
+/*****************************************************************************
+* Function Name: DrainReceived()
+******************************************************************************
+* Summary:
+* Read out the RX buffer if it holds a frame and dispatch it
+**
+Note:
+* An RX_Data_Available that arrived while TransmitPacket() waited for its result is kept by the driver, so
+* HOST_INT and INT_Status are enough to find every frame.
+*****************************************************************************/
+static void DrainReceived(PLC_I2C &plc, PLC_Dispatcher &dispatcher)
+{
+	dispatcher.Service(&plc);
+}
+
+/* A node's sending side, shared with its PLC_Tdma callbacks */
+struct TxContext {
+    SimKernel *pKernel;
+    const ScaleConfig *pConfig;
+    NodeStats *pSelf;
+    std::deque<uint64_t> queue;
+    std::vector<byte> abTag;	/* Sequence tag of the next frame to each node */
+    byte bLocal;
+    uint16_t wSeq;
+    uint64_t qwInFlight;		/* When the frame in flight was queued */
+};
+
+/*****************************************************************************
+* Function Name: NextFrame()
+******************************************************************************
+* Summary:
+* Take the oldest queued frame, pick its destination and fill in its payload
+**
+Return:
+* The destination
+*****************************************************************************/
+static byte NextFrame(TxContext &tx, byte *pbPayload)
+{
+	std::mt19937 &rng = SimKernel::pCurrent->rng;
+	byte bNodes = (byte)tx.abTag.size();
+	byte bTarget = 1;
+
+	tx.qwInFlight = tx.queue.front();
+	tx.queue.pop_front();
+	if (!tx.pConfig->bSink)
+	{
+		do
+		{
+			bTarget = (byte)(1 + rng() % bNodes);
+		} while (bTarget == tx.bLocal);
+	}
+	tx.wSeq++;
+	ProbeMessage::Set<0>(pbPayload, tx.abTag[bTarget - 1]);
+	tx.abTag[bTarget - 1] = PLC_DedupCache::NextTag(tx.abTag[bTarget - 1]);
+	ProbeMessage::Set<1>(pbPayload, tx.wSeq);
+	ProbeMessage::Set<2>(pbPayload, (uint32_t)tx.qwInFlight);
+	return bTarget;
+}
+
+/* Account the result of the frame in flight */
+static void FrameDone(TxContext &tx, byte bResult)
+{
+	if (bResult & Status_TX_Data_Sent)
+	{
+		tx.pSelf->qwSent++;
+		tx.pSelf->service.push_back((uint32_t)(tx.pKernel->Now() - tx.qwInFlight));
+	}
+	else
+	{
+		tx.pSelf->qwNoAck++;
+	}
+}
+
+/* PLC_Tdma callbacks */
+static byte TdmaSource(void *pContext, byte *pbAddress, byte *pbCommand, byte *pbData)
+{
+	TxContext &tx = *(TxContext *)pContext;
+
+	if (tx.queue.empty())
+	{
+		return PLC_NO_FRAME;
+	}
+	memset(pbData, 0, tx.pConfig->iPayload);
+	*pbAddress = NextFrame(tx, pbData);
+	*pbCommand = CMD_SENDMSG;
+	return (byte)tx.pConfig->iPayload;
+}
+
+static void TdmaDone(void *pContext, byte bAddress, byte bStatus)
+{
+	FrameDone(*(TxContext *)pContext, bStatus);
+}
+
+/*****************************************************************************
+* Function Name: FrameMs()
+******************************************************************************
+* Summary:
+* Time a frame of iPayload bytes takes on the simulated line with a profile, with its ACK and the quiet time
+* after it, for PLC_TdmaConfig::wFrameMs. Retries are left out, see plc_tdma.h.
+*****************************************************************************/
+static word FrameMs(const PLC_Profile &profile, int iPayload)
+{
+	static const uint32_t adwDelayMs[4] = { 7, 13, 19, 25 };
+	static const uint32_t adwBitRate[4] = { 600, 1200, 1800, 2400 };
+	SimMediumConfig medium;
+	uint64_t qwDelayUs = adwDelayMs[(profile.bModemConfig & Modem_TXDelay) >> 5] * 1000ULL;
+	uint32_t dwBitRate = adwBitRate[profile.bModemConfig & Modem_BPS];
+	uint64_t qwFrameUs;
+
+	qwFrameUs = qwDelayUs + (SIM_FRAME_OVERHEAD + iPayload + 2) * 8000000ULL / dwBitRate + medium.dwInterFrameUs;
+	if (profile.bTxConfig & TX_Service_Type)
+	{
+		qwFrameUs += medium.dwTurnaroundUs + qwDelayUs + SIM_ACK_BYTES * 8000000ULL / dwBitRate;
+	}
+	return (word)((qwFrameUs + 999) / 1000);
+}
+
+/*****************************************************************************
+* Function Name: NodeMain()
+******************************************************************************
+* Summary:
+* Firmware of one simulated node
+*****************************************************************************/
+static void NodeMain(SimKernel &kernel, int iIndex, const ScaleConfig &config, double dLoad, std::vector<NodeStats> &stats)
+{
+	PLC_I2C plc;
+	NodeStats &self = stats[iIndex];
+	PLC_Dispatcher dispatcher;
+	PLC_LinkTable links;
+	PLC_DedupCache dedup;
+	PLC_Tdma tdma;
+	PLC_TdmaConfig tdmaConfig;
+	RxContext rx = { &kernel, &stats, std::vector<uint16_t>(stats.size(), 0xFFFF) };
+	TxContext tx = { &kernel, &config, &self, std::deque<uint64_t>(), std::vector<byte>(stats.size(), 0), 0, 0, 0 };
+	std::deque<uint64_t> &queue = tx.queue;
+	std::mt19937 &rng = SimKernel::pCurrent->rng;
+	std::exponential_distribution<double> gap(dLoad > 0 ? dLoad : 1.0);
+	bool bSender = dLoad > 0 && !(config.bSink && iIndex == 0);
+	uint64_t qwNextArrival = bSender ? kernel.Now() + (uint64_t)(gap(rng) * 1e6) : SIM_FOREVER;
+	byte bLocal = (byte)(iIndex + 1);
+	byte bDestination = 0;
+	byte abPayload[MAX_PLC_PACKET_LENGTH];
+	byte bTemp;
+	PLC_Profile profile;
+
+	PLC_GetProfile((byte)config.iProfile, &profile);
+	plc.init(true, &profile);
+	bTemp = TX_Enable | RX_Enable | RX_Override;
+	plc.WriteToOffset(PLC_Mode, &bTemp, 1);
+	plc.WriteToOffset(Local_LA_LSB, &bLocal, 1);
+	if (config.iAdaptive > 0)
+	{
+		links.begin(&plc);
+	}
+	memset(abPayload, 0, sizeof(abPayload));
+	dispatcher.begin();
+	dispatcher.Register(CMD_SENDMSG, OnSendMsg, &rx, config.iDedup > 0);
+	if (config.iDedup > 0)
+	{
+		dedup.begin();
+		dispatcher.SetDedup(&dedup);
+	}
+	tx.bLocal = bLocal;
+	if (config.iTdmaSlotMs > 0)
+	{
+		/* Node 1 sends the beacons; with --pattern sink it sends nothing else and owns no slot */
+		tdmaConfig.wSlotMs = (word)config.iTdmaSlotMs;
+		tdmaConfig.bSlots = (byte)(config.bSink ? stats.size() - 1 : stats.size());
+		tdmaConfig.bGuardMs = (byte)config.iGuardMs;
+		tdmaConfig.wFrameMs = FrameMs(profile, config.iPayload);
+		tdmaConfig.bGroup = PLC_TDMA_GROUP;
+		tdmaConfig.dwSlots = 0;
+		if (bSender)
+		{
+			tdmaConfig.dwSlots = 1UL << (config.bSink ? iIndex - 1 : iIndex);
+		}
+		tdma.begin(&plc, &tdmaConfig, iIndex == 0, TdmaSource, TdmaDone, &tx);
+		tdma.Attach(&dispatcher);
+	}
+	self.dwBootUs = (uint32_t)kernel.Now();
+
+	for (;;)
+	{
+		while (qwNextArrival <= kernel.Now())
+		{
+			self.qwOffered++;
+			if (queue.size() < MAX_QUEUE)
+			{
+				queue.push_back(qwNextArrival);
+			}
+			else
+			{
+				self.qwQueueDrops++;
+			}
+			qwNextArrival += (uint64_t)(gap(rng) * 1e6) + 1;
+		}
+
+		if (config.iTdmaSlotMs > 0)
+		{
+			/* Frames go out from tdma.Service() when a slot allows; sleep until that or a line event */
+			if (tdma.Service() + dispatcher.Service(&plc) == 0)
+			{
+				uint64_t qwWake = qwNextArrival;
+				unsigned long dwIdle = tdma.Idle();
+
+				if ((iIndex == 0 || !queue.empty()) && dwIdle != PLC_TDMA_NEVER)
+				{
+					qwWake = std::min(qwWake, kernel.Now() + (uint64_t)dwIdle * 1000);
+				}
+				SimIdle(qwWake);
+			}
+		}
+		else if (!queue.empty())
+		{
+			byte bTarget = NextFrame(tx, abPayload);
+			byte bResult;
+
+			if (config.iAdaptive > 0)
+			{
+				links.Prepare(bTarget);
+			}
+			else if (bTarget != bDestination)
+			{
+				bDestination = bTarget;
+				plc.SetDestinationAddress(TX_DA_Type_Log, &bDestination);
+			}
+			bResult = plc.TransmitPacket(CMD_SENDMSG, abPayload, config.iPayload);
+			if (config.iAdaptive > 0)
+			{
+				links.Record(bTarget, bResult);
+			}
+			FrameDone(tx, bResult);
+		}
+		else
+		{
+			SimIdle(qwNextArrival);
+		}
+		if (config.iTdmaSlotMs == 0)
+		{
+			DrainReceived(plc, dispatcher);
+		}
+		self.health = plc.health;
+		self.dwDedupDrops = config.iDedup > 0 ? dedup.wDuplicates : 0;
+		self.dwBeacons = tdma.wBeacons;
+		self.dwMissed = tdma.wMissed;
+		self.dwLostSync = tdma.wLostSync;
+		self.dwLinks = links.Count();
+		self.dwRetrySum = 0;
+		for (byte i = 0; i < links.Count(); i++)
+		{
+			self.dwRetrySum += links.Entry(i)->bRetry;
+		}
+	}
+}
+
+/*****************************************************************************
+* Function Name: RunOnce()
+******************************************************************************
+* Summary:
+* Simulate one node count at one offered load
+*****************************************************************************/
+static RunResult RunOnce(const ScaleConfig &config, int iNodes, double dLoad, FILE *pPerNode)
+{
+	SimMediumConfig mediumConfig;
+	RunResult result = RunResult();
+	std::vector<NodeStats> stats(iNodes);
+	std::vector<SimHost *> hosts;
+	std::vector<SimChip *> chips;
+
+	mediumConfig.dNoiseFloor = config.dNoise;
+	mediumConfig.dLossRate = config.dLoss;
+
+	{
+		SimKernel kernel;
+		SimMedium medium(kernel, mediumConfig, config.dwSeed);
+
+		for (int i = 0; i < iNodes; i++)
+		{
+			SimHost *pHost = new SimHost();
+			SimChip *pChip = new SimChip(medium, pHost, PLC_ADDRESS, 2, (uint8_t)(i + 1), 0x0001000000000000ULL + i);
+			pHost->dI2CFaultRate = config.dI2CFaults;
+			pChip->qwReadyUs = (uint64_t)(config.dChipBootMs * 1000);
+			hosts.push_back(pHost);
+			chips.push_back(pChip);
+			pHost->pTask = kernel.Spawn(pHost, [&kernel, i, &config, dLoad, &stats]() {
+				NodeMain(kernel, i, config, dLoad, stats);
+			}, config.dwSeed * 7919 + i);
+		}
+		kernel.Run((uint64_t)(config.dSeconds * 1e6));
+		kernel.Stop();
+
+		result.iNodes = iNodes;
+		result.dLoad = dLoad;
+		result.medium = medium.stats;
+		for (int i = 0; i < iNodes; i++)
+		{
+			NodeStats &node = stats[i];
+
+			result.qwOffered += node.qwOffered;
+			result.qwDelivered += node.qwDelivered;
+			result.qwDuplicates += node.qwDuplicates;
+			result.qwNoAck += node.qwNoAck;
+			result.qwUnableToTX += chips[i]->stats.qwUnableToTX;
+			result.qwRxDropped += chips[i]->stats.qwRxDropped;
+			result.health.wAddressNack += node.health.wAddressNack;
+			result.health.wDataNack += node.health.wDataNack;
+			result.health.wBusError += node.health.wBusError;
+			result.health.wShortRead += node.health.wShortRead;
+			result.health.wRetries += node.health.wRetries;
+			result.health.wRecoveries += node.health.wRecoveries;
+			result.health.wFailures += node.health.wFailures;
+			result.health.wLostStatus += node.health.wLostStatus;
+			result.boot.push_back(node.dwBootUs);
+			result.qwDedupDrops += node.dwDedupDrops;
+			if (i == 0)
+			{
+				result.dwBeaconsSent = node.dwBeacons;
+			}
+			else
+			{
+				result.qwBeaconsHeard += node.dwBeacons;
+				result.qwBeaconsMissed += node.dwMissed;
+				result.qwLostSync += node.dwLostSync;
+			}
+			result.dwLinks += node.dwLinks;
+			result.dwRetrySum += node.dwRetrySum;
+			result.endToEnd.insert(result.endToEnd.end(), node.endToEnd.begin(), node.endToEnd.end());
+			result.service.insert(result.service.end(), node.service.begin(), node.service.end());
+
+			if (pPerNode != NULL)
+			{
+				std::sort(node.endToEnd.begin(), node.endToEnd.end());
+				fprintf(pPerNode, "%d,%g,%d,%llu,%llu,%llu,%llu,%llu,%llu,%.1f,%.1f,%.1f,%.1f\n", iNodes, dLoad, i + 1,
+					(unsigned long long)node.qwOffered, (unsigned long long)node.qwQueueDrops, (unsigned long long)node.qwSent,
+					(unsigned long long)node.qwNoAck, (unsigned long long)chips[i]->stats.qwUnableToTX, (unsigned long long)node.qwDelivered,
+					Percentile(node.endToEnd, 50) / 1000.0, Percentile(node.endToEnd, 90) / 1000.0,
+					Percentile(node.endToEnd, 99) / 1000.0, node.endToEnd.empty() ? 0.0 : node.endToEnd.back() / 1000.0);
+			}
+		}
+	}
+	for (size_t i = 0; i < chips.size(); i++)
+	{
+		delete chips[i];
+		delete hosts[i];
+	}
+	std::sort(result.boot.begin(), result.boot.end());
+	std::sort(result.endToEnd.begin(), result.endToEnd.end());
+	std::sort(result.service.begin(), result.service.end());
+	return result;
+}
+
+static void ParseList(const char *pszArg, std::vector<double> &values)
+{
+	std::string list(pszArg);
+	size_t start = 0;
+
+	values.clear();
+	while (start <= list.size())
+	{
+		size_t end = list.find(',', start);
+		if (end == std::string::npos)
+		{
+			end = list.size();
+		}
+		values.push_back(atof(list.substr(start, end - start).c_str()));
+		start = end + 1;
+	}
+}
+
+static void Usage(void)
+{
+	fprintf(stderr, "usage: sim_scale [--nodes 10,50,200] [--load 0.02,0.1,0.5] [--seconds 120] [--payload 8]\n"
+		"                 [--pattern sink|random] [--seed 1] [--noise 60] [--loss 0] [--i2c-faults 0]\n"
+		"                 [--profile 0..%d] [--chip-boot 0] [--adaptive 0|1] [--dedup 0|1]\n"
+		"                 [--tdma slot_ms] [--guard 10] [--per-node file.csv]\n", PLC_PROFILE_COUNT - 1);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	ScaleConfig config;
+	std::vector<double> values;
+	FILE *pPerNode = NULL;
+
+	config.nodes = { 10, 50, 200 };
+	config.loads = { 0.02, 0.1, 0.5 };
+	config.dSeconds = 120;
+	config.iPayload = 8;
+	config.bSink = true;
+	config.dwSeed = 1;
+	config.dNoise = 60;
+	config.dLoss = 0;
+	config.dI2CFaults = 0;
+	config.iProfile = PLC_PROFILE_DEFAULT;
+	config.dChipBootMs = 0;
+	config.iAdaptive = -1;
+	config.iDedup = -1;
+	config.iTdmaSlotMs = 0;
+	config.iGuardMs = 10;
+	config.pszPerNode = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *pszValue = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (pszValue == NULL)
+		{
+			Usage();
+		}
+		if (!strcmp(argv[i], "--nodes"))
+		{
+			ParseList(pszValue, values);
+			config.nodes.assign(values.begin(), values.end());
+		}
+		else if (!strcmp(argv[i], "--load"))
+		{
+			ParseList(pszValue, config.loads);
+		}
+		else if (!strcmp(argv[i], "--seconds"))
+		{
+			config.dSeconds = atof(pszValue);
+		}
+		else if (!strcmp(argv[i], "--payload"))
+		{
+			config.iPayload = atoi(pszValue);
+		}
+		else if (!strcmp(argv[i], "--pattern"))
+		{
+			config.bSink = strcmp(pszValue, "random") != 0;
+		}
+		else if (!strcmp(argv[i], "--seed"))
+		{
+			config.dwSeed = (uint32_t)atoi(pszValue);
+		}
+		else if (!strcmp(argv[i], "--noise"))
+		{
+			config.dNoise = atof(pszValue);
+		}
+		else if (!strcmp(argv[i], "--loss"))
+		{
+			config.dLoss = atof(pszValue);
+		}
+		else if (!strcmp(argv[i], "--i2c-faults"))
+		{
+			config.dI2CFaults = atof(pszValue);
+		}
+		else if (!strcmp(argv[i], "--profile"))
+		{
+			config.iProfile = atoi(pszValue);
+			if (config.iProfile < 0 || config.iProfile >= PLC_PROFILE_COUNT)
+			{
+				Usage();
+			}
+		}
+		else if (!strcmp(argv[i], "--chip-boot"))
+		{
+			config.dChipBootMs = atof(pszValue);
+		}
+		else if (!strcmp(argv[i], "--adaptive"))
+		{
+			config.iAdaptive = atoi(pszValue) != 0;
+		}
+		else if (!strcmp(argv[i], "--dedup"))
+		{
+			config.iDedup = atoi(pszValue) != 0;
+		}
+		else if (!strcmp(argv[i], "--tdma"))
+		{
+			config.iTdmaSlotMs = atoi(pszValue);
+		}
+		else if (!strcmp(argv[i], "--guard"))
+		{
+			config.iGuardMs = atoi(pszValue);
+		}
+		else if (!strcmp(argv[i], "--per-node"))
+		{
+			config.pszPerNode = pszValue;
+		}
+		else
+		{
+			Usage();
+		}
+		i++;
+	}
+	if (config.iPayload < MIN_PAYLOAD || config.iPayload > MAX_PLC_PACKET_LENGTH)
+	{
+		fprintf(stderr, "payload must be %d..%d bytes\n", MIN_PAYLOAD, MAX_PLC_PACKET_LENGTH);
+		return 2;
+	}
+	for (size_t i = 0; i < config.nodes.size(); i++)
+	{
+		if (config.nodes[i] < 2 || config.nodes[i] > 250)
+		{
+			fprintf(stderr, "node count must be 2..250\n");
+			return 2;
+		}
+		if (config.iTdmaSlotMs > 0 && (config.bSink ? config.nodes[i] - 1 : config.nodes[i]) > PLC_TDMA_MAX_SLOTS)
+		{
+			fprintf(stderr, "--tdma takes up to %d sending nodes\n", PLC_TDMA_MAX_SLOTS);
+			return 2;
+		}
+	}
+	if (config.pszPerNode != NULL)
+	{
+		pPerNode = fopen(config.pszPerNode, "w");
+		if (pPerNode == NULL)
+		{
+			perror(config.pszPerNode);
+			return 1;
+		}
+		fprintf(pPerNode, "nodes,load,node,offered,queue_drops,sent,no_ack,unable_to_tx,delivered,e2e_p50_ms,e2e_p90_ms,e2e_p99_ms,e2e_max_ms\n");
+	}
+
+	printf("%6s %7s %9s %9s %10s %7s %8s %7s %6s %6s %9s %9s %9s %9s\n", "nodes", "load/s", "offered/s", "deliver/s",
+		"goodput", "deliv%", "collide%", "line%", "noack", "biu_to", "svc_p50", "e2e_p50", "e2e_p90", "e2e_p99");
+	for (size_t n = 0; n < config.nodes.size(); n++)
+	{
+		for (size_t l = 0; l < config.loads.size(); l++)
+		{
+			RunResult r = RunOnce(config, config.nodes[n], config.loads[l], pPerNode);
+			uint64_t qwOnAir = r.medium.qwFrames + r.medium.qwAcks;
+
+			printf("%6d %7.3f %9.2f %9.2f %8.1fB/s %6.1f%% %7.1f%% %6.1f%% %6llu %6llu %7.0fms %7.0fms %7.0fms %7.0fms\n",
+				r.iNodes, r.dLoad, r.qwOffered / config.dSeconds, r.qwDelivered / config.dSeconds,
+				r.qwDelivered * config.iPayload / config.dSeconds,
+				r.qwOffered ? 100.0 * r.qwDelivered / r.qwOffered : 0.0,
+				qwOnAir ? 100.0 * r.medium.qwCollided / qwOnAir : 0.0,
+				100.0 * r.medium.qwBusyUs / (config.dSeconds * 1e6),
+				(unsigned long long)r.qwNoAck, (unsigned long long)r.qwUnableToTX,
+				Percentile(r.service, 50) / 1000.0, Percentile(r.endToEnd, 50) / 1000.0,
+				Percentile(r.endToEnd, 90) / 1000.0, Percentile(r.endToEnd, 99) / 1000.0);
+			if (config.dI2CFaults > 0)
+			{
+				printf("       i2c: addr_nack %u data_nack %u bus_error %u short_read %u retries %u recoveries %u failures %u lost_status %u\n",
+					r.health.wAddressNack, r.health.wDataNack, r.health.wBusError, r.health.wShortRead, r.health.wRetries,
+					r.health.wRecoveries, r.health.wFailures, r.health.wLostStatus);
+			}
+			if (config.dChipBootMs > 0)
+			{
+				printf("       boot: chip ready %.0fms, node ready p50 %.1fms max %.1fms\n", config.dChipBootMs,
+					Percentile(r.boot, 50) / 1000.0, r.boot.empty() ? 0.0 : r.boot.back() / 1000.0);
+			}
+			if (config.iAdaptive >= 0)
+			{
+				printf("       links: %.2f data frames on the line per frame offered", r.qwOffered ? (double)r.medium.qwFrames / r.qwOffered : 0.0);
+				if (config.iAdaptive > 0)
+				{
+					printf(", mean retry count %.2f over %u peers", r.dwLinks ? (double)r.dwRetrySum / r.dwLinks : 0.0, r.dwLinks);
+				}
+				printf("\n");
+			}
+			if (config.iTdmaSlotMs > 0)
+			{
+				printf("       tdma: %u beacons sent, %.1f%% heard, %llu missed, sync lost %llu times\n", r.dwBeaconsSent,
+					r.dwBeaconsSent ? 100.0 * r.qwBeaconsHeard / ((double)r.dwBeaconsSent * (r.iNodes - 1)) : 0.0,
+					(unsigned long long)r.qwBeaconsMissed, (unsigned long long)r.qwLostSync);
+			}
+			if (config.iDedup >= 0)
+			{
+				printf("       dedup: %llu duplicates reached the handler, %llu dropped by the caches\n",
+					(unsigned long long)r.qwDuplicates, (unsigned long long)r.qwDedupDrops);
+			}
+			fflush(stdout);
+		}
+	}
+	if (pPerNode != NULL)
+	{
+		fclose(pPerNode);
+	}
+	return 0;
+}
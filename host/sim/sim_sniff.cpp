@@ -0,0 +1,226 @@
+/*
+* File Name: sim_sniff.cpp
+**
+Description:
+* Checks that the PLC_Sniffer capture path keeps up with a saturated line. Several talkers send back to back
+* to each other while one node runs the sniffer, with its stream drained at the Serial baud rate. Every frame
+* the sniffer's PLC device decoded should come out of the stream, with no Status_RX_Packet_Dropped and no
+* ring overflow.
+**
+Usage:
+* sim_sniff [--talkers 4] [--seconds 60] [--baud 115200] [--seed 1] [--out capture.bin]
+*
+* Payloads are 1 to MAX_PLC_PACKET_LENGTH bytes at random. --out saves the stream for plc_sniffconv.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "plc_i2c.h"
+#include "plc_sniffer.h"
+#include "plc_sim.h"
+
+#define SERIAL_TX_BUFFER	64		/* Bytes buffered by the Arduino HardwareSerial driver */
+#define SNIFFER_ADDRESS		0x7F
+
+struct SniffResult {
+    uint64_t qwHeard;			/* Frames the sniffer's PLC device put in its RX buffer */
+    uint64_t qwChipDropped;
+    PLC_SnifferStats stats;
+    uint64_t qwStreamBytes;
+    double dLineBusy;
+    uint32_t dwMaxPending;		/* Ring high water mark */
+};
+
+/*****************************************************************************
+* Function Name: TalkerMain()
+******************************************************************************
+* Summary:
+* Firmware of a talker: send frames of random length to random other talkers, back to back
+*****************************************************************************/
+static void TalkerMain(int iIndex, int iTalkers)
+{
+	PLC_I2C plc;
+	std::mt19937 &rng = SimKernel::pCurrent->rng;
+	byte bLocal = (byte)(iIndex + 1);
+	byte bDestination;
+	byte abPayload[MAX_PLC_PACKET_LENGTH];
+	byte bLength;
+
+	plc.init(true);
+	plc.WriteToOffset(Local_LA_LSB, &bLocal, 1);
+	for (;;)
+	{
+		bDestination = (byte)(1 + (iIndex + 1 + rng() % (iTalkers - 1)) % iTalkers);
+		plc.SetDestinationAddress(TX_DA_Type_Log, &bDestination);
+		bLength = (byte)(1 + rng() % MAX_PLC_PACKET_LENGTH);
+		memset(abPayload, bLocal, bLength);
+		plc.TransmitPacket(CMD_SENDMSG, abPayload, bLength);
+	}
+}
+
+/*****************************************************************************
+* Function Name: SnifferMain()
+******************************************************************************
+* Summary:
+* Firmware of the sniffer: the capture loop of the sketch, with Serial modelled as a byte rate
+*****************************************************************************/
+static void SnifferMain(SimKernel &kernel, uint32_t dwBaud, FILE *pOut, SniffResult &result, PLC_Sniffer &sniffer)
+{
+	PLC_I2C plc;
+	byte bLocal = SNIFFER_ADDRESS;
+	byte abChunk[SERIAL_TX_BUFFER];
+	double dByteUs = 10e6 / dwBaud;		/* 8N1 */
+	double dSerialFill = 0;
+	uint64_t qwLast;
+	byte bCount;
+
+	plc.init(false);
+	plc.WriteToOffset(Local_LA_LSB, &bLocal, 1);
+	sniffer.begin(&plc);
+	qwLast = kernel.Now();
+	for (;;)
+	{
+		sniffer.Service();
+
+		/* Serial.availableForWrite(): what the UART has sent since the last pass is free again */
+		dSerialFill -= (kernel.Now() - qwLast) / dByteUs;
+		if (dSerialFill < 0)
+		{
+			dSerialFill = 0;
+		}
+		qwLast = kernel.Now();
+		if (sniffer.Pending() > result.dwMaxPending)
+		{
+			result.dwMaxPending = sniffer.Pending();
+		}
+		bCount = sniffer.Read(abChunk, (byte)(SERIAL_TX_BUFFER - (int)(dSerialFill + 0.999)));
+		dSerialFill += bCount;
+		result.qwStreamBytes += bCount;
+		if (pOut != NULL && bCount > 0)
+		{
+			fwrite(abChunk, 1, bCount, pOut);
+		}
+		SimIdle(sniffer.Pending() > 0 ? kernel.Now() + (uint64_t)(dByteUs * 16) : kernel.Now() + 100000);
+	}
+}
+
+static SniffResult RunOnce(int iTalkers, double dSeconds, uint32_t dwBaud, uint32_t dwSeed, FILE *pOut)
+{
+	SimKernel kernel;
+	SimMedium medium(kernel, SimMediumConfig(), dwSeed);
+	std::vector<SimHost *> hosts;
+	std::vector<SimChip *> chips;
+	PLC_Sniffer sniffer;
+	SniffResult result;
+
+	memset(&result, 0, sizeof(result));
+	for (int i = 0; i <= iTalkers; i++)
+	{
+		SimHost *pHost = new SimHost();
+		bool bSniffer = (i == iTalkers);
+
+		hosts.push_back(pHost);
+		chips.push_back(new SimChip(medium, pHost, PLC_ADDRESS, 2, bSniffer ? SNIFFER_ADDRESS : (uint8_t)(i + 1),
+			0x0001000000000000ULL + i));
+		if (bSniffer)
+		{
+			pHost->pTask = kernel.Spawn(pHost, [&kernel, dwBaud, pOut, &result, &sniffer]() {
+				SnifferMain(kernel, dwBaud, pOut, result, sniffer);
+			}, dwSeed * 7919 + i);
+		}
+		else
+		{
+			pHost->pTask = kernel.Spawn(pHost, [i, iTalkers]() { TalkerMain(i, iTalkers); }, dwSeed * 7919 + i);
+		}
+	}
+	kernel.Run((uint64_t)(dSeconds * 1e6));
+	kernel.Stop();
+
+	result.qwHeard = chips[iTalkers]->stats.qwRxFrames;
+	result.qwChipDropped = chips[iTalkers]->stats.qwRxDropped;
+	result.stats = sniffer.stats;
+	result.dLineBusy = medium.stats.qwBusyUs / (dSeconds * 1e6);
+	for (size_t i = 0; i < chips.size(); i++)
+	{
+		delete chips[i];
+		delete hosts[i];
+	}
+	return result;
+}
+
+static void Usage(void)
+{
+	fprintf(stderr, "usage: sim_sniff [--talkers 4] [--seconds 60] [--baud 115200] [--seed 1] [--out capture.bin]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int iTalkers = 4;
+	double dSeconds = 60;
+	uint32_t dwBaud = 115200;
+	uint32_t dwSeed = 1;
+	const char *pszOut = NULL;
+	FILE *pOut = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *pszValue = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (pszValue == NULL)
+		{
+			Usage();
+		}
+		if (!strcmp(argv[i], "--talkers"))
+		{
+			iTalkers = atoi(pszValue);
+		}
+		else if (!strcmp(argv[i], "--seconds"))
+		{
+			dSeconds = atof(pszValue);
+		}
+		else if (!strcmp(argv[i], "--baud"))
+		{
+			dwBaud = (uint32_t)atol(pszValue);
+		}
+		else if (!strcmp(argv[i], "--seed"))
+		{
+			dwSeed = (uint32_t)atol(pszValue);
+		}
+		else if (!strcmp(argv[i], "--out"))
+		{
+			pszOut = pszValue;
+		}
+		else
+		{
+			Usage();
+		}
+		i++;
+	}
+	if (iTalkers < 2 || dSeconds <= 0 || dwBaud == 0)
+	{
+		Usage();
+	}
+	if (pszOut != NULL && (pOut = fopen(pszOut, "wb")) == NULL)
+	{
+		perror(pszOut);
+		return 1;
+	}
+
+	SniffResult r = RunOnce(iTalkers, dSeconds, dwBaud, dwSeed, pOut);
+
+	printf("line busy %.1f%%, %.2f frames/s heard by the sniffer's PLC device\n", r.dLineBusy * 100, r.qwHeard / dSeconds);
+	printf("captured %lu of %llu, PLC device drops %u (sim %llu), ring drops %u, ring high water %u/%d bytes\n",
+		(unsigned long)r.stats.dwFrames, (unsigned long long)r.qwHeard, r.stats.wChipDrops,
+		(unsigned long long)r.qwChipDropped, r.stats.wRingDrops, r.dwMaxPending, PLC_SNIFFER_RING);
+	printf("stream %.0f B/s at %u baud (%.0f%% of the link)\n", r.qwStreamBytes / dSeconds, dwBaud,
+		r.qwStreamBytes / dSeconds * 10 * 100 / dwBaud);
+	if (pOut != NULL)
+	{
+		fclose(pOut);
+	}
+	return 0;
+}
@@ -0,0 +1,762 @@
+/*
+* File Name: sim_sweep.cpp
+**
+Description:
+* Modem setting sweep. For every combination of Modem_Config TX delay, FSK bandwidth and bit rate, TX_Gain
+* and RX_Gain given, and every traffic scenario (node count, offered load, noise floor, loss), a network of
+* simulated nodes runs the same traffic with those settings written over a plc_profile.h profile. Each point
+* reports goodput, delivery, end-to-end latency (queued to the receiver reading it), retries, frames given up
+* without an ACK, band-in-use events and line use, so site profiles can be picked from data.
+* The points are independent simulations and run in --jobs processes at a time. Rows are printed in grid
+* order, followed for each scenario by the point with the highest goodput, latency deciding between points
+* within 1% of it, as the PLC_Profile fields to use.
+**
+Usage:
+* sim_sweep [--delay 7,13,19,25] [--bw 1.5,3] [--bps 600,1200,1800,2400] [--tx-gain 14] [--rx-gain 1]
+*           [--nodes 10] [--load 0.5] [--noise 60] [--loss 0] [--payload 8] [--pattern sink|random]
+*           [--atten 10,30] [--profile 0] [--seconds 30] [--seed 1] [--jobs <cpus>] [--csv sweep.csv]
+*
+* --load is frames per second offered by each node. --payload is the traffic mix: each frame takes one of
+* the listed lengths at random, so repeat a length to weigh it. --atten is the range of the pairwise
+* attenuation in dB. --profile gives everything the sweep does not set: service type, retries, threshold.
+* In the results, retry/fr is the PLC device's retries per frame handed to it, noack the share of those
+* given up without an ACK, biu/fr the band-in-use backoffs per frame and unable the frames given up with
+* Status_UnableToTX. goodput counts the payload bytes read by their destination, repeats excluded.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <algorithm>
+
+#include "plc_i2c.h"
+#include "plc_profile.h"
+#include "plc_dispatch.h"
+#include "plc_schema.h"
+#include "plc_sim.h"
+
+#define MAX_QUEUE		32
+/* Sequence number and the time the frame was queued, in us */
+typedef PLC_Schema<16, 32> ProbeMessage;
+#define MIN_PAYLOAD		ProbeMessage::bLength
+
+struct SweepConfig {
+    std::vector<double> delays;		/* Modem_Config axes: TX delay in ms, FSK bandwidth in MHz, bit rate */
+    std::vector<double> bandwidths;
+    std::vector<double> bitRates;
+    std::vector<double> txGains;
+    std::vector<double> rxGains;
+    std::vector<double> nodes;		/* Scenario axes */
+    std::vector<double> loads;
+    std::vector<double> noises;
+    std::vector<double> losses;
+    std::vector<double> payloads;	/* Traffic mix */
+    bool bSink;
+    double dAttenMin;
+    double dAttenMax;
+    int iProfile;
+    double dSeconds;
+    uint32_t dwSeed;
+    int iJobs;
+    const char *pszCsv;
+};
+
+/* One grid point: a scenario and the settings it is run with */
+struct SweepPoint {
+    int iScenario;
+    int iNodes;
+    double dLoad;
+    double dNoise;
+    double dLoss;
+    int iDelayMs;
+    double dBandwidth;
+    int iBitRate;
+    PLC_Profile profile;
+};
+
+/* Result of a point, passed back from the process that ran it as it is */
+struct PointResult {
+    bool bValid;
+    uint64_t qwOffered;
+    uint64_t qwDelivered;
+    uint64_t qwGoodBytes;
+    uint64_t qwTxRequests;		/* Summed over the chips */
+    uint64_t qwRetries;
+    uint64_t qwNoAck;
+    uint64_t qwBiuBackoffs;
+    uint64_t qwUnableToTX;
+    uint64_t qwRxDropped;
+    SimMediumStats medium;
+    uint32_t dwP50;				/* End-to-end latency, us */
+    uint32_t dwP99;
+};
+
+struct NodeStats {
+    uint64_t qwOffered;
+    uint64_t qwDelivered;		/* Frames from this node read by their destination's host */
+    uint64_t qwGoodBytes;
+    std::vector<uint32_t> endToEnd;
+};
+
+static const struct {
+    int iMs;
+    byte bBits;
+} aDelays[] = {
+	{ 7, Modem_TXDelay_7ms }, { 13, Modem_TXDelay_13ms }, { 19, Modem_TXDelay_19ms }, { 25, Modem_TXDelay_25ms }
+};
+
+static const struct {
+    int iBitRate;
+    byte bBits;
+} aBitRates[] = {
+	{ 600, Modem_BPS_600 }, { 1200, Modem_BPS_1200 }, { 1800, Modem_BPS_1800 }, { 2400, Modem_BPS_2400 }
+};
+
+static uint32_t Percentile(std::vector<uint32_t> &values, double dPercent)
+{
+	size_t i;
+
+	if (values.empty())
+	{
+		return 0;
+	}
+	i = (size_t)(dPercent / 100.0 * (values.size() - 1) + 0.5);
+	return values[i];
+}
+
+/* What a node's CMD_SENDMSG handler accounts received frames to */
+struct RxContext {
+    SimKernel *pKernel;
+    std::vector<NodeStats> *pStats;
+    std::vector<uint16_t> lastSeq;
+};
+
+/*****************************************************************************
+* Function Name: OnSendMsg()
+******************************************************************************
+* Summary:
+* Account a received frame to its source
+*****************************************************************************/
+static void OnSendMsg(const PLC_Frame *pFrame, void *pContext)
+{
+	RxContext &rx = *(RxContext *)pContext;
+	byte bSource = pFrame->pbSource[0];
+	uint16_t wSeq;
+
+	if (bSource == 0 || bSource > rx.pStats->size() || pFrame->bLength < ProbeMessage::bLength)
+	{
+		return;
+	}
+	NodeStats &source = (*rx.pStats)[bSource - 1];
+	wSeq = ProbeMessage::Get<0>(pFrame->pbData);
+	if (rx.lastSeq[bSource - 1] == wSeq)
+	{
+		return;
+	}
+	rx.lastSeq[bSource - 1] = wSeq;
+	source.qwDelivered++;
+	source.qwGoodBytes += pFrame->bLength;
+	source.endToEnd.push_back((uint32_t)rx.pKernel->Now() - ProbeMessage::Get<1>(pFrame->pbData));
+}
+
+/*****************************************************************************
+* Function Name: NodeMain()
+******************************************************************************
+* Summary:
+* Firmware of one simulated node: queue Poisson arrivals, send them one at a time with TransmitPacket(),
+* and read what it receives in between
+*****************************************************************************/
+static void NodeMain(SimKernel &kernel, int iIndex, const SweepConfig &config, const SweepPoint &point,
+                     std::vector<NodeStats> &stats)
+{
+	PLC_I2C plc;
+	NodeStats &self = stats[iIndex];
+	PLC_Dispatcher dispatcher;
+	RxContext rx = { &kernel, &stats, std::vector<uint16_t>(stats.size(), 0xFFFF) };
+	std::deque<uint64_t> queue;
+	std::mt19937 &rng = SimKernel::pCurrent->rng;
+	std::exponential_distribution<double> gap(point.dLoad > 0 ? point.dLoad : 1.0);
+	bool bSender = point.dLoad > 0 && !(config.bSink && iIndex == 0);
+	uint64_t qwNextArrival = bSender ? kernel.Now() + (uint64_t)(gap(rng) * 1e6) : SIM_FOREVER;
+	byte bLocal = (byte)(iIndex + 1);
+	byte bDestination = 0;
+	byte abPayload[MAX_PLC_PACKET_LENGTH];
+	uint16_t wSeq = 0;
+	byte bTemp;
+
+	plc.init(true, &point.profile);
+	bTemp = TX_Enable | RX_Enable | RX_Override;
+	plc.WriteToOffset(PLC_Mode, &bTemp, 1);
+	plc.WriteToOffset(Local_LA_LSB, &bLocal, 1);
+	memset(abPayload, 0, sizeof(abPayload));
+	dispatcher.begin();
+	dispatcher.Register(CMD_SENDMSG, OnSendMsg, &rx);
+
+	for (;;)
+	{
+		while (qwNextArrival <= kernel.Now())
+		{
+			self.qwOffered++;
+			if (queue.size() < MAX_QUEUE)
+			{
+				queue.push_back(qwNextArrival);
+			}
+			qwNextArrival += (uint64_t)(gap(rng) * 1e6) + 1;
+		}
+
+		if (!queue.empty())
+		{
+			byte bTarget = 1;
+			byte bLength = (byte)config.payloads[rng() % config.payloads.size()];
+
+			if (!config.bSink)
+			{
+				do
+				{
+					bTarget = (byte)(1 + rng() % stats.size());
+				} while (bTarget == bLocal);
+			}
+			if (bTarget != bDestination)
+			{
+				bDestination = bTarget;
+				plc.SetDestinationAddress(TX_DA_Type_Log, &bDestination);
+			}
+			ProbeMessage::Set<0>(abPayload, ++wSeq);
+			ProbeMessage::Set<1>(abPayload, (uint32_t)queue.front());
+			queue.pop_front();
+			plc.TransmitPacket(CMD_SENDMSG, abPayload, bLength);
+		}
+		else
+		{
+			SimIdle(qwNextArrival);
+		}
+		dispatcher.Service(&plc);
+	}
+}
+
+/*****************************************************************************
+* Function Name: RunPoint()
+******************************************************************************
+* Summary:
+* Simulate one grid point
+*****************************************************************************/
+static PointResult RunPoint(const SweepConfig &config, const SweepPoint &point)
+{
+	SimMediumConfig mediumConfig;
+	PointResult result;
+	std::vector<NodeStats> stats(point.iNodes);
+	std::vector<SimHost *> hosts;
+	std::vector<SimChip *> chips;
+	std::vector<uint32_t> endToEnd;
+
+	memset(&result, 0, sizeof(result));
+	mediumConfig.dNoiseFloor = point.dNoise;
+	mediumConfig.dLossRate = point.dLoss;
+	mediumConfig.dAttenMin = config.dAttenMin;
+	mediumConfig.dAttenMax = config.dAttenMax;
+
+	{
+		SimKernel kernel;
+		SimMedium medium(kernel, mediumConfig, config.dwSeed);
+
+		for (int i = 0; i < point.iNodes; i++)
+		{
+			SimHost *pHost = new SimHost();
+			SimChip *pChip = new SimChip(medium, pHost, PLC_ADDRESS, 2, (uint8_t)(i + 1), 0x0001000000000000ULL + i);
+			hosts.push_back(pHost);
+			chips.push_back(pChip);
+			pHost->pTask = kernel.Spawn(pHost, [&kernel, i, &config, &point, &stats]() {
+				NodeMain(kernel, i, config, point, stats);
+			}, config.dwSeed * 7919 + i);
+		}
+		kernel.Run((uint64_t)(config.dSeconds * 1e6));
+		kernel.Stop();
+
+		result.medium = medium.stats;
+		for (int i = 0; i < point.iNodes; i++)
+		{
+			result.qwOffered += stats[i].qwOffered;
+			result.qwDelivered += stats[i].qwDelivered;
+			result.qwGoodBytes += stats[i].qwGoodBytes;
+			result.qwTxRequests += chips[i]->stats.qwTxRequests;
+			result.qwRetries += chips[i]->stats.qwRetries;
+			result.qwNoAck += chips[i]->stats.qwNoAck;
+			result.qwBiuBackoffs += chips[i]->stats.qwBiuBackoffs;
+			result.qwUnableToTX += chips[i]->stats.qwUnableToTX;
+			result.qwRxDropped += chips[i]->stats.qwRxDropped;
+			endToEnd.insert(endToEnd.end(), stats[i].endToEnd.begin(), stats[i].endToEnd.end());
+		}
+	}
+	for (size_t i = 0; i < chips.size(); i++)
+	{
+		delete chips[i];
+		delete hosts[i];
+	}
+	std::sort(endToEnd.begin(), endToEnd.end());
+	result.dwP50 = Percentile(endToEnd, 50);
+	result.dwP99 = Percentile(endToEnd, 99);
+	result.bValid = true;
+	return result;
+}
+
+/* Figures derived from a result, as printed and written to the CSV */
+struct PointFigures {
+    double dDelivered;			/* % of offered */
+    double dGoodput;			/* B/s */
+    double dRetryRate;			/* Retries per frame handed to the PLC devices */
+    double dNoAck;				/* % of those */
+    double dBiuRate;			/* Backoffs per frame */
+    double dCollided;			/* % of the frames on the line */
+    double dBusy;				/* % of the time */
+};
+
+static PointFigures Figures(const SweepConfig &config, const PointResult &r)
+{
+	PointFigures f;
+	double dRequests = r.qwTxRequests ? (double)r.qwTxRequests : 1.0;
+
+	f.dDelivered = r.qwOffered ? 100.0 * r.qwDelivered / r.qwOffered : 0.0;
+	f.dGoodput = r.qwGoodBytes / config.dSeconds;
+	f.dRetryRate = r.qwRetries / dRequests;
+	f.dNoAck = 100.0 * r.qwNoAck / dRequests;
+	f.dBiuRate = r.qwBiuBackoffs / dRequests;
+	f.dCollided = r.medium.qwFrames ? 100.0 * r.medium.qwCollided / (r.medium.qwFrames + r.medium.qwAcks) : 0.0;
+	f.dBusy = 100.0 * r.medium.qwBusyUs / (config.dSeconds * 1e6);
+	return f;
+}
+
+static void PrintHeader(const SweepPoint &point)
+{
+	printf("\n%d nodes, %g fr/s each, noise %g dBuV, loss %g\n", point.iNodes, point.dLoad, point.dNoise, point.dLoss);
+	printf("%5s %4s %5s %3s %3s %7s %10s %8s %8s %8s %6s %7s %7s %8s %6s\n", "delay", "bw", "bps", "txg", "rxg",
+		"deliv", "goodput", "p50 ms", "p99 ms", "retry/fr", "noack", "biu/fr", "unable", "collided", "busy");
+}
+
+static void PrintPoint(const SweepConfig &config, const SweepPoint &point, const PointResult &r)
+{
+	PointFigures f = Figures(config, r);
+
+	if (!r.bValid)
+	{
+		printf("%5d %4g %5d %3d %3d   the simulation failed\n", point.iDelayMs, point.dBandwidth, point.iBitRate,
+			point.profile.bTxGain, point.profile.bRxGain);
+		return;
+	}
+	printf("%5d %4g %5d %3d %3d %6.1f%% %6.1fB/s %8.0f %8.0f %8.3f %5.1f%% %7.2f %7llu %7.1f%% %5.0f%%\n",
+		point.iDelayMs, point.dBandwidth, point.iBitRate, point.profile.bTxGain, point.profile.bRxGain,
+		f.dDelivered, f.dGoodput, r.dwP50 / 1000.0, r.dwP99 / 1000.0, f.dRetryRate, f.dNoAck, f.dBiuRate,
+		(unsigned long long)r.qwUnableToTX, f.dCollided, f.dBusy);
+}
+
+static void WriteCsvHeader(FILE *pCsv)
+{
+	fprintf(pCsv, "nodes,load,noise,loss,delay_ms,fsk_bw,bps,modem_config,tx_gain,rx_gain,offered,delivered,"
+		"delivered_pct,goodput_bps,e2e_p50_ms,e2e_p99_ms,tx_requests,retries,retry_rate,no_ack,biu_backoffs,"
+		"unable_to_tx,rx_dropped,line_frames,line_acks,collided,busy_pct\n");
+}
+
+static void WriteCsvPoint(FILE *pCsv, const SweepConfig &config, const SweepPoint &point, const PointResult &r)
+{
+	PointFigures f = Figures(config, r);
+
+	if (!r.bValid)
+	{
+		return;
+	}
+	fprintf(pCsv, "%d,%g,%g,%g,%d,%g,%d,0x%02X,%d,%d,%llu,%llu,%.2f,%.2f,%.1f,%.1f,%llu,%llu,%.4f,%llu,%llu,%llu,%llu,"
+		"%llu,%llu,%llu,%.2f\n", point.iNodes, point.dLoad, point.dNoise, point.dLoss, point.iDelayMs, point.dBandwidth,
+		point.iBitRate, point.profile.bModemConfig, point.profile.bTxGain, point.profile.bRxGain,
+		(unsigned long long)r.qwOffered, (unsigned long long)r.qwDelivered, f.dDelivered, f.dGoodput,
+		r.dwP50 / 1000.0, r.dwP99 / 1000.0, (unsigned long long)r.qwTxRequests, (unsigned long long)r.qwRetries,
+		f.dRetryRate, (unsigned long long)r.qwNoAck, (unsigned long long)r.qwBiuBackoffs,
+		(unsigned long long)r.qwUnableToTX, (unsigned long long)r.qwRxDropped, (unsigned long long)r.medium.qwFrames,
+		(unsigned long long)r.medium.qwAcks, (unsigned long long)r.medium.qwCollided, f.dBusy);
+}
+
+/*****************************************************************************
+* Function Name: PrintBest()
+******************************************************************************
+* Summary:
+* Print the best point of the scenario made of points [iFirst, iEnd)
+**
+Note:
+* Best is the highest goodput; points within 1% of it are taken as equal and the lowest p99 latency wins.
+*****************************************************************************/
+static void PrintBest(const SweepConfig &config, const std::vector<SweepPoint> &points,
+                      const std::vector<PointResult> &results, size_t iFirst, size_t iEnd)
+{
+	double dTop = 0;
+	int iBest = -1;
+
+	for (size_t i = iFirst; i < iEnd; i++)
+	{
+		if (results[i].bValid)
+		{
+			dTop = std::max(dTop, Figures(config, results[i]).dGoodput);
+		}
+	}
+	for (size_t i = iFirst; i < iEnd; i++)
+	{
+		if (results[i].bValid && Figures(config, results[i]).dGoodput >= 0.99 * dTop
+			&& (iBest < 0 || results[i].dwP99 < results[iBest].dwP99))
+		{
+			iBest = (int)i;
+		}
+	}
+	if (iBest >= 0)
+	{
+		const PLC_Profile &p = points[iBest].profile;
+
+		printf("best: bModemConfig 0x%02X (%d ms, %g MHz, %d bps), bTxGain 0x%02X, bRxGain 0x%02X\n", p.bModemConfig,
+			points[iBest].iDelayMs, points[iBest].dBandwidth, points[iBest].iBitRate, p.bTxGain, p.bRxGain);
+	}
+}
+
+/*****************************************************************************
+* Function Name: RunSweep()
+******************************************************************************
+* Summary:
+* Run every point, up to config.iJobs at a time, each in a process of its own, and print the results in
+* grid order as they come in
+**
+Note:
+* The simulation kernel keeps its running task in globals, so the points cannot share a process. A point
+* whose process dies is reported as failed rather than ending the sweep.
+*****************************************************************************/
+static void RunSweep(const SweepConfig &config, const std::vector<SweepPoint> &points, FILE *pCsv)
+{
+	std::vector<PointResult> results(points.size());
+	std::vector<bool> done(points.size(), false);
+	std::map<pid_t, std::pair<size_t, int> > running;		/* Process, its point and the read end of its pipe */
+	size_t iNext = 0;
+	size_t iPrinted = 0;
+	size_t iScenarioStart = 0;
+
+	while (iPrinted < points.size())
+	{
+		while (iNext < points.size() && (int)running.size() < config.iJobs)
+		{
+			int aiPipe[2];
+			pid_t pid;
+
+			fflush(stdout);
+			if (pipe(aiPipe) != 0 || (pid = fork()) < 0)
+			{
+				perror("sim_sweep");
+				exit(1);
+			}
+			if (pid == 0)
+			{
+				PointResult result = RunPoint(config, points[iNext]);
+
+				close(aiPipe[0]);
+				_exit(write(aiPipe[1], &result, sizeof(result)) == (ssize_t)sizeof(result) ? 0 : 1);
+			}
+			close(aiPipe[1]);
+			running[pid] = std::make_pair(iNext, aiPipe[0]);
+			iNext++;
+		}
+
+		if (!running.empty())
+		{
+			int iStatus;
+			pid_t pid = waitpid(-1, &iStatus, 0);
+			std::map<pid_t, std::pair<size_t, int> >::iterator it = running.find(pid);
+
+			if (it == running.end())
+			{
+				continue;
+			}
+			PointResult &result = results[it->second.first];
+			/* The result is smaller than the pipe buffer, so it is all there once the writer has exited */
+			if (read(it->second.second, &result, sizeof(result)) != (ssize_t)sizeof(result))
+			{
+				memset(&result, 0, sizeof(result));
+			}
+			close(it->second.second);
+			done[it->second.first] = true;
+			running.erase(it);
+		}
+
+		while (iPrinted < points.size() && done[iPrinted])
+		{
+			const SweepPoint &point = points[iPrinted];
+
+			if (iPrinted == 0 || point.iScenario != points[iPrinted - 1].iScenario)
+			{
+				iScenarioStart = iPrinted;
+				PrintHeader(point);
+			}
+			PrintPoint(config, point, results[iPrinted]);
+			if (pCsv != NULL)
+			{
+				WriteCsvPoint(pCsv, config, point, results[iPrinted]);
+			}
+			iPrinted++;
+			if (iPrinted == points.size() || points[iPrinted].iScenario != point.iScenario)
+			{
+				PrintBest(config, points, results, iScenarioStart, iPrinted);
+			}
+			fflush(stdout);
+		}
+	}
+}
+
+static void ParseList(const char *pszArg, std::vector<double> &values)
+{
+	std::string list(pszArg);
+	size_t start = 0;
+
+	values.clear();
+	while (start <= list.size())
+	{
+		size_t end = list.find(',', start);
+		if (end == std::string::npos)
+		{
+			end = list.size();
+		}
+		values.push_back(atof(list.substr(start, end - start).c_str()));
+		start = end + 1;
+	}
+}
+
+static void Usage(void)
+{
+	fprintf(stderr, "usage: sim_sweep [--delay 7,13,19,25] [--bw 1.5,3] [--bps 600,1200,1800,2400] [--tx-gain 14]\n"
+		"                 [--rx-gain 1] [--nodes 10] [--load 0.5] [--noise 60] [--loss 0] [--payload 8]\n"
+		"                 [--pattern sink|random] [--atten 10,30] [--profile 0] [--seconds 30] [--seed 1]\n"
+		"                 [--jobs <cpus>] [--csv sweep.csv]\n");
+	exit(2);
+}
+
+/* The Modem_Config bits of a TX delay or bit rate, or -1 when the value is not one the PLC device has */
+static int DelayBits(double dMs)
+{
+	for (size_t i = 0; i < sizeof(aDelays) / sizeof(aDelays[0]); i++)
+	{
+		if (dMs == aDelays[i].iMs)
+		{
+			return aDelays[i].bBits;
+		}
+	}
+	return -1;
+}
+
+static int BitRateBits(double dBitRate)
+{
+	for (size_t i = 0; i < sizeof(aBitRates) / sizeof(aBitRates[0]); i++)
+	{
+		if (dBitRate == aBitRates[i].iBitRate)
+		{
+			return aBitRates[i].bBits;
+		}
+	}
+	return -1;
+}
+
+int main(int argc, char **argv)
+{
+	SweepConfig config;
+	std::vector<double> atten;
+	std::vector<SweepPoint> points;
+	PLC_Profile base;
+	FILE *pCsv = NULL;
+	int iScenario = 0;
+
+	config.delays = { 7, 13, 19, 25 };
+	config.bandwidths = { 1.5, 3 };
+	config.bitRates = { 600, 1200, 1800, 2400 };
+	config.txGains = { 14 };
+	config.rxGains = { 1 };
+	config.nodes = { 10 };
+	config.loads = { 0.5 };
+	config.noises = { 60 };
+	config.losses = { 0 };
+	config.payloads = { 8 };
+	config.bSink = true;
+	config.dAttenMin = SimMediumConfig().dAttenMin;
+	config.dAttenMax = SimMediumConfig().dAttenMax;
+	config.iProfile = PLC_PROFILE_DEFAULT;
+	config.dSeconds = 30;
+	config.dwSeed = 1;
+	config.iJobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	config.pszCsv = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *pszValue = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (pszValue == NULL)
+		{
+			Usage();
+		}
+		if (!strcmp(argv[i], "--delay"))
+		{
+			ParseList(pszValue, config.delays);
+		}
+		else if (!strcmp(argv[i], "--bw"))
+		{
+			ParseList(pszValue, config.bandwidths);
+		}
+		else if (!strcmp(argv[i], "--bps"))
+		{
+			ParseList(pszValue, config.bitRates);
+		}
+		else if (!strcmp(argv[i], "--tx-gain"))
+		{
+			ParseList(pszValue, config.txGains);
+		}
+		else if (!strcmp(argv[i], "--rx-gain"))
+		{
+			ParseList(pszValue, config.rxGains);
+		}
+		else if (!strcmp(argv[i], "--nodes"))
+		{
+			ParseList(pszValue, config.nodes);
+		}
+		else if (!strcmp(argv[i], "--load"))
+		{
+			ParseList(pszValue, config.loads);
+		}
+		else if (!strcmp(argv[i], "--noise"))
+		{
+			ParseList(pszValue, config.noises);
+		}
+		else if (!strcmp(argv[i], "--loss"))
+		{
+			ParseList(pszValue, config.losses);
+		}
+		else if (!strcmp(argv[i], "--payload"))
+		{
+			ParseList(pszValue, config.payloads);
+		}
+		else if (!strcmp(argv[i], "--pattern"))
+		{
+			config.bSink = strcmp(pszValue, "random") != 0;
+		}
+		else if (!strcmp(argv[i], "--atten"))
+		{
+			ParseList(pszValue, atten);
+			if (atten.size() != 2 || atten[0] > atten[1])
+			{
+				Usage();
+			}
+			config.dAttenMin = atten[0];
+			config.dAttenMax = atten[1];
+		}
+		else if (!strcmp(argv[i], "--profile"))
+		{
+			config.iProfile = atoi(pszValue);
+		}
+		else if (!strcmp(argv[i], "--seconds"))
+		{
+			config.dSeconds = atof(pszValue);
+		}
+		else if (!strcmp(argv[i], "--seed"))
+		{
+			config.dwSeed = (uint32_t)atol(pszValue);
+		}
+		else if (!strcmp(argv[i], "--jobs"))
+		{
+			config.iJobs = atoi(pszValue);
+		}
+		else if (!strcmp(argv[i], "--csv"))
+		{
+			config.pszCsv = pszValue;
+		}
+		else
+		{
+			Usage();
+		}
+		i++;
+	}
+	if (!PLC_GetProfile((byte)config.iProfile, &base) || config.dSeconds <= 0)
+	{
+		Usage();
+	}
+	if (config.iJobs < 1)
+	{
+		config.iJobs = 1;
+	}
+	for (size_t i = 0; i < config.payloads.size(); i++)
+	{
+		if (config.payloads[i] < MIN_PAYLOAD || config.payloads[i] > MAX_PLC_PACKET_LENGTH)
+		{
+			fprintf(stderr, "payload lengths must be %d..%d\n", MIN_PAYLOAD, MAX_PLC_PACKET_LENGTH);
+			return 2;
+		}
+	}
+	for (size_t i = 0; i < config.nodes.size(); i++)
+	{
+		if (config.nodes[i] < 2 || config.nodes[i] > 250)
+		{
+			fprintf(stderr, "node counts must be 2..250\n");
+			return 2;
+		}
+	}
+
+	/* Scenarios outside, settings inside, so each scenario's points are printed together */
+	for (size_t n = 0; n < config.nodes.size(); n++)
+	for (size_t l = 0; l < config.loads.size(); l++)
+	for (size_t z = 0; z < config.noises.size(); z++)
+	for (size_t x = 0; x < config.losses.size(); x++, iScenario++)
+	for (size_t d = 0; d < config.delays.size(); d++)
+	for (size_t w = 0; w < config.bandwidths.size(); w++)
+	for (size_t b = 0; b < config.bitRates.size(); b++)
+	for (size_t t = 0; t < config.txGains.size(); t++)
+	for (size_t r = 0; r < config.rxGains.size(); r++)
+	{
+		SweepPoint point;
+		int iDelay = DelayBits(config.delays[d]);
+		int iBitRate = BitRateBits(config.bitRates[b]);
+
+		if (iDelay < 0 || iBitRate < 0 || (config.bandwidths[w] != 1.5 && config.bandwidths[w] != 3))
+		{
+			fprintf(stderr, "TX delays are 7, 13, 19 or 25 ms, bandwidths 1.5 or 3 MHz, bit rates 600, 1200, 1800 or 2400\n");
+			return 2;
+		}
+		point.iScenario = iScenario;
+		point.iNodes = (int)config.nodes[n];
+		point.dLoad = config.loads[l];
+		point.dNoise = config.noises[z];
+		point.dLoss = config.losses[x];
+		point.iDelayMs = (int)config.delays[d];
+		point.dBandwidth = config.bandwidths[w];
+		point.iBitRate = (int)config.bitRates[b];
+		point.profile = base;
+		point.profile.bModemConfig = (byte)(iDelay | iBitRate
+			| (config.bandwidths[w] == 3 ? Modem_FSKBW_3M : Modem_FSKBW_1_5M));
+		point.profile.bTxGain = (byte)config.txGains[t] & TX_Gain_Mask;
+		point.profile.bRxGain = (byte)config.rxGains[r] & RX_Gain_Mask;
+		points.push_back(point);
+	}
+
+	if (config.pszCsv != NULL)
+	{
+		pCsv = fopen(config.pszCsv, "w");
+		if (pCsv == NULL)
+		{
+			perror(config.pszCsv);
+			return 1;
+		}
+		WriteCsvHeader(pCsv);
+	}
+	printf("%zu points of %g s, %s traffic, payload", points.size(), config.dSeconds, config.bSink ? "sink" : "random");
+	for (size_t i = 0; i < config.payloads.size(); i++)
+	{
+		printf("%s%g", i ? "," : " ", config.payloads[i]);
+	}
+	printf(" bytes, profile %d, %d at a time\n", config.iProfile, config.iJobs);
+	RunSweep(config, points, pCsv);
+	if (pCsv != NULL)
+	{
+		fclose(pCsv);
+	}
+	return 0;
+}
@@ -0,0 +1,390 @@
+/*
+* File Name: sim_tasks.cpp
+**
+Description:
+* The transmitter of the sketch, sampling an input every ms and sending each change to a receiver, run two ways:
+* with the old blocking loop, where TransmitPacket() holds off sampling until the frame's result is back, and
+* with TaskScheduler, where the send task yields while the frame is on the line and sampling goes on.
+* The input changes at random times. For each way the table gives the frames sent, the longest and 99th
+* percentile gap between samples, and the time from a change of the input to the receiver having the new
+* state, for the states that reached it. The task statistics of the scheduled run follow.
+* Then both ways run again on an input that never changes, with the sketch's Heartbeat (PowerComms/heartbeat.h)
+* keeping the link alive, and the table gives the frames sent per heartbeat period, which should be one.
+**
+Usage:
+* sim_tasks [--rate 5] [--seconds 60] [--heartbeat 1000] [--seed 1]
+*
+* --rate is the mean number of input changes per second, --heartbeat the heartbeat period in ms, 0 for none.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "plc_i2c.h"
+#include "plc_dispatch.h"
+#include "task_scheduler.h"
+#include "heartbeat.h"
+#include "plc_sim.h"
+
+#define NODE_SENDER		0x01
+#define NODE_RECEIVER	0x02
+#define SAMPLE_US		1000	/* Sampling period of both loops */
+
+struct TasksResult {
+    std::vector<uint64_t> gaps;			/* Between consecutive samples */
+    std::vector<uint64_t> latencies;	/* Input change to the receiver having the state */
+    uint64_t qwFrames;
+    uint32_t dwChanges;
+    TaskScheduler *pTasks;				/* The scheduled run's, for its statistics */
+    Task aStats[TASK_MAX];
+    byte bTasks;
+};
+
+/* The input: the number of changes so far, which the frames carry, so each state names the change it follows */
+static std::vector<uint64_t> changes;
+
+static word Input(uint64_t qwNow)
+{
+	return (word)(std::upper_bound(changes.begin(), changes.end(), qwNow) - changes.begin());
+}
+
+/* State shared by the transmitter's tasks, as the sketch keeps it in globals */
+struct SenderState {
+    SimKernel *pKernel;
+    TasksResult *pResult;
+    PLC_I2C *pPlc;
+    TaskScheduler *pTasks;
+    Task *pSendTask;
+    Heartbeat *pHeartbeat;				/* NULL without heartbeats */
+    uint64_t qwLastSample;
+    word wSent;
+    word wState;
+    byte abData[2];
+};
+
+static void Sample(SenderState &state)
+{
+	uint64_t qwNow = state.pKernel->Now();
+
+	if (state.qwLastSample != 0)
+	{
+		state.pResult->gaps.push_back(qwNow - state.qwLastSample);
+	}
+	state.qwLastSample = qwNow;
+	state.wState = Input(qwNow);
+}
+
+/* As the sketch: a frame is due on a change of the input, or when the heartbeat is */
+static bool FrameDue(SenderState &state)
+{
+	byte bPeer;
+
+	return state.wState != state.wSent || (state.pHeartbeat != NULL && state.pHeartbeat->Due(&bPeer));
+}
+
+static void FrameSent(SenderState &state)
+{
+	state.pResult->qwFrames++;
+	if (state.pHeartbeat != NULL)
+	{
+		state.pHeartbeat->NoteTransmit(NODE_RECEIVER);
+	}
+}
+
+/* Old loop: sample, and send a change with the blocking TransmitPacket() before sampling again */
+static void BlockingMain(SenderState &state)
+{
+	for (;;)
+	{
+		Sample(state);
+		if (FrameDue(state))
+		{
+			state.wSent = state.wState;
+			state.abData[0] = (byte)state.wSent;
+			state.abData[1] = (byte)(state.wSent >> 8);
+			state.pPlc->TransmitPacket(CMD_SENDMSG, state.abData, 2);
+			FrameSent(state);
+		}
+		SimIdle(state.qwLastSample + SAMPLE_US);
+	}
+}
+
+static char SampleTask(Task *pTask, void *pContext)
+{
+	SenderState &state = *(SenderState *)pContext;
+
+	TASK_BEGIN(pTask);
+	Sample(state);
+	if (FrameDue(state))
+	{
+		state.pTasks->Signal(state.pSendTask);
+	}
+	TASK_END(pTask);
+}
+
+static char SendTask(Task *pTask, void *pContext)
+{
+	SenderState &state = *(SenderState *)pContext;
+
+	TASK_BEGIN(pTask);
+	state.wSent = state.wState;
+	state.abData[0] = (byte)state.wSent;
+	state.abData[1] = (byte)(state.wSent >> 8);
+	if (state.pPlc->StartTransmit(CMD_SENDMSG, state.abData, 2) == I2C_SUCCESS)
+	{
+		TASK_WAIT_UNTIL(pTask, state.pPlc->PollTransmit() != PLC_TX_PENDING);
+	}
+	FrameSent(state);
+	TASK_END(pTask);
+}
+
+/* New loop: the sketch's tasks, sleeping until the next one is due or HOST_INT is asserted */
+static void ScheduledMain(SenderState &state)
+{
+	TaskScheduler &tasks = *state.pTasks;
+	unsigned long dwIdle;
+
+	tasks.begin();
+	tasks.Add(SampleTask, &state, SAMPLE_US / 1000);
+	state.pSendTask = tasks.Add(SendTask, &state, TASK_EVENT);
+	for (;;)
+	{
+		tasks.Service();
+		dwIdle = tasks.Idle();
+		if (dwIdle != 0)
+		{
+			/* millis() charges no time: stay in step with the ms tick the scheduler counts in */
+			SimIdle((state.pKernel->Now() / 1000 + dwIdle) * 1000);
+		}
+	}
+}
+
+static void SenderMain(SenderState &state, bool bScheduled, unsigned long dwHeartbeat)
+{
+	PLC_I2C plc;
+	Heartbeat heartbeat;
+	byte bLocal = NODE_SENDER;
+	byte bDestination = NODE_RECEIVER;
+
+	plc.init(true);
+	plc.WriteToOffset(Local_LA_LSB, &bLocal, 1);
+	plc.SetDestinationAddress(TX_DA_Type_Log, &bDestination);
+	state.pPlc = &plc;
+	if (dwHeartbeat != 0)
+	{
+		heartbeat.begin(dwHeartbeat, (unsigned int)(dwHeartbeat / 8), bLocal);
+		heartbeat.AddPeer(NODE_RECEIVER);
+		state.pHeartbeat = &heartbeat;
+	}
+	if (bScheduled)
+	{
+		ScheduledMain(state);
+	}
+	BlockingMain(state);
+}
+
+struct ReceiverContext {
+    SimKernel *pKernel;
+    TasksResult *pResult;
+    word wState;
+};
+
+static void OnSendMsg(const PLC_Frame *pFrame, void *pContext)
+{
+	ReceiverContext &receiver = *(ReceiverContext *)pContext;
+	word wState;
+
+	if (pFrame->bLength < 2)
+	{
+		return;
+	}
+	wState = pFrame->pbData[0] | (pFrame->pbData[1] << 8);
+	if (wState != receiver.wState && wState != 0)
+	{
+		receiver.wState = wState;
+		receiver.pResult->latencies.push_back(receiver.pKernel->Now() - changes[wState - 1]);
+	}
+}
+
+static void ReceiverMain(ReceiverContext &receiver)
+{
+	PLC_I2C plc;
+	PLC_Dispatcher dispatcher;
+	byte bLocal = NODE_RECEIVER;
+
+	plc.init(false);
+	plc.WriteToOffset(Local_LA_LSB, &bLocal, 1);
+	dispatcher.begin();
+	dispatcher.Register(CMD_SENDMSG, OnSendMsg, &receiver);
+	for (;;)
+	{
+		dispatcher.Service(&plc);
+		SimIdle(SIM_FOREVER);
+	}
+}
+
+static TasksResult RunOnce(bool bScheduled, double dSeconds, unsigned long dwHeartbeat, uint32_t dwSeed)
+{
+	SimMediumConfig mediumConfig;
+	TasksResult result;
+	TaskScheduler tasks;
+	SenderState state;
+	ReceiverContext receiver;
+	SimHost *apHost[2];
+	SimChip *apChip[2];
+	uint64_t qwEnd = (uint64_t)(dSeconds * 1e6);
+
+	result.qwFrames = 0;
+	result.pTasks = &tasks;
+	{
+		SimKernel kernel;
+		SimMedium medium(kernel, mediumConfig, dwSeed);
+
+		memset(&state, 0, sizeof(state));
+		state.pKernel = &kernel;
+		state.pResult = &result;
+		state.pTasks = &tasks;
+		receiver.pKernel = &kernel;
+		receiver.pResult = &result;
+		receiver.wState = 0;
+		for (int i = 0; i < 2; i++)
+		{
+			apHost[i] = new SimHost();
+			apChip[i] = new SimChip(medium, apHost[i], PLC_ADDRESS, 2, (uint8_t)(NODE_SENDER + i), 0x0001000000000000ULL + i);
+		}
+		apHost[0]->pTask = kernel.Spawn(apHost[0], [&]() { SenderMain(state, bScheduled, dwHeartbeat); }, dwSeed * 7919);
+		apHost[1]->pTask = kernel.Spawn(apHost[1], [&]() { ReceiverMain(receiver); }, dwSeed * 7919 + 1);
+		kernel.Run(qwEnd);
+		kernel.Stop();
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		delete apChip[i];
+		delete apHost[i];
+	}
+	result.dwChanges = (uint32_t)Input(qwEnd);
+	result.bTasks = bScheduled ? tasks.Count() : 0;
+	for (byte i = 0; i < result.bTasks; i++)
+	{
+		result.aStats[i] = *tasks.Entry(i);
+	}
+	return result;
+}
+
+static double Percentile(std::vector<uint64_t> &values, double dShare)
+{
+	if (values.empty())
+	{
+		return 0;
+	}
+	std::sort(values.begin(), values.end());
+	return (double)values[(size_t)(dShare * (values.size() - 1))];
+}
+
+static void Usage(void)
+{
+	fprintf(stderr, "usage: sim_tasks [--rate 5] [--seconds 60] [--heartbeat 1000] [--seed 1]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *apszTasks[] = { "sample", "send" };
+	double dRate = 5;
+	double dSeconds = 60;
+	unsigned long dwHeartbeat = 1000;
+	uint32_t dwSeed = 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *pszValue = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (pszValue == NULL)
+		{
+			Usage();
+		}
+		if (!strcmp(argv[i], "--rate"))
+		{
+			dRate = atof(pszValue);
+		}
+		else if (!strcmp(argv[i], "--seconds"))
+		{
+			dSeconds = atof(pszValue);
+		}
+		else if (!strcmp(argv[i], "--heartbeat"))
+		{
+			dwHeartbeat = (unsigned long)atol(pszValue);
+		}
+		else if (!strcmp(argv[i], "--seed"))
+		{
+			dwSeed = (uint32_t)atol(pszValue);
+		}
+		else
+		{
+			Usage();
+		}
+		i++;
+	}
+	if (dRate <= 0 || dSeconds <= 0 || dRate * dSeconds > 60000)
+	{
+		Usage();
+	}
+
+	/* Changes start after a second, once both nodes are up */
+	{
+		std::mt19937 rng(dwSeed);
+		std::exponential_distribution<double> interval(dRate);
+
+		for (double t = 1 + interval(rng); t < dSeconds; t += interval(rng))
+		{
+			changes.push_back((uint64_t)(t * 1e6));
+		}
+	}
+
+	printf("%.1f input changes/s for %.0f s, sampled every %d ms\n", dRate, dSeconds, SAMPLE_US / 1000);
+	printf("%-10s %8s %8s %12s %12s %10s %12s %12s\n", "loop", "changes", "frames", "gap p99 ms", "gap max ms",
+		"delivered", "e2e p50 ms", "e2e p99 ms");
+	for (int m = 0; m < 2; m++)
+	{
+		TasksResult r = RunOnce(m == 1, dSeconds, 0, dwSeed);
+
+		printf("%-10s %8u %8llu %12.2f %12.2f %10zu %12.1f %12.1f\n", m ? "tasks" : "blocking", r.dwChanges,
+			(unsigned long long)r.qwFrames, Percentile(r.gaps, 0.99) / 1e3, Percentile(r.gaps, 1.0) / 1e3,
+			r.latencies.size(), Percentile(r.latencies, 0.5) / 1e3, Percentile(r.latencies, 0.99) / 1e3);
+		fflush(stdout);
+		if (m == 1)
+		{
+			printf("\n%-10s %8s %8s %12s %10s %9s\n", "task", "runs", "calls", "us per call", "max us", "overruns");
+			for (byte i = 0; i < r.bTasks; i++)
+			{
+				Task &task = r.aStats[i];
+
+				printf("%-10s %8lu %8lu %12.1f %10lu %9u\n", apszTasks[i], task.dwRuns, task.dwCalls,
+					task.dwCalls ? (double)task.dwRunUs / task.dwCalls : 0.0, task.dwMaxUs, task.wOverruns);
+			}
+		}
+	}
+	if (dwHeartbeat == 0)
+	{
+		return 0;
+	}
+
+	/* Idle input: every frame is a heartbeat. The first is due a period after the sender is up. */
+	changes.clear();
+	printf("\nno input changes, heartbeat every %lu ms\n", dwHeartbeat);
+	printf("%-10s %8s %8s %14s\n", "loop", "periods", "frames", "frames/period");
+	for (int m = 0; m < 2; m++)
+	{
+		TasksResult r = RunOnce(m == 1, dSeconds, dwHeartbeat, dwSeed);
+		double dPeriods = dSeconds * 1e3 / dwHeartbeat;
+
+		printf("%-10s %8.0f %8llu %14.2f\n", m ? "tasks" : "blocking", dPeriods, (unsigned long long)r.qwFrames,
+			r.qwFrames / dPeriods);
+		fflush(stdout);
+	}
+	return 0;
+}
@@ -0,0 +1,25 @@
+/*
+* File Name: plc_size.cpp
+**
+Description:
+* Counterpart of the driver in the size report (make size-report): one PLC_I2C, as a sketch holds it, and a
+* call to each of its entry points, so the parts of the driver that are inlined into callers are counted.
+*/
+
+#include "plc_i2c.h"
+
+PLC_I2C plcSize;
+
+byte PLC_SizeProbe(byte *pbData, byte bLength)
+{
+	byte bResult;
+
+	bResult = plcSize.init(true);
+	bResult &= plcSize.SetDestinationAddress(TX_DA_Type_Log, pbData);
+	bResult &= plcSize.TransmitPacket(CMD_SENDMSG, pbData, bLength);
+	if (plcSize.IsPacketReceived())
+	{
+		bResult &= plcSize.ReadFromOffset(RX_Message_INFO, pbData, bLength);
+	}
+	return bResult;
+}
@@ -0,0 +1,337 @@
+/*
+* File Name: plc_sniffconv.cpp
+**
+Description:
+* Converts the capture stream of the sketch's sniffer mode (PowerComms/plc_sniffer.h) to pcap or CSV.
+* Reads a saved stream, or the serial port of the sniffer directly, in which case the output is written as
+* frames arrive until the port closes or the program is interrupted.
+**
+Usage:
+* plc_sniffconv [--format pcap|csv] [--baud 115200] [-o out] <capture.bin | /dev/ttyUSB0>
+*
+* The pcap link type is LINKTYPE_USER0. Each packet is a FRAME record without its timestamp: RX_Message_INFO,
+* the source address (2 or 8 bytes, see RX_SA_PHY), the command ID and the payload. Timestamps are the
+* sniffer's micros(), unwrapped, from the start of the capture. In CSV, STATS records become rows of their own
+* carrying the sniffer's drop counters. Damaged records are skipped and counted on stderr.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "plc_sniffer.h"
+
+#define LINKTYPE_USER0		147
+
+enum OutFormat { FORMAT_PCAP, FORMAT_CSV };
+
+struct Decoder {
+    uint8_t abRecord[PLC_SNIFF_MAX_RECORD + 4];
+    int iFill;
+    bool bHaveTime;
+    uint32_t dwLastMicros;
+    uint64_t qwTime;			/* Unwrapped micros() */
+    uint64_t qwRecords;
+    uint64_t qwBadRecords;
+    uint64_t qwSkipped;			/* Bytes thrown away while looking for a record */
+    PLC_SnifferStats last;
+};
+
+static OutFormat eFormat = FORMAT_PCAP;
+static FILE *pOut = stdout;
+
+static uint32_t GetLong(const uint8_t *pb)
+{
+	return pb[0] | (pb[1] << 8) | ((uint32_t)pb[2] << 16) | ((uint32_t)pb[3] << 24);
+}
+
+static void PutPcap32(uint32_t dwValue)
+{
+	fwrite(&dwValue, 4, 1, pOut);
+}
+
+static void WriteHeader(void)
+{
+	if (eFormat == FORMAT_CSV)
+	{
+		fprintf(pOut, "time_us,record,da_type,sa_type,source,command,length,payload,frames,chip_drops,ring_drops\n");
+		return;
+	}
+	PutPcap32(0xA1B2C3D4);
+	PutPcap32(2 | (4 << 16));		/* Version 2.4 */
+	PutPcap32(0);					/* Time zone */
+	PutPcap32(0);					/* Accuracy */
+	PutPcap32(0xFFFF);				/* Snap length */
+	PutPcap32(LINKTYPE_USER0);
+}
+
+/* micros() wraps every 71 minutes; the stream has records at least every PLC_SNIFFER_STATS_MS */
+static uint64_t Unwrap(Decoder &decoder, uint32_t dwMicros)
+{
+	if (decoder.bHaveTime)
+	{
+		decoder.qwTime += (uint32_t)(dwMicros - decoder.dwLastMicros);
+	}
+	decoder.bHaveTime = true;
+	decoder.dwLastMicros = dwMicros;
+	return decoder.qwTime;
+}
+
+static void WriteFrame(Decoder &decoder, const uint8_t *pbBody, int iLength)
+{
+	uint64_t qwTime = Unwrap(decoder, GetLong(pbBody));
+	uint8_t bInfo = pbBody[4];
+	int iSource = (bInfo & RX_SA_PHY) ? PLC_SNIFF_PHYSICAL_SA : PLC_SNIFF_LOGICAL_SA;
+	const uint8_t *pbSource = &pbBody[5];
+	int iPayload = iLength - 5 - iSource - 1;
+
+	if (iPayload < 0 || iPayload != (bInfo & RX_Msg_Length))
+	{
+		decoder.qwBadRecords++;
+		return;
+	}
+	if (eFormat == FORMAT_PCAP)
+	{
+		PutPcap32((uint32_t)(qwTime / 1000000));
+		PutPcap32((uint32_t)(qwTime % 1000000));
+		PutPcap32(iLength - 4);
+		PutPcap32(iLength - 4);
+		fwrite(&pbBody[4], 1, iLength - 4, pOut);
+		return;
+	}
+
+	fprintf(pOut, "%llu,frame,%s,%s,", (unsigned long long)qwTime, (bInfo & RX_DA_GROUP) ? "group" : "unique",
+		(bInfo & RX_SA_PHY) ? "physical" : "logical");
+	if (bInfo & RX_SA_PHY)
+	{
+		for (int i = 0; i < iSource; i++)
+		{
+			fprintf(pOut, "%02X", pbSource[i]);
+		}
+	}
+	else
+	{
+		fprintf(pOut, "%u", pbSource[0] | (pbSource[1] << 8));
+	}
+	fprintf(pOut, ",0x%02X,%d,", pbSource[iSource], iPayload);
+	for (int i = 0; i < iPayload; i++)
+	{
+		fprintf(pOut, "%02X", pbSource[iSource + 1 + i]);
+	}
+	fprintf(pOut, ",,,\n");
+}
+
+static void WriteStats(Decoder &decoder, const uint8_t *pbBody, int iLength)
+{
+	uint64_t qwTime;
+
+	if (iLength != 4 + 4 + 2 + 2)
+	{
+		decoder.qwBadRecords++;
+		return;
+	}
+	qwTime = Unwrap(decoder, GetLong(pbBody));
+	decoder.last.dwFrames = GetLong(&pbBody[4]);
+	decoder.last.wChipDrops = pbBody[8] | (pbBody[9] << 8);
+	decoder.last.wRingDrops = pbBody[10] | (pbBody[11] << 8);
+	if (eFormat == FORMAT_CSV)
+	{
+		fprintf(pOut, "%llu,stats,,,,,,,%lu,%u,%u\n", (unsigned long long)qwTime, (unsigned long)decoder.last.dwFrames,
+			decoder.last.wChipDrops, decoder.last.wRingDrops);
+	}
+}
+
+/*****************************************************************************
+* Function Name: Feed()
+******************************************************************************
+* Summary:
+* Run stream bytes through the record parser and write out each complete record
+**
+Note:
+* A record with a bad length or checksum is dropped and the search for the next PLC_SNIFF_SYNC starts one
+* byte after its sync, so a sync byte inside a payload cannot swallow the records that follow it.
+*****************************************************************************/
+static void Feed(Decoder &decoder, const uint8_t *pbData, int iLength)
+{
+	for (int i = 0; i < iLength; i++)
+	{
+		uint8_t *pbRecord = decoder.abRecord;
+
+		pbRecord[decoder.iFill++] = pbData[i];
+		while (decoder.iFill > 0)
+		{
+			uint8_t bSum = 0;
+			int iTotal;
+
+			if (pbRecord[0] != PLC_SNIFF_SYNC)
+			{
+				decoder.qwSkipped++;
+			}
+			else if (decoder.iFill < 2)
+			{
+				break;
+			}
+			else if (pbRecord[1] >= 1 && pbRecord[1] <= PLC_SNIFF_MAX_RECORD - 4 + 1)
+			{
+				iTotal = pbRecord[1] + 3;
+				if (decoder.iFill < iTotal)
+				{
+					break;
+				}
+				for (int j = 1; j < iTotal; j++)
+				{
+					bSum += pbRecord[j];
+				}
+				if (bSum == 0)
+				{
+					decoder.qwRecords++;
+					if (pbRecord[2] == PLC_SNIFF_FRAME)
+					{
+						WriteFrame(decoder, &pbRecord[3], pbRecord[1] - 1);
+					}
+					else if (pbRecord[2] == PLC_SNIFF_STATS)
+					{
+						WriteStats(decoder, &pbRecord[3], pbRecord[1] - 1);
+					}
+					decoder.iFill -= iTotal;
+					memmove(pbRecord, &pbRecord[iTotal], decoder.iFill);
+					continue;
+				}
+				decoder.qwBadRecords++;
+			}
+			else
+			{
+				decoder.qwBadRecords++;
+			}
+			decoder.iFill--;
+			memmove(pbRecord, &pbRecord[1], decoder.iFill);
+		}
+	}
+}
+
+static speed_t BaudConstant(long lBaud)
+{
+	switch (lBaud)
+	{
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		default: return B0;
+	}
+}
+
+static void Usage(void)
+{
+	fprintf(stderr, "usage: plc_sniffconv [--format pcap|csv] [--baud 115200] [-o out] <capture.bin | /dev/ttyUSB0>\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *pszIn = NULL;
+	const char *pszOut = NULL;
+	long lBaud = 115200;
+	bool bTty;
+	int fd;
+	uint8_t abBuffer[256];
+	ssize_t iRead;
+	Decoder *pDecoder = new Decoder();
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--format") && i + 1 < argc)
+		{
+			i++;
+			if (!strcmp(argv[i], "pcap"))
+			{
+				eFormat = FORMAT_PCAP;
+			}
+			else if (!strcmp(argv[i], "csv"))
+			{
+				eFormat = FORMAT_CSV;
+			}
+			else
+			{
+				Usage();
+			}
+		}
+		else if (!strcmp(argv[i], "--baud") && i + 1 < argc)
+		{
+			lBaud = atol(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+		{
+			pszOut = argv[++i];
+		}
+		else if (argv[i][0] != '-' && pszIn == NULL)
+		{
+			pszIn = argv[i];
+		}
+		else
+		{
+			Usage();
+		}
+	}
+	if (pszIn == NULL)
+	{
+		Usage();
+	}
+
+	fd = open(pszIn, O_RDONLY | O_NOCTTY);
+	if (fd < 0)
+	{
+		perror(pszIn);
+		return 1;
+	}
+	bTty = isatty(fd);
+	if (bTty)
+	{
+		struct termios tio;
+
+		if (BaudConstant(lBaud) == B0 || tcgetattr(fd, &tio) != 0)
+		{
+			fprintf(stderr, "%s: cannot set %ld baud\n", pszIn, lBaud);
+			return 1;
+		}
+		cfmakeraw(&tio);
+		cfsetispeed(&tio, BaudConstant(lBaud));
+		cfsetospeed(&tio, BaudConstant(lBaud));
+		tio.c_cc[VMIN] = 1;
+		tio.c_cc[VTIME] = 0;
+		tcsetattr(fd, TCSANOW, &tio);
+		tcflush(fd, TCIFLUSH);
+	}
+	if (pszOut != NULL && (pOut = fopen(pszOut, "wb")) == NULL)
+	{
+		perror(pszOut);
+		return 1;
+	}
+
+	WriteHeader();
+	while ((iRead = read(fd, abBuffer, sizeof(abBuffer))) > 0)
+	{
+		Feed(*pDecoder, abBuffer, (int)iRead);
+		if (bTty)
+		{
+			fflush(pOut);
+		}
+	}
+	close(fd);
+	if (pOut != stdout)
+	{
+		fclose(pOut);
+	}
+
+	fprintf(stderr, "%llu records, %llu damaged, %llu bytes skipped. Sniffer: %lu frames, %u PLC device drops, %u ring drops\n",
+		(unsigned long long)pDecoder->qwRecords, (unsigned long long)pDecoder->qwBadRecords,
+		(unsigned long long)pDecoder->qwSkipped, (unsigned long)pDecoder->last.dwFrames, pDecoder->last.wChipDrops,
+		pDecoder->last.wRingDrops);
+	delete pDecoder;
+	return 0;
+}